@@ -47,6 +47,7 @@
 #include "screens.h"
 #include "playlist.h"
 #include "pcmbuf.h"
+#include "governor.h"
 #include "bmp.h"
 #include "appevents.h"
 #include "metadata.h"
@@ -616,8 +617,6 @@ static bool buffer_handle(int handle_id)
             lseek(h->fd, h->offset, SEEK_SET);
     }
 
-    trigger_cpu_boost();
-
     if (h->type == TYPE_ID3)
     {
         if (!get_metadata((struct mp3entry *)(buffer + h->data), h->fd, h->path))
@@ -1387,9 +1386,7 @@ void buffering_thread(void)
 
     while (true)
     {
-        if (!filling) {
-            cancel_cpu_boost();
-        }
+        governor_update();
 
         queue_wait_w_tmo(&buffering_queue, &ev, filling ? 5 : HZ/2);
 
@@ -27,6 +27,7 @@
 #include "codecs.h"
 #include "buffering.h"
 #include "pcmbuf.h"
+#include "governor.h"
 #include "dsp.h"
 #include "abrepeat.h"
 #include "metadata.h"
@@ -185,7 +186,6 @@ static void codec_pcmbuf_insert_callback(
 
         while ((dest = pcmbuf_request_buffer(&out_count)) == NULL)
         {
-            cancel_cpu_boost();
             sleep(1);
             if (ci.seek_time || ci.new_track || ci.stop_codec)
                 return;
@@ -208,6 +208,7 @@ static void codec_pcmbuf_insert_callback(
             return;
 
         pcmbuf_write_complete(out_count);
+        governor_codec_output(out_count);
 
         count -= inp_count;
     }
@@ -437,7 +438,6 @@ static bool codec_load_next_track(void)
 
     if (!ci.stop_codec)
     {
-        trigger_cpu_boost();
         LOGFQUEUE("codec >| audio Q_AUDIO_CHECK_NEW_TRACK");
         result = queue_send(&audio_queue, Q_AUDIO_CHECK_NEW_TRACK, 0);
     }
@@ -472,14 +472,7 @@ static void codec_thread(void)
 
     while (1) {
         status = 0;
-        
-#ifdef HAVE_CROSSFADE
-        if (!pcmbuf_is_crossfade_active())
-#endif
-        {
-            cancel_cpu_boost();
-        }
-            
+
         queue_wait(&codec_queue, &ev);
         codec_requested_stop = false;
 
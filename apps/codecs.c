@@ -70,6 +70,8 @@ void sim_codec_close(void *pd);
 #endif
 
 size_t codec_size;
+struct codec_heap_stats codec_heap;
+struct codec_iram_usage codec_iram;
 
 extern void* plugin_get_audio_buffer(size_t *buffer_size);
 
@@ -168,6 +170,12 @@ struct codec_api ci = {
 
     /* new stuff at the end, sort into place next time
        the API gets incompatible */
+#ifdef RB_PROFILE
+    profsample_start,
+    profsample_stop,
+#endif
+    &codec_heap,
+    &codec_iram,
 };
 
 void codec_get_full_path(char *path, const char *codec_root_fn)
@@ -227,6 +235,9 @@ static int codec_load_ram(int size, struct codec_api *api)
         return CODEC_ERROR;
     }
 
+    memset(api->heap_stats, 0, sizeof(*api->heap_stats));
+    memset(api->iram_usage, 0, sizeof(*api->iram_usage));
+
     *(hdr->api) = api;
     cpucache_invalidate();
     status = hdr->entry_point();
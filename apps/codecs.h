@@ -75,7 +75,7 @@
 #define CODEC_ENC_MAGIC 0x52454E43 /* RENC */
 
 /* increase this every time the api struct changes */
-#define CODEC_API_VERSION 33
+#define CODEC_API_VERSION 36
 
 /* update this to latest version if a change to the api struct breaks
    backwards compatibility (and please take the opportunity to sort in any
@@ -89,6 +89,23 @@ enum codec_status {
     CODEC_ERROR = -1,
 };
 
+/* How the codec uses the memory after its code, kept up to date by codeclib.
+   Reset whenever a codec is loaded. */
+struct codec_heap_stats {
+    size_t size;            /* Bytes the codec can allocate */
+    size_t used;            /* Bytes allocated right now */
+    size_t peak;            /* Most bytes allocated at any time */
+    unsigned long allocs;   /* Number of allocations */
+    size_t largest_free;    /* Largest free block, shows fragmentation */
+};
+
+/* IRAM the codec takes while it runs, filled in by codec_crt0 before it
+   starts. Both stay 0 on targets without codec IRAM. */
+struct codec_iram_usage {
+    size_t iram;            /* .icode, .irodata and .idata */
+    size_t ibss;            /* .ibss */
+};
+
 /* NOTE: To support backwards compatibility, only add new functions at
          the end of the structure.  Every time you add a new function,
          remember to increase CODEC_API_VERSION.  If you make changes to the
@@ -235,6 +252,12 @@ struct codec_api {
 
     /* new stuff at the end, sort into place next time
        the API gets incompatible */
+#ifdef RB_PROFILE
+    void (*profsample_start)(void);
+    void (*profsample_stop)(void);
+#endif
+    struct codec_heap_stats *heap_stats;
+    struct codec_iram_usage *iram_usage;
 };
 
 /* codec header */
@@ -250,6 +273,8 @@ struct codec_header {
 
 extern unsigned char codecbuf[];
 extern size_t codec_size;
+extern struct codec_heap_stats codec_heap;
+extern struct codec_iram_usage codec_iram;
 
 #ifdef CODEC
 #ifndef SIMULATOR
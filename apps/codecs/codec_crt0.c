@@ -40,6 +40,8 @@ enum codec_status codec_start(void)
 #ifdef USE_IRAM
     ci->memcpy(iramstart, iramcopy, iramend - iramstart);
     ci->memset(iedata, 0, iend - iedata);
+    ci->iram_usage->iram = iramend - iramstart;
+    ci->iram_usage->ibss = iend - iedata;
 #endif
     ci->memset(plugin_bss_start, 0, plugin_end_addr - plugin_bss_start);
 #endif
@@ -37,10 +37,23 @@ int codec_init(void)
 {
     mem_ptr = 0;
     mallocbuf = (unsigned char *)ci->codec_get_buffer((size_t *)&bufsize);
+
+    ci->heap_stats->size = bufsize;
+    codec_heap_update(0, bufsize);
   
     return 0;
 }
 
+void codec_heap_update(size_t used, size_t largest_free)
+{
+    struct codec_heap_stats *heap = ci->heap_stats;
+
+    heap->used = used;
+    if (used > heap->peak)
+        heap->peak = used;
+    heap->largest_free = largest_free;
+}
+
 void codec_set_replaygain(struct mp3entry* id3)
 {
     ci->configure(DSP_SET_TRACK_GAIN, id3->track_gain);
@@ -62,6 +75,9 @@ void* codec_malloc(size_t size)
     x=&mallocbuf[mem_ptr];
     mem_ptr+=(size+3)&~3; /* Keep memory 32-bit aligned */
 
+    ci->heap_stats->allocs++;
+    codec_heap_update(mem_ptr, mem_ptr < bufsize ? bufsize - mem_ptr : 0);
+
     return(x);
 }
 
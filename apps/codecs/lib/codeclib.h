@@ -116,7 +116,12 @@ static inline unsigned int av_log2(unsigned int v)
 
 /* Various codec helper functions */
 
+/* Also gives back everything allocated with codec_malloc() before, so
+   codecs calling it for every track start each one with an empty heap */
 int codec_init(void);
+/* Records the heap use for ci->heap_stats, done by codec_malloc() and by
+   any other allocator working on the codec buffer */
+void codec_heap_update(size_t used, size_t largest_free);
 void codec_set_replaygain(struct mp3entry* id3);
 
 #ifdef RB_PROFILE
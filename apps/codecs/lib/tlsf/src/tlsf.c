@@ -594,6 +594,33 @@ size_t get_max_size(void *mem_pool)
 #endif
 }
 
+#ifdef ROCKBOX
+/******************************************************************/
+size_t get_largest_free_size(void *mem_pool)
+{
+/******************************************************************/
+    tlsf_t *tlsf = (tlsf_t *) mem_pool;
+    bhdr_t *b;
+    size_t size, largest = 0;
+    int fl, sl;
+
+    if (!tlsf->fl_bitmap)
+        return 0;
+
+    /* The largest block is in the highest list that isn't empty, but
+     * the blocks in a list don't all have the same size */
+    fl = ms_bit(tlsf->fl_bitmap);
+    sl = ms_bit(tlsf->sl_bitmap[fl]);
+    for (b = tlsf->matrix[fl][sl]; b; b = b->ptr.free_ptr.next) {
+        size = b->size & BLOCK_SIZE;
+        if (size > largest)
+            largest = size;
+    }
+
+    return largest;
+}
+#endif /* ROCKBOX */
+
 /******************************************************************/
 void destroy_memory_pool(void *mem_pool)
 {
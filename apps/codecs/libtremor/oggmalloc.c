@@ -11,18 +11,33 @@ extern jmp_buf rb_jump_buf;
 #define LONGJMP(x)  return NULL
 #endif
 
+static void *mem_pool;
+
+static void heap_update(void)
+{
+    codec_heap_update(get_used_size(mem_pool),
+                      get_largest_free_size(mem_pool));
+}
+
 void ogg_malloc_init(void)
 {
     size_t bufsize;
-    void* buf = ci->codec_get_buffer(&bufsize);
-    init_memory_pool(bufsize, buf);
+    mem_pool = ci->codec_get_buffer(&bufsize);
+    init_memory_pool(bufsize, mem_pool);
+    heap_update();
 }
 
 void ogg_malloc_destroy()
 {
-    size_t bufsize;
-    void* buf = ci->codec_get_buffer(&bufsize);
-    destroy_memory_pool(buf);
+    destroy_memory_pool(mem_pool);
+}
+
+/* Throws away everything allocated since ogg_malloc_init(). That takes the
+   same time however much there is, and leaves no fragments behind. */
+void ogg_malloc_reset(void)
+{
+    ogg_malloc_destroy();
+    ogg_malloc_init();
 }
 
 void *ogg_malloc(size_t size)
@@ -31,7 +46,9 @@ void *ogg_malloc(size_t size)
 
     if (x == NULL)
         LONGJMP(1);
-    
+
+    ci->heap_stats->allocs++;
+    heap_update();
     return x;
 }
 
@@ -41,7 +58,9 @@ void *ogg_calloc(size_t nmemb, size_t size)
 
     if (x == NULL)
         LONGJMP(1);
-    
+
+    ci->heap_stats->allocs++;
+    heap_update();
     return x;
 }
 
@@ -51,13 +70,16 @@ void *ogg_realloc(void *ptr, size_t size)
 
     if (x == NULL)
         LONGJMP(1);
-    
+
+    ci->heap_stats->allocs++;
+    heap_update();
     return x;
 }
 
 void ogg_free(void* ptr)
 {
     tlsf_free(ptr);
+    heap_update();
 }
 
 /* Allocate IRAM buffer */
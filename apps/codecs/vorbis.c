@@ -236,22 +236,10 @@ next_track:
     error = CODEC_OK;
     
 done:
-#if 0 /* defined(SIMULATOR) */
-    {
-        size_t bufsize;
-        void* buf = ci->codec_get_buffer(&bufsize);
-
-        DEBUGF("Vorbis: Memory max: %u\n", get_max_size(buf));
-    }
-#endif
-
     if (ci->request_next_track()) {
-        /* Clean things up for the next track */
-        vf.dataoffsets = NULL;
-        vf.offsets = NULL;
-        vf.serialnos = NULL;
-        vf.pcmlengths = NULL;
-        ov_clear(&vf);
+        /* Clean things up for the next track - all the decoder state lives
+           on the heap, so throwing it away in one go is enough */
+        ogg_malloc_reset();
         goto next_track;
     }
         
@@ -54,6 +54,9 @@
 #include "lcd-remote.h"
 #include "crc32.h"
 #include "logf.h"
+#include "buffer.h"
+#include "core_alloc.h"
+#include "plugin.h"
 #ifndef SIMULATOR
 #include "disk.h"
 #include "adc.h"
@@ -85,6 +88,8 @@
 #include "pcmbuf.h"
 #include "buffering.h"
 #include "playback.h"
+#include "codecs.h"
+#include "governor.h"
 #if defined(HAVE_SPDIF_OUT) || defined(HAVE_SPDIF_IN)
 #include "spdif.h"
 #endif
@@ -186,6 +191,35 @@ static const char* threads_getname(int selected_item, void *data,
              IF_PRIO(thread->base_priority, thread->priority, )
              thread_stack_usage(thread), name);
 
+#ifdef HAVE_THREAD_STATS
+    {
+        struct thread_stats stats;
+        uint64_t time = thread_stats_time();
+        size_t len = strlen(buffer);
+
+        thread_get_stats(thread, &stats);
+        if (time == 0)
+            time = 1;
+
+#ifdef HAVE_THREAD_TRACE
+        /* CPU and boost share of the time since the last reset, switches
+           and average/maximum wakeup latency in us */
+        snprintf(buffer + len, buffer_len - len,
+                 " c%d%% b%d%% s%lu l%lu/%lu",
+                 (int)(stats.run_time * 100 / time),
+                 (int)(stats.boost_time * 100 / time),
+                 stats.switches,
+                 stats.wakeups ?
+                    (unsigned long)(stats.wakeup_latency / stats.wakeups) : 0,
+                 stats.max_wakeup_latency);
+#else
+        /* CPU share of the time since the last reset and switches */
+        snprintf(buffer + len, buffer_len - len, " c%d%% s%lu",
+                 (int)(stats.run_time * 100 / time), stats.switches);
+#endif
+    }
+#endif
+
     return buffer;
 }
 
@@ -205,10 +239,74 @@ static int dbg_threads_action_callback(int action, struct gui_synclist *lists)
         return ACTION_REDRAW;
     }
 #endif /* ROCKBOX_HAS_LOGF */
+#ifdef HAVE_THREAD_STATS
+    if (action == ACTION_STD_CONTEXT)
+    {
+        thread_reset_stats();
+        return ACTION_REDRAW;
+    }
+#endif
     if (action == ACTION_NONE)
         action = ACTION_REDRAW;
     return action;
 }
+
+#ifdef HAVE_THREAD_TRACE
+/* Starts the scheduler trace, or stops it and writes it to a file that
+   tools/threadtrace.pl turns into a timeline */
+static bool dbg_thread_trace(void)
+{
+    static const char * const types[] =
+    {
+        [THREAD_TRACE_SWITCH]  = "switch",
+        [THREAD_TRACE_WAKEUP]  = "wakeup",
+        [THREAD_TRACE_BOOST]   = "boost",
+        [THREAD_TRACE_UNBOOST] = "unboost",
+    };
+    struct thread_trace_event ev[16];
+    char name[32];
+    int fd, pos, n, i;
+
+    if (!thread_trace_running())
+    {
+        thread_trace_start();
+        splash(HZ, "Thread trace started");
+        return false;
+    }
+
+    thread_trace_stop();
+
+    fd = creat("/thread_trace.txt");
+    if (fd < 0)
+    {
+        splash(HZ*2, "Can't create /thread_trace.txt");
+        return false;
+    }
+
+    fdprintf(fd, "# Rockbox thread trace, times in us\n");
+    for (i = 0; i < MAXTHREADS; i++)
+    {
+        if (threads[i].state == STATE_KILLED)
+            continue;
+        thread_get_name(name, sizeof(name), &threads[i]);
+        fdprintf(fd, "thread %d %s\n", i, name);
+    }
+
+    for (pos = 0; (n = thread_trace_read(pos, ev, 16)) > 0; pos += n)
+    {
+        for (i = 0; i < n; i++)
+        {
+            fdprintf(fd, "%lu %d %s %d %d\n", (unsigned long)ev[i].time,
+                     ev[i].core, types[ev[i].type], ev[i].thread,
+                     ev[i].arg == THREAD_TRACE_NONE ? -1 : ev[i].arg);
+        }
+    }
+
+    close(fd);
+    splashf(HZ*2, "Saved %d events", pos);
+    return false;
+}
+#endif /* HAVE_THREAD_TRACE */
 /* Test code!!! */
 static bool dbg_os(void)
 {
@@ -1369,8 +1467,94 @@ static bool dbg_cpufreq(void)
     lcd_setfont(FONT_UI);
     return false;
 }
+
+#if CONFIG_CODEC == SWCODEC
+static int governor_callback(int btn, struct gui_synclist *lists)
+{
+    static struct governor_event trace[GOVERNOR_TRACE_SIZE];
+    struct governor_stats stats;
+    int i, count;
+    (void)lists;
+
+    if (btn == ACTION_STD_OK)
+        governor_reset_stats();
+
+    governor_get_stats(&stats);
+    count = governor_trace_read(trace, GOVERNOR_TRACE_SIZE);
+
+    simplelist_set_line_count(0);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Boosted: %s",
+             stats.boosted ? "yes" : "no");
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Boosts: %lu", stats.boosts);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Boosted for: %ld/%ld s",
+             stats.boosted_ticks / HZ, stats.total_ticks / HZ);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Average clock: %ld MHz",
+             stats.avg_frequency / 1000000);
+    if (stats.min_pcm_ms != UINT_MAX)
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Least PCM: %u ms",
+                 stats.min_pcm_ms);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Top codec load: %u%%",
+             stats.max_load);
+
+    /* Newest first: time ago, pcm fill, codec load and the reasons */
+    for (i = 0; i < count; i++)
+    {
+        struct governor_event *ev = &trace[i];
+        simplelist_addline(SIMPLELIST_ADD_LINE,
+                 "-%ld.%02ld %s %ums %u%% %s%s%s%s",
+                 (current_tick - ev->tick) / HZ,
+                 (current_tick - ev->tick) % HZ * 100 / HZ,
+                 ev->reasons ? "B" : "U", ev->pcm_ms, ev->load,
+                 ev->reasons & GOVERNOR_LOWDATA ? "low " : "",
+                 ev->reasons & GOVERNOR_PREBUFFER ? "pre " : "",
+                 ev->reasons & GOVERNOR_CODEC ? "codec " : "",
+                 ev->reasons & GOVERNOR_IO ? "io" : "");
+    }
+
+    return btn == ACTION_STD_OK ? ACTION_REDRAW : btn;
+}
+
+static bool dbg_governor(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Boost governor", 0, NULL);
+    info.action_callback = governor_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
+#endif /* CONFIG_CODEC == SWCODEC */
 #endif /* HAVE_ADJUSTABLE_CPU_FREQ */
 
+#ifdef HAVE_TICKLESS_IDLE
+/* Whether the tick really stops while idle. If "Kept running" grows with
+   "Idle", a tick task that isn't deferrable is registered. */
+static int tick_idle_callback(int btn, struct gui_synclist *lists)
+{
+    struct tick_idle_stats s = tick_idle_stats;
+
+    (void)lists;
+    simplelist_set_line_count(0);
+
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Idle: %lu", s.entries);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Kept running: %lu", s.kept);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Stopped: %lu", s.stops);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Ticks skipped: %lu", s.skipped);
+    return btn;
+}
+
+static bool dbg_tick_idle(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Tickless idle", 4, NULL);
+    info.action_callback = tick_idle_callback;
+    info.hide_selection = true;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
+#endif /* HAVE_TICKLESS_IDLE */
+
 #if defined(HAVE_TSC2100) && !defined(SIMULATOR)
 #include "tsc2100.h"
 static char *itob(int n, int len)
@@ -2022,8 +2206,229 @@ static bool dbg_disk_info(void)
     info.scroll_all = true;
     return simplelist_show_list(&info);
 }
+
+/* adds a line per file in the directory with the number of pieces the
+   file is stored in */
+static void fragments_add_dir(const char *path)
+{
+    DIR_UNCACHED *dir = opendir_uncached(path);
+    struct dirent_uncached *entry;
+
+    if (!dir)
+        return;
+
+    while ((entry = readdir_uncached(dir)) != NULL)
+    {
+        if (entry->attribute & ATTR_DIRECTORY)
+            continue;
+        simplelist_addline(SIMPLELIST_ADD_LINE, "%3ld %s",
+                 fat_fragments(IF_MV2(dir->fatdir.file.volume,)
+                               entry->startcluster), entry->d_name);
+    }
+    closedir_uncached(dir);
+}
+
+static bool dbg_fragments(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Fragments per file", 0, NULL);
+    info.hide_selection = true;
+    info.scroll_all = true;
+
+    simplelist_set_line_count(0);
+    fragments_add_dir(ROCKBOX_DIR);
+#ifdef HAVE_RECORDING
+    fragments_add_dir(global_settings.rec_directory[0] ?
+                      global_settings.rec_directory : "/");
+#endif
+    return simplelist_show_list(&info);
+}
+
+static int file_io_callback(int btn, struct gui_synclist *lists)
+{
+    unsigned long bytes, commands;
+    (void)lists;
+
+    file_get_read_stats(&bytes, &commands);
+
+    simplelist_set_line_count(0);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Bytes read: %lu", bytes);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Read commands: %lu", commands);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Bytes/command: %lu",
+                       commands ? bytes / commands : 0);
+#ifdef HAVE_IO_SCHEDULER
+    {
+        struct storage_sched_stats stats;
+        storage_get_sched_stats(&stats);
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Queue: %d (max %d)",
+                           stats.depth, stats.max_depth);
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Requests: %lu (%lu prio)",
+                           stats.requests, stats.prio_requests);
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Commands: %lu",
+                           stats.commands);
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Merged: %lu",
+                           stats.merged);
+    }
+#endif
+    return btn;
+}
+
+static bool dbg_file_io(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "File I/O", 7, NULL);
+    info.action_callback = file_io_callback;
+    info.hide_selection = true;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
 #endif /* !SIMULATOR */
 
+static int core_alloc_callback(int btn, struct gui_synclist *lists)
+{
+    int handle = 0;
+
+    (void)lists;
+    simplelist_set_line_count(0);
+
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Allocated: %ld B",
+             (long)core_allocated());
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Free inside: %ld B",
+             (long)core_available());
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Audio buffer: %ld B",
+             (long)(audiobufend - audiobuf));
+    while ((handle = core_get_next_handle(handle)) > 0)
+    {
+        simplelist_addline(SIMPLELIST_ADD_LINE, "%d %s: %ld B", handle,
+                 core_get_name(handle), (long)core_get_size(handle));
+    }
+    return btn;
+}
+
+static bool dbg_core_alloc(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Core allocations", 0, NULL);
+    info.action_callback = core_alloc_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
+
+/* The core's IRAM sections as placed by the linker script. SH prefixes C
+   symbols with an underscore and the Jz47xx keeps .ibss in DRAM, so both
+   only show the codec and plugin parts. */
+#if defined(USE_IRAM) && CONFIG_CPU != SH7034 && CONFIG_CPU != JZ4732
+#define CORE_IRAM_USAGE
+extern char _iramstart[], _iramend[], _iedata[], _iend[];
+#endif
+
+/* Peak stack use of every thread in bytes, and what the core, the codec and
+   the last plugin have in IRAM. tools/iramfit.pl gives the same IRAM
+   breakdown by object file from the map files. */
+static int stack_iram_callback(int btn, struct gui_synclist *lists)
+{
+    char name[32];
+    int i;
+
+    (void)lists;
+    simplelist_set_line_count(0);
+
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Stack peak/size:");
+#if NUM_CORES > 1
+    for (i = 0; i < NUM_CORES; i++)
+    {
+        simplelist_addline(SIMPLELIST_ADD_LINE, " idle (%d): %ld/%ld B", i,
+                 (long)idle_stack_peak(i), (long)IDLE_STACK_SIZE);
+    }
+#endif
+    for (i = 0; i < MAXTHREADS; i++)
+    {
+        struct thread_entry *thread = &threads[i];
+        long peak;
+
+        if (thread->state == STATE_KILLED)
+            continue;
+
+        thread_get_name(name, sizeof(name), thread);
+        peak = thread_stack_peak(thread);
+        simplelist_addline(SIMPLELIST_ADD_LINE, " %s: %ld/%ld B, %ld free",
+                 name, peak, (long)thread->stack_size,
+                 (long)thread->stack_size - peak);
+    }
+
+#ifdef CORE_IRAM_USAGE
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Core IRAM: %ld B",
+             (long)(_iramend - _iramstart));
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Core IBSS: %ld B",
+             (long)(_iend - _iedata));
+#endif
+#if CONFIG_CODEC == SWCODEC
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Codec IRAM: %ld B",
+             (long)codec_iram.iram);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Codec IBSS: %ld B",
+             (long)codec_iram.ibss);
+#endif
+#ifdef PLUGIN_USE_IRAM
+    {
+        size_t iram, ibss;
+        char *plugin = strrchr(plugin_get_current_filename(), '/');
+
+        plugin_get_iram_usage(&iram, &ibss);
+        simplelist_addline(SIMPLELIST_ADD_LINE, "Plugin %s",
+                 plugin ? plugin + 1 : "-");
+        simplelist_addline(SIMPLELIST_ADD_LINE, " IRAM: %ld B, IBSS: %ld B",
+                 (long)iram, (long)ibss);
+    }
+#endif
+    return btn;
+}
+
+static bool dbg_stack_iram(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Stack and IRAM usage", 0, NULL);
+    info.action_callback = stack_iram_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
+
+#if CONFIG_CODEC == SWCODEC
+static int codec_heap_callback(int btn, struct gui_synclist *lists)
+{
+    (void)lists;
+    simplelist_set_line_count(0);
+
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Codec buffer: %ld B",
+             (long)CODEC_SIZE);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Code: %ld B",
+             (long)codec_size);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Heap: %ld B",
+             (long)codec_heap.size);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "In use: %ld B",
+             (long)codec_heap.used);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Peak: %ld B",
+             (long)codec_heap.peak);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Allocations: %lu",
+             codec_heap.allocs);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Largest free: %ld B",
+             (long)codec_heap.largest_free);
+    return btn;
+}
+
+static bool dbg_codec_heap(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Codec heap", 7, NULL);
+    info.action_callback = codec_heap_callback;
+    info.hide_selection = true;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
+#endif /* CONFIG_CODEC == SWCODEC */
+
 #ifdef HAVE_DIRCACHE
 static int dircache_callback(int btn, struct gui_synclist *lists)
 {
@@ -2043,6 +2448,14 @@ static int dircache_callback(int btn, struct gui_synclist *lists)
              dircache_get_build_ticks() / HZ);
     simplelist_addline(SIMPLELIST_ADD_LINE, "Entry count: %d",
              dircache_get_entry_count());
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Names: %d B",
+             dircache_get_names_size());
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Bytes per entry: %d",
+             dircache_get_cache_size() / MAX(1, dircache_get_entry_count()));
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Validating: %s",
+             dircache_is_validating() ? "Yes" : "No");
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Rescanned dirs: %d",
+             dircache_get_changed_dirs());
     return btn;
 }
 
@@ -2086,6 +2499,10 @@ static int database_callback(int btn, struct gui_synclist *lists)
 
     simplelist_addline(SIMPLELIST_ADD_LINE, "Queue length: %d", 
              stat->queue_length);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Journal length: %d", 
+             stat->journal_length);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Substring index: %ld B",
+             stat->trigram_size);
     
     if (synced)
     {
@@ -2578,6 +2995,12 @@ static const struct the_menu_item menuitems[] = {
 #endif
 #ifdef HAVE_ADJUSTABLE_CPU_FREQ
         { "CPU frequency", dbg_cpufreq },
+#if CONFIG_CODEC == SWCODEC
+        { "Boost governor", dbg_governor },
+#endif
+#endif
+#ifdef HAVE_TICKLESS_IDLE
+        { "Tickless idle", dbg_tick_idle },
 #endif
 #if defined(IRIVER_H100_SERIES) && !defined(SIMULATOR)
         { "S/PDIF analyzer", dbg_spdif },
@@ -2586,6 +3009,14 @@ static const struct the_menu_item menuitems[] = {
         { "Catch mem accesses", dbg_set_memory_guard },
 #endif
         { "View OS stacks", dbg_os },
+        { "View core allocations", dbg_core_alloc },
+        { "View stack and IRAM usage", dbg_stack_iram },
+#if CONFIG_CODEC == SWCODEC
+        { "View codec heap", dbg_codec_heap },
+#endif
+#ifdef HAVE_THREAD_TRACE
+        { "Start/save thread trace", dbg_thread_trace },
+#endif
 #ifdef HAVE_LCD_BITMAP
 #ifndef SIMULATOR
         { "View battery", view_battery },
@@ -2600,6 +3031,8 @@ static const struct the_menu_item menuitems[] = {
 #endif
 #ifndef SIMULATOR
         { "View disk info", dbg_disk_info },
+        { "View file fragments", dbg_fragments },
+        { "View file I/O", dbg_file_io },
 #if (CONFIG_STORAGE & STORAGE_ATA)
         { "Dump ATA identify info", dbg_identify_info},
 #endif
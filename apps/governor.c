@@ -0,0 +1,269 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#include <string.h>
+#include "config.h"
+#include "system.h"
+#include "kernel.h"
+#include "thread.h"
+#include "storage.h"
+#include "audio.h"
+#include "pcm.h"
+#include "pcmbuf.h"
+#include "dsp.h"
+#include "governor.h"
+#include "logf.h"
+
+#ifdef HAVE_ADJUSTABLE_CPU_FREQ
+
+/* How often the pipeline is looked at */
+#define GOVERNOR_INTERVAL   (HZ/10)
+/* How long nothing must need the boost before it is given up */
+#define GOVERNOR_HOLD       (HZ/2)
+/* Codec load at normal speed to boost at and to stay boosted above */
+#define GOVERNOR_LOAD_HIGH  85
+#define GOVERNOR_LOAD_LOW   70
+/* Audio the load is measured over, in samples */
+#define GOVERNOR_LOAD_SPAN  (NATIVE_FREQUENCY/10)
+
+extern unsigned int codec_thread_id;
+
+static bool boosted = false;
+static long next_sample;
+static long calm_since;         /* Last time the boost was needed */
+
+/* Codec load measurement */
+static unsigned long codec_samples;   /* Output since the last measurement */
+static long codec_output_tick;        /* Last time the codec produced any */
+#ifdef HAVE_THREAD_STATS
+static uint64_t codec_run_time;       /* Codec run time at the last one */
+#endif
+static unsigned int codec_load;       /* Percent of real time, at normal */
+
+#ifdef HAVE_IO_SCHEDULER
+static unsigned long io_requests;
+#endif
+
+static struct governor_stats stats;
+static long stats_tick;         /* Start of the statistics */
+static long boosted_tick;       /* Start of the current boost */
+
+static struct governor_event trace[GOVERNOR_TRACE_SIZE];
+static unsigned int trace_pos;  /* Events added so far */
+
+static void add_event(unsigned int reasons, unsigned int pcm_ms)
+{
+    struct governor_event *ev = &trace[trace_pos++ % GOVERNOR_TRACE_SIZE];
+
+    ev->tick = current_tick;
+    ev->pcm_ms = MIN(pcm_ms, 0xffff);
+    ev->load = MIN(codec_load, 0xff);
+    ev->reasons = reasons;
+
+    logf("governor: %s %02x pcm %u ms load %u%%",
+         reasons ? "boost" : "unboost", reasons, pcm_ms, codec_load);
+}
+
+static void set_boost(bool boost, unsigned int reasons, unsigned int pcm_ms)
+{
+    if (boost == boosted)
+        return;
+
+    boosted = boost;
+    add_event(reasons, pcm_ms);
+
+    if (boost)
+    {
+        stats.boosts++;
+        boosted_tick = current_tick;
+    }
+    else
+    {
+        stats.boosted_ticks += current_tick - boosted_tick;
+    }
+
+    cpu_boost(boost);
+}
+
+void governor_codec_output(int count)
+{
+    codec_samples += count;
+    codec_output_tick = current_tick;
+}
+
+/* Percentage of real time the codec needed for what it decoded lately, as if
+   it ran unboosted */
+static void measure_codec_load(void)
+{
+    bool decoding = TIME_BEFORE(current_tick, codec_output_tick + HZ);
+#ifdef HAVE_THREAD_STATS
+    struct thread_stats ts;
+    uint64_t run_time;
+#endif
+
+    if (decoding && codec_samples < GOVERNOR_LOAD_SPAN)
+        return;
+
+#ifdef HAVE_THREAD_STATS
+    thread_get_stats(thread_id_entry(codec_thread_id), &ts);
+    run_time = ts.run_time - codec_run_time;
+    codec_run_time = ts.run_time;
+#endif
+
+    if (!decoding)
+    {
+        codec_load = 0;
+    }
+    else
+    {
+#ifdef HAVE_THREAD_STATS
+        /* run time * 100 / audio time, scaled to the normal frequency */
+        codec_load = run_time * NATIVE_FREQUENCY / 10000 / codec_samples
+                     * cpu_frequency / CPUFREQ_NORMAL;
+#endif
+        if (codec_load > stats.max_load)
+            stats.max_load = codec_load;
+    }
+
+    codec_samples = 0;
+}
+
+/* Returns what needs the boost right now */
+static unsigned int sample_pipeline(unsigned int *pcm_ms)
+{
+    unsigned int reasons = 0;
+    unsigned int watermark = pcmbuf_get_watermark();
+
+    *pcm_ms = pcmbuf_get_latency();
+    measure_codec_load();
+
+    if (pcm_is_playing() && !pcm_is_paused())
+    {
+        if (*pcm_ms < stats.min_pcm_ms)
+            stats.min_pcm_ms = *pcm_ms;
+
+        /* The codec refills the buffer unboosted as long as it is faster
+           than real time, only boost when getting close to running dry or
+           until it is back above the watermark */
+        if (*pcm_ms < (boosted ? watermark : watermark / 2))
+            reasons |= GOVERNOR_LOWDATA;
+    }
+    else if (!pcm_is_playing() &&
+             TIME_BEFORE(current_tick, codec_output_tick + HZ))
+    {
+        /* Get playback going quickly */
+        reasons |= GOVERNOR_PREBUFFER;
+    }
+
+    if (codec_load > (boosted ? GOVERNOR_LOAD_LOW : GOVERNOR_LOAD_HIGH))
+        reasons |= GOVERNOR_CODEC;
+
+#ifdef HAVE_IO_SCHEDULER
+    {
+        /* Reading is mostly copying on PIO drives, a faster CPU lets the
+           disk spin down sooner. Only the buffering for playback counts,
+           browsing, the database and so on boost by themselves if they
+           want to. */
+        struct storage_sched_stats s;
+        storage_get_sched_stats(&s);
+
+        if ((audio_status() & AUDIO_STATUS_PLAY) &&
+            (s.depth > 0 || s.requests != io_requests))
+            reasons |= GOVERNOR_IO;
+
+        io_requests = s.requests;
+    }
+#endif
+
+    return reasons;
+}
+
+void governor_update(void)
+{
+    unsigned int reasons, pcm_ms;
+
+    if (TIME_BEFORE(current_tick, next_sample))
+        return;
+
+    next_sample = current_tick + GOVERNOR_INTERVAL;
+    reasons = sample_pipeline(&pcm_ms);
+
+    if (reasons)
+    {
+        calm_since = current_tick;
+        set_boost(true, reasons, pcm_ms);
+    }
+    else if (TIME_AFTER(current_tick, calm_since + GOVERNOR_HOLD))
+    {
+        set_boost(false, 0, pcm_ms);
+    }
+}
+
+void governor_get_stats(struct governor_stats *s)
+{
+    long total = current_tick - stats_tick;
+
+    *s = stats;
+    s->total_ticks = total;
+    s->boosted = boosted;
+
+    if (boosted)
+        s->boosted_ticks += current_tick - boosted_tick;
+
+    if (total > 0)
+    {
+        s->avg_frequency = ((long long)s->boosted_ticks * CPUFREQ_MAX +
+                           (long long)(total - s->boosted_ticks) *
+                           CPUFREQ_NORMAL) / total;
+    }
+    else
+    {
+        s->avg_frequency = boosted ? CPUFREQ_MAX : CPUFREQ_NORMAL;
+    }
+}
+
+void governor_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.min_pcm_ms = UINT_MAX;
+    stats_tick = current_tick;
+    boosted_tick = current_tick;
+}
+
+int governor_trace_read(struct governor_event *buf, int count)
+{
+    unsigned int pos = trace_pos;
+    int n = 0;
+
+    while (n < count && pos > 0 && trace_pos - pos < GOVERNOR_TRACE_SIZE)
+        buf[n++] = trace[--pos % GOVERNOR_TRACE_SIZE];
+
+    return n;
+}
+
+void governor_init(void)
+{
+    next_sample = current_tick;
+    calm_since = current_tick;
+    codec_output_tick = current_tick - HZ - 1;
+    governor_reset_stats();
+}
+
+#endif /* HAVE_ADJUSTABLE_CPU_FREQ */
@@ -0,0 +1,81 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include "config.h"
+
+/* Decides when playback needs the CPU boosted. The playback threads only
+ * report what they do, the governor looks at how full the PCM buffer is,
+ * how much of real time the codec needs and whether there is disk I/O, and
+ * holds one boost for all of them. */
+
+#ifdef HAVE_ADJUSTABLE_CPU_FREQ
+
+/* Reasons for a boost, several may apply */
+#define GOVERNOR_LOWDATA    0x01 /* PCM buffer below the watermark */
+#define GOVERNOR_PREBUFFER  0x02 /* Filling the PCM buffer before playing */
+#define GOVERNOR_CODEC      0x04 /* Codec close to real time unboosted */
+#define GOVERNOR_IO         0x08 /* Disk I/O going on */
+
+struct governor_event
+{
+    long tick;              /* When it was decided */
+    unsigned short pcm_ms;  /* Audio in the PCM buffer */
+    unsigned char load;     /* Codec load at normal speed, percent */
+    unsigned char reasons;  /* GOVERNOR_* or 0 when unboosting */
+};
+
+struct governor_stats
+{
+    unsigned long boosts;       /* Times boosted */
+    long boosted_ticks;         /* Time spent boosted */
+    long total_ticks;           /* Time since the last reset */
+    long avg_frequency;         /* Average of the frequencies chosen */
+    unsigned int min_pcm_ms;    /* Least audio buffered while playing,
+                                   UINT_MAX before playing */
+    unsigned int max_load;      /* Highest codec load seen */
+    bool boosted;
+};
+
+#define GOVERNOR_TRACE_SIZE 64
+
+void governor_init(void);
+/* Called by the playback threads whenever they pass by, samples the
+   pipeline when it is time to */
+void governor_update(void);
+/* The codec produced count samples */
+void governor_codec_output(int count);
+
+void governor_get_stats(struct governor_stats *stats);
+void governor_reset_stats(void);
+/* Copies out the last decisions, newest first, and returns how many */
+int governor_trace_read(struct governor_event *buf, int count);
+
+#else
+#define governor_init()
+#define governor_update()
+#define governor_codec_output(count)
+#endif /* HAVE_ADJUSTABLE_CPU_FREQ */
+
+#endif /* GOVERNOR_H */
@@ -59,15 +59,25 @@ static int serbuf_i = 0;
 static unsigned char response[TX_BUFLEN];
 static int responselen;
 
+/* Goes by current_tick rather than counting calls, so the tick may stop
+   while idle as long as the accessory doesn't want to be polled */
 static void iap_task(void)
 {
-    static int count = 0;
+    static long next_poll;
+    static bool polling = false;
+    int pollspeed = iap_pollspeed;
 
-    count += iap_pollspeed;
-    if (count < (500/10)) return;
+    if ((pollspeed != 0) != polling)
+    {
+        polling = pollspeed != 0;
+        tick_set_deferrable(iap_task, !polling);
+        next_poll = current_tick + HZ/2;
+    }
+
+    if (!polling || TIME_BEFORE(current_tick, next_poll)) return;
 
     /* exec every 500ms if pollspeed == 1 */
-    count = 0;
+    next_poll = current_tick + HZ/2 / pollspeed;
     queue_post(&button_queue, SYS_IAP_PERIODIC, 0);
 }
 
@@ -81,6 +91,7 @@ void iap_setup(int ratenum)
     iap_setupflag = true;
     iap_remotebtn = BUTTON_NONE;
     tick_add_task(iap_task);
+    tick_set_deferrable(iap_task, true);
     add_event(PLAYBACK_EVENT_TRACK_CHANGE, false, iap_track_changed);
 }
 
@@ -176,15 +176,22 @@ static int init_dircache(bool preinit)
     if (!global_settings.dircache)
         return 0;
     
-# ifdef HAVE_EEPROM_SETTINGS
-    if (firmware_settings.initialized && firmware_settings.disk_clean 
-        && preinit)
+    if (preinit)
     {
-        result = dircache_load();
+        /* After a clean shutdown the snapshot matches the disk, otherwise
+           it is validated in the background. */
+# ifdef HAVE_EEPROM_SETTINGS
+        result = dircache_load(!firmware_settings.initialized
+                               || !firmware_settings.disk_clean);
+# else
+        result = dircache_load(true);
+# endif
 
         if (result < 0)
         {
+# ifdef HAVE_EEPROM_SETTINGS
             firmware_settings.disk_clean = false;
+# endif
             if (global_status.dircache_size <= 0)
             {
                 /* This will be in default language, settings are not
@@ -197,11 +204,7 @@ static int init_dircache(bool preinit)
         }
     }
     else
-# endif
     {
-        if (preinit)
-            return -1;
-        
         if (!dircache_is_enabled()
             && !dircache_is_initializing())
         {
@@ -68,6 +68,7 @@ static void tagcache_update_with_splash(void)
 MENUITEM_SETTING(tagcache_ram, &global_settings.tagcache_ram, NULL);
 #endif
 MENUITEM_SETTING(tagcache_autoupdate, &global_settings.tagcache_autoupdate, NULL);
+MENUITEM_SETTING(tagcache_trigram, &global_settings.tagcache_trigram, NULL);
 MENUITEM_FUNCTION(tc_init, 0, ID2P(LANG_TAGCACHE_FORCE_UPDATE),
                     (int(*)(void))tagcache_rebuild_with_splash,
                     NULL, NULL, Icon_NOICON);
@@ -85,7 +86,8 @@ MAKE_MENU(tagcache_menu, ID2P(LANG_TAGCACHE), 0, Icon_NOICON,
 #ifdef HAVE_TC_RAMCACHE
                 &tagcache_ram,
 #endif
-                &tagcache_autoupdate, &tc_init, &tc_update, &runtimedb,
+                &tagcache_autoupdate, &tagcache_trigram, &tc_init, &tc_update,
+                &runtimedb,
                 &tc_export, &tc_import);
 #endif /* HAVE_TAGCACHE */
 /*    TAGCACHE MENU                */
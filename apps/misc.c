@@ -511,7 +511,10 @@ static void car_adapter_tick(void)
 
 void car_adapter_mode_init(void)
 {
+    /* Resuming may come up to TICK_IDLE_MAX late, which doesn't matter
+       after waiting for seconds */
     tick_add_task(car_adapter_tick);
+    tick_set_deferrable(car_adapter_tick, true);
 }
 #endif
 
@@ -786,7 +789,7 @@ bool file_exists(const char *file)
 
 #ifdef HAVE_DIRCACHE
     if (dircache_is_enabled())
-        return (dircache_get_entry_ptr(file) != NULL);
+        return (dircache_get_entry_id(file) >= 0);
 #endif
 
     fd = open(file, O_RDONLY);
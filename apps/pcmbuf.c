@@ -37,6 +37,7 @@
 #include "settings.h"
 #include "audio.h"
 #include "voice_thread.h"
+#include "governor.h"
 #include "dsp.h"
 
 #define PCMBUF_TARGET_CHUNK 32768 /* This is the target fill size of chunks
@@ -302,6 +303,9 @@ static void boost_codec_thread(bool boost)
  * Also maintain buffer level above the watermark. */
 static bool prepare_insert(size_t length)
 {
+    /* Let the governor see how the buffer is doing */
+    governor_update();
+
     if (low_latency_mode)
     {
         /* 1/4s latency. */
@@ -316,24 +320,15 @@ static bool prepare_insert(size_t length)
     /* Maintain the buffer level above the watermark */
     if (pcm_is_playing())
     {
-        /* Only codec thread initiates boost - voice boosts the cpu when playing
-           a clip */
+        /* Only codec thread changes its priority - voice follows it */
 #ifndef SIMULATOR
         if (thread_get_current() == codec_thread_id)
 #endif /* SIMULATOR */
         {
-            if (pcmbuf_unplayed_bytes <= pcmbuf_watermark)
-            {
-                /* Fill PCM buffer by boosting cpu */
-                trigger_cpu_boost();
-                /* If buffer is critically low, override UI priority, else
-                   set back to the original priority. */
-                boost_codec_thread(LOW_DATA(2));
-            }
-            else
-            {
-                boost_codec_thread(false);
-            }
+            /* If buffer is critically low, override UI priority, else
+               set back to the original priority. */
+            boost_codec_thread(pcmbuf_unplayed_bytes <= pcmbuf_watermark &&
+                               LOW_DATA(2));
         }
 
 #ifdef HAVE_CROSSFADE
@@ -346,9 +341,6 @@ static bool prepare_insert(size_t length)
     }
     else    /* pcm_is_playing */
     {
-        /* Boost CPU for pre-buffer */
-        trigger_cpu_boost();
-
         /* If pre-buffered to the watermark, start playback */
 #if MEMORYSIZE > 2
         if (!LOW_DATA(4))
@@ -538,8 +530,6 @@ void pcmbuf_start_track_change(bool auto_skip)
             return;
         }
 
-        trigger_cpu_boost();
-
         /* Not enough data, or not crossfading, flush the old data instead */
         if (LOW_DATA(2) || !crossfade || low_latency_mode)
         {
@@ -1158,6 +1148,12 @@ unsigned long pcmbuf_get_latency(void)
     return (pcmbuf_unplayed_bytes + pcm_get_bytes_waiting()) * 1000 / BYTERATE;
 }
 
+/* Audio the codec tries to keep buffered, in ms */
+unsigned long pcmbuf_get_watermark(void)
+{
+    return pcmbuf_watermark * 1000 / BYTERATE;
+}
+
 #ifndef HAVE_HARDWARE_BEEP
 #define MINIBUF_SAMPLES (NATIVE_FREQUENCY / 1000 * KEYCLICK_DURATION)
 #define MINIBUF_SIZE (MINIBUF_SAMPLES*4)
@@ -58,6 +58,7 @@ unsigned char *pcmbuf_get_meminfo(size_t *length);
 bool pcmbuf_is_lowdata(void);
 void pcmbuf_set_low_latency(bool state);
 unsigned long pcmbuf_get_latency(void);
+unsigned long pcmbuf_get_watermark(void);
 void pcmbuf_beep(unsigned int frequency, size_t duration, int amplitude);
 
 #endif
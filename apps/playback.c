@@ -34,6 +34,7 @@
 #include "ata.h"
 #include "playlist.h"
 #include "pcmbuf.h"
+#include "governor.h"
 #include "buffer.h"
 #include "cuesheet.h"
 #ifdef HAVE_TAGCACHE
@@ -123,6 +124,9 @@ enum audio_buffer_state
     AUDIOBUF_STATE_VOICED_ONLY = 1, /* voice-only */
 };
 static int buffer_state = AUDIOBUF_STATE_TRASHED; /* Buffer state */
+/* audiobuf when the buffer was laid out. The core allocator may take more
+   of it while audio is stopped */
+static unsigned char *buffer_start;
 
 /* These are used to store the current and next (or prev if the current is the last)
  * mp3entry's in a round-robin system. This guarentees that the pointer returned
@@ -370,8 +374,21 @@ void audio_hard_stop(void)
 #endif
 }
 
+/* Trashes the buffer if audiobuf has moved since it was laid out */
+static void audio_check_buffer_start(void)
+{
+    if (buffer_state != AUDIOBUF_STATE_TRASHED && audiobuf != buffer_start)
+    {
+        logf("audiobuf moved");
+        talk_buffer_steal();
+        buffer_state = AUDIOBUF_STATE_TRASHED;
+    }
+}
+
 bool audio_restore_playback(int type)
 {
+    audio_check_buffer_start();
+
     switch (type)
     {
     case AUDIO_WANT_PLAYBACK:
@@ -399,6 +416,7 @@ unsigned char *audio_get_buffer(bool talk_buf, size_t *buffer_size)
 
     /* Reset the buffering thread so that it doesn't try to use the data */
     buffering_reset(filebuf, filebuflen);
+    audio_check_buffer_start();
 
     if (buffer_size == NULL)
     {
@@ -1416,8 +1434,6 @@ static void audio_finish_load_track(void)
 
 static void audio_fill_file_buffer(bool start_play, size_t offset)
 {
-    trigger_cpu_boost();
-
     /* No need to rebuffer if there are track skips pending,
      * however don't cancel buffering on skipping while filling. */
     if (ci.new_track != 0 && filling != STATE_FILLING)
@@ -1427,6 +1443,7 @@ static void audio_fill_file_buffer(bool start_play, size_t offset)
     /* Must reset the buffer before use if trashed or voice only - voice
        file size shouldn't have changed so we can go straight from
        AUDIOBUF_STATE_VOICED_ONLY to AUDIOBUF_STATE_INITIALIZED */
+    audio_check_buffer_start();
     if (buffer_state != AUDIOBUF_STATE_INITIALIZED)
         audio_reset_buffer();
 
@@ -1827,6 +1844,7 @@ static void audio_reset_buffer(void)
        as it will likely be affected and need sliding over */
 
     /* Initially set up file buffer as all space available */
+    buffer_start = audiobuf;
     malloc_buf = audiobuf + talk_get_bufsize();
     /* Align the malloc buf to line size. Especially important to cf
        targets that do line reads/writes. */
@@ -1885,11 +1903,12 @@ static void audio_thread(void)
     while (1)
     {
         if (filling != STATE_FILLING && filling != STATE_IDLE) {
-            /* End of buffering, let's calculate the watermark and unboost */
+            /* End of buffering, let's calculate the watermark */
             set_filebuf_watermark();
-            cancel_cpu_boost();
         }
 
+        governor_update();
+
         if (!pcmbuf_queue_scan(&ev))
             queue_wait_w_tmo(&audio_queue, &ev, HZ/2);
 
@@ -2057,6 +2076,7 @@ void audio_init(void)
        talk first */
     talk_init();
 
+    governor_init();
     make_codec_thread();
 
     audio_thread_id = create_thread(audio_thread, audio_stack,
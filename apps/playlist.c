@@ -574,7 +574,7 @@ static int add_indices_to_playlist(struct playlist_info* playlist,
                     playlist->indices[ playlist->amount ] = i+count;
 #ifdef HAVE_DIRCACHE
                     if (playlist->filenames)
-                        playlist->filenames[ playlist->amount ] = NULL;
+                        playlist->filenames[ playlist->amount ] = 0;
 #endif
                     playlist->amount++;
                 }
@@ -812,7 +812,7 @@ static int add_track_to_playlist(struct playlist_info* playlist,
 
 #ifdef HAVE_DIRCACHE
     if (playlist->filenames)
-        playlist->filenames[insert_position] = NULL;
+        playlist->filenames[insert_position] = 0;
 #endif
 
     playlist->amount++;
@@ -954,9 +954,9 @@ static int randomise_playlist(struct playlist_info* playlist,
 #ifdef HAVE_DIRCACHE
         if (playlist->filenames)
         {
-            store = (long)playlist->filenames[candidate];
+            store = playlist->filenames[candidate];
             playlist->filenames[candidate] = playlist->filenames[count];
-            playlist->filenames[count] = (struct dircache_entry *)store;
+            playlist->filenames[count] = store;
         }
 #endif
     }
@@ -1291,7 +1291,7 @@ static void playlist_thread(void)
                 for (index = 0; index < playlist->amount
                      && queue_empty(&playlist_queue); index++)
                 {
-                    /* Process only pointers that are not already loaded. */
+                    /* Process only entries that are not already loaded. */
                     if (playlist->filenames[index])
                         continue ;
                     
@@ -1303,8 +1303,9 @@ static void playlist_thread(void)
                         sizeof(tmp)) < 0)
                         break ;
 
-                    /* Set the dircache entry pointer. */
-                    playlist->filenames[index] = dircache_get_entry_ptr(tmp);
+                    /* Set the dircache entry ID, 0 if it isn't cached. */
+                    playlist->filenames[index] =
+                        MAX(0, dircache_get_entry_id(tmp));
 
                     /* And be on background so user doesn't notice any delays. */
                     yield();
@@ -1345,7 +1346,7 @@ static int get_filename(struct playlist_info* playlist, int index, int seek,
 #ifdef HAVE_DIRCACHE
     if (dircache_is_enabled() && playlist->filenames)
     {
-        if (playlist->filenames[index] != NULL)
+        if (playlist->filenames[index] > 0)
         {
             dircache_copy_path(playlist->filenames[index], tmp_buf, sizeof(tmp_buf)-1);
             max = strlen(tmp_buf) + 1;
@@ -2377,7 +2378,7 @@ int playlist_add(const char *filename)
 
     playlist->indices[playlist->amount] = playlist->buffer_end_pos;
 #ifdef HAVE_DIRCACHE
-    playlist->filenames[playlist->amount] = NULL;
+    playlist->filenames[playlist->amount] = 0;
 #endif
     playlist->amount++;
     
@@ -2692,8 +2693,7 @@ int playlist_create_ex(struct playlist_info* playlist,
             playlist->max_playlist_size = num_indices;
             playlist->indices = index_buffer;
 #ifdef HAVE_DIRCACHE
-            playlist->filenames = (const struct dircache_entry **)
-                &playlist->indices[num_indices];
+            playlist->filenames = (int *)&playlist->indices[num_indices];
 #endif
         }
         else
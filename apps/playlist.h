@@ -81,7 +81,7 @@ struct playlist_info
     bool control_created; /* has control file been created?         */
     int  dirlen;         /* Length of the path to the playlist file */
     unsigned long *indices; /* array of indices                     */
-    const struct dircache_entry **filenames; /* Entries from dircache */
+    int *filenames;      /* entry IDs from dircache                 */
     int  max_playlist_size; /* Max number of files in playlist. Mirror of
                               global_settings.max_files_in_playlist */
     bool in_ram;         /* playlist stored in ram (dirplay)        */
@@ -79,8 +79,10 @@ static bool plugin_loaded = false;
 static int  plugin_size = 0;
 static bool (*pfn_tsr_exit)(bool reenter) = NULL; /* TSR exit callback */
 static char current_plugin[MAX_PATH];
-
-char *plugin_get_current_filename(void);
+#ifdef PLUGIN_USE_IRAM
+static size_t plugin_iram_size = 0;
+static size_t plugin_ibss_size = 0;
+#endif
 
 static const struct plugin_api rockbox_api = {
 
@@ -676,6 +678,10 @@ static const struct plugin_api rockbox_api = {
     pcmbuf_beep,
 #endif
     crc_32,
+#ifdef RB_PROFILE
+    profsample_start,
+    profsample_stop,
+#endif
 };
 
 int plugin_load(const char* plugin, const void* parameter)
@@ -710,6 +716,10 @@ int plugin_load(const char* plugin, const void* parameter)
 
     splash(0, ID2P(LANG_WAIT));
     strcpy(current_plugin, plugin);
+#ifdef PLUGIN_USE_IRAM
+    plugin_iram_size = 0;
+    plugin_ibss_size = 0;
+#endif
 
 #ifdef SIMULATOR
     hdr = sim_plugin_load((char *)plugin, &pd);
@@ -896,6 +906,9 @@ void* plugin_get_audio_buffer(size_t *buffer_size)
 void plugin_iram_init(char *iramstart, char *iramcopy, size_t iram_size,
                       char *iedata, size_t iedata_size)
 {
+    plugin_iram_size = iram_size;
+    plugin_ibss_size = iedata_size;
+
     /* We need to stop audio playback in order to use codec IRAM */
     audio_hard_stop();
     memcpy(iramstart, iramcopy, iram_size);
@@ -906,6 +919,12 @@ void plugin_iram_init(char *iramstart, char *iramcopy, size_t iram_size,
     cpucache_flush();
 #endif
 }
+
+void plugin_get_iram_usage(size_t *iram, size_t *ibss)
+{
+    *iram = plugin_iram_size;
+    *ibss = plugin_ibss_size;
+}
 #endif /* PLUGIN_USE_IRAM */
 
 /* The plugin wants to stay resident after leaving its main function, e.g.
@@ -135,12 +135,12 @@ void* plugin_get_buffer(size_t *buffer_size);
 #define PLUGIN_MAGIC 0x526F634B /* RocK */
 
 /* increase this every time the api struct changes */
-#define PLUGIN_API_VERSION 175
+#define PLUGIN_API_VERSION 179
 
 /* update this to latest version if a change to the api struct breaks
    backwards compatibility (and please take the opportunity to sort in any
    new function which are "waiting" at the end of the function table) */
-#define PLUGIN_MIN_API_VERSION 173
+#define PLUGIN_MIN_API_VERSION 179
 
 /* plugin return codes */
 enum plugin_status {
@@ -850,6 +850,10 @@ struct plugin_api {
                         int amplitude);
 #endif
     unsigned (*crc_32)(const void *src, unsigned len, unsigned crc32);
+#ifdef RB_PROFILE
+    void (*profsample_start)(void);
+    void (*profsample_stop)(void);
+#endif
 };
 
 /* plugin header */
@@ -902,9 +906,12 @@ extern unsigned char plugin_end_addr[];
 
 int plugin_load(const char* plugin, const void* parameter);
 void* plugin_get_audio_buffer(size_t *buffer_size);
+char *plugin_get_current_filename(void);
 #ifdef PLUGIN_USE_IRAM
 void plugin_iram_init(char *iramstart, char *iramcopy, size_t iram_size,
                       char *iedata, size_t iedata_size);
+/* IRAM and IBSS bytes taken by the current plugin, 0 when it has none */
+void plugin_get_iram_usage(size_t *iram, size_t *ibss);
 #endif
 
 /* plugin_tsr,
@@ -31,7 +31,7 @@
 #include "lib/configfile.h"
 #include "lib/grey.h"
 #include "lib/feature_wrappers.h"
-#include "lib/buflib.h"
+#include "buflib.h"
 
 PLUGIN_HEADER
 
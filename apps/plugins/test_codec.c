@@ -100,6 +100,8 @@ static char str[MAX_PATH];
 
 /* Our local implementation of the codec API */
 static struct codec_api ci;
+static struct codec_heap_stats heap_stats;
+static struct codec_iram_usage iram_usage;
 
 struct test_track_info {
     struct mp3entry id3;       /* TAG metadata */
@@ -653,6 +655,9 @@ static void init_ci(void)
 #ifdef CPU_ARM
     ci.__div0 = rb->__div0;
 #endif
+
+    ci.heap_stats = &heap_stats;
+    ci.iram_usage = &iram_usage;
 }
 
 static void codec_thread(void)
@@ -798,6 +803,21 @@ static enum plugin_status test_track(const char* filename)
 #endif
     }
 
+    /* What the codec needed of the CODEC_SIZE it was given */
+    rb->snprintf(str, sizeof(str), "Heap peak - %lu bytes",
+                 (unsigned long)heap_stats.peak);
+    log_text(str,true);
+    rb->snprintf(str, sizeof(str), "Allocations - %lu",
+                 heap_stats.allocs);
+    log_text(str,true);
+    rb->snprintf(str, sizeof(str), "Largest free - %lu bytes",
+                 (unsigned long)heap_stats.largest_free);
+    log_text(str,true);
+    rb->snprintf(str, sizeof(str), "IRAM - %lu bytes, IBSS - %lu bytes",
+                 (unsigned long)iram_usage.iram,
+                 (unsigned long)iram_usage.ibss);
+    log_text(str,true);
+
     res = PLUGIN_OK;
 
 exit:
@@ -69,6 +69,10 @@ static inline void clear_flush_interrupt(void)
 /** Stats on encoded data for current file **/
 static size_t        num_rec_bytes;      /* Num bytes recorded             */
 static unsigned long num_rec_samples;    /* Number of PCM samples recorded */
+static off_t         rec_prealloc_end;   /* File size disk space is kept for */
+
+/* Disk space is reserved ahead of the writes in steps of this size */
+#define PREALLOC_SIZE  (8*1024*1024)
 
 /** Stats on encoded data for all files from start to stop **/
 #if 0
@@ -580,6 +584,26 @@ static void pcmrec_close_file(int *fd_p)
     *fd_p = -1;
 } /* pcmrec_close_file */
 
+/* keep disk space reserved ahead of the current file so that it ends up
+   in one piece - failure only means the disk is almost full */
+static void pcmrec_preallocate(void)
+{
+    off_t size;
+
+    if (rec_fdata.rec_file < 0)
+        return;
+
+    size = filesize(rec_fdata.rec_file);
+    if (size < 0 || size + PREALLOC_SIZE/2 < rec_prealloc_end)
+        return;
+
+    rec_prealloc_end = size + PREALLOC_SIZE;
+    if (fpreallocate(rec_fdata.rec_file, rec_prealloc_end) < 0)
+    {
+        logf("preallocate failed");
+    }
+} /* pcmrec_preallocate */
+
 /** Data Flushing **/
 
 /**
@@ -664,6 +688,8 @@ static void pcmrec_start_file(void)
     else
     {
         pcmrec_update_sizes(enc_size, num_pcm);
+        rec_prealloc_end = 0;
+        pcmrec_preallocate();
     }
     
     rec_fdata.chunk->flags &= ~CHUNKF_START_FILE;
@@ -920,6 +946,8 @@ static void pcmrec_flush(unsigned flush_num)
            sufficiently */
     } /* end while */
 
+    pcmrec_preallocate();
+
     /* sync file */
     if (rec_fdata.rec_file >= 0 && fsync(rec_fdata.rec_file) != 0)
         errors |= PCMREC_E_IO;
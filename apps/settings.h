@@ -604,6 +604,7 @@ struct user_settings
     bool tagcache_ram;        /* load tagcache to ram? */
 #endif
     bool tagcache_autoupdate; /* automatically keep tagcache in sync? */
+    bool tagcache_trigram;    /* build and use substring search indices? */
     bool runtimedb;           /* runtime database active? */
 #endif /* HAVE_TAGCACHE */
 
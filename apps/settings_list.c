@@ -1313,6 +1313,8 @@ const struct settings_list settings[] = {
 #endif
     OFFON_SETTING(F_BANFROMQS, tagcache_autoupdate, LANG_TAGCACHE_AUTOUPDATE, false,
                   "tagcache_autoupdate", NULL),
+    OFFON_SETTING(F_BANFROMQS, tagcache_trigram, LANG_TAGCACHE_TRIGRAM, true,
+                  "tagcache_substring_index", NULL),
 #endif
     CHOICE_SETTING(0, default_codepage, LANG_DEFAULT_CODEPAGE, 0,
                    "default codepage",
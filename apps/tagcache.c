@@ -71,6 +71,9 @@
 #include "metadata.h"
 #include "tagcache.h"
 #include "buffer.h"
+#ifndef __PCTOOL__
+#include "core_alloc.h"
+#endif
 #include "crc32.h"
 #include "misc.h"
 #include "settings.h"
@@ -88,6 +91,11 @@
 #define do_timed_yield() do { } while(0)
 #endif
 
+#ifdef SIMULATOR
+/* Host builds read the database files through memory mappings. */
+#define HAVE_TC_MMAP
+#endif
+
 #ifndef __PCTOOL__
 /* Tag Cache thread. */
 static struct event_queue tagcache_queue;
@@ -106,6 +114,9 @@ static long tempbufidx;   /* Current location in buffer. */
 static long tempbuf_size; /* Buffer size (TEMPBUF_SIZE). */
 static long tempbuf_left; /* Buffer space left. */
 static long tempbuf_pos;
+#ifndef __PCTOOL__
+static int tempbuf_handle;
+#endif
 
 #define SORTED_TAGS_COUNT 8
 #define TAGCACHE_IS_UNIQUE(tag) (BIT_N(tag) & TAGCACHE_UNIQUE_TAGS)
@@ -122,6 +133,11 @@ static long tempbuf_pos;
     (1LU << tag_genre) | (1LU << tag_composer) | (1LU << tag_comment) | \
     (1LU << tag_albumartist) | (1LU << tag_grouping))
 
+/* Tags that get a substring search index at commit. */
+#define TAGCACHE_TRIGRAM_TAGS ((1LU << tag_artist) | (1LU << tag_album) | \
+    (1LU << tag_title) | (1LU << tag_composer) | (1LU << tag_albumartist))
+#define TAGCACHE_IS_TRIGRAM(tag) (BIT_N(tag) & TAGCACHE_TRIGRAM_TAGS)
+
 /* String presentation of the tags defined in tagcache.h. Must be in correct order! */
 static const char *tags_str[] = { "artist", "album", "genre", "title", 
     "filename", "composer", "comment", "albumartist", "grouping", "year", 
@@ -156,6 +172,23 @@ static struct tagcache_command_entry command_queue[TAGCACHE_COMMAND_QUEUE_LENGTH
 static volatile int command_queue_widx = 0;
 static volatile int command_queue_ridx = 0;
 static struct mutex command_queue_mutex;
+
+/* Statistics journal: command queue entries spilled to disk but not yet
+ * replayed into the master index. Kept in memory as well so that reads
+ * see the updated values. */
+static struct tagcache_command_entry journal[TAGCACHE_JOURNAL_LENGTH];
+static int journal_count = 0;
+static bool journal_loaded = false;
+/* One bit per index id modulo JOURNAL_FILTER_BITS, set for the ids in the
+ * journal, so that it is only searched for the few entries it updates. */
+#define JOURNAL_FILTER_BITS 4096
+static uint32_t journal_filter[JOURNAL_FILTER_BITS / 32];
+#define JOURNAL_FILTER_SET(id) \
+    (journal_filter[((unsigned)(id) % JOURNAL_FILTER_BITS) / 32] |= \
+        1u << ((unsigned)(id) % 32))
+#define JOURNAL_FILTER_TEST(id) \
+    (journal_filter[((unsigned)(id) % JOURNAL_FILTER_BITS) / 32] & \
+        (1u << ((unsigned)(id) % 32)))
 #endif
 
 /* Tag database structures. */
@@ -187,6 +220,22 @@ struct master_header {
     int32_t dirty;
 };
 
+/** 
+ * Header of a substring search index file. It is followed by
+ * TRIGRAM_BUCKETS+1 offsets into the posting list and the posting list
+ * itself: for every bucket the seeks of all tag file entries containing
+ * a trigram hashing to that bucket, in ascending order.
+ */
+struct trigram_header {
+    int32_t magic;         /* Header version number */
+    int32_t datasize;      /* Data size of the indexed tag file */
+    int32_t entry_count;   /* Entry count of the indexed tag file */
+    int32_t posting_count; /* Number of seeks in the posting list */
+};
+
+#define TRIGRAM_POSTINGS_POS (sizeof(struct trigram_header) \
+    + (TRIGRAM_BUCKETS + 1) * sizeof(int32_t))
+
 /* For the endianess correction */
 static const char *tagfile_entry_ec   = "ll";
 /**
@@ -196,6 +245,14 @@ static const char *index_entry_ec     = "lllllllllllllllllllll";
 
 static const char *tagcache_header_ec = "lll";
 static const char *master_header_ec   = "llllll";
+static const char *trigram_header_ec  = "llll";
+
+/* Header of the statistics journal. It is followed by the spilled
+ * command queue entries in native byte order. */
+struct journal_header {
+    int32_t magic;    /* Header version number */
+    int32_t commitid; /* Commit id of the master index it applies to */
+};
 
 static struct master_header current_tcmh;
 
@@ -247,17 +304,54 @@ static long commit_entry_count;
 static long lookup_buffer_depth;
 static struct tempbuf_searchidx **lookup;
 
+/* Final size of the master file, reserved by the first build_index() */
+static long master_prealloc_size;
+
 /* Used when building the temporary file. */
 static int cachefd = -1, filenametag_fd;
 static int total_entry_count = 0;
 static int data_size = 0;
 static int processed_dir_count;
 
+/* Candidate seeks of the search currently using a substring index. */
+static struct {
+    const struct tagcache_search *owner;
+    int tag;
+    int count;
+    int32_t seek[TRIGRAM_MAX_CANDIDATES];
+} trigram_filter;
+
+/* Used to drop duplicate buckets of a string. */
+static unsigned char trigram_seen[TRIGRAM_BUCKETS/8];
+
 /* Thread safe locking */
 static volatile int write_lock;
 static volatile int read_lock;
 
+#ifdef HAVE_TC_MMAP
+/* Read-only mappings of the tag files and, at index TAG_COUNT, of the
+ * master index. */
+struct tagcache_mapping {
+    char *addr;
+    long size;
+    bool failed;  /* Don't retry until the files change */
+};
+static struct tagcache_mapping tc_map[TAG_COUNT+1];
+#ifndef __PCTOOL__
+/* Held while reading from a mapping, so that it isn't unmapped meanwhile */
+static struct mutex tc_map_mutex;
+#define map_lock()   mutex_lock(&tc_map_mutex)
+#define map_unlock() mutex_unlock(&tc_map_mutex)
+#else
+#define map_lock()   do { } while(0)
+#define map_unlock() do { } while(0)
+#endif
+#endif
+
 static bool delete_entry(long idx_id);
+#ifndef __PCTOOL__
+static void command_queue_sync_callback(void *data);
+#endif
 
 const char* tagcache_tag_to_str(int tag)
 {
@@ -363,8 +457,7 @@ static bool do_timed_yield(void)
 #endif
 
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
-static long find_entry_ram(const char *filename,
-                           const struct dirent *dc)
+static long find_entry_ram(const char *filename, int dc)
 {
     static long last_pos = 0;
     int i;
@@ -373,10 +466,10 @@ static long find_entry_ram(const char *filename,
     if (!tc_stat.ramcache)
         return -1;
 
-    if (dc == NULL)
-        dc = dircache_get_entry_ptr(filename);
+    if (dc < 0)
+        dc = dircache_get_entry_id(filename);
     
-    if (dc == NULL)
+    if (dc < 0)
     {
         logf("tagcache: file not found.");
         return -1;
@@ -512,7 +605,7 @@ static int find_index(const char *filename)
     
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
     if (tc_stat.ramcache && is_dircache_intact())
-        idx_id = find_entry_ram(filename, NULL);
+        idx_id = find_entry_ram(filename, -1);
 #endif
     
     if (idx_id < 0)
@@ -541,6 +634,137 @@ bool tagcache_find_index(struct tagcache_search *tcs, const char *filename)
     return true;
 }
 
+#ifdef HAVE_TC_MMAP
+/* Map a database file on first use. The mappings are invalid while a
+ * commit rewrites the files, reads fall back to file I/O then. */
+static const char *map_file(int tag, long *size)
+{
+    struct tagcache_mapping *map = &tc_map[tag];
+    char buf[MAX_PATH];
+    int fd;
+    
+    if (map->addr == NULL)
+    {
+        if (map->failed || read_lock || tc_stat.econ)
+            return NULL;
+        
+        if (tag == TAG_COUNT)
+            strlcpy(buf, TAGCACHE_FILE_MASTER, sizeof buf);
+        else
+            snprintf(buf, sizeof buf, TAGCACHE_FILE_INDEX, tag);
+        
+        fd = open(buf, O_RDONLY);
+        if (fd >= 0)
+        {
+            map->size = filesize(fd);
+            if (map->size > 0)
+                map->addr = sim_mmap(fd, map->size);
+            close(fd);
+        }
+        
+        if (map->addr == NULL)
+        {
+            logf("mmap failed: %s", buf);
+            map->failed = true;
+            return NULL;
+        }
+    }
+    
+    *size = map->size;
+    return map->addr;
+}
+
+/* Drop all mappings before the files get truncated. Readers still
+ * copying from them are waited for. */
+static void unmap_files(void)
+{
+    int i;
+    
+    map_lock();
+    for (i = 0; i <= TAG_COUNT; i++)
+    {
+        if (tc_map[i].addr != NULL)
+            sim_munmap(tc_map[i].addr, tc_map[i].size);
+        
+        tc_map[i].addr = NULL;
+        tc_map[i].failed = false;
+    }
+    map_unlock();
+}
+
+static bool map_read_index(int idxid, struct index_entry *idx)
+{
+    const char *p;
+    long size, pos;
+    bool ret = false;
+    
+    map_lock();
+    p = map_file(TAG_COUNT, &size);
+    pos = idxid * sizeof(struct index_entry) + sizeof(struct master_header);
+    if (p != NULL && pos + (long)sizeof(struct index_entry) <= size)
+    {
+        memcpy(idx, &p[pos], sizeof(struct index_entry));
+        ret = true;
+    }
+    map_unlock();
+    
+    return ret;
+}
+
+static bool map_retrieve(int tag, long seek, char *buf, long size)
+{
+    const struct tagfile_entry *tfe;
+    const char *p;
+    long mapsize;
+    bool ret = false;
+    
+    map_lock();
+    p = map_file(tag, &mapsize);
+    if (p == NULL || seek + (long)sizeof(struct tagfile_entry) > mapsize)
+        goto out;
+    
+    tfe = (const struct tagfile_entry *)&p[seek];
+    if (tfe->tag_length < 0 || tfe->tag_length >= size
+        || seek + (long)sizeof(struct tagfile_entry) + tfe->tag_length > mapsize)
+    {
+        goto out;
+    }
+    
+    memcpy(buf, tfe->tag_data, tfe->tag_length);
+    buf[tfe->tag_length] = '\0';
+    ret = true;
+    
+out:
+    map_unlock();
+    return ret;
+}
+#endif /* HAVE_TC_MMAP */
+
+/* Merge updates from the statistics journal into an index entry read
+ * from disk. */
+static void journal_apply(int idx_id, struct index_entry *idx)
+{
+#ifndef __PCTOOL__
+    int i;
+    
+    if (!JOURNAL_FILTER_TEST(idx_id))
+        return ;
+    
+    for (i = 0; i < journal_count; i++)
+    {
+        if (journal[i].command != CMD_UPDATE_NUMERIC
+            || journal[i].idx_id != idx_id)
+            continue;
+        
+        idx->tag_seek[journal[i].tag] = journal[i].data;
+        idx->flag |= FLAG_DIRTYNUM;
+    }
+#else
+    (void)idx_id;
+    (void)idx;
+#endif
+}
+
 static bool get_index(int masterfd, int idxid, 
                       struct index_entry *idx, bool use_ram)
 {
@@ -571,6 +795,17 @@ static bool get_index(int masterfd, int idxid,
     (void)use_ram;
 #endif
     
+#ifdef HAVE_TC_MMAP
+    if (map_read_index(idxid, idx))
+    {
+        if (idx->flag & FLAG_DELETED)
+            return false;
+        
+        journal_apply(idxid, idx);
+        return true;
+    }
+#endif
+    
     if (masterfd < 0)
     {
         struct master_header tcmh;
@@ -599,6 +834,8 @@ static bool get_index(int masterfd, int idxid,
     if (idx->flag & FLAG_DELETED)
         return false;
     
+    journal_apply(idxid, idx);
+    
     return true;
 }
 
@@ -697,8 +934,7 @@ static bool retrieve(struct tagcache_search *tcs, struct index_entry *idx,
         if (tag == tag_filename && (idx->flag & FLAG_DIRCACHE)
             && is_dircache_intact())
         {
-            dircache_copy_path((struct dirent *)seek,
-                               buf, size);
+            dircache_copy_path(seek, buf, size);
             return true;
         }
         else
@@ -713,6 +949,11 @@ static bool retrieve(struct tagcache_search *tcs, struct index_entry *idx,
     }
 #endif
     
+#ifdef HAVE_TC_MMAP
+    if (map_retrieve(tag, seek, buf, size))
+        return true;
+#endif
+    
     if (!open_files(tcs, tag))
         return false;
     
@@ -972,6 +1213,236 @@ static bool check_clauses(struct tagcache_search *tcs,
     return true;
 }
 
+static bool trigram_enabled(void)
+{
+#ifdef __PCTOOL__
+    return true;
+#else
+    return global_settings.tagcache_trigram;
+#endif
+}
+
+static inline int trigram_bucket(const char *str)
+{
+    uint32_t t = (tolower((unsigned char)str[0]) << 16)
+        | (tolower((unsigned char)str[1]) << 8)
+        | tolower((unsigned char)str[2]);
+    
+    /* Must give the same result on the device and on the host. */
+    return ((uint32_t)(t * 2654435761u) >> 20) & (TRIGRAM_BUCKETS - 1);
+}
+
+/* Get the distinct buckets of all trigrams in the first len chars of str. */
+static int trigram_get_buckets(const char *str, int len, short *buckets)
+{
+    int i, count = 0;
+    
+    for (i = 0; i + 3 <= len; i++)
+    {
+        int b = trigram_bucket(&str[i]);
+        
+        if (trigram_seen[b >> 3] & BIT_N(b & 7))
+            continue;
+        
+        trigram_seen[b >> 3] |= BIT_N(b & 7);
+        buckets[count++] = b;
+    }
+    
+    for (i = 0; i < count; i++)
+        trigram_seen[buckets[i] >> 3] = 0;
+    
+    return count;
+}
+
+static int trigram_read_bucket(int fd, int bucket, int32_t *range)
+{
+    lseek(fd, sizeof(struct trigram_header) + bucket * sizeof(int32_t),
+          SEEK_SET);
+    if (ecread(fd, range, 2, "l", tc_stat.econ) != 2 * sizeof(int32_t))
+        return -1;
+    
+    return range[1] - range[0];
+}
+
+/* Narrow the entries a string clause can match down to the ones that
+ * contain every trigram of the clause, if the tag has an index. */
+static void trigram_setup_filter(const struct tagcache_search *tcs,
+                                 const struct tagcache_search_clause *clause)
+{
+    struct tagcache_header tch;
+    struct trigram_header th;
+    short buckets[62];
+    int32_t range[2], best[2];
+    char buf[MAX_PATH];
+    int fd, i, len, count;
+    int best_count = -1;
+    
+    if (trigram_filter.owner != NULL || !trigram_enabled()
+        || clause->numeric || !TAGCACHE_IS_TRIGRAM(clause->tag))
+    {
+        return;
+    }
+    
+    switch (clause->type)
+    {
+        case clause_is:
+        case clause_contains:
+        case clause_begins_with:
+        case clause_ends_with:
+            break;
+        default:
+            return;
+    }
+    
+    /* A subset of the trigrams is enough for filtering. */
+    len = MIN((int)strlen(clause->str), (int)ARRAYLEN(buckets) + 2);
+    if (len < 3)
+        return;
+    
+    fd = open_tag_fd(&tch, clause->tag, false);
+    if (fd < 0)
+        return;
+    close(fd);
+    
+    snprintf(buf, sizeof buf, TAGCACHE_FILE_TRIGRAM, clause->tag);
+    fd = open(buf, O_RDONLY);
+    if (fd < 0)
+        return;
+    
+    /* The index is only valid for the tag file it was built from. */
+    if (ecread(fd, &th, 1, trigram_header_ec, tc_stat.econ)
+        != sizeof(struct trigram_header) || th.magic != TAGCACHE_MAGIC
+        || th.datasize != tch.datasize || th.entry_count != tch.entry_count)
+    {
+        logf("trigram index outdated: %d", clause->tag);
+        close(fd);
+        return;
+    }
+    
+    count = trigram_get_buckets(clause->str, len, buckets);
+    
+    /* Start with the shortest posting list. */
+    for (i = 0; i < count; i++)
+    {
+        int n = trigram_read_bucket(fd, buckets[i], range);
+        
+        if (n < 0)
+        {
+            close(fd);
+            return;
+        }
+        
+        if (best_count < 0 || n < best_count)
+        {
+            best_count = n;
+            best[0] = range[0];
+            best[1] = range[1];
+        }
+    }
+    
+    if (best_count > TRIGRAM_MAX_CANDIDATES)
+    {
+        logf("too many trigram candidates: %d", best_count);
+        close(fd);
+        return;
+    }
+    
+    lseek(fd, TRIGRAM_POSTINGS_POS + best[0] * sizeof(int32_t), SEEK_SET);
+    if (ecread(fd, trigram_filter.seek, best_count, "l", tc_stat.econ)
+        != (ssize_t)(best_count * sizeof(int32_t)))
+    {
+        close(fd);
+        return;
+    }
+    trigram_filter.count = best_count;
+    
+    /* And intersect it with the others. */
+    for (i = 0; i < count && trigram_filter.count > 0; i++)
+    {
+        int32_t chunk[32];
+        int left, chunk_len = 0, chunk_pos = 0;
+        int rpos = 0, wpos = 0;
+        
+        left = trigram_read_bucket(fd, buckets[i], range);
+        if (left < 0)
+        {
+            close(fd);
+            return;
+        }
+        
+        if (range[0] == best[0] && range[1] == best[1])
+            continue;
+        
+        lseek(fd, TRIGRAM_POSTINGS_POS + range[0] * sizeof(int32_t), SEEK_SET);
+        while (rpos < trigram_filter.count)
+        {
+            if (chunk_pos == chunk_len)
+            {
+                if (left <= 0)
+                    break;
+                
+                chunk_len = MIN(left, (int)ARRAYLEN(chunk));
+                if (ecread(fd, chunk, chunk_len, "l", tc_stat.econ)
+                    != (ssize_t)(chunk_len * sizeof(int32_t)))
+                {
+                    close(fd);
+                    return;
+                }
+                left -= chunk_len;
+                chunk_pos = 0;
+            }
+            
+            while (rpos < trigram_filter.count
+                   && trigram_filter.seek[rpos] < chunk[chunk_pos])
+            {
+                rpos++;
+            }
+            
+            if (rpos < trigram_filter.count
+                && trigram_filter.seek[rpos] == chunk[chunk_pos])
+            {
+                trigram_filter.seek[wpos++] = trigram_filter.seek[rpos++];
+            }
+            
+            chunk_pos++;
+        }
+        
+        trigram_filter.count = wpos;
+    }
+    
+    close(fd);
+    
+    logf("trigram candidates: %d", trigram_filter.count);
+    trigram_filter.tag = clause->tag;
+    trigram_filter.owner = tcs;
+}
+
+static bool trigram_check(const struct tagcache_search *tcs,
+                          const struct index_entry *idx)
+{
+    int32_t seek;
+    int low = 0, high;
+    
+    if (trigram_filter.owner != tcs)
+        return true;
+    
+    seek = idx->tag_seek[trigram_filter.tag];
+    high = trigram_filter.count - 1;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        
+        if (trigram_filter.seek[mid] == seek)
+            return true;
+        else if (trigram_filter.seek[mid] < seek)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    
+    return false;
+}
+
 bool tagcache_check_clauses(struct tagcache_search *tcs,
                             struct tagcache_search_clause **clause, int count)
 {
@@ -1051,7 +1522,8 @@ static bool build_lookup_list(struct tagcache_search *tcs)
                 continue ;
 
             /* Check for conditions. */
-            if (!check_clauses(tcs, idx, tcs->clause, tcs->clause_count))
+            if (!trigram_check(tcs, idx)
+                || !check_clauses(tcs, idx, tcs->clause, tcs->clause_count))
                 continue;
             
             /* Add to the seek list if not already in uniq buffer. */
@@ -1096,6 +1568,8 @@ static bool build_lookup_list(struct tagcache_search *tcs)
         if (entry.flag & FLAG_DELETED)
             continue;
         
+        journal_apply(i, &entry);
+        
         /* Go through all filters.. */
         for (j = 0; j < tcs->filter_count; j++)
         {
@@ -1107,7 +1581,8 @@ static bool build_lookup_list(struct tagcache_search *tcs)
             continue ;
         
         /* Check for conditions. */
-        if (!check_clauses(tcs, &entry, tcs->clause, tcs->clause_count))
+        if (!trigram_check(tcs, &entry)
+            || !check_clauses(tcs, &entry, tcs->clause, tcs->clause_count))
             continue;
             
         /* Add to the seek list if not already in uniq buffer. */
@@ -1136,6 +1611,9 @@ static void remove_files(void)
     tc_stat.ready = false;
     tc_stat.ramcache = false;
     tc_stat.econ = false;
+#ifdef HAVE_TC_MMAP
+    unmap_files();
+#endif
     remove(TAGCACHE_FILE_MASTER);
     for (i = 0; i < TAG_COUNT; i++)
     {
@@ -1144,7 +1622,16 @@ static void remove_files(void)
         
         snprintf(buf, sizeof buf, TAGCACHE_FILE_INDEX, i);
         remove(buf);
+        snprintf(buf, sizeof buf, TAGCACHE_FILE_TRIGRAM, i);
+        remove(buf);
     }
+    
+    remove(TAGCACHE_FILE_JOURNAL);
+#ifndef __PCTOOL__
+    journal_count = 0;
+    memset(journal_filter, 0, sizeof journal_filter);
+    tc_stat.journal_length = 0;
+#endif
 }
 
 
@@ -1167,11 +1654,24 @@ static bool check_all_headers(void)
     
     memcpy(&current_tcmh, &myhdr, sizeof(struct master_header));
     
+    tc_stat.trigram_size = 0;
     for (tag = 0; tag < TAG_COUNT; tag++)
     {
         if (TAGCACHE_IS_NUMERIC(tag))
             continue;
         
+        if (TAGCACHE_IS_TRIGRAM(tag))
+        {
+            char buf[MAX_PATH];
+            
+            snprintf(buf, sizeof buf, TAGCACHE_FILE_TRIGRAM, tag);
+            if ( (fd = open(buf, O_RDONLY)) >= 0)
+            {
+                tc_stat.trigram_size += filesize(fd);
+                close(fd);
+            }
+        }
+        
         if ( (fd = open_tag_fd(&tch, tag, false)) < 0)
             return false;
         
@@ -1195,6 +1695,10 @@ bool tagcache_search(struct tagcache_search *tcs, int tag)
     while (read_lock)
         sleep(1);
     
+    /* Don't inherit a filter from an unfinished search. */
+    if (trigram_filter.owner == tcs)
+        trigram_filter.owner = NULL;
+    
     memset(tcs, 0, sizeof(struct tagcache_search));
     if (tc_stat.commit_step > 0 || !tc_stat.ready)
         return false;
@@ -1300,6 +1804,8 @@ bool tagcache_search_add_clause(struct tagcache_search *tcs,
         tcs->idxfd[clause->tag] = open(buf, O_RDONLY);
     }
     
+    trigram_setup_filter(tcs, clause);
+    
     tcs->clause[tcs->clause_count] = clause;
     tcs->clause_count++;
     
@@ -1382,8 +1888,7 @@ static bool get_next(struct tagcache_search *tcs)
         if (tcs->type == tag_filename && (flag & FLAG_DIRCACHE)
             && is_dircache_intact())
         {
-            dircache_copy_path((struct dirent *)tcs->position,
-                               buf, sizeof buf);
+            dircache_copy_path(tcs->position, buf, sizeof buf);
             tcs->result = buf;
             tcs->result_len = strlen(buf) + 1;
             tcs->ramresult = false;
@@ -1555,6 +2060,9 @@ void tagcache_search_finish(struct tagcache_search *tcs)
         }
     }
     
+    if (trigram_filter.owner == tcs)
+        trigram_filter.owner = NULL;
+    
     tcs->ramsearch = false;
     tcs->valid = false;
     tcs->initialized = 0;
@@ -1588,7 +2096,7 @@ bool tagcache_fill_tags(struct mp3entry *id3, const char *filename)
         return false;
     
     /* Find the corresponding entry in tagcache. */
-    idx_id = find_entry_ram(filename, NULL);
+    idx_id = find_entry_ram(filename, -1);
     if (idx_id < 0)
         return false;
     
@@ -1660,7 +2168,7 @@ static int check_if_empty(char **tag)
 static void __attribute__ ((noinline)) add_tagcache(char *path,
                                                     unsigned long mtime
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
-                                                    ,const struct dirent *dc
+                                                    ,int dc
 #endif
                                                    )
 {
@@ -1932,23 +2440,28 @@ static bool tempbuf_insert(char *str, int id, int idx_id, bool unique)
     return true;
 }
 
-static int compare(const void *p1, const void *p2)
+static int compare_tags(const char *str1, const char *str2)
 {
-    do_timed_yield();
-
-    struct tempbuf_searchidx *e1 = (struct tempbuf_searchidx *)p1;
-    struct tempbuf_searchidx *e2 = (struct tempbuf_searchidx *)p2;
-    
-    if (strcmp(e1->str, UNTAGGED) == 0)
+    if (strcmp(str1, UNTAGGED) == 0)
     {
-        if (strcmp(e2->str, UNTAGGED) == 0)
+        if (strcmp(str2, UNTAGGED) == 0)
             return 0;
         return -1;
     }
-    else if (strcmp(e2->str, UNTAGGED) == 0)
+    else if (strcmp(str2, UNTAGGED) == 0)
         return 1;
     
-    return strncasecmp(e1->str, e2->str, TAG_MAXLEN);
+    return strncasecmp(str1, str2, TAG_MAXLEN);
+}
+
+static int compare(const void *p1, const void *p2)
+{
+    do_timed_yield();
+
+    struct tempbuf_searchidx *e1 = (struct tempbuf_searchidx *)p1;
+    struct tempbuf_searchidx *e2 = (struct tempbuf_searchidx *)p2;
+    
+    return compare_tags(e1->str, e2->str);
 }
 
 static int tempbuf_sort(int fd)
@@ -2310,14 +2823,632 @@ static bool build_numeric_indices(struct tagcache_header *h, int tmpfd)
 }
 
 /**
- * Return values:
- *     > 0   success
- *    == 0   temporary failure
- *     < 0   fatal error
+ * External merge sort, used for the sorted tags when they don't fit in
+ * tempbuf at once. The tags are sorted in tempbuf sized runs to a
+ * temporary file and the runs are then merged reading EXTSORT_CHUNK
+ * bytes of each at a time, so memory use doesn't depend on the size of
+ * the library and all file accesses stay sequential.
+ *
+ * Instead of the lookup buffer, the new location of every tag is written
+ * to a remap file as (lookup id, seek) pairs. The master index is then
+ * updated by loading as big windows of the lookup id range from it as
+ * fit in tempbuf.
  */
-static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
-{
-    int i;
+#define EXTSORT_CHUNK    4096
+#define EXTSORT_MAX_RUNS 256
+
+struct sort_record {
+    int32_t origin;  /* Lookup id, as with tempbuf_insert() */
+    int32_t idx_id;
+    int32_t length;  /* String length including '\0' */
+    char str[0];
+};
+
+#define SORT_RECORD_SIZE(len) \
+    (long)(sizeof(struct sort_record) + ALIGN_UP((len), 4))
+
+struct extsort_way {
+    long pos;        /* Position of the unread part of the run */
+    long end;        /* End of the run */
+    char *buf;
+    int fill;
+    int cur;
+};
+
+static struct {
+    int fd;                              /* Run file */
+    int file;                            /* Index of the run file name */
+    int run_count;
+    long run_pos[EXTSORT_MAX_RUNS + 1];
+    long buf_pos;                        /* Records in tempbuf */
+    int rec_count;                       /* Record pointers at tempbuf end */
+} extsort;
+
+/* State of the final merge writing the tag file. */
+static struct {
+    int fd;
+    int remapfd;
+    bool unique;
+    long pos;
+    int count;
+    int32_t seek;
+    char last[TAG_MAXLEN+32];
+} extsort_out;
+
+static int extsort_compare_rec(const struct sort_record *r1,
+                               const struct sort_record *r2)
+{
+    int cmp = compare_tags(r1->str, r2->str);
+    
+    if (cmp != 0)
+        return cmp;
+    
+    /* Tags already in the db go first, as with tempbuf_insert(). */
+    return r2->origin - r1->origin;
+}
+
+static int extsort_compare(const void *p1, const void *p2)
+{
+    do_timed_yield();
+    
+    return extsort_compare_rec(*(const struct sort_record **)p1,
+                               *(const struct sort_record **)p2);
+}
+
+static int extsort_open(int file)
+{
+    char buf[MAX_PATH];
+    
+    snprintf(buf, sizeof buf, TAGCACHE_FILE_SORT, file);
+    return open(buf, O_RDWR | O_CREAT | O_TRUNC);
+}
+
+static void extsort_remove(int file)
+{
+    char buf[MAX_PATH];
+    
+    snprintf(buf, sizeof buf, TAGCACHE_FILE_SORT, file);
+    remove(buf);
+}
+
+static bool extsort_flush_run(void)
+{
+    struct sort_record **ptrs = 
+        (struct sort_record **)&tempbuf[tempbuf_size] - extsort.rec_count;
+    int i;
+    
+    if (extsort.rec_count == 0)
+        return true;
+    
+    if (extsort.run_count >= EXTSORT_MAX_RUNS)
+    {
+        logf("too many runs");
+        return false;
+    }
+    
+    qsort(ptrs, extsort.rec_count, sizeof(struct sort_record *),
+          extsort_compare);
+    
+    for (i = 0; i < extsort.rec_count; i++)
+    {
+        long size = SORT_RECORD_SIZE(ptrs[i]->length);
+        
+        if (write(extsort.fd, ptrs[i], size) != size)
+        {
+            logf("run write error");
+            return false;
+        }
+    }
+    
+    extsort.run_count++;
+    extsort.run_pos[extsort.run_count] = lseek(extsort.fd, 0, SEEK_CUR);
+    extsort.buf_pos = 0;
+    extsort.rec_count = 0;
+    
+    return true;
+}
+
+static bool extsort_add(int32_t origin, int32_t idx_id, const char *str)
+{
+    struct sort_record *rec;
+    int len = strlen(str) + 1;
+    long size = SORT_RECORD_SIZE(len);
+    
+    if (extsort.buf_pos + size + (extsort.rec_count + 1)
+        * (long)sizeof(struct sort_record *) > tempbuf_size)
+    {
+        if (!extsort_flush_run())
+            return false;
+    }
+    
+    rec = (struct sort_record *)&tempbuf[extsort.buf_pos];
+    rec->origin = origin;
+    rec->idx_id = idx_id;
+    rec->length = len;
+    memcpy(rec->str, str, len);
+    
+    extsort.buf_pos += size;
+    extsort.rec_count++;
+    *((struct sort_record **)&tempbuf[tempbuf_size] - extsort.rec_count) = rec;
+    
+    return true;
+}
+
+/* Make sure the next record of the run is entirely in the buffer. */
+static struct sort_record *extsort_head(int fd, struct extsort_way *w)
+{
+    int left = w->fill - w->cur;
+    
+    if (left < (int)sizeof(struct sort_record) || left < 
+        SORT_RECORD_SIZE(((struct sort_record *)&w->buf[w->cur])->length))
+    {
+        int n = MIN(EXTSORT_CHUNK - left, w->end - w->pos);
+        
+        memmove(w->buf, &w->buf[w->cur], left);
+        w->fill = left;
+        w->cur = 0;
+        
+        if (n > 0)
+        {
+            lseek(fd, w->pos, SEEK_SET);
+            if (read(fd, &w->buf[w->fill], n) != n)
+            {
+                logf("run read error");
+                return NULL;
+            }
+            w->pos += n;
+            w->fill += n;
+        }
+        
+        if (w->fill < (int)sizeof(struct sort_record))
+            return NULL;
+    }
+    
+    return (struct sort_record *)&w->buf[w->cur];
+}
+
+static int extsort_max_ways(void)
+{
+    return tempbuf_size / (EXTSORT_CHUNK + sizeof(struct extsort_way)
+                           + sizeof(struct sort_record *) + sizeof(int));
+}
+
+/* Merge count runs starting from run first, passing the records in
+ * order to emit(). */
+static bool extsort_merge_runs(int first, int count,
+                               bool (*emit)(const struct sort_record *rec))
+{
+    struct extsort_way *ways = (struct extsort_way *)tempbuf;
+    struct sort_record **heads = (struct sort_record **)&ways[count];
+    char *bufs = (char *)&heads[count];
+    int *heap = (int *)&tempbuf[tempbuf_size] - count;
+    int heap_count = 0;
+    int i;
+    
+    /* Build a heap of the runs, ordered by their first record. */
+    for (i = 0; i < count; i++)
+    {
+        int k;
+        
+        ways[i].pos = extsort.run_pos[first + i];
+        ways[i].end = extsort.run_pos[first + i + 1];
+        ways[i].buf = &bufs[i * EXTSORT_CHUNK];
+        ways[i].fill = 0;
+        ways[i].cur = 0;
+        
+        heads[i] = extsort_head(extsort.fd, &ways[i]);
+        if (heads[i] == NULL)
+            continue;
+        
+        for (k = heap_count++; k > 0; k = (k - 1) / 2)
+        {
+            int parent = heap[(k - 1) / 2];
+            
+            if (extsort_compare_rec(heads[parent], heads[i]) <= 0)
+                break;
+            heap[k] = parent;
+        }
+        heap[k] = i;
+    }
+    
+    while (heap_count > 0)
+    {
+        int w = heap[0];
+        int k, child;
+        
+        if (!emit(heads[w]))
+            return false;
+        
+        ways[w].cur += SORT_RECORD_SIZE(heads[w]->length);
+        heads[w] = extsort_head(extsort.fd, &ways[w]);
+        if (heads[w] == NULL)
+        {
+            if (ways[w].pos < ways[w].end)
+                return false;
+            
+            w = heap[--heap_count];
+        }
+        
+        /* Sift down the run of the next record. */
+        for (k = 0; (child = 2 * k + 1) < heap_count; k = child)
+        {
+            if (child + 1 < heap_count && extsort_compare_rec(
+                    heads[heap[child + 1]], heads[heap[child]]) < 0)
+            {
+                child++;
+            }
+            
+            if (extsort_compare_rec(heads[w], heads[heap[child]]) <= 0)
+                break;
+            heap[k] = heap[child];
+        }
+        heap[k] = w;
+        
+        do_timed_yield();
+    }
+    
+    return true;
+}
+
+static int extsort_passfd;
+
+static bool extsort_emit_run(const struct sort_record *rec)
+{
+    long size = SORT_RECORD_SIZE(rec->length);
+    
+    return write(extsort_passfd, rec, size) == size;
+}
+
+/* Merge the runs until all of them can be merged in one go, and then
+ * pass the records to emit(). */
+static bool extsort_merge(bool (*emit)(const struct sort_record *rec))
+{
+    int ways = MIN(extsort_max_ways(), EXTSORT_MAX_RUNS);
+    
+    if (ways < 2)
+    {
+        logf("too small buffer for merging");
+        return false;
+    }
+    
+    while (extsort.run_count > ways)
+    {
+        int i, count = 0;
+        
+        logf("merging %d runs", extsort.run_count);
+        extsort_passfd = extsort_open(extsort.file ^ 1);
+        if (extsort_passfd < 0)
+            return false;
+        
+        /* New runs are never numbered above the ones still to merge,
+         * so run_pos can be updated in place. */
+        for (i = 0; i < extsort.run_count; i += ways)
+        {
+            long pos = lseek(extsort_passfd, 0, SEEK_CUR);
+            
+            if (!extsort_merge_runs(i, MIN(ways, extsort.run_count - i),
+                                    extsort_emit_run))
+            {
+                close(extsort_passfd);
+                return false;
+            }
+            extsort.run_pos[count++] = pos;
+        }
+        extsort.run_pos[count] = lseek(extsort_passfd, 0, SEEK_CUR);
+        extsort.run_count = count;
+        
+        close(extsort.fd);
+        extsort_remove(extsort.file);
+        extsort.fd = extsort_passfd;
+        extsort.file ^= 1;
+    }
+    
+    return extsort_merge_runs(0, extsort.run_count, emit);
+}
+
+static bool extsort_emit_tag(const struct sort_record *rec)
+{
+    int32_t remap[2];
+    
+    if (!extsort_out.unique || extsort_out.count == 0
+        || strcasecmp(extsort_out.last, rec->str))
+    {
+        struct tagfile_entry fe;
+        
+        fe.tag_length = rec->length;
+        fe.idx_id = rec->idx_id;
+        
+        /* Check the chunk alignment. */
+        if ((fe.tag_length + sizeof(struct tagfile_entry)) 
+            % TAGFILE_ENTRY_CHUNK_LENGTH)
+        {
+            fe.tag_length += TAGFILE_ENTRY_CHUNK_LENGTH - 
+                ((fe.tag_length + sizeof(struct tagfile_entry)) 
+                 % TAGFILE_ENTRY_CHUNK_LENGTH);
+        }
+        
+        if (ecwrite(extsort_out.fd, &fe, 1, tagfile_entry_ec, tc_stat.econ)
+            != sizeof(struct tagfile_entry)
+            || write(extsort_out.fd, rec->str, rec->length) != rec->length)
+        {
+            logf("extsort: write error");
+            return false;
+        }
+        
+        /* Write some padding. */
+        if (fe.tag_length - rec->length > 0)
+            write(extsort_out.fd, "XXXXXXXX", fe.tag_length - rec->length);
+        
+        extsort_out.seek = extsort_out.pos;
+        extsort_out.pos += sizeof(struct tagfile_entry) + fe.tag_length;
+        extsort_out.count++;
+        strlcpy(extsort_out.last, rec->str, sizeof(extsort_out.last));
+    }
+    
+    remap[0] = rec->origin;
+    remap[1] = extsort_out.seek;
+    
+    return write(extsort_out.remapfd, remap, sizeof(remap)) == sizeof(remap);
+}
+
+/**
+ * Sort the old tags in fd and the new ones in tmpfd, and write them to
+ * fd. Returns the number of entries in the tag file or < 0 on error.
+ */
+static int extsort_build_tagfile(int index_type, struct tagcache_header *h,
+                                 int tmpfd, int fd, int old_entry_count,
+                                 int master_entry_count)
+{
+    char buf[TAG_MAXLEN+32];
+    bool unique = TAGCACHE_IS_UNIQUE(index_type);
+    int i;
+    
+    logf("external sort: %d", index_type);
+    
+    extsort.file = 0;
+    extsort.fd = extsort_open(extsort.file);
+    if (extsort.fd < 0)
+        return -1;
+    
+    extsort.run_count = 0;
+    extsort.run_pos[0] = 0;
+    extsort.buf_pos = 0;
+    extsort.rec_count = 0;
+    
+    /* Tags already in the db. */
+    lseek(fd, sizeof(struct tagcache_header), SEEK_SET);
+    for (i = 0; i < old_entry_count; i++)
+    {
+        struct tagfile_entry entry;
+        int loc = lseek(fd, 0, SEEK_CUR);
+        
+        if (ecread(fd, &entry, 1, tagfile_entry_ec, tc_stat.econ)
+            != sizeof(struct tagfile_entry)
+            || entry.tag_length >= (int)sizeof(buf)
+            || read(fd, buf, entry.tag_length) != entry.tag_length)
+        {
+            logf("read error #e1");
+            goto error;
+        }
+        
+        /* Skip deleted entries. */
+        if (buf[0] == '\0')
+            continue;
+        
+        if (!extsort_add(loc/TAGFILE_ENTRY_CHUNK_LENGTH + commit_entry_count,
+                         entry.idx_id, buf))
+        {
+            goto error;
+        }
+        do_timed_yield();
+    }
+    
+    /* New tags in the temporary file. */
+    lseek(tmpfd, sizeof(struct tagcache_header), SEEK_SET);
+    for (i = 0; i < h->entry_count; i++)
+    {
+        struct temp_file_entry entry;
+        
+        if (read(tmpfd, &entry, sizeof(struct temp_file_entry)) !=
+            sizeof(struct temp_file_entry)
+            || entry.tag_length[index_type] >= (long)sizeof(buf))
+        {
+            logf("read fail #e2");
+            goto error;
+        }
+        
+        lseek(tmpfd, entry.tag_offset[index_type], SEEK_CUR);
+        if (read(tmpfd, buf, entry.tag_length[index_type]) !=
+            entry.tag_length[index_type])
+        {
+            logf("read fail #e3");
+            goto error;
+        }
+        
+        if (!extsort_add(i, unique ? -1 : master_entry_count + i, buf))
+            goto error;
+        
+        /* Skip to next. */
+        lseek(tmpfd, entry.data_length - entry.tag_offset[index_type] -
+                entry.tag_length[index_type], SEEK_CUR);
+        do_timed_yield();
+    }
+    
+    if (!extsort_flush_run())
+        goto error;
+    logf("%d runs", extsort.run_count);
+    
+    /* Now the old tags are safe in the runs, rewrite the tag file. */
+    extsort_out.fd = fd;
+    extsort_out.remapfd = open(TAGCACHE_FILE_REMAP, 
+                               O_WRONLY | O_CREAT | O_TRUNC);
+    if (extsort_out.remapfd < 0)
+        goto error;
+    
+    extsort_out.unique = unique;
+    extsort_out.pos = sizeof(struct tagcache_header);
+    extsort_out.count = 0;
+    lseek(fd, extsort_out.pos, SEEK_SET);
+    ftruncate(fd, extsort_out.pos);
+    
+    if (!extsort_merge(extsort_emit_tag))
+    {
+        close(extsort_out.remapfd);
+        goto error;
+    }
+    
+    close(extsort_out.remapfd);
+    close(extsort.fd);
+    extsort_remove(extsort.file);
+    
+    return extsort_out.count;
+    
+error:
+    close(extsort.fd);
+    extsort_remove(extsort.file);
+    return -2;
+}
+
+/* Load the seeks of lookup ids lo..lo+count-1 from the remap file. */
+static bool extsort_load_remap(int remapfd, int32_t *window, 
+                               long lo, long count)
+{
+    int32_t remap[64][2];
+    int i, n;
+    
+    for (i = 0; i < count; i++)
+        window[i] = -1;
+    
+    lseek(remapfd, 0, SEEK_SET);
+    while ( (n = read(remapfd, remap, sizeof(remap))) > 0)
+    {
+        for (i = 0; i < n / (int)sizeof(remap[0]); i++)
+        {
+            if (remap[i][0] >= lo && remap[i][0] < lo + count)
+                window[remap[i][0] - lo] = remap[i][1];
+        }
+        do_timed_yield();
+    }
+    
+    return n == 0;
+}
+
+static long extsort_window_size(void)
+{
+    return tempbuf_size / sizeof(int32_t);
+}
+
+/* Update the tag seeks of the entries already in the master index. */
+static bool extsort_update_master(int index_type, int masterfd,
+                                  int entry_count)
+{
+    struct index_entry idxbuf[IDX_BUF_DEPTH];
+    int32_t seeks[IDX_BUF_DEPTH];
+    int32_t *window = (int32_t *)tempbuf;
+    long window_size = extsort_window_size();
+    long lo;
+    int remapfd, seekfd;
+    int i, j, count;
+    bool ret = false;
+    
+    remapfd = open(TAGCACHE_FILE_REMAP, O_RDONLY);
+    if (remapfd < 0)
+        return false;
+    
+    /* Save the old seeks, since they get updated one window at a time. */
+    seekfd = extsort_open(2);
+    if (seekfd < 0)
+    {
+        close(remapfd);
+        return false;
+    }
+    
+    lseek(masterfd, sizeof(struct master_header), SEEK_SET);
+    for (i = 0; i < entry_count; i += count)
+    {
+        count = MIN(entry_count - i, IDX_BUF_DEPTH);
+        if (ecread(masterfd, idxbuf, count, index_entry_ec, tc_stat.econ)
+            != (int)sizeof(struct index_entry)*count)
+        {
+            logf("read fail #e4");
+            goto exit;
+        }
+        
+        for (j = 0; j < count; j++)
+            seeks[j] = idxbuf[j].tag_seek[index_type];
+        write(seekfd, seeks, count * sizeof(int32_t));
+    }
+    
+    for (lo = commit_entry_count; lo < lookup_buffer_depth; lo += window_size)
+    {
+        if (!extsort_load_remap(remapfd, window, lo, window_size))
+            goto exit;
+        
+        lseek(seekfd, 0, SEEK_SET);
+        lseek(masterfd, sizeof(struct master_header), SEEK_SET);
+        for (i = 0; i < entry_count; i += count)
+        {
+            int loc = lseek(masterfd, 0, SEEK_CUR);
+            
+            count = MIN(entry_count - i, IDX_BUF_DEPTH);
+            if (ecread(masterfd, idxbuf, count, index_entry_ec, tc_stat.econ)
+                != (int)sizeof(struct index_entry)*count
+                || read(seekfd, seeks, count * sizeof(int32_t))
+                != (int)(count * sizeof(int32_t)))
+            {
+                logf("read fail #e5");
+                goto exit;
+            }
+            
+            for (j = 0; j < count; j++)
+            {
+                long id = seeks[j] / TAGFILE_ENTRY_CHUNK_LENGTH
+                    + commit_entry_count;
+                
+                if (idxbuf[j].flag & FLAG_DELETED)
+                    continue;
+                
+                if (id < lo || id >= lo + window_size)
+                    continue;
+                
+                idxbuf[j].tag_seek[index_type] = window[id - lo];
+                if (window[id - lo] < 0)
+                {
+                    logf("update error: %d/%d", idxbuf[j].flag, i+j);
+                    goto exit;
+                }
+            }
+            
+            lseek(masterfd, loc, SEEK_SET);
+            if (ecwrite(masterfd, idxbuf, count, index_entry_ec, tc_stat.econ)
+                != (int)sizeof(struct index_entry)*count)
+            {
+                logf("write fail #e6");
+                goto exit;
+            }
+            do_timed_yield();
+        }
+    }
+    
+    ret = true;
+    
+exit:
+    close(seekfd);
+    extsort_remove(2);
+    close(remapfd);
+    
+    return ret;
+}
+
+/**
+ * Return values:
+ *     > 0   success
+ *    == 0   temporary failure
+ *     < 0   fatal error
+ */
+static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
+{
+    int i;
     struct tagcache_header tch;
     struct master_header   tcmh;
     struct index_entry idxbuf[IDX_BUF_DEPTH];
@@ -2325,6 +3456,11 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     char buf[TAG_MAXLEN+32];
     int fd = -1, masterfd;
     bool error = false;
+    bool external = false;
+    int32_t *remap_window = (int32_t *)tempbuf;
+    long remap_lo = 0, remap_hi = 0;
+    int remapfd = -1;
+    int old_entry_count = 0;
     int init;
     int masterfd_pos;
     
@@ -2391,25 +3527,29 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
      */
     lookup = (struct tempbuf_searchidx **)&tempbuf[tempbuf_pos];
     tempbuf_pos += lookup_buffer_depth * sizeof(void **);
-    memset(lookup, 0, lookup_buffer_depth * sizeof(void **));
     
     /* And calculate the remaining data space used mainly for storing
-     * tag data (strings). */
+     * tag data (strings). If that is not enough, sort on disk. */
     tempbuf_left = tempbuf_size - tempbuf_pos - 8;
     if (tempbuf_left - TAGFILE_ENTRY_AVG_LENGTH * commit_entry_count < 0)
     {
         logf("Buffer way too small!");
-        return 0;
+        if (TAGCACHE_IS_SORTED(index_type))
+            external = true;
     }
+    else
+        memset(lookup, 0, lookup_buffer_depth * sizeof(void **));
 
     if (fd >= 0)
     {
+        old_entry_count = tch.entry_count;
+        
         /**
          * If tag file contains unique tags (sorted index), we will load
          * it entirely into memory so we can resort it later for use with
          * chunked browsing.
          */
-        if (TAGCACHE_IS_SORTED(index_type))
+        if (TAGCACHE_IS_SORTED(index_type) && !external)
         {
             logf("loading tags...");
             for (i = 0; i < tch.entry_count; i++)
@@ -2454,14 +3594,15 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
                                      TAGCACHE_IS_UNIQUE(index_type));
                 if (!ret)
                 {
-                    close(fd);
-                    return -3;
+                    logf("tempbuf full");
+                    external = true;
+                    break;
                 }
                 do_timed_yield();
             }
             logf("done");
         }
-        else
+        else if (!TAGCACHE_IS_SORTED(index_type))
             tempbufidx = tch.entry_count;
     }
     else
@@ -2550,11 +3691,20 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
         }
     }
 
+    /* The first index to be built grows the master file to its final
+     * size, reserve the space for that in one go so it isn't scattered
+     * over the disk. Later indices only update the entries in place. */
+    if (master_prealloc_size > 0)
+    {
+        fpreallocate(masterfd, master_prealloc_size);
+        master_prealloc_size = 0;
+    }
+
     /**
      * Load new unique tags in memory to be sorted later and added
      * to the master lookup file.
      */
-    if (TAGCACHE_IS_SORTED(index_type))
+    if (TAGCACHE_IS_SORTED(index_type) && !external)
     {
         lseek(tmpfd, sizeof(struct tagcache_header), SEEK_SET);
         /* h is the header of the temporary file containing new tags. */
@@ -2589,14 +3739,14 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
             }
             
             if (TAGCACHE_IS_UNIQUE(index_type))
-                error = !tempbuf_insert(buf, i, -1, true);
+                external = !tempbuf_insert(buf, i, -1, true);
             else
-                error = !tempbuf_insert(buf, i, tcmh.tch.entry_count + i, false);
+                external = !tempbuf_insert(buf, i, tcmh.tch.entry_count + i, false);
             
-            if (error)
+            if (external)
             {
-                logf("insert error");
-                goto error_exit;
+                logf("tempbuf full");
+                break;
             }
             
             /* Skip to next. */
@@ -2605,7 +3755,10 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
             do_timed_yield();
         }
         logf("done");
-
+    }
+    
+    if (TAGCACHE_IS_SORTED(index_type) && !external)
+    {
         /* Sort the buffer data and write it to the index file. */
         lseek(fd, sizeof(struct tagcache_header), SEEK_SET);
         /**
@@ -2677,6 +3830,35 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
         }
         logf("done");
     }
+    
+    if (external)
+    {
+        /* The tags didn't fit in tempbuf, sort them on disk. */
+        tempbufidx = extsort_build_tagfile(index_type, h, tmpfd, fd,
+                                           old_entry_count,
+                                           tcmh.tch.entry_count);
+        if (tempbufidx < 0)
+        {
+            error = true;
+            goto error_exit;
+        }
+        logf("sorted %d tags", tempbufidx);
+        
+        logf("updating indices...");
+        if (!extsort_update_master(index_type, masterfd, tcmh.tch.entry_count))
+        {
+            error = true;
+            goto error_exit;
+        }
+        logf("done");
+        
+        remapfd = open(TAGCACHE_FILE_REMAP, O_RDONLY);
+        if (remapfd < 0)
+        {
+            error = true;
+            goto error_exit;
+        }
+    }
 
     /**
      * Walk through the temporary file containing the new tags.
@@ -2758,6 +3940,30 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
                 lseek(tmpfd, entry.data_length - entry.tag_offset[index_type] -
                       entry.tag_length[index_type], SEEK_CUR);
             }
+            else if (external)
+            {
+                /* Locate the entry from the remap file, loading it to
+                 * tempbuf a window at a time. */
+                if (i + j >= remap_hi)
+                {
+                    remap_lo = i + j;
+                    remap_hi = remap_lo + extsort_window_size();
+                    if (!extsort_load_remap(remapfd, remap_window, remap_lo,
+                                            remap_hi - remap_lo))
+                    {
+                        error = true;
+                        break ;
+                    }
+                }
+                
+                idxbuf[j].tag_seek[index_type] = remap_window[i + j - remap_lo];
+                if (idxbuf[j].tag_seek[index_type] < 0)
+                {
+                    logf("entry not found (%d)", j);
+                    error = true;
+                    break ;
+                }
+            }
             else
             {
                 /* Locate the correct entry from the sorted array. */
@@ -2797,6 +4003,11 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     logf("s:%d/%ld/%ld", index_type, tch.datasize, h->datasize);
     error_exit:
     
+    if (remapfd >= 0)
+        close(remapfd);
+    if (external)
+        remove(TAGCACHE_FILE_REMAP);
+    
     close(fd);
     close(masterfd);
 
@@ -2806,6 +4017,157 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     return 1;
 }
 
+/* Process the tag file and add the entries of buckets first..last-1 to
+ * postings, or just count the entries per bucket if postings is NULL. */
+static bool trigram_scan_tagfile(int fd, const struct tagcache_header *tch,
+                                 int32_t *offsets, int32_t *postings,
+                                 int first, int last)
+{
+    static short buckets[TAG_MAXLEN+32];
+    struct tagfile_entry entry;
+    char buf[TAG_MAXLEN+32];
+    long pos = sizeof(struct tagcache_header);
+    int i, j, count;
+    
+    lseek(fd, pos, SEEK_SET);
+    for (i = 0; i < tch->entry_count; i++)
+    {
+        if (ecread(fd, &entry, 1, tagfile_entry_ec, tc_stat.econ)
+            != sizeof(struct tagfile_entry))
+        {
+            logf("read error #t1");
+            return false;
+        }
+        
+        if (entry.tag_length >= (int)sizeof(buf))
+        {
+            logf("too long tag #t2");
+            return false;
+        }
+        
+        if (read(fd, buf, entry.tag_length) != entry.tag_length)
+        {
+            logf("read error #t3");
+            return false;
+        }
+        
+        count = trigram_get_buckets(buf, strlen(buf), buckets);
+        for (j = 0; j < count; j++)
+        {
+            int b = buckets[j];
+            
+            if (postings == NULL)
+                offsets[b]++;
+            else if (b >= first && b < last)
+                postings[offsets[b]++] = pos;
+        }
+        
+        pos += sizeof(struct tagfile_entry) + entry.tag_length;
+        do_timed_yield();
+    }
+    
+    return true;
+}
+
+static bool build_trigram_index(int tag)
+{
+    struct tagcache_header tch;
+    struct trigram_header th;
+    char buf[MAX_PATH];
+    int32_t *offsets, *cursor, *postings;
+    long capacity;
+    int fd, ifd;
+    int i, first, last;
+    
+    snprintf(buf, sizeof buf, TAGCACHE_FILE_TRIGRAM, tag);
+    remove(buf);
+    
+    /* Bucket offsets and fill positions, the rest for the posting list. */
+    offsets = (int32_t *)tempbuf;
+    cursor = &offsets[TRIGRAM_BUCKETS + 1];
+    postings = &cursor[TRIGRAM_BUCKETS];
+    capacity = tempbuf_size / (long)sizeof(int32_t) - 2*TRIGRAM_BUCKETS - 1;
+    if (capacity < TRIGRAM_MAX_CANDIDATES)
+    {
+        logf("too small buffer for trigrams");
+        return false;
+    }
+    
+    fd = open_tag_fd(&tch, tag, false);
+    if (fd < 0)
+        return false;
+    
+    /* First count the postings of every bucket. */
+    memset(offsets, 0, (TRIGRAM_BUCKETS + 1) * sizeof(int32_t));
+    if (!trigram_scan_tagfile(fd, &tch, offsets, NULL, 0, 0))
+    {
+        close(fd);
+        return false;
+    }
+    
+    th.posting_count = 0;
+    for (i = 0; i <= TRIGRAM_BUCKETS; i++)
+    {
+        int32_t n = offsets[i];
+        offsets[i] = th.posting_count;
+        th.posting_count += n;
+    }
+    
+    ifd = open(buf, O_WRONLY | O_CREAT | O_TRUNC);
+    if (ifd < 0)
+    {
+        logf("trigram index open failed");
+        close(fd);
+        return false;
+    }
+    
+    th.magic = TAGCACHE_MAGIC;
+    th.datasize = tch.datasize;
+    th.entry_count = tch.entry_count;
+    ecwrite(ifd, &th, 1, trigram_header_ec, tc_stat.econ);
+    ecwrite(ifd, offsets, TRIGRAM_BUCKETS + 1, "l", tc_stat.econ);
+    
+    /* Then fill as many buckets as fit the buffer at a time, so that
+     * the index file can be written sequentially. */
+    for (first = 0; first < TRIGRAM_BUCKETS; first = last)
+    {
+        for (last = first; last < TRIGRAM_BUCKETS; last++)
+        {
+            if (offsets[last + 1] - offsets[first] > capacity)
+                break;
+        }
+        
+        if (last == first)
+        {
+            logf("trigram bucket too big: %d", first);
+            close(ifd);
+            close(fd);
+            remove(buf);
+            return false;
+        }
+        
+        for (i = first; i < last; i++)
+            cursor[i] = offsets[i] - offsets[first];
+        
+        if (!trigram_scan_tagfile(fd, &tch, cursor, postings, first, last))
+        {
+            close(ifd);
+            close(fd);
+            remove(buf);
+            return false;
+        }
+        
+        ecwrite(ifd, postings, offsets[last] - offsets[first], "l",
+                tc_stat.econ);
+    }
+    
+    logf("trigram index %d: %ld postings", tag, (long)th.posting_count);
+    close(ifd);
+    close(fd);
+    
+    return true;
+}
+
 static bool commit(void)
 {
     struct tagcache_header tch;
@@ -2855,12 +4217,20 @@ static bool commit(void)
     remove(TAGCACHE_STATEFILE);
 #endif
     
+#ifndef __PCTOOL__
+    /* Pending statistics must reach the master index before the commit. */
+    command_queue_sync_callback(NULL);
+#endif
+    
     /* At first be sure to unload the ramcache! */
 #ifdef HAVE_TC_RAMCACHE
     tc_stat.ramcache = false;
 #endif
     
     read_lock++;
+#ifdef HAVE_TC_MMAP
+    unmap_files();
+#endif
     
     /* Try to steal every buffer we can :) */
     if (tempbuf_size == 0)
@@ -2910,6 +4280,17 @@ static bool commit(void)
     tch.datasize = 0;
     tc_stat.commit_delayed = false;
     
+    /* Old and new entries all end up in the master file. */
+    master_prealloc_size = sizeof(struct master_header)
+                           + tch.entry_count * sizeof(struct index_entry);
+    masterfd = open_master_fd(&tcmh, false);
+    if (masterfd >= 0)
+    {
+        master_prealloc_size += tcmh.tch.entry_count
+                                * sizeof(struct index_entry);
+        close(masterfd);
+    }
+    
     for (i = 0; i < TAG_COUNT; i++)
     {
         int ret;
@@ -2944,6 +4325,24 @@ static bool commit(void)
     close(tmpfd);
     remove(TAGCACHE_FILE_TEMP);
     
+    /* The substring indices are optional, failing to build one only
+     * makes searches slower. */
+    for (i = 0; i < TAG_COUNT; i++)
+    {
+        char buf[MAX_PATH];
+        
+        if (!TAGCACHE_IS_TRIGRAM(i))
+            continue;
+        
+        if (trigram_enabled())
+            build_trigram_index(i);
+        else
+        {
+            snprintf(buf, sizeof buf, TAGCACHE_FILE_TRIGRAM, i);
+            remove(buf);
+        }
+    }
+    
     tc_stat.commit_step = 0;
     
     /* Update the master index headers. */
@@ -2998,9 +4397,19 @@ static void allocate_tempbuf(void)
     tempbuf_size = 32*1024*1024;
     tempbuf = malloc(tempbuf_size);
 #else
-    tempbuf = (char *)(((long)audiobuf & ~0x03) + 0x04);
-    tempbuf_size = (long)audiobufend - (long)audiobuf - 4;
-    audiobuf += tempbuf_size;
+    size_t size;
+
+    tempbuf_handle = core_alloc_maximum("tagcache tmp", &size,
+                                        &buflib_pinned_ops);
+    if (tempbuf_handle <= 0)
+    {
+        tempbuf = NULL;
+        tempbuf_size = 0;
+        return;
+    }
+
+    tempbuf = core_get_data(tempbuf_handle);
+    tempbuf_size = size & ~0x03;
 #endif
 }
 
@@ -3012,7 +4421,8 @@ static void free_tempbuf(void)
 #ifdef __PCTOOL__
     free(tempbuf);
 #else
-    audiobuf -= tempbuf_size;
+    core_free(tempbuf_handle);
+    tempbuf_handle = 0;
 #endif
     tempbuf = NULL;
     tempbuf_size = 0;
@@ -3068,6 +4478,209 @@ static bool command_queue_is_full(void)
     return (next == command_queue_ridx);
 }
 
+/* Load the statistics journal left behind by a previous session. */
+static void journal_load(void)
+{
+    struct journal_header jh;
+    struct master_header myhdr;
+    int fd, i, rc;
+    
+    journal_loaded = true;
+    journal_count = 0;
+    memset(journal_filter, 0, sizeof journal_filter);
+    
+    fd = open(TAGCACHE_FILE_JOURNAL, O_RDONLY);
+    if (fd < 0)
+        return ;
+    
+    i = open_master_fd(&myhdr, false);
+    if (i < 0)
+    {
+        close(fd);
+        return ;
+    }
+    close(i);
+    
+    rc = read(fd, &jh, sizeof(struct journal_header));
+    if (rc != sizeof(struct journal_header) || jh.magic != TAGCACHE_MAGIC
+        || jh.commitid != myhdr.commitid)
+    {
+        logf("journal invalid");
+        close(fd);
+        remove(TAGCACHE_FILE_JOURNAL);
+        return ;
+    }
+    
+    /* A torn entry at the end is simply dropped. */
+    rc = read(fd, journal, sizeof journal);
+    close(fd);
+    if (rc < 0)
+        rc = 0;
+    
+    for (i = 0; i < rc / (int)sizeof(struct tagcache_command_entry); i++)
+    {
+        struct tagcache_command_entry *ce = &journal[i];
+        
+        if (ce->command == CMD_UPDATE_MASTER_HEADER)
+        {
+            if (ce->data > current_tcmh.serial)
+                current_tcmh.serial = ce->data;
+        }
+        else if (ce->command != CMD_UPDATE_NUMERIC
+                 || ce->idx_id < 0 || ce->idx_id >= myhdr.tch.entry_count
+                 || ce->tag < 0 || ce->tag >= TAG_COUNT
+                 || !TAGCACHE_IS_NUMERIC(ce->tag))
+        {
+            continue;
+        }
+        
+        journal[journal_count++] = *ce;
+        JOURNAL_FILTER_SET(ce->idx_id);
+    }
+    
+    tc_stat.journal_length = journal_count;
+    logf("journal: %d entries", journal_count);
+}
+
+/**
+ * Write the journal into the master index. Every modified entry is
+ * rewritten only once and in ascending order to keep seeking down.
+ */
+static void journal_replay(int masterfd)
+{
+    struct master_header myhdr;
+    struct index_entry idx;
+    long serial = -1;
+    int last = -1;
+    int i;
+    
+    if (journal_count == 0)
+        return ;
+    
+    logf("replaying journal: %d", journal_count);
+    while (1)
+    {
+        int next = -1;
+        
+        for (i = 0; i < journal_count; i++)
+        {
+            struct tagcache_command_entry *ce = &journal[i];
+            
+            if (ce->command == CMD_UPDATE_MASTER_HEADER)
+            {
+                if (ce->data > serial)
+                    serial = ce->data;
+            }
+            else if (ce->idx_id > last && (next < 0 || ce->idx_id < next))
+                next = ce->idx_id;
+        }
+        
+        if (next < 0)
+            break ;
+        
+        /* get_index() merges all journal entries of the index. */
+        if (get_index(masterfd, next, &idx, false))
+            write_index(masterfd, next, &idx);
+        last = next;
+    }
+    
+    lseek(masterfd, 0, SEEK_SET);
+    if (serial >= 0 && ecread(masterfd, &myhdr, 1, master_header_ec, 
+            tc_stat.econ) == sizeof(struct master_header)
+        && serial > myhdr.serial)
+    {
+        myhdr.serial = serial;
+        lseek(masterfd, 0, SEEK_SET);
+        ecwrite(masterfd, &myhdr, 1, master_header_ec, tc_stat.econ);
+    }
+    
+    journal_count = 0;
+    memset(journal_filter, 0, sizeof journal_filter);
+    tc_stat.journal_length = 0;
+    remove(TAGCACHE_FILE_JOURNAL);
+}
+
+/**
+ * Move the command queue to the journal with a single sequential write
+ * instead of updating the master index all over the place. Returns false
+ * if the journal is full and must be replayed first.
+ */
+static bool journal_spill_queue(void)
+{
+    struct journal_header jh;
+    int first, fd;
+    bool ret = false;
+    
+    mutex_lock(&command_queue_mutex);
+    
+    if (!journal_loaded)
+        journal_load();
+    
+    if (!tc_stat.ready
+        || journal_count + tc_stat.queue_length > TAGCACHE_JOURNAL_LENGTH)
+        goto out;
+    
+    if (journal_count == 0)
+    {
+        fd = open(TAGCACHE_FILE_JOURNAL, O_WRONLY | O_CREAT | O_TRUNC);
+        if (fd < 0)
+            goto out;
+        
+        jh.magic = TAGCACHE_MAGIC;
+        jh.commitid = current_tcmh.commitid;
+        if (write(fd, &jh, sizeof(struct journal_header))
+            != sizeof(struct journal_header))
+        {
+            close(fd);
+            goto out;
+        }
+    }
+    else
+    {
+        fd = open(TAGCACHE_FILE_JOURNAL, O_WRONLY | O_APPEND);
+        if (fd < 0)
+            goto out;
+    }
+    
+    first = journal_count;
+    while (command_queue_ridx != command_queue_widx)
+    {
+        struct tagcache_command_entry *ce = &journal[journal_count++];
+        
+        *ce = command_queue[command_queue_ridx];
+        if (ce->command == CMD_UPDATE_MASTER_HEADER)
+            ce->data = current_tcmh.serial;
+        else
+        {
+            JOURNAL_FILTER_SET(ce->idx_id);
+#ifdef HAVE_TC_RAMCACHE
+            if (tc_stat.ramcache)
+            {
+                hdr->indices[ce->idx_id].tag_seek[ce->tag] = ce->data;
+                hdr->indices[ce->idx_id].flag |= FLAG_DIRTYNUM;
+            }
+#endif
+        }
+        
+        if (++command_queue_ridx >= TAGCACHE_COMMAND_QUEUE_LENGTH)
+            command_queue_ridx = 0;
+    }
+    
+    /* Entries stay in memory even if the write fails, they just won't
+     * survive a crash. */
+    write(fd, &journal[first],
+          (journal_count - first) * sizeof(struct tagcache_command_entry));
+    close(fd);
+    
+    tc_stat.queue_length = 0;
+    tc_stat.journal_length = journal_count;
+    ret = true;
+    
+out:
+    mutex_unlock(&command_queue_mutex);
+    return ret;
+}
+
 static void command_queue_sync_callback(void *data)
 {
     (void)data;
@@ -3076,8 +4689,17 @@ static void command_queue_sync_callback(void *data)
         
     mutex_lock(&command_queue_mutex);
 	
+    if (!journal_loaded)
+        journal_load();
+    
     if ( (masterfd = open_master_fd(&myhdr, true)) < 0)
+    {
+        mutex_unlock(&command_queue_mutex);
         return;
+    }
+    
+    /* Journal entries are older than anything in the queue. */
+    journal_replay(masterfd);
     
     while (command_queue_ridx != command_queue_widx)
     {
@@ -3092,7 +4714,10 @@ static void command_queue_sync_callback(void *data)
                 
                 /* Re-open the masterfd. */
                 if ( (masterfd = open_master_fd(&myhdr, true)) < 0)
+                {
+                    mutex_unlock(&command_queue_mutex);
                     return;
+                }
                 
                 break;
             }
@@ -3115,10 +4740,12 @@ static void command_queue_sync_callback(void *data)
 
 static void run_command_queue(bool force)
 {
-    if (COMMAND_QUEUE_IS_EMPTY)
+    if (COMMAND_QUEUE_IS_EMPTY && journal_count == 0)
         return;
     
-    if (force || command_queue_is_full())
+    /* A full queue goes to the journal which is replayed into the master
+     * index only when the disk spins anyway. */
+    if (force || (command_queue_is_full() && !journal_spill_queue()))
         command_queue_sync_callback(NULL);
     else
         register_storage_idle_func(command_queue_sync_callback);
@@ -3455,6 +5082,8 @@ bool tagcache_create_changelog(struct tagcache_search *tcs)
             return false;
         }
         
+        journal_apply(i, &idx);
+        
         /* Skip until the entry found has been modified. */
         if (! (idx.flag & FLAG_DIRTYNUM) )
             continue;
@@ -3759,11 +5388,8 @@ static bool tagcache_dumpload(void)
         return false;
     }
     
-    /* Check the statefile memory placement */
-    hdr = buffer_alloc(0);
     rc = read(fd, &shdr, sizeof(struct statefile_header));
-    if (rc != sizeof(struct statefile_header)
-        /* || (long)hdr != (long)shdr.hdr */)
+    if (rc != sizeof(struct statefile_header))
     {
         logf("incorrect statefile");
         hdr = NULL;
@@ -3771,10 +5397,10 @@ static bool tagcache_dumpload(void)
         return false;
     }
     
-    offpos = (long)hdr - (long)shdr.hdr;
-    
-    /* Lets allocate real memory and load it */
+    /* Lets allocate real memory and load it, the pointers in it are
+     * relative to where it was when it was saved */
     hdr = buffer_alloc(shdr.tc_stat.ramcache_allocated);
+    offpos = (long)hdr - (long)shdr.hdr;
     rc = read(fd, hdr, shdr.tc_stat.ramcache_allocated);
     close(fd);
     
@@ -3868,6 +5494,8 @@ static bool load_tagcache(void)
             close(fd);
             return false;
         }
+        
+        journal_apply(i, idx);
     
         bytesleft -= sizeof(struct index_entry);
         if (bytesleft < 0 || ((long)idx - (long)hdr->indices) >= tc_stat.ramcache_allocated)
@@ -3931,7 +5559,7 @@ static bool load_tagcache(void)
             if (tag == tag_filename)
             {
 # ifdef HAVE_DIRCACHE
-                const struct dirent *dc;
+                int dc;
 # endif
                 
                 // FIXME: This is wrong!
@@ -3978,8 +5606,8 @@ static bool load_tagcache(void)
 # ifdef HAVE_DIRCACHE
                 if (dircache_is_enabled())
                 {
-                    dc = dircache_get_entry_ptr(buf);
-                    if (dc == NULL)
+                    dc = dircache_get_entry_id(buf);
+                    if (dc < 0)
                     {
                         logf("Entry no longer valid.");
                         logf("-> %s", buf);
@@ -4366,6 +5994,11 @@ static void tagcache_thread(void)
     tc_stat.ready = check_all_headers();
     tc_stat.readyvalid = true;
     
+    /* Statistics journaled before an unclean shutdown get replayed on the
+     * next disk spin. */
+    if (tc_stat.ready && !journal_loaded)
+        journal_load();
+    
     while (1)
     {
         run_command_queue(false);
@@ -4538,6 +6171,9 @@ void tagcache_init(void)
     
 #ifndef __PCTOOL__
     mutex_init(&command_queue_mutex);
+#ifdef HAVE_TC_MMAP
+    mutex_init(&tc_map_mutex);
+#endif
     queue_init(&tagcache_queue, true);
     create_thread(tagcache_thread, tagcache_stack,
                   sizeof(tagcache_stack), 0, tagcache_thread_name 
@@ -70,10 +70,18 @@ enum tag_type { tag_artist = 0, tag_album, tag_genre, tag_title,
 /* Always strict align entries for best performance and binary compatibility. */
 #define TAGCACHE_STRICT_ALIGN 1
 
+/* Number of hash buckets in the substring search index (power of 2). */
+#define TRIGRAM_BUCKETS 4096
+
+/* Max tag entries a substring search can narrow the results down to. */
+#define TRIGRAM_MAX_CANDIDATES 4096
+
 /* Max events in the internal tagcache command queue. */
 #define TAGCACHE_COMMAND_QUEUE_LENGTH 32
 /* Idle time before committing events in the command queue. */
 #define TAGCACHE_COMMAND_QUEUE_COMMIT_DELAY  HZ*2
+/* Max events kept in the statistics journal before forcing a replay. */
+#define TAGCACHE_JOURNAL_LENGTH 256
 
 #define TAGCACHE_MAX_FILTERS 4
 #define TAGCACHE_MAX_CLAUSES 32
@@ -89,6 +97,16 @@ enum tag_type { tag_artist = 0, tag_album, tag_genre, tag_title,
 /* The main database string data. */
 #define TAGCACHE_FILE_INDEX      ROCKBOX_DIR "/database_%d.tcd"
 
+/* Temporary files of the external sort used at commit. */
+#define TAGCACHE_FILE_SORT       ROCKBOX_DIR "/database_sort%d.tmp"
+#define TAGCACHE_FILE_REMAP      ROCKBOX_DIR "/database_remap.tmp"
+
+/* Substring search index of a string tag. */
+#define TAGCACHE_FILE_TRIGRAM    ROCKBOX_DIR "/database_%d.tci"
+
+/* Journal of runtime statistics not yet written to the master index. */
+#define TAGCACHE_FILE_JOURNAL    ROCKBOX_DIR "/database_journal.tcd"
+
 /* ASCII dumpfile of the DB contents. */
 #define TAGCACHE_FILE_CHANGELOG  ROCKBOX_DIR "/database_changelog.txt"
 
@@ -131,6 +149,8 @@ struct tagcache_stat {
     int  progress;           /* Current progress of disk scan */
     int  processed_entries;  /* Scanned disk entries so far */
     int  queue_length;       /* Command queue length */
+    int  journal_length;     /* Statistics journal length */
+    long trigram_size;       /* Disk space used by substring search indices */
     volatile const char 
         *curentry;           /* Path of the current entry being scanned. */
     volatile bool syncscreen;/* Synchronous operation with debug screen? */
@@ -220,6 +240,7 @@ void tagcache_search_finish(struct tagcache_search *tcs);
 long tagcache_get_numeric(const struct tagcache_search *tcs, int tag);
 long tagcache_increase_serial(void);
 long tagcache_get_serial(void);
+long tagcache_get_commitid(void);
 bool tagcache_import_changelog(void);
 bool tagcache_create_changelog(struct tagcache_search *tcs);
 void tagcache_update_numeric(int idx_id, int tag, long data);
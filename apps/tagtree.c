@@ -45,6 +45,7 @@
 #include "keyboard.h"
 #include "gui/list.h"
 #include "buffer.h"
+#include "core_alloc.h"
 #include "yesno.h"
 #include "misc.h"
 #include "filetypes.h"
@@ -52,6 +53,7 @@
 #include "appevents.h"
 #include "storage.h"
 #include "dir_uncached.h"
+#include "crc32.h"
 
 #define FILE_SEARCH_INSTRUCTIONS ROCKBOX_DIR "/tagnavi.config"
 
@@ -98,6 +100,15 @@ static long *uniqbuf;
 #define MAX_TAGS 5
 #define MAX_MENU_ID_SIZE 32
 
+/* Cache for materialized result sets, so that entering or leaving a
+ * level that was just visited doesn't need to run the search again. */
+#if MEMORYSIZE > 2
+#define RESULTCACHE_SIZE  (128*1024)
+#else
+#define RESULTCACHE_SIZE  (16*1024)
+#endif
+#define RESULTCACHE_SLOTS 8
+
 static bool sort_inverse;
 
 /*
@@ -168,6 +179,46 @@ static int current_entry_count;
 
 static struct tree_context *tc;
 
+struct resultcache_key {
+    struct search_instruction *si;
+    int table;
+    int level;
+    int seek[MAX_TAGS];
+    unsigned clause_crc;
+};
+
+struct resultcache_slot {
+    struct resultcache_key key;
+    long offset;          /* Position of the data in resultcache_buf */
+    long size;
+    int entry_count;      /* Entries in the buffer (current_entry_count) */
+    int total_count;      /* Value returned by retrieve_entries() */
+    unsigned long used;   /* LRU stamp */
+};
+
+/* Slots are kept in the same order as their data in the buffer, so
+ * evicting one only needs to move the data behind it down. The buffer is
+ * a movable core allocation, only offsets into it are kept. */
+static unsigned char *resultcache_buf;
+static long resultcache_buf_used;
+static struct resultcache_slot resultcache[RESULTCACHE_SLOTS];
+static int resultcache_count;
+static unsigned long resultcache_stamp;
+static long resultcache_serial;
+static long resultcache_commitid;
+
+static int resultcache_move_callback(int handle, void *current, void *new)
+{
+    (void)handle;
+    (void)current;
+    resultcache_buf = new;
+    return BUFLIB_CB_OK;
+}
+
+static struct buflib_callbacks resultcache_ops = {
+    resultcache_move_callback, NULL
+};
+
 static int get_token_str(char *buf, int size)
 {
     /* Find the start. */
@@ -926,6 +977,8 @@ static bool parse_menu(const char *filename)
 
 void tagtree_init(void)
 {
+    int handle;
+
     format_count = 0;
     menu_count = 0;
     menu = NULL;
@@ -938,6 +991,10 @@ void tagtree_init(void)
         rootmenu = 0;
     
     uniqbuf = buffer_alloc(UNIQBUF_SIZE);
+    handle = core_alloc_ex("tagtree cache", RESULTCACHE_SIZE,
+                           &resultcache_ops);
+    if (handle > 0)
+        resultcache_buf = core_get_data(handle);
 
     add_event(PLAYBACK_EVENT_TRACK_BUFFER, false, tagtree_buffer_event);
     add_event(PLAYBACK_EVENT_TRACK_FINISH, false, tagtree_track_finish_event);
@@ -1047,8 +1104,191 @@ static int format_str(struct tagcache_search *tcs, struct display_format *fmt,
     return 0;
 }
 
+static void resultcache_invalidate(void)
+{
+    resultcache_count = 0;
+    resultcache_buf_used = 0;
+    resultcache_serial = tagcache_get_serial();
+    resultcache_commitid = tagcache_get_commitid();
+}
+
+static void resultcache_remove(int slot)
+{
+    struct resultcache_slot *s = &resultcache[slot];
+    long end = s->offset + s->size;
+    long size = s->size;
+    int i;
+    
+    /* Compact the buffer by moving the following sets down. */
+    memmove(&resultcache_buf[s->offset], &resultcache_buf[end],
+            resultcache_buf_used - end);
+    resultcache_buf_used -= size;
+    
+    for (i = slot; i < resultcache_count - 1; i++)
+    {
+        resultcache[i] = resultcache[i+1];
+        resultcache[i].offset -= size;
+    }
+    resultcache_count--;
+}
+
+static void resultcache_make_key(struct resultcache_key *key,
+                                 struct tree_context *c, int level)
+{
+    unsigned crc = 0xffffffff;
+    int i, j;
+    
+    memset(key, 0, sizeof(struct resultcache_key));
+    key->si = csi;
+    key->table = c->currtable;
+    key->level = c->currextra;
+    
+    for (i = 0; i < level; i++)
+        key->seek[i] = csi->result_seek[i];
+    
+    /* Clauses may have been filled at runtime from keyboard input or
+     * from the current track, so their contents are part of the key. */
+    for (i = 0; i <= level; i++)
+    {
+        for (j = 0; j < csi->clause_count[i]; j++)
+        {
+            struct tagcache_search_clause *clause = csi->clause[i][j];
+            
+            crc = crc_32(&clause->numeric_data, sizeof(long), crc);
+            if (clause->str)
+                crc = crc_32(clause->str, strlen(clause->str), crc);
+        }
+    }
+    key->clause_crc = crc;
+}
+
+static int resultcache_find(const struct resultcache_key *key)
+{
+    struct tagcache_stat *stat = tagcache_get_stat();
+    int i;
+    
+    /* Any statistics update or commit may change the results. */
+    if (stat->commit_step > 0 || !stat->ready
+        || resultcache_serial != tagcache_get_serial()
+        || resultcache_commitid != tagcache_get_commitid())
+    {
+        resultcache_invalidate();
+        return -1;
+    }
+    
+    for (i = 0; i < resultcache_count; i++)
+    {
+        if (!memcmp(&resultcache[i].key, key, sizeof(struct resultcache_key)))
+            return i;
+    }
+    
+    return -1;
+}
+
+/* Fill the tree buffers from the cache. Returns the number of entries
+ * as retrieve_entries() would, or -1 if the set is not cached. */
+static int resultcache_load(struct tree_context *c,
+                            const struct resultcache_key *key)
+{
+    struct resultcache_slot *s;
+    struct tagentry *src, *dptr = (struct tagentry *)c->dircache;
+    char *names;
+    int slot = resultcache_find(key);
+    int i;
+    
+    if (slot < 0)
+        return -1;
+    
+    s = &resultcache[slot];
+    src = (struct tagentry *)&resultcache_buf[s->offset];
+    names = (char *)&src[s->entry_count];
+    
+    if (s->entry_count > global_settings.max_files_in_dir
+        || s->size - s->entry_count * (long)sizeof(struct tagentry)
+           > c->name_buffer_size)
+    {
+        return -1;
+    }
+    
+    memcpy(c->name_buffer, names,
+           s->size - s->entry_count * sizeof(struct tagentry));
+    for (i = 0; i < s->entry_count; i++, dptr++, src++)
+    {
+        dptr->newtable = src->newtable;
+        dptr->extraseek = src->extraseek;
+        dptr->name = &c->name_buffer[(intptr_t)src->name];
+    }
+    
+    s->used = ++resultcache_stamp;
+    current_offset = 0;
+    current_entry_count = s->entry_count;
+    c->dirfull = false;
+    
+    logf("resultcache hit: %d", s->total_count);
+    return s->total_count;
+}
+
+static void resultcache_store(struct tree_context *c,
+                              const struct resultcache_key *key,
+                              int total_count)
+{
+    struct resultcache_slot *s;
+    struct tagentry *dst, *dptr = (struct tagentry *)c->dircache;
+    long names_size = 0;
+    long size;
+    char *names;
+    int i;
+    
+    if (resultcache_buf == NULL || resultcache_find(key) >= 0)
+        return;
+    
+    for (i = 0; i < current_entry_count; i++)
+        names_size += strlen(dptr[i].name) + 1;
+    
+    size = ALIGN_UP(current_entry_count * sizeof(struct tagentry)
+                    + names_size, sizeof(long));
+    if (size > RESULTCACHE_SIZE || names_size > c->name_buffer_size)
+        return;
+    
+    /* Evict the least recently used sets until the new one fits. */
+    while (resultcache_count >= RESULTCACHE_SLOTS
+           || resultcache_buf_used + size > RESULTCACHE_SIZE)
+    {
+        int lru = 0;
+        
+        for (i = 1; i < resultcache_count; i++)
+        {
+            if (resultcache[i].used < resultcache[lru].used)
+                lru = i;
+        }
+        resultcache_remove(lru);
+    }
+    
+    s = &resultcache[resultcache_count++];
+    s->key = *key;
+    s->offset = resultcache_buf_used;
+    s->size = size;
+    s->entry_count = current_entry_count;
+    s->total_count = total_count;
+    s->used = ++resultcache_stamp;
+    resultcache_buf_used += size;
+    
+    dst = (struct tagentry *)&resultcache_buf[s->offset];
+    names = (char *)&dst[current_entry_count];
+    names_size = 0;
+    for (i = 0; i < current_entry_count; i++, dptr++, dst++)
+    {
+        dst->newtable = dptr->newtable;
+        dst->extraseek = dptr->extraseek;
+        dst->name = (char *)(intptr_t)names_size;
+        strcpy(&names[names_size], dptr->name);
+        names_size += strlen(dptr->name) + 1;
+    }
+}
+
 static int retrieve_entries(struct tree_context *c, int offset, bool init)
 {
+    struct resultcache_key cache_key;
     struct tagcache_search tcs;
     struct tagentry *dptr = (struct tagentry *)c->dircache;
     struct display_format *fmt;
@@ -1059,6 +1299,7 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
     int level = c->currextra;
     int tag;
     bool sort = false;
+    bool aborted = false;
     int sort_limit;
     int strip;
 
@@ -1080,6 +1321,15 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
     else
         tag = csi->tagorder[level];
 
+    if (init && offset == 0)
+    {
+        resultcache_make_key(&cache_key, c, level);
+        total_count = resultcache_load(c, &cache_key);
+        if (total_count >= 0)
+            return total_count;
+        total_count = 0;
+    }
+
     if (!tagcache_search(&tcs, tag))
         return -1;
     
@@ -1265,7 +1515,10 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
         if (!tcs.ramsearch)
         {
             if (!show_search_progress(false, total_count))
+            {
+                aborted = true;
                 break;
+            }
         }
         total_count++;
     }
@@ -1296,6 +1549,11 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
         }
     }
     
+    /* Don't cache while statistics updates are still pending. */
+    if (init && offset == 0 && !c->dirfull && !aborted
+        && !tagcache_get_stat()->queue_length)
+        resultcache_store(c, &cache_key, total_count);
+    
     return total_count;
     
 }
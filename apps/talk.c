@@ -599,6 +599,10 @@ int talk_id(int32_t id, bool enqueue)
         return -1;
 #endif
 
+    /* the core allocator may have taken the start of the buffer since */
+    if (p_voicefile != NULL && (unsigned char *)p_voicefile != audiobuf)
+        talk_buffer_steal();
+
     if (p_voicefile == NULL && has_voicefile)
         load_voicefile(); /* reload needed */
 
@@ -1173,10 +1173,7 @@ void tree_flush(void)
         {
             if (!dircache_is_initializing())
                 global_status.dircache_size = dircache_get_cache_size();
-# ifdef HAVE_EEPROM_SETTINGS
-            if (firmware_settings.initialized)
-                dircache_save();
-# endif
+            dircache_save();
             dircache_disable();
         }
         else
@@ -1201,7 +1198,8 @@ void tree_restore(void)
     
 #ifdef HAVE_DIRCACHE
     remove(DIRCACHE_FILE);
-    if (global_settings.dircache)
+    /* Keep using the cache from before and only rescan what has changed. */
+    if (global_settings.dircache && dircache_resume() < 0)
     {
         /* Print "Scanning disk..." to the display. */
         splash(0, str(LANG_SCANNING_DISK));
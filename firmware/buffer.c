@@ -20,6 +20,8 @@
  ****************************************************************************/
 #include <stdio.h>
 #include "buffer.h"
+#include "core_alloc.h"
+#include "panic.h"
 
 #ifdef SIMULATOR
 unsigned char audiobuffer[(MEM*1024-256)*1024];
@@ -35,16 +37,17 @@ void buffer_init(void)
 {
     /* 32-bit aligned */
     audiobuf = (void *)(((unsigned long)audiobuffer + 3) & ~3);
+    core_allocator_init();
 }
 
+/* Memory from buffer_alloc() is used through the pointer it returns and is
+   never given back */
 void *buffer_alloc(size_t size)
 {
-    void *retval = audiobuf;
-    
-    audiobuf += size;
-    /* 32-bit aligned */
-    audiobuf = (void *)(((unsigned long)audiobuf + 3) & ~3);
-    
+    void *retval = core_alloc_permanent(size);
+
+    if (!retval)
+        panicf("buffer_alloc: out of memory (%lu)", (unsigned long)size);
+
     return retval;
 }
-
@@ -23,6 +23,9 @@
 *
 ****************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+#include "system.h"
 #include "buflib.h"
 
 /* The main goal of this design is fast fetching of the pointer for a handle.
@@ -32,14 +35,23 @@
  * to be moved to free space, allocations grow up in address from the start of
  * the buffer. The buffer is treated as an array of union buflib_data. Blocks
  * start with a length marker, which is included in their length. Free blocks
- * are marked by negative length, allocated ones use the second buflib_data in
- * the block to store a pointer to their handle table entry, so that it can be
- * quickly found and updated during compaction. The allocator functions are
- * passed a context struct so that two allocators can be run, for example, one
- * per core may be used, with convenience wrappers for the single-allocator
- * case that use a predefined context.
+ * are marked by negative length. Allocated ones store a pointer to their
+ * handle table entry, so that it can be quickly found and updated during
+ * compaction, followed by their callbacks and name.
+ *
+ * Callbacks let blocks holding raw pointers be fixed up or pinned when moved.
+ * buflib_resize() lets the core allocator give the unused end of its buffer
+ * back to the audio buffer. The plugin library is built from this file too.
  */
 
+/* Length, handle, callbacks, name */
+#define BUFLIB_HEADER 4
+
+#define B_TO_UNITS(b) \
+    (((b) + sizeof(union buflib_data) - 1) / sizeof(union buflib_data))
+
+struct buflib_callbacks buflib_pinned_ops = { NULL, NULL };
+
 /* Initialize buffer manager */
 void
 buflib_init(struct buflib_context *ctx, void *buf, size_t size)
@@ -113,22 +125,50 @@ handle_table_shrink(struct buflib_context *ctx)
 {
     bool rv;
     union buflib_data *handle;
-    for (handle = ctx->last_handle; !(handle->ptr); handle++);
+    for (handle = ctx->last_handle;
+         handle < ctx->handle_table && !(handle->ptr); handle++);
     if (handle > ctx->first_free_handle)
         ctx->first_free_handle = handle - 1;
-    rv = handle == ctx->last_handle;
+    rv = handle != ctx->last_handle;
     ctx->last_handle = handle;
     return rv;
 }
 
-/* Compact allocations and handle table, adjusting handle pointers as needed.
- * Return true if any space was freed or consolidated, false otherwise.
+/* Moves a block down by shift units, unless its owner wants it to stay.
+ * Returns true if it was moved.
  */
 static bool
+move_block(struct buflib_context *ctx, union buflib_data *block, int shift)
+{
+    union buflib_data *new_block = block + shift;
+    struct buflib_callbacks *ops = block[2].ops;
+
+    if (ops)
+    {
+        int handle = ctx->handle_table - block[1].ptr;
+
+        if (!ops->move_callback ||
+            ops->move_callback(handle, block + BUFLIB_HEADER,
+                               new_block + BUFLIB_HEADER) != BUFLIB_CB_OK)
+            return false;
+    }
+
+    block[1].ptr->ptr = new_block + BUFLIB_HEADER;
+    memmove(new_block, block, block->val * sizeof(union buflib_data));
+    return true;
+}
+
+/* Compact allocations and handle table, adjusting handle pointers as needed.
+ * Blocks that can't be moved stay where they are, with the space before them
+ * left as a free block. Return true if any space was freed or consolidated,
+ * false otherwise.
+ */
+bool
 buflib_compact(struct buflib_context *ctx)
 {
-    union buflib_data *block = ctx->first_free_block, *new_block;
+    union buflib_data *block = ctx->first_free_block, *hole = NULL;
     int shift = 0, len;
+    bool moved = false;
     /* Store the results of attempting to shrink the handle table */
     bool ret = handle_table_shrink(ctx);
     for(; block != ctx->alloc_end; block += len)
@@ -142,82 +182,85 @@ buflib_compact(struct buflib_context *ctx)
             continue;
         }
         /* If shift is non-zero, it represents the number of places to move
-         * blocks down in memory. Calculate the new address for this block,
-         * update its entry in the handle table, and then move its contents.
+         * blocks down in memory. Move the block, or if its owner doesn't let
+         * it move, mark the space before it as free and start over after it.
          */
         if (shift)
         {
-            new_block = block + shift;
-            block[1].ptr->ptr = new_block + 2;
-            rb->memmove(new_block, block, len * sizeof(union buflib_data));
+            if (move_block(ctx, block, shift))
+                moved = true;
+            else
+            {
+                block[shift].val = shift;
+                if (!hole)
+                    hole = block + shift;
+                shift = 0;
+            }
         }
     }
     /* Move the end-of-allocation mark, and return true if any new space has
      * been freed.
      */
     ctx->alloc_end += shift;
-    ctx->first_free_block = ctx->alloc_end;
-    ctx->compact = true;
-    return ret || shift;
+    ctx->first_free_block = hole ? hole : ctx->alloc_end;
+    /* Pinned blocks may agree to move on the next try */
+    ctx->compact = hole == NULL;
+    return ret || moved || shift;
 }
 
-/* Shift buffered items by size units, and update handle pointers. The shift
- * value must be determined to be safe *before* calling.
+/* Asks the owners of shrinkable allocations to give back memory, returning
+ * true if any did.
  */
-static void
-buflib_buffer_shift(struct buflib_context *ctx, int shift)
+static bool
+buflib_shrink_others(struct buflib_context *ctx, size_t wanted)
 {
-    rb->memmove(ctx->buf_start + shift, ctx->buf_start,
-        (ctx->alloc_end - ctx->buf_start) * sizeof(union buflib_data));
-    union buflib_data *ptr;
-    for (ptr = ctx->last_handle; ptr < ctx->handle_table; ptr++)
-        if (ptr->ptr)
-            ptr->ptr += shift;
-    ctx->first_free_block += shift;
-    ctx->buf_start += shift;
-    ctx->alloc_end += shift;
-}
+    union buflib_data *block;
+    bool ret = false;
 
-/* Shift buffered items up by size bytes, or as many as possible if size == 0.
- * Set size to the number of bytes freed.
- */
-void*
-buflib_buffer_out(struct buflib_context *ctx, size_t *size)
-{
-    if (!ctx->compact)
-        buflib_compact(ctx);
-    size_t avail = ctx->last_handle - ctx->alloc_end;
-    size_t avail_b = avail * sizeof(union buflib_data);
-    if (*size && *size < avail_b)
+    for (block = ctx->buf_start; block < ctx->alloc_end; block += ABS(block->val))
     {
-        avail = (*size + sizeof(union buflib_data) - 1)
-            / sizeof(union buflib_data);
-        avail_b = avail * sizeof(union buflib_data);
+        struct buflib_callbacks *ops;
+        int len = block->val;
+
+        if (len < 0)
+            continue;
+
+        ops = block[2].ops;
+        if (ops && ops->shrink_callback &&
+            ops->shrink_callback(ctx->handle_table - block[1].ptr, wanted,
+                                 block + BUFLIB_HEADER,
+                                 (len - BUFLIB_HEADER) *
+                                    sizeof(union buflib_data)) == BUFLIB_CB_OK)
+        {
+            ret = true;
+        }
     }
-    *size = avail_b;
-    void *ret = ctx->buf_start;
-    buflib_buffer_shift(ctx, avail);
+
     return ret;
 }
 
-/* Shift buffered items down by size bytes */
-void
-buflib_buffer_in(struct buflib_context *ctx, int size)
+/* Allocate a buffer of size bytes, returning a handle for it. The block
+ * may be moved at any time by compaction.
+ */
+int
+buflib_alloc(struct buflib_context *ctx, size_t size)
 {
-    size /= sizeof(union buflib_data);
-    buflib_buffer_shift(ctx, -size);
+    return buflib_alloc_ex(ctx, size, "<anonymous>", NULL);
 }
 
-/* Allocate a buffer of size bytes, returning a handle for it */
+/* Allocate a buffer of size bytes with the given name and callbacks,
+ * returning a handle for it or 0 if there is no room
+ */
 int
-buflib_alloc(struct buflib_context *ctx, size_t size)
+buflib_alloc_ex(struct buflib_context *ctx, size_t size, const char *name,
+                struct buflib_callbacks *ops)
 {
     union buflib_data *handle, *block;
-    bool last = false;
+    bool last;
+    bool shrunk = false;
     /* This really is assigned a value before use */
     int block_len;
-    size = (size + sizeof(union buflib_data) - 1) /
-           sizeof(union buflib_data) + 2;
+    size = B_TO_UNITS(size) + BUFLIB_HEADER;
 handle_alloc:
     handle = handle_alloc(ctx);
     if (!handle)
@@ -232,6 +275,7 @@ handle_alloc:
     }
 
 buffer_alloc:
+    last = false;
     for (block = ctx->first_free_block;; block += block_len)
     {
         /* If the last used block extends all the way to the handle table, the
@@ -253,7 +297,7 @@ buffer_alloc:
         if(block_len > 0)
             continue;
         block_len = -block_len;
-        /* The search is first-fit, any fragmentation this causes will be 
+        /* The search is first-fit, any fragmentation this causes will be
          * handled at compaction.
          */
         if ((size_t)block_len >= size)
@@ -263,16 +307,29 @@ buffer_alloc:
     {
         /* Try compacting if allocation failed, but only if the handle
          * allocation did not trigger compaction already, since there will
-         * be no further gain.
+         * be no further gain. After that, ask the owners of other blocks to
+         * shrink them, once.
          */
         if (!ctx->compact && buflib_compact(ctx))
         {
             goto buffer_alloc;
-        } else {
-            handle->val=1;
-            handle_free(ctx, handle);
-            return 0;
         }
+        else if (!shrunk)
+        {
+            int wanted = size - (ctx->last_handle - ctx->alloc_end);
+
+            shrunk = true;
+            if (wanted <= 0)
+                wanted = size;
+            if (buflib_shrink_others(ctx, wanted * sizeof(union buflib_data)))
+            {
+                buflib_compact(ctx);
+                goto buffer_alloc;
+            }
+        }
+        handle->val=1;
+        handle_free(ctx, handle);
+        return 0;
     }
 
     /* Set up the allocated block, by marking the size allocated, and storing
@@ -280,7 +337,9 @@ buffer_alloc:
      */
     block->val = size;
     block[1].ptr = handle;
-    handle->ptr = block + 2;
+    block[2].ops = ops;
+    block[3].name = name;
+    handle->ptr = block + BUFLIB_HEADER;
     /* If we have just taken the first free block, the next allocation search
      * can save some time by starting after this block.
      */
@@ -297,12 +356,37 @@ buffer_alloc:
     return ctx->handle_table - handle;
 }
 
+/* Allocate all the space left after compaction, setting size to the number
+ * of bytes allocated. Usually followed by buflib_shrink() once the real size
+ * is known.
+ */
+int
+buflib_alloc_maximum(struct buflib_context *ctx, const char *name,
+                     size_t *size, struct buflib_callbacks *ops)
+{
+    int avail;
+
+    if (!ctx->compact)
+        buflib_compact(ctx);
+
+    /* Leave a unit for the handle in case the table has to grow */
+    avail = ctx->last_handle - ctx->alloc_end - 1 - BUFLIB_HEADER;
+    if (avail <= 0)
+    {
+        *size = 0;
+        return 0;
+    }
+
+    *size = avail * sizeof(union buflib_data);
+    return buflib_alloc_ex(ctx, *size, name, ops);
+}
+
 /* Free the buffer associated with handle_num. */
 void
 buflib_free(struct buflib_context *ctx, int handle_num)
 {
     union buflib_data *handle = ctx->handle_table - handle_num,
-                      *freed_block = handle->ptr - 2,
+                      *freed_block = handle->ptr - BUFLIB_HEADER,
                       *block = ctx->first_free_block,
                       *next_block = block;
     /* We need to find the block before the current one, to see if it is free
@@ -328,17 +412,21 @@ buflib_free(struct buflib_context *ctx, int handle_num)
         block->val = -block->val;
     }
     next_block = block - block->val;
-    /* Check if we are merging with the free space at alloc_end. */
-    if (next_block == ctx->alloc_end)
-        ctx->alloc_end = block;
-    /* Otherwise, the next block might still be a "normal" free block, and the
+    /* The next block might still be a "normal" free block, and the
      * mid-allocation free means that the buffer is no longer compact.
      */
-    else {
-        ctx->compact = false;
+    if (next_block != ctx->alloc_end)
+    {
         if (next_block->val < 0)
+        {
             block->val += next_block->val;
+            next_block = block - block->val;
+        }
+        ctx->compact = false;
     }
+    /* Check if we are merging with the free space at alloc_end. */
+    if (next_block == ctx->alloc_end)
+        ctx->alloc_end = block;
     handle_free(ctx, handle);
     handle->ptr = NULL;
     /* If this block is before first_free_block, it becomes the new starting
@@ -347,3 +435,217 @@ buflib_free(struct buflib_context *ctx, int handle_num)
     if (block < ctx->first_free_block)
         ctx->first_free_block = block;
 }
+
+/* Gives back the end of an allocation, keeping its first new_size bytes.
+ * Returns false if new_size is larger than the allocation.
+ */
+bool
+buflib_shrink(struct buflib_context *ctx, int handle, size_t new_size)
+{
+    union buflib_data *block = ctx->handle_table[-handle].ptr - BUFLIB_HEADER;
+    union buflib_data *freed, *next;
+    intptr_t new_len = B_TO_UNITS(new_size) + BUFLIB_HEADER;
+    intptr_t old_len = block->val;
+
+    if (new_len > old_len)
+        return false;
+    if (new_len == old_len)
+        return true;
+
+    block->val = new_len;
+    freed = block + new_len;
+    next = block + old_len;
+
+    if (next != ctx->alloc_end)
+    {
+        freed->val = new_len - old_len;
+        if (next->val < 0)
+        {
+            freed->val += next->val;
+            next = freed - freed->val;
+        }
+        ctx->compact = false;
+    }
+
+    if (next == ctx->alloc_end)
+        ctx->alloc_end = freed;
+    /* After buflib_alloc_maximum() this was past the new alloc_end */
+    if (freed < ctx->first_free_block)
+        ctx->first_free_block = freed;
+
+    return true;
+}
+
+/* Makes the last allocation bigger, from the free space at the end of the
+ * buffer. Returns false if another block follows it or there is no room.
+ */
+bool
+buflib_extend(struct buflib_context *ctx, int handle, size_t new_size)
+{
+    union buflib_data *block = ctx->handle_table[-handle].ptr - BUFLIB_HEADER;
+    intptr_t new_len = B_TO_UNITS(new_size) + BUFLIB_HEADER;
+
+    if (block + block->val != ctx->alloc_end)
+        return false;
+    if (new_len <= block->val)
+        return true;
+    if (block + new_len > ctx->last_handle)
+        return false;
+
+    if (ctx->first_free_block == ctx->alloc_end)
+        ctx->first_free_block = block + new_len;
+    ctx->alloc_end = block + new_len;
+    block->val = new_len;
+    return true;
+}
+
+/* Free bytes, counting all free blocks and the space at the end */
+size_t
+buflib_available(struct buflib_context *ctx)
+{
+    union buflib_data *block;
+    size_t free = ctx->last_handle - ctx->alloc_end;
+
+    for (block = ctx->first_free_block; block < ctx->alloc_end;
+         block += ABS(block->val))
+    {
+        if (block->val < 0)
+            free -= block->val;
+    }
+
+    return free * sizeof(union buflib_data);
+}
+
+size_t
+buflib_used(struct buflib_context *ctx)
+{
+    return ((ctx->alloc_end - ctx->buf_start) +
+            (ctx->handle_table - ctx->last_handle)) *
+           sizeof(union buflib_data);
+}
+
+size_t
+buflib_resize(struct buflib_context *ctx, size_t size)
+{
+    union buflib_data *new_table = ctx->buf_start + size /
+                                   sizeof(union buflib_data);
+    union buflib_data *block;
+    int shift;
+
+    if (new_table < ctx->handle_table)
+    {
+        union buflib_data *min;
+
+        if (!ctx->compact)
+            buflib_compact(ctx);
+        handle_table_shrink(ctx);
+
+        min = ctx->alloc_end + (ctx->handle_table - ctx->last_handle);
+        if (new_table < min)
+            new_table = min;
+    }
+
+    shift = new_table - ctx->handle_table;
+    if (shift)
+    {
+        memmove(ctx->last_handle + shift, ctx->last_handle,
+                (ctx->handle_table - ctx->last_handle) *
+                    sizeof(union buflib_data));
+
+        /* Blocks point back at their handles */
+        for (block = ctx->buf_start; block < ctx->alloc_end;
+             block += ABS(block->val))
+        {
+            if (block->val > 0)
+                block[1].ptr += shift;
+        }
+
+        ctx->handle_table += shift;
+        ctx->last_handle += shift;
+        ctx->first_free_handle += shift;
+    }
+
+    return (ctx->handle_table - ctx->buf_start) * sizeof(union buflib_data);
+}
+
+/* Shift buffered items by size units, and update handle pointers. The shift
+ * value must be determined to be safe *before* calling. The blocks are moved
+ * without asking their callbacks, so this is only for contexts whose blocks
+ * all move freely.
+ */
+static void
+buflib_buffer_shift(struct buflib_context *ctx, int shift)
+{
+    union buflib_data *ptr;
+
+    memmove(ctx->buf_start + shift, ctx->buf_start,
+        (ctx->alloc_end - ctx->buf_start) * sizeof(union buflib_data));
+    for (ptr = ctx->last_handle; ptr < ctx->handle_table; ptr++)
+        if (ptr->ptr)
+            ptr->ptr += shift;
+    ctx->first_free_block += shift;
+    ctx->buf_start += shift;
+    ctx->alloc_end += shift;
+}
+
+/* Shift buffered items up by size bytes, or as many as possible if size == 0.
+ * Set size to the number of bytes freed.
+ */
+void*
+buflib_buffer_out(struct buflib_context *ctx, size_t *size)
+{
+    size_t avail, avail_b;
+    void *ret;
+
+    if (!ctx->compact)
+        buflib_compact(ctx);
+    avail = ctx->last_handle - ctx->alloc_end;
+    avail_b = avail * sizeof(union buflib_data);
+    if (*size && *size < avail_b)
+    {
+        avail = B_TO_UNITS(*size);
+        avail_b = avail * sizeof(union buflib_data);
+    }
+    *size = avail_b;
+    ret = ctx->buf_start;
+    buflib_buffer_shift(ctx, avail);
+    return ret;
+}
+
+/* Shift buffered items down by size bytes */
+void
+buflib_buffer_in(struct buflib_context *ctx, int size)
+{
+    size /= sizeof(union buflib_data);
+    buflib_buffer_shift(ctx, -size);
+}
+
+const char *
+buflib_get_name(struct buflib_context *ctx, int handle)
+{
+    union buflib_data *block = ctx->handle_table[-handle].ptr - BUFLIB_HEADER;
+    return block[3].name;
+}
+
+size_t
+buflib_get_size(struct buflib_context *ctx, int handle)
+{
+    union buflib_data *block = ctx->handle_table[-handle].ptr - BUFLIB_HEADER;
+    return (block->val - BUFLIB_HEADER) * sizeof(union buflib_data);
+}
+
+int
+buflib_get_next_handle(struct buflib_context *ctx, int handle)
+{
+    int last = ctx->handle_table - ctx->last_handle;
+
+    /* Skip free entries and those reserved by a running allocation */
+    while (++handle <= last)
+    {
+        union buflib_data *h = ctx->handle_table - handle;
+        if (h->ptr && h->val != -1)
+            return handle;
+    }
+
+    return 0;
+}
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include "debug.h"
@@ -39,7 +40,9 @@
 #include "usb.h"
 #include "file.h"
 #include "buffer.h"
+#include "core_alloc.h"
 #include "dir.h"
+#include "crc32.h"
 #if CONFIG_RTC
 #include "time.h"
 #include "timefuncs.h"
@@ -48,6 +51,17 @@
 /* Queue commands. */
 #define DIRCACHE_BUILD 1
 #define DIRCACHE_STOP  2
+#define DIRCACHE_VALIDATE 3
+
+/* Marks the entries found on disk while a directory is resynced. */
+#define DIRCACHE_FLAG_SEEN 0x01
+
+/* Set in dircache_node.name once the entry has been removed. The name
+ * is kept for paths that are still referenced by their entry ID. */
+#define DIRCACHE_NODE_REMOVED 0x80000000
+
+/* Entry 0 means no entry, the root directory is entry 1. */
+#define DIRCACHE_ROOT 1
 
 #if ((defined(MEMORYSIZE) && (MEMORYSIZE > 8)) || MEM > 8)
 #define MAX_OPEN_DIRS 12
@@ -56,20 +70,29 @@
 #endif
 static DIR_CACHED opendirs[MAX_OPEN_DIRS];
 
-static struct dircache_entry *fd_bindings[MAX_OPEN_FILES];
-static struct dircache_entry *dircache_root;
-#ifdef HAVE_MULTIVOLUME
-static struct dircache_entry *append_position;
-#endif
+static uint32_t fd_bindings[MAX_OPEN_FILES];
+
+/* The cache buffer holds the entry blocks growing upwards from the start
+ * and the name pool growing downwards from names_top, followed by the
+ * hash table. Live updates take their space from the gap in between. */
+static char *dircache_buf;
+/* Allocation of a cache built in the foreground, 0 if there's none */
+static int dircache_handle = 0;
+static struct dircache_block *dircache_blocks;
+static char *names_top;
+static unsigned long names_size = 0;
+static uint32_t node_count = 0;
 
 static bool dircache_initialized = false;
 static bool dircache_initializing = false;
 static bool thread_enabled = false;
+static bool validating = false;
+static bool resumable = false;
 static unsigned long allocated_size = DIRCACHE_LIMIT;
 static unsigned long dircache_size = 0;
 static unsigned long entry_count = 0;
-static unsigned long reserve_used = 0;
 static unsigned int  cache_build_ticks = 0;
+static unsigned long changed_dirs = 0;
 static unsigned long appflags = 0;
 static char dircache_cur_path[MAX_PATH*2];
 
@@ -80,71 +103,124 @@ static const char dircache_thread_name[] = "dircache";
 static struct fdbind_queue fdbind_cache[MAX_PENDING_BINDINGS];
 static int fdbind_idx = 0;
 
+/* Hash of (directory, name) to entry, stored within the cache buffer. */
+static uint32_t *hash_table;
+static unsigned long hash_size = 0; /* bytes taken by the table */
+static unsigned long hash_mask = 0; /* 0 if there is no hash table */
+static unsigned long hash_used = 0;
+
 /* --- Internal cache structure control functions --- */
 
-/** 
- * Internal function to allocate a new dircache_entry from memory.
+static inline struct dircache_node* get_node(uint32_t idx)
+{
+    return &dircache_blocks[idx / DIRCACHE_BLOCK_ENTRIES]
+        .node[idx % DIRCACHE_BLOCK_ENTRIES];
+}
+
+static inline struct dircache_fileinfo* get_info(uint32_t idx)
+{
+    return &dircache_blocks[idx / DIRCACHE_BLOCK_ENTRIES]
+        .info[idx % DIRCACHE_BLOCK_ENTRIES];
+}
+
+static inline bool is_removed(const struct dircache_node *node)
+{
+    return node->name & DIRCACHE_NODE_REMOVED;
+}
+
+static inline char* get_name(const struct dircache_node *node)
+{
+    return names_top - (node->name & ~DIRCACHE_NODE_REMOVED);
+}
+
+/**
+ * Returns the number of bytes left between the entries and the names.
  */
-static struct dircache_entry* allocate_entry(void)
+static inline unsigned long dircache_free_space(void)
 {
-    struct dircache_entry *next_entry;
-    
-    if (dircache_size > allocated_size - MAX_PATH*2)
+    return allocated_size - dircache_size;
+}
+
+/**
+ * Internal function to allocate a new entry from memory.
+ * Returns the index of the entry or 0 if the cache is full.
+ */
+static uint32_t allocate_entry(void)
+{
+    uint32_t idx = node_count;
+
+    if (idx % DIRCACHE_BLOCK_ENTRIES == 0)
     {
-        logf("size limit reached");
-        return NULL;
+        if (dircache_free_space() < sizeof(struct dircache_block) + MAX_PATH)
+        {
+            logf("size limit reached");
+            return 0;
+        }
+
+        dircache_size += sizeof(struct dircache_block);
     }
-    
-    next_entry = (struct dircache_entry *)((char *)dircache_root+dircache_size);
-#ifdef ROCKBOX_STRICT_ALIGN
-    /* Make sure the entry is long aligned. */
-    if ((long)next_entry & 0x03)
+
+    node_count++;
+    memset(get_node(idx), 0, sizeof(struct dircache_node));
+    memset(get_info(idx), 0, sizeof(struct dircache_fileinfo));
+
+    return idx;
+}
+
+/**
+ * Internal function to add a name to the name pool. Returns the value
+ * for dircache_node.name or 0 if the cache is full.
+ */
+static uint32_t allocate_name(const char *name, size_t len)
+{
+    if (dircache_free_space() < len + 1)
     {
-        dircache_size += 4 - ((long)next_entry & 0x03);
-        next_entry = (struct dircache_entry *)(((long)next_entry & ~0x03) + 0x04);
+        logf("size limit reached");
+        return 0;
     }
-#endif
-    next_entry->name_len = 0;
-    next_entry->d_name = NULL;
-    next_entry->up = NULL;
-    next_entry->down = NULL;
-    next_entry->next = NULL;
-    
-    dircache_size += sizeof(struct dircache_entry);
 
-    return next_entry;
+    names_size += len + 1;
+    dircache_size += len + 1;
+    memcpy(names_top - names_size, name, len);
+    names_top[len - names_size] = '\0';
+
+    return names_size;
 }
 
 /**
- * Internal function to allocate a dircache_entry and set 
- * ->next entry pointers.
+ * Internal function to allocate an entry and append it to the given
+ * list, last being its current last entry or 0 if the list is empty.
  */
-static struct dircache_entry* dircache_gen_next(struct dircache_entry *ce)
+static uint32_t dircache_gen_next(uint32_t parent, uint32_t last)
 {
-    struct dircache_entry *next_entry;
+    uint32_t idx;
 
-    if ( (next_entry = allocate_entry()) == NULL)
-        return NULL;
-    next_entry->up = ce->up;
-    ce->next = next_entry;
-    
-    return next_entry;
+    if ( (idx = allocate_entry()) == 0)
+        return 0;
+
+    get_node(idx)->up = parent;
+    if (last != 0)
+        get_node(last)->next = idx;
+    else
+        get_node(parent)->down = idx;
+
+    return idx;
 }
 
-/*
- * Internal function to allocate a dircache_entry and set
- * ->down entry pointers.
+/**
+ * Internal function to find the last entry of a directory, 0 if it's empty.
  */
-static struct dircache_entry* dircache_gen_down(struct dircache_entry *ce)
+static uint32_t dircache_last_entry(uint32_t parent)
 {
-    struct dircache_entry *next_entry;
+    uint32_t idx = get_node(parent)->down;
 
-    if ( (next_entry = allocate_entry()) == NULL)
-        return NULL;
-    next_entry->up = ce;
-    ce->down = next_entry;
-    
-    return next_entry;
+    if (idx == 0)
+        return 0;
+
+    while (get_node(idx)->next != 0)
+        idx = get_node(idx)->next;
+
+    return idx;
 }
 
 /* This will eat ~30 KiB of memory!
@@ -152,6 +228,175 @@ static struct dircache_entry* dircache_gen_down(struct dircache_entry *ce)
 #define MAX_SCAN_DEPTH 16
 static struct travel_data dir_recursion[MAX_SCAN_DEPTH];
 
+/**
+ * Internal function to get the first entry of the directory an entry
+ * belongs to. It doesn't change when the directory is renamed, so it
+ * is used as the directory key in the hash table.
+ */
+static inline uint32_t dircache_get_head(uint32_t idx)
+{
+    return get_node(get_node(idx)->up)->down;
+}
+
+static unsigned long dircache_hash(uint32_t head, const char *name)
+{
+    unsigned long h = 2166136261u ^ head;
+
+    while (*name)
+        h = (h ^ tolower(*(const unsigned char *)name++)) * 16777619u;
+
+    return h ^ (h >> 15);
+}
+
+/**
+ * Internal function to add an entry to the hash table. The table is
+ * dropped when it gets too full, lookups fall back to the linear scan.
+ * Returns false if there is no hash table (anymore).
+ */
+static bool dircache_hash_insert(uint32_t idx)
+{
+    unsigned long i;
+
+    if (hash_mask == 0)
+        return false;
+
+    if (++hash_used > hash_mask - (hash_mask >> 2))
+    {
+        logf("hash table full");
+        hash_mask = 0;
+        return false;
+    }
+
+    i = dircache_hash(dircache_get_head(idx), get_name(get_node(idx)))
+        & hash_mask;
+    while (hash_table[i] != 0)
+        i = (i + 1) & hash_mask;
+
+    hash_table[i] = idx;
+    return true;
+}
+
+/**
+ * Internal function to find a name in the directory starting at head.
+ * Removed entries are kept in the table and skipped here.
+ */
+static uint32_t dircache_hash_find(uint32_t head, const char *name)
+{
+    struct dircache_node *node;
+    uint32_t idx;
+    unsigned long i;
+
+    i = dircache_hash(head, name) & hash_mask;
+    while ( (idx = hash_table[i]) != 0)
+    {
+        node = get_node(idx);
+        if (!is_removed(node) && !strcasecmp(name, get_name(node))
+            && dircache_get_head(idx) == head)
+        {
+            return idx;
+        }
+
+        i = (i + 1) & hash_mask;
+    }
+
+    return 0;
+}
+
+/**
+ * Internal function to walk the whole cache and call func for every live
+ * entry before descending into it. Returns the number of entries visited,
+ * or -1 if the walk was stopped by func or the tree is too deep.
+ */
+static long dircache_walk(bool (*func)(uint32_t idx))
+{
+    uint32_t stack[MAX_SCAN_DEPTH*2];
+    uint32_t idx = get_node(DIRCACHE_ROOT)->down;
+    struct dircache_node *node;
+    long count = 0;
+    int depth = 0;
+
+    while (1)
+    {
+        if (idx == 0)
+        {
+            if (--depth < 0)
+                break ;
+
+            idx = stack[depth];
+            continue ;
+        }
+
+        node = get_node(idx);
+        if (is_removed(node))
+        {
+            idx = node->next;
+            continue ;
+        }
+
+        count++;
+        if (func != NULL && !func(idx))
+            return -1;
+
+        if (node->down != 0)
+        {
+            if (depth >= (int)ARRAYLEN(stack))
+                return -1;
+
+            stack[depth++] = node->next;
+            idx = node->down;
+        }
+        else
+            idx = node->next;
+    }
+
+    return count;
+}
+
+/**
+ * Internal function to place the hash table above the name pool, which
+ * is moved down to make room. It is sized to also take the entries that
+ * fit in the reserve.
+ */
+static void dircache_hash_build(void)
+{
+    long count;
+    unsigned long size;
+
+    hash_mask = 0;
+    hash_used = 0;
+
+    count = dircache_walk(NULL);
+    if (count <= 0)
+        return ;
+
+    count += DIRCACHE_RESERVE / (sizeof(struct dircache_block)
+                                 / DIRCACHE_BLOCK_ENTRIES);
+    count += count / 3;
+    for (size = 64; size < (unsigned long)count; size <<= 1)
+        ;
+
+    size *= sizeof(uint32_t);
+    if (dircache_size + size > allocated_size - DIRCACHE_RESERVE)
+    {
+        logf("no room for hash table");
+        return ;
+    }
+
+    memmove(names_top - names_size - size, names_top - names_size,
+            names_size);
+    names_top -= size;
+    hash_table = (uint32_t *)names_top;
+    memset(hash_table, 0, size);
+    hash_size = size;
+    dircache_size += size;
+    hash_mask = size / sizeof(uint32_t) - 1;
+
+    if (dircache_walk(dircache_hash_insert) < 0)
+        hash_mask = 0;
+
+    logf("hash: %lu slots, %lu used", hash_mask + 1, hash_used);
+}
+
 /**
  * Returns true if there is an event waiting in the queue
  * that requires the current operation to be aborted.
@@ -159,7 +404,7 @@ static struct travel_data dir_recursion[MAX_SCAN_DEPTH];
 static bool check_event_queue(void)
 {
     struct queue_event ev;
-    
+
     queue_wait_w_tmo(&dircache_queue, &ev, 0);
     switch (ev.id)
     {
@@ -172,15 +417,38 @@ static bool check_event_queue(void)
             queue_post(&dircache_queue, ev.id, ev.data);
             return true;
     }
-    
+
     return false;
 }
 
+/**
+ * Internal function to add a directory entry as read from disk to the
+ * checksum of its directory listing.
+ */
+static unsigned dircache_entry_crc(const char *name,
+                                   const struct dircache_fileinfo *info,
+                                   unsigned crc)
+{
+    long data[4];
+
+    data[0] = info->attribute;
+    data[1] = info->size;
+    data[2] = info->startcluster;
+    data[3] = ((long)info->wrtdate << 16) | info->wrttime;
+    crc = crc_32(name, strlen(name) + 1, crc);
+
+    return crc_32(data, sizeof(data), crc);
+}
+
 /**
  * Internal function to iterate a path.
  */
 static int dircache_scan(IF_MV2(int volume,) struct travel_data *td)
 {
+    struct dircache_node *node;
+    struct dircache_fileinfo *info;
+    uint32_t name;
+
 #ifdef SIMULATOR
 #ifdef HAVE_MULTIVOLUME
     (void)volume;
@@ -196,51 +464,50 @@ static int dircache_scan(IF_MV2(int volume,) struct travel_data *td)
         {
             continue;
         }
-        
-        td->ce->attribute = td->entry->attribute;
-        td->ce->name_len = strlen(td->entry->d_name) + 1;
-        td->ce->d_name = ((char *)dircache_root+dircache_size);
-        td->ce->size = td->entry->size;
-        td->ce->wrtdate = td->entry->wrtdate;
-        td->ce->wrttime = td->entry->wrttime;
-        memcpy(td->ce->d_name, td->entry->d_name, td->ce->name_len);
+
+        name = allocate_name(td->entry->d_name, strlen(td->entry->d_name));
+        td->ce = dircache_gen_next(td->parent, td->ce);
+        if (name == 0 || td->ce == 0)
+            return -2;
+
+        info = get_info(td->ce);
+        info->attribute = td->entry->attribute;
+        info->size = td->entry->size;
+        info->startcluster = td->entry->startcluster;
+        info->wrtdate = td->entry->wrtdate;
+        info->wrttime = td->entry->wrttime;
 #else
         if (!strcmp(".", td->entry.name) ||
              !strcmp("..", td->entry.name))
         {
             continue;
         }
-        
-        td->ce->attribute = td->entry.attr;
-        td->ce->name_len = strlen(td->entry.name) + 1;
-        td->ce->d_name = ((char *)dircache_root+dircache_size);
-        td->ce->startcluster = td->entry.firstcluster;
-        td->ce->size = td->entry.filesize;
-        td->ce->wrtdate = td->entry.wrtdate;
-        td->ce->wrttime = td->entry.wrttime;
-        memcpy(td->ce->d_name, td->entry.name, td->ce->name_len);
+
+        name = allocate_name(td->entry.name, strlen(td->entry.name));
+        td->ce = dircache_gen_next(td->parent, td->ce);
+        if (name == 0 || td->ce == 0)
+            return -2;
+
+        info = get_info(td->ce);
+        info->attribute = td->entry.attr;
+        info->size = td->entry.filesize;
+        info->startcluster = td->entry.firstcluster;
+        info->wrtdate = td->entry.wrtdate;
+        info->wrttime = td->entry.wrttime;
 #endif
-        dircache_size += td->ce->name_len;
+        node = get_node(td->ce);
+        node->name = name;
         entry_count++;
-        
-#ifdef SIMULATOR
-        if (td->entry->attribute & ATTR_DIRECTORY)
-#else
-        if (td->entry.attr & FAT_ATTR_DIRECTORY)
-#endif
+        td->crc = dircache_entry_crc(get_name(node), info, td->crc);
+
+        if (info->attribute & ATTR_DIRECTORY)
         {
-            
-            td->down_entry = dircache_gen_down(td->ce);
-            if (td->down_entry == NULL)
-                return -2;
-            
             td->pathpos = strlen(dircache_cur_path);
-            strlcpy(&dircache_cur_path[td->pathpos], "/", 
+            strlcpy(&dircache_cur_path[td->pathpos], "/",
                     sizeof(dircache_cur_path) - td->pathpos);
-#ifdef SIMULATOR
-            strlcpy(&dircache_cur_path[td->pathpos+1], td->entry->d_name, 
+            strlcpy(&dircache_cur_path[td->pathpos+1], get_name(node),
                     sizeof(dircache_cur_path) - td->pathpos - 1);
-            
+#ifdef SIMULATOR
             td->newdir = opendir_uncached(dircache_cur_path);
             if (td->newdir == NULL)
             {
@@ -248,9 +515,6 @@ static int dircache_scan(IF_MV2(int volume,) struct travel_data *td)
                 return -3;
             }
 #else
-            strlcpy(&dircache_cur_path[td->pathpos+1], td->entry.name,
-                    sizeof(dircache_cur_path) - td->pathpos - 1);
-
             td->newdir = *td->dir;
             if (fat_opendir(IF_MV2(volume,) &td->newdir,
                 td->entry.firstcluster, td->dir) < 0 )
@@ -259,18 +523,9 @@ static int dircache_scan(IF_MV2(int volume,) struct travel_data *td)
             }
 #endif
 
-            td->ce = dircache_gen_next(td->ce);
-            if (td->ce == NULL)
-                return -4;
-            
             return 1;
         }
-        
-        td->ce->down = NULL;
-        td->ce = dircache_gen_next(td->ce);
-        if (td->ce == NULL)
-            return -5;
-        
+
         /* When simulator is used, it's only safe to yield here. */
         if (thread_enabled)
         {
@@ -279,86 +534,69 @@ static int dircache_scan(IF_MV2(int volume,) struct travel_data *td)
                 return -6;
             yield();
         }
-        
+
     }
 
     return 0;
 }
 
-/** 
+/**
  * Recursively scan the hard disk and build the cache.
  */
 #ifdef SIMULATOR
-static int dircache_travel(IF_MV2(int volume,) DIR_UNCACHED *dir, struct dircache_entry *ce)
+static int dircache_travel(IF_MV2(int volume,) DIR_UNCACHED *dir, uint32_t parent)
 #else
-static int dircache_travel(IF_MV2(int volume,) struct fat_dir *dir, struct dircache_entry *ce)
+static int dircache_travel(IF_MV2(int volume,) struct fat_dir *dir, uint32_t parent)
 #endif
 {
     int depth = 0;
     int result;
 
-    memset(ce, 0, sizeof(struct dircache_entry));
-
 #if defined(HAVE_MULTIVOLUME) && !defined(SIMULATOR)
     if (volume > 0)
     {
-        ce->d_name = ((char *)dircache_root+dircache_size);
-        snprintf(ce->d_name, VOL_ENUM_POS + 3, VOL_NAMES, volume);
-        ce->name_len = VOL_ENUM_POS + 3;
-        dircache_size += ce->name_len;
-        ce->attribute = FAT_ATTR_DIRECTORY | FAT_ATTR_VOLUME;
-        ce->size = 0;
-        append_position = dircache_gen_next(ce);
-        ce = dircache_gen_down(ce);
+        char name[VOL_ENUM_POS + 3];
+        struct dircache_fileinfo *info;
+        uint32_t idx;
+
+        snprintf(name, sizeof(name), VOL_NAMES, volume);
+        idx = dircache_gen_next(parent, dircache_last_entry(parent));
+        if (idx == 0)
+            return -2;
+
+        get_node(idx)->name = allocate_name(name, strlen(name));
+        if (get_node(idx)->name == 0)
+            return -2;
+
+        info = get_info(idx);
+        info->attribute = FAT_ATTR_DIRECTORY | FAT_ATTR_VOLUME;
+        parent = idx;
     }
 #endif
 
     dir_recursion[0].dir = dir;
-    dir_recursion[0].ce = ce;
-    dir_recursion[0].first = ce;
-    
+    dir_recursion[0].parent = parent;
+    dir_recursion[0].ce = dircache_last_entry(parent);
+    dir_recursion[0].crc = 0xffffffff;
+
     do {
         //logf("=> %s", dircache_cur_path);
         result = dircache_scan(IF_MV2(volume,) &dir_recursion[depth]);
         switch (result) {
             case 0: /* Leaving the current directory. */
-                /* Add the standard . and .. entries. */
-                ce = dir_recursion[depth].ce;
-                ce->d_name = ".";
-                ce->name_len = 2;
 #ifdef SIMULATOR
                 closedir_uncached(dir_recursion[depth].dir);
-                ce->attribute = ATTR_DIRECTORY;
-#else
-                ce->attribute = FAT_ATTR_DIRECTORY;
-                ce->startcluster = dir_recursion[depth].dir->file.firstcluster;
 #endif
-                ce->size = 0;
-                ce->down = dir_recursion[depth].first;
-    
+                /* The size of a directory holds the checksum of its
+                   listing, to find the changed directories later. */
+                get_info(dir_recursion[depth].parent)->size =
+                    dir_recursion[depth].crc;
+
                 depth--;
                 if (depth < 0)
                     break ;
 
                 dircache_cur_path[dir_recursion[depth].pathpos] = '\0';
-            
-                ce = dircache_gen_next(ce);
-                if (ce == NULL)
-                {
-                    logf("memory allocation error");
-                    return -3;
-                }
-#ifdef SIMULATOR
-                ce->attribute = ATTR_DIRECTORY;
-#else
-                ce->attribute = FAT_ATTR_DIRECTORY;
-                ce->startcluster = dir_recursion[depth].dir->file.firstcluster;
-#endif
-                ce->d_name = "..";
-                ce->name_len = 3;
-                ce->size = 0;
-                ce->down = dir_recursion[depth].first;
-    
                 break ;
 
             case 1: /* Going down in the directory tree. */
@@ -368,102 +606,434 @@ static int dircache_travel(IF_MV2(int volume,) struct fat_dir *dir, struct dirca
                     logf("Too deep directory structure");
                     return -2;
                 }
-            
+
 #ifdef SIMULATOR
                 dir_recursion[depth].dir = dir_recursion[depth-1].newdir;
 #else
                 dir_recursion[depth].dir = &dir_recursion[depth-1].newdir;
 #endif
-                dir_recursion[depth].first = dir_recursion[depth-1].down_entry;
-                dir_recursion[depth].ce = dir_recursion[depth-1].down_entry;
+                dir_recursion[depth].parent = dir_recursion[depth-1].ce;
+                dir_recursion[depth].ce = 0;
+                dir_recursion[depth].crc = 0xffffffff;
                 break ;
-            
+
             default:
                 logf("Scan failed");
                 logf("-> %s", dircache_cur_path);
                 return -1;
         }
     } while (depth >= 0) ;
-    
+
+    return 0;
+}
+
+/**
+ * Internal function to find a live entry by name in the given directory.
+ */
+static uint32_t dircache_find_child(uint32_t parent, const char *name)
+{
+    struct dircache_node *node;
+    uint32_t idx = get_node(parent)->down;
+
+    if (idx == 0)
+        return 0;
+
+    if (hash_mask != 0)
+        return dircache_hash_find(idx, name);
+
+    for (; idx != 0; idx = node->next)
+    {
+        node = get_node(idx);
+        if (!is_removed(node) && !strcasecmp(name, get_name(node)))
+            return idx;
+    }
+
     return 0;
 }
 
 /**
- * Internal function to get a pointer to dircache_entry for a given filename.
+ * Internal function to get the entry for a given filename.
  *   path: Absolute path to a file or directory.
- *   get_before: Returns the cache pointer before the last valid entry found.
- *   only_directories: Match only filenames which are a directory type.
+ * Returns the index of the entry, 0 if it wasn't found.
  */
-static struct dircache_entry* dircache_get_entry(const char *path,
-        bool get_before, bool only_directories)
+static uint32_t dircache_get_entry(const char *path)
 {
-    struct dircache_entry *cache_entry, *before;
+    uint32_t idx = DIRCACHE_ROOT;
     char namecopy[MAX_PATH*2];
     char* part;
     char* end;
 
     strlcpy(namecopy, path, sizeof(namecopy));
-    cache_entry = dircache_root;
-    before = NULL;
-    
+
     for ( part = strtok_r(namecopy, "/", &end); part;
           part = strtok_r(NULL, "/", &end)) {
 
-        /* scan dir for name */
-        while (1)
+        idx = dircache_find_child(idx, part);
+        if (idx == 0)
+            return 0;
+    }
+
+    return idx;
+}
+
+/**
+ * Internal function to append a new entry to the given directory.
+ */
+static uint32_t dircache_append_entry(uint32_t parent, const char *name,
+                                      int attribute)
+{
+    struct dircache_node *node;
+    struct dircache_fileinfo *info;
+    uint32_t idx, last;
+
+    if (dircache_free_space() < sizeof(struct dircache_block) + MAX_PATH)
+    {
+        logf("not enough space");
+        return 0;
+    }
+
+    last = dircache_last_entry(parent);
+
+    /* A renamed directory still owns its children, don't reuse it. */
+    if (last != 0 && is_removed(get_node(last))
+        && get_node(last)->down == 0)
+    {
+        idx = last;
+    }
+    else
+    {
+        idx = dircache_gen_next(parent, last);
+        if (idx == 0)
+            return 0;
+    }
+
+    node = get_node(idx);
+    node->name = allocate_name(name, MIN(254, strlen(name)));
+
+    info = get_info(idx);
+    memset(info, 0, sizeof(struct dircache_fileinfo));
+    info->attribute = attribute;
+
+    /* Don't let a running validation drop an entry created meanwhile. */
+    if (validating)
+        info->flags |= DIRCACHE_FLAG_SEEN;
+
+    dircache_hash_insert(idx);
+
+    return idx;
+}
+
+/* --- Snapshot validation --- */
+
+/* An entry of a directory listing read from disk. */
+struct dircache_disk_entry {
+    const char *name;
+    struct dircache_fileinfo info;
+};
+
+#ifdef SIMULATOR
+static DIR_UNCACHED *listing_dir;
+#endif
+
+#if defined(HAVE_MULTIVOLUME) && !defined(SIMULATOR)
+/**
+ * Internal function to get the volume a cached entry belongs to.
+ */
+static int dircache_get_volume(uint32_t idx)
+{
+    if (idx == DIRCACHE_ROOT)
+        return 0;
+
+    while (get_node(idx)->up != DIRCACHE_ROOT)
+        idx = get_node(idx)->up;
+
+    if (get_info(idx)->attribute & ATTR_VOLUME)
+        return get_name(get_node(idx))[VOL_ENUM_POS] - '0';
+
+    return 0;
+}
+#endif
+
+/**
+ * Internal function to open the on-disk listing of a cached directory.
+ */
+static bool dircache_listing_open(uint32_t dir)
+{
+#ifdef SIMULATOR
+    if (dir == DIRCACHE_ROOT)
+        strlcpy(dircache_cur_path, "/", sizeof(dircache_cur_path));
+    else
+        dircache_copy_path(dir, dircache_cur_path,
+                           sizeof(dircache_cur_path));
+
+    listing_dir = opendir_uncached(dircache_cur_path);
+    return listing_dir != NULL;
+#else
+    /* The scan is not running, borrow its directory handle. */
+    return fat_opendir(IF_MV2(dircache_get_volume(dir),)
+                       &dir_recursion[0].newdir,
+                       dir == DIRCACHE_ROOT ? 0 : get_info(dir)->startcluster,
+                       NULL) >= 0;
+#endif
+}
+
+/**
+ * Internal function to read the next entry of the listing, skipping
+ * "." and "..". Returns false at the end.
+ */
+static bool dircache_listing_next(struct dircache_disk_entry *de)
+{
+#ifdef SIMULATOR
+    struct dirent_uncached *entry;
+
+    while ( (entry = readdir_uncached(listing_dir)) != NULL)
+    {
+        if (!strcmp(".", entry->d_name) || !strcmp("..", entry->d_name))
+            continue;
+
+        de->name = (char *)entry->d_name;
+        de->info.attribute = entry->attribute;
+        de->info.startcluster = entry->startcluster;
+        de->info.size = entry->size;
+        de->info.wrtdate = entry->wrtdate;
+        de->info.wrttime = entry->wrttime;
+        return true;
+    }
+#else
+    struct fat_direntry *entry = &dir_recursion[0].entry;
+
+    while (fat_getnext(&dir_recursion[0].newdir, entry) >= 0
+           && entry->name[0])
+    {
+        if (!strcmp(".", entry->name) || !strcmp("..", entry->name))
+            continue;
+
+        de->name = (char *)entry->name;
+        de->info.attribute = entry->attr;
+        de->info.startcluster = entry->firstcluster;
+        de->info.size = entry->filesize;
+        de->info.wrtdate = entry->wrtdate;
+        de->info.wrttime = entry->wrttime;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+static void dircache_listing_close(void)
+{
+#ifdef SIMULATOR
+    closedir_uncached(listing_dir);
+#endif
+}
+
+/**
+ * Internal function to compare a cached directory with the disk and
+ * bring it up to date if the listing has changed since the cache was
+ * built. Returns 1 if the directory was resynced, 0 if it was intact
+ * and < 0 on failure.
+ */
+static int dircache_check_dir(uint32_t dir)
+{
+    struct dircache_disk_entry de;
+    struct dircache_fileinfo *info;
+    struct dircache_node *node;
+    unsigned crc = 0xffffffff;
+    uint32_t idx;
+
+    memset(&de, 0, sizeof(de));
+    if (!dircache_listing_open(dir))
+        return -1;
+    while (dircache_listing_next(&de))
+        crc = dircache_entry_crc(de.name, &de.info, crc);
+    dircache_listing_close();
+
+    if ((unsigned long)get_info(dir)->size == crc)
+        return 0;
+
+    if (!dircache_listing_open(dir))
+        return -1;
+
+    while (dircache_listing_next(&de))
+    {
+        idx = dircache_find_child(dir, de.name);
+
+        /* Case changes and files replaced by directories (or the other way
+           round) are handled like a removal followed by a creation. */
+        if (idx != 0 && (strcmp(get_name(get_node(idx)), de.name)
+            || ((get_info(idx)->attribute ^ de.info.attribute)
+                & ATTR_DIRECTORY)))
         {
-            if (cache_entry == NULL)
-            {
-                return NULL;
-            }
-            else if (cache_entry->name_len == 0)
-            {
-                cache_entry = cache_entry->next;
-                continue ;
-            }
+            get_node(idx)->name |= DIRCACHE_NODE_REMOVED;
+            idx = 0;
+        }
 
-            if (!strcasecmp(part, cache_entry->d_name))
+        if (idx == 0)
+        {
+            idx = dircache_append_entry(dir, de.name, de.info.attribute);
+            if (idx == 0)
             {
-                before = cache_entry;
-                if (cache_entry->down || only_directories)
-                    cache_entry = cache_entry->down;
-                break ;
+                dircache_listing_close();
+                return -2;
             }
+        }
+
+        info = get_info(idx);
+        info->attribute = de.info.attribute;
+        info->flags |= DIRCACHE_FLAG_SEEN;
+        info->startcluster = de.info.startcluster;
+        info->wrtdate = de.info.wrtdate;
+        info->wrttime = de.info.wrttime;
+        /* A directory keeps the checksum of its own listing. */
+        if (!(info->attribute & ATTR_DIRECTORY))
+            info->size = de.info.size;
+    }
+    dircache_listing_close();
+
+    /* Whatever wasn't seen on disk has been removed. */
+    for (idx = get_node(dir)->down; idx != 0; idx = node->next)
+    {
+        node = get_node(idx);
+        info = get_info(idx);
+        if (is_removed(node) || (info->attribute & ATTR_VOLUME))
+            continue;
+
+        if (info->flags & DIRCACHE_FLAG_SEEN)
+            info->flags &= ~DIRCACHE_FLAG_SEEN;
+        else
+            node->name |= DIRCACHE_NODE_REMOVED;
+    }
+
+    get_info(dir)->size = crc;
+    changed_dirs++;
+    return 1;
+}
+
+static bool dircache_validate_entry(uint32_t idx)
+{
+    if (!(get_info(idx)->attribute & ATTR_DIRECTORY))
+        return true;
+
+    if (dircache_check_dir(idx) < 0)
+        return false;
+
+    /* Stop if we got an external signal. */
+    if (check_event_queue())
+        return false;
+    yield();
+
+    return true;
+}
 
-            cache_entry = cache_entry->next;
+static bool dircache_count_entry(uint32_t idx)
+{
+    /* Clear the marks of entries created while a directory was resynced. */
+    get_info(idx)->flags &= ~DIRCACHE_FLAG_SEEN;
+    entry_count++;
+
+    return true;
+}
+
+/**
+ * Internal function to set up the cache buffer layout for the given
+ * buffer, moving the name pool and hash table if they are in place.
+ */
+static void dircache_set_buffer(char *buf, unsigned long size)
+{
+    char *top = buf + (size & ~3) - hash_size;
+
+    if (names_top != NULL && top != names_top)
+    {
+        memmove(top - names_size, names_top - names_size,
+                names_size + hash_size);
+    }
+
+    dircache_buf = buf;
+    dircache_blocks = (struct dircache_block *)buf;
+    allocated_size = size & ~3;
+    names_top = top;
+    hash_table = (uint32_t *)top;
+}
+
+/**
+ * Internal function to check that all the indices of a loaded snapshot
+ * stay inside of it, so that a damaged file can't send lookups or walks
+ * anywhere else. Lists only ever link forward, which also rules out loops.
+ */
+static bool dircache_check_snapshot(void)
+{
+    struct dircache_node *node;
+    unsigned long name;
+    uint32_t idx;
+    unsigned long i;
+
+    if (node_count <= DIRCACHE_ROOT || names_size == 0
+        || names_top[-1] != '\0')
+        return false;
+
+    for (idx = DIRCACHE_ROOT; idx < node_count; idx++)
+    {
+        node = get_node(idx);
+        name = node->name & ~DIRCACHE_NODE_REMOVED;
+        if (name == 0 || name > names_size
+            || (node->next != 0
+                && (node->next <= idx || node->next >= node_count))
+            || node->up >= node_count || node->down >= node_count)
+            return false;
+    }
+
+    if (hash_mask != 0)
+    {
+        if ((hash_mask & (hash_mask + 1)) != 0
+            || hash_size != (hash_mask + 1) * sizeof(uint32_t)
+            || hash_used > hash_mask)
+            return false;
+
+        for (i = 0; i <= hash_mask; i++)
+        {
+            if (hash_table[i] >= node_count)
+                return false;
         }
     }
 
-    if (get_before)
-        cache_entry = before;
-        
-    return cache_entry;
+    return true;
 }
 
-#ifdef HAVE_EEPROM_SETTINGS
 /**
  * Function to load the internal cache structure from disk to initialize
- * the dircache really fast and little disk access.
+ * the dircache really fast and little disk access. Unless the snapshot
+ * is known to match the disk, it is validated in the background.
  */
-int dircache_load(void)
+int dircache_load(bool validate)
 {
     struct dircache_maindata maindata;
+    unsigned long blocks_size;
     int bytes_read;
     int fd;
-        
+
     if (dircache_initialized)
         return -1;
-        
+
     logf("Loading directory cache");
     dircache_size = 0;
-    
+
     fd = open(DIRCACHE_FILE, O_RDONLY);
     if (fd < 0)
         return -2;
-        
+
     bytes_read = read(fd, &maindata, sizeof(struct dircache_maindata));
+    blocks_size = maindata.size - maindata.names_size - maindata.hash_size;
     if (bytes_read != sizeof(struct dircache_maindata)
-        || maindata.size <= 0)
+        || maindata.magic != DIRCACHE_MAGIC || maindata.size <= 0
+        || maindata.size > DIRCACHE_LIMIT
+        || maindata.names_size > (unsigned long)maindata.size
+        || maindata.hash_size > maindata.size - maindata.names_size
+        || maindata.hash_size % sizeof(uint32_t) != 0
+        || maindata.node_count > DIRCACHE_LIMIT
+        || blocks_size != ((maindata.node_count + DIRCACHE_BLOCK_ENTRIES - 1)
+                           / DIRCACHE_BLOCK_ENTRIES)
+                          * sizeof(struct dircache_block))
     {
         logf("Dircache file header error");
         close(fd);
@@ -471,84 +1041,116 @@ int dircache_load(void)
         return -3;
     }
 
-    dircache_root = buffer_alloc(0);
-    if ((long)maindata.root_entry != (long)dircache_root)
-    {
-        logf("Position missmatch");
-        close(fd);
-        remove(DIRCACHE_FILE);
-        return -4;
-    }
-    
-    dircache_root = buffer_alloc(maindata.size + DIRCACHE_RESERVE);
+    /* The snapshot only holds indices, it can be loaded anywhere. */
+    names_top = NULL;
+    names_size = maindata.names_size;
+    hash_size = maindata.hash_size;
+    dircache_set_buffer(buffer_alloc(maindata.size + DIRCACHE_RESERVE + 4),
+                        maindata.size + DIRCACHE_RESERVE + 4);
+    node_count = maindata.node_count;
     entry_count = maindata.entry_count;
     appflags = maindata.appflags;
-    bytes_read = read(fd, dircache_root, MIN(DIRCACHE_LIMIT, maindata.size));
+    hash_mask = maindata.hash_mask;
+    hash_used = maindata.hash_used;
+    bytes_read = read(fd, dircache_buf, blocks_size);
+    bytes_read += read(fd, names_top - names_size, names_size + hash_size);
     close(fd);
-    remove(DIRCACHE_FILE);
-    
+
+    /* A good snapshot stays on disk, so it can be loaded and validated
+       again should the player crash before it is saved next time. */
     if (bytes_read != maindata.size)
     {
         logf("Dircache read failed");
+        remove(DIRCACHE_FILE);
+        hash_mask = 0;
         return -6;
     }
 
+    if (!dircache_check_snapshot())
+    {
+        logf("Dircache file is damaged");
+        remove(DIRCACHE_FILE);
+        hash_mask = 0;
+        return -7;
+    }
+
     /* Cache successfully loaded. */
     dircache_size = maindata.size;
-    allocated_size = dircache_size + DIRCACHE_RESERVE;
-    reserve_used = 0;
     logf("Done, %ld KiB used", dircache_size / 1024);
     dircache_initialized = true;
     memset(fd_bindings, 0, sizeof(fd_bindings));
 
+    if (validate)
+    {
+        appflags = 0;
+        validating = true;
+        queue_post(&dircache_queue, DIRCACHE_VALIDATE, 0);
+    }
+
     return 0;
 }
 
 /**
  * Function to save the internal cache stucture to disk for fast loading
- * on boot.
+ * on boot. Only called at shutdown, when nothing changes the cache while
+ * it is being written.
  */
 int dircache_save(void)
 {
     struct dircache_maindata maindata;
+    unsigned long blocks_size;
     int fd;
     unsigned long bytes_written;
 
     remove(DIRCACHE_FILE);
-    
-    if (!dircache_initialized)
+
+    /* A cache that is still being validated isn't worth saving. */
+    if (!dircache_initialized || validating)
         return -1;
 
     logf("Saving directory cache");
     fd = open(DIRCACHE_FILE, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0)
+    {
+        logf("dircache: open failed");
+        return -4;
+    }
 
     maindata.magic = DIRCACHE_MAGIC;
     maindata.size = dircache_size;
-    maindata.root_entry = dircache_root;
     maindata.entry_count = entry_count;
     maindata.appflags = appflags;
+    maindata.node_count = node_count;
+    maindata.names_size = names_size;
+    maindata.hash_size = hash_size;
+    maindata.hash_mask = hash_mask;
+    maindata.hash_used = hash_used;
 
     /* Save the info structure */
     bytes_written = write(fd, &maindata, sizeof(struct dircache_maindata));
     if (bytes_written != sizeof(struct dircache_maindata))
     {
         close(fd);
+        remove(DIRCACHE_FILE);
         logf("dircache: write failed #1");
         return -2;
     }
 
-    /* Dump whole directory cache to disk */
-    bytes_written = write(fd, dircache_root, dircache_size);
+    /* Dump the entries, names and hash table to disk */
+    blocks_size = dircache_size - names_size - hash_size;
+    bytes_written = write(fd, dircache_buf, blocks_size);
+    bytes_written += write(fd, names_top - names_size,
+                           names_size + hash_size);
     close(fd);
     if (bytes_written != dircache_size)
     {
+        remove(DIRCACHE_FILE);
         logf("dircache: write failed #2");
         return -3;
     }
-    
+
     return 0;
 }
-#endif /* #if 0 */
 
 /**
  * Internal function which scans the disk and creates the dircache structure.
@@ -562,19 +1164,29 @@ static int dircache_do_rebuild(void)
 #endif
     unsigned int start_tick;
     int i;
-    
+
     /* Measure how long it takes build the cache. */
     start_tick = current_tick;
     dircache_initializing = true;
     appflags = 0;
     entry_count = 0;
-    
+    hash_mask = 0;
+
     memset(dircache_cur_path, 0, sizeof(dircache_cur_path));
-    dircache_size = sizeof(struct dircache_entry);
+    dircache_size = 0;
+    node_count = 0;
+    names_size = 0;
+    hash_size = 0;
+    names_top = NULL;
+    dircache_set_buffer(dircache_buf, allocated_size);
+
+    /* Entry 0 is never used, entry 1 is the root directory. */
+    allocate_entry();
+    allocate_entry();
+    get_node(DIRCACHE_ROOT)->name = allocate_name("", 0);
+    get_info(DIRCACHE_ROOT)->attribute = ATTR_DIRECTORY;
 
 #ifdef HAVE_MULTIVOLUME
-    append_position = dircache_root;
-
     for (i = NUM_VOLUMES; i >= 0; i--)
     {
         if (fat_ismounted(i))
@@ -602,9 +1214,9 @@ static int dircache_do_rebuild(void)
 #endif
             cpu_boost(true);
 #ifdef HAVE_MULTIVOLUME
-            if (dircache_travel(IF_MV2(i,) pdir, append_position) < 0)
+            if (dircache_travel(IF_MV2(i,) pdir, DIRCACHE_ROOT) < 0)
 #else
-            if (dircache_travel(IF_MV2(0,) pdir, dircache_root) < 0)
+            if (dircache_travel(IF_MV2(0,) pdir, DIRCACHE_ROOT) < 0)
 #endif /* HAVE_MULTIVOLUME */
             {
                 logf("dircache_travel failed");
@@ -619,35 +1231,64 @@ static int dircache_do_rebuild(void)
     }
 #endif
 
+    dircache_hash_build();
+
+    if (!thread_enabled)
+    {
+        /* Shrink the buffer to what is used plus the reserve. */
+        dircache_set_buffer(dircache_buf, dircache_size + DIRCACHE_RESERVE + 4);
+        core_shrink(dircache_handle, allocated_size);
+    }
+
     logf("Done, %ld KiB used", dircache_size / 1024);
-    
+
     dircache_initialized = true;
     dircache_initializing = false;
     cache_build_ticks = current_tick - start_tick;
-    
+
     /* Initialized fd bindings. */
     memset(fd_bindings, 0, sizeof(fd_bindings));
     for (i = 0; i < fdbind_idx; i++)
         dircache_bind(fdbind_cache[i].fd, fdbind_cache[i].path);
     fdbind_idx = 0;
-    
-    if (thread_enabled)
-    {
-        if (allocated_size - dircache_size < DIRCACHE_RESERVE)
-            reserve_used = DIRCACHE_RESERVE - (allocated_size - dircache_size);
-    }
-    else
-    {
-        /* We have to long align the audiobuf to keep the buffer access fast. */
-        audiobuf += (long)((dircache_size & ~0x03) + 0x04);
-        audiobuf += DIRCACHE_RESERVE;
-        allocated_size = dircache_size + DIRCACHE_RESERVE;
-        reserve_used = 0;
-    }
-    
+
     return 1;
 }
 
+/**
+ * Internal function which validates a loaded or resumed cache against
+ * the disk. Only the directories that have changed are rescanned, the
+ * cache stays usable meanwhile. Falls back to a full rebuild on failure.
+ */
+static void dircache_do_validate(void)
+{
+    unsigned int start_tick = current_tick;
+    long result;
+
+    logf("Validating directory cache");
+    changed_dirs = 0;
+    cpu_boost(true);
+    result = dircache_check_dir(DIRCACHE_ROOT);
+    if (result >= 0)
+        result = dircache_walk(dircache_validate_entry);
+    cpu_boost(false);
+
+    entry_count = 0;
+    dircache_walk(dircache_count_entry);
+    validating = false;
+    cache_build_ticks = current_tick - start_tick;
+    logf("Validated, %lu dirs changed", changed_dirs);
+
+    if (result >= 0 || check_event_queue())
+        return ;
+
+    logf("Validation failed, rebuilding");
+    dircache_initialized = false;
+    thread_enabled = true;
+    dircache_do_rebuild();
+    thread_enabled = false;
+}
+
 /**
  * Internal thread that controls transparent cache building.
  */
@@ -672,12 +1313,16 @@ static void dircache_thread(void)
                 dircache_do_rebuild();
                 thread_enabled = false;
                 break ;
-                
+
+            case DIRCACHE_VALIDATE:
+                dircache_do_validate();
+                break ;
+
             case DIRCACHE_STOP:
                 logf("Stopped the rebuilding.");
                 dircache_initialized = false;
                 break ;
-            
+
 #ifndef SIMULATOR
             case SYS_USB_CONNECTED:
                 usb_acknowledge(SYS_USB_CONNECTED_ACK);
@@ -694,12 +1339,16 @@ static void dircache_thread(void)
  */
 int dircache_build(int last_size)
 {
+    size_t size;
+    int result;
+
     if (dircache_initialized || thread_enabled)
         return -3;
 
     logf("Building directory cache");
+    resumable = false;
     remove(DIRCACHE_FILE);
-    
+
     /* Background build, dircache has been previously allocated */
     if (dircache_size > 0)
     {
@@ -708,11 +1357,11 @@ int dircache_build(int last_size)
         queue_post(&dircache_queue, DIRCACHE_BUILD, 0);
         return 2;
     }
-    
+
     if (last_size > DIRCACHE_RESERVE && last_size < DIRCACHE_LIMIT )
     {
         allocated_size = last_size + DIRCACHE_RESERVE;
-        dircache_root = buffer_alloc(allocated_size);
+        dircache_buf = buffer_alloc(allocated_size);
         thread_enabled = true;
 
         /* Start a transparent rebuild. */
@@ -720,10 +1369,47 @@ int dircache_build(int last_size)
         return 3;
     }
 
-    dircache_root = (struct dircache_entry *)(((long)audiobuf & ~0x03) + 0x04);
+    /* Take what's left of the buffer for now, the end is given back once
+     * the size is known. Names are stored from the end, so don't go past
+     * the allocation. */
+    dircache_handle = core_alloc_maximum("dircache", &size,
+                                         &buflib_pinned_ops);
+    if (dircache_handle <= 0)
+        return -4;
+
+    allocated_size = MIN(DIRCACHE_LIMIT, size);
+    core_shrink(dircache_handle, allocated_size);
+    dircache_buf = core_get_data(dircache_handle);
 
     /* Start a non-transparent rebuild. */
-    return dircache_do_rebuild();
+    result = dircache_do_rebuild();
+    if (result < 0)
+    {
+        core_free(dircache_handle);
+        dircache_handle = 0;
+    }
+
+    return result;
+}
+
+/**
+ * Re-enable a cache that was disabled intact, e.g. for a USB session,
+ * and validate it against the disk in the background.
+ */
+int dircache_resume(void)
+{
+    if (dircache_initialized || thread_enabled || !resumable)
+        return -1;
+
+    logf("Resuming directory cache");
+    resumable = false;
+    appflags = 0;
+    memset(fd_bindings, 0, sizeof(fd_bindings));
+    validating = true;
+    dircache_initialized = true;
+    queue_post(&dircache_queue, DIRCACHE_VALIDATE, 0);
+
+    return 0;
 }
 
 /**
@@ -732,15 +1418,16 @@ int dircache_build(int last_size)
 void* dircache_steal_buffer(long *size)
 {
     dircache_disable();
+    resumable = false;
     if (dircache_size == 0)
     {
         *size = 0;
         return NULL;
     }
-    
-    *size = dircache_size + (DIRCACHE_RESERVE-reserve_used);
-    
-    return dircache_root;
+
+    *size = dircache_size + MIN(dircache_free_space(), DIRCACHE_RESERVE);
+
+    return dircache_buf;
 }
 
 /**
@@ -750,16 +1437,16 @@ void* dircache_steal_buffer(long *size)
 void dircache_init(void)
 {
     int i;
-    
+
     dircache_initialized = false;
     dircache_initializing = false;
-    
+
     memset(opendirs, 0, sizeof(opendirs));
     for (i = 0; i < MAX_OPEN_DIRS; i++)
     {
         opendirs[i].secondary_entry.d_name = buffer_alloc(MAX_PATH);
     }
-    
+
     queue_init(&dircache_queue, true);
     create_thread(dircache_thread, dircache_stack,
                 sizeof(dircache_stack), 0, dircache_thread_name
@@ -783,6 +1470,14 @@ bool dircache_is_initializing(void)
     return dircache_initializing || thread_enabled;
 }
 
+/**
+ * Returns true if a loaded cache is being validated against the disk.
+ */
+bool dircache_is_validating(void)
+{
+    return validating;
+}
+
 /**
  * Set application flags used to determine if dircache is still intact.
  */
@@ -815,13 +1510,27 @@ int dircache_get_cache_size(void)
     return dircache_is_enabled() ? dircache_size : 0;
 }
 
+/**
+ * Returns how many bytes the names take of the cache size.
+ */
+int dircache_get_names_size(void)
+{
+    return dircache_is_enabled() ? names_size : 0;
+}
+
 /**
  * Returns how many bytes of the reserve allocation for live cache
  * updates have been used.
  */
 int dircache_get_reserve_used(void)
 {
-    return dircache_is_enabled() ? reserve_used : 0;
+    if (!dircache_is_enabled()
+        || dircache_free_space() >= DIRCACHE_RESERVE)
+    {
+        return 0;
+    }
+
+    return DIRCACHE_RESERVE - dircache_free_space();
 }
 
 /**
@@ -832,6 +1541,14 @@ int dircache_get_build_ticks(void)
     return dircache_is_enabled() ? cache_build_ticks : 0;
 }
 
+/**
+ * Returns how many directories the last validation had to rescan.
+ */
+int dircache_get_changed_dirs(void)
+{
+    return dircache_is_enabled() ? changed_dirs : 0;
+}
+
 /**
  * Disables the dircache. Usually called on shutdown or when
  * accepting a usb connection.
@@ -840,13 +1557,15 @@ void dircache_disable(void)
 {
     int i;
     bool cache_in_use;
-    
-    if (thread_enabled)
+    bool intact = dircache_initialized && !thread_enabled;
+
+    if (thread_enabled || validating)
         queue_post(&dircache_queue, DIRCACHE_STOP, 0);
-    
-    while (thread_enabled)
+
+    while (thread_enabled || validating)
         sleep(1);
     dircache_initialized = false;
+    resumable = intact;
 
     logf("Waiting for cached dirs to release");
     do {
@@ -860,50 +1579,73 @@ void dircache_disable(void)
             }
         }
     } while (cache_in_use) ;
-    
+
     logf("Cache released");
     entry_count = 0;
 }
 
 /**
- * Usermode function to return dircache_entry pointer to the given path.
+ * Usermode function to return the ID of the entry for the given path,
+ * or -1 if it isn't in the cache. The ID stays valid until the cache
+ * is rebuilt.
  */
-const struct dircache_entry *dircache_get_entry_ptr(const char *filename)
+int dircache_get_entry_id(const char *filename)
 {
+    uint32_t idx;
+
     if (!dircache_initialized || filename == NULL)
+        return -1;
+
+    idx = dircache_get_entry(filename);
+
+    return idx != 0 ? (int)idx : -1;
+}
+
+/**
+ * Returns the file information of the entry with the given ID.
+ */
+const struct dircache_fileinfo *dircache_get_fileinfo(int id)
+{
+    if (id <= 0 || (uint32_t)id >= node_count)
         return NULL;
-    
-    return dircache_get_entry(filename, false, false);
+
+    return get_info(id);
 }
 
 /**
  * Function to copy the full absolute path from dircache to the given buffer
- * using the given dircache_entry pointer.
+ * using the given entry ID.
  */
-void dircache_copy_path(const struct dircache_entry *entry, char *buf, int size)
+void dircache_copy_path(int entry, char *buf, int size)
 {
-    const struct dircache_entry *down[MAX_SCAN_DEPTH];
+    uint32_t down[MAX_SCAN_DEPTH];
+    const char *name;
+    uint32_t idx = entry;
     int depth = 0;
-    
+    int len;
+
     if (size <= 0)
         return ;
-    
+
     buf[0] = '\0';
-    
-    if (entry == NULL)
+
+    if (entry <= 0 || idx >= node_count)
         return ;
-    
-    do {
-        down[depth] = entry;
-        entry = entry->up;
+
+    while (idx != DIRCACHE_ROOT && idx != 0 && depth < MAX_SCAN_DEPTH)
+    {
+        down[depth] = idx;
+        idx = get_node(idx)->up;
         depth++;
-    } while (entry != NULL && depth < MAX_SCAN_DEPTH);
-    
+    }
+
     while (--depth >= 0)
     {
-        snprintf(buf, size, "/%s", down[depth]->d_name);
-        buf += down[depth]->name_len; /* '/' + d_name */
-        size -= down[depth]->name_len;
+        name = get_name(get_node(down[depth]));
+        snprintf(buf, size, "/%s", name);
+        len = strlen(name) + 1; /* '/' + name */
+        buf += len;
+        size -= len;
         if (size <= 0)
             break ;
     }
@@ -915,19 +1657,18 @@ static int block_until_ready(void)
     /* Block until dircache has been built. */
     while (!dircache_initialized && dircache_is_initializing())
         sleep(1);
-    
+
     if (!dircache_initialized)
         return -1;
-    
+
     return 0;
 }
 
-static struct dircache_entry* dircache_new_entry(const char *path, int attribute)
+static uint32_t dircache_new_entry(const char *path, int attribute)
 {
-    struct dircache_entry *entry;
+    uint32_t entry;
     char basedir[MAX_PATH*2];
     char *new;
-    long last_cache_size = dircache_size;
 
     strlcpy(basedir, path, sizeof(basedir));
     new = strrchr(basedir, '/');
@@ -935,84 +1676,50 @@ static struct dircache_entry* dircache_new_entry(const char *path, int attribute
     {
         logf("error occurred");
         dircache_initialized = false;
-        return NULL;
+        return 0;
     }
 
     *new = '\0';
     new++;
 
-    entry = dircache_get_entry(basedir, false, true);
-    if (entry == NULL)
+    entry = dircache_get_entry(basedir);
+    if (entry == 0 || !(get_info(entry)->attribute & ATTR_DIRECTORY))
     {
         logf("basedir not found!");
         logf("%s", basedir);
         dircache_initialized = false;
-        return NULL;
+        return 0;
     }
 
-    if (reserve_used + 2*sizeof(struct dircache_entry) + strlen(new)+1
-        >= DIRCACHE_RESERVE)
-    {
-        logf("not enough space");
+    entry = dircache_append_entry(entry, new, attribute);
+    if (entry == 0)
         dircache_initialized = false;
-        return NULL;
-    }
-    
-    while (entry->next != NULL)
-        entry = entry->next;
-
-    if (entry->name_len > 0)
-        entry = dircache_gen_next(entry);
-
-    if (entry == NULL)
-    {
-        dircache_initialized = false;
-        return NULL;
-    }
-        
-    entry->attribute = attribute;
-    entry->name_len = MIN(254, strlen(new)) + 1;
-    entry->d_name = ((char *)dircache_root+dircache_size);
-    entry->startcluster = 0;
-    entry->wrtdate = 0;
-    entry->wrttime = 0;
-    entry->size = 0;
-    memcpy(entry->d_name, new, entry->name_len);
-    dircache_size += entry->name_len;
-
-    if (attribute & ATTR_DIRECTORY)
-    {
-        logf("gen_down");
-        dircache_gen_down(entry);
-    }
-        
-    reserve_used += dircache_size - last_cache_size;
 
     return entry;
 }
 
 void dircache_bind(int fd, const char *path)
 {
-    struct dircache_entry *entry;
-    
+    uint32_t entry;
+
     /* Queue requests until dircache has been built. */
     if (!dircache_initialized && dircache_is_initializing())
     {
         if (fdbind_idx >= MAX_PENDING_BINDINGS)
             return ;
-        strlcpy(fdbind_cache[fdbind_idx].path, path, 
+        strlcpy(fdbind_cache[fdbind_idx].path, path,
                 sizeof(fdbind_cache[fdbind_idx].path));
         fdbind_cache[fdbind_idx].fd = fd;
         fdbind_idx++;
         return ;
     }
-    
+
     if (!dircache_initialized)
         return ;
 
     logf("bind: %d/%s", fd, path);
-    entry = dircache_get_entry(path, false, false);
-    if (entry == NULL)
+    entry = dircache_get_entry(path);
+    if (entry == 0)
     {
         logf("not found!");
         dircache_initialized = false;
@@ -1024,42 +1731,47 @@ void dircache_bind(int fd, const char *path)
 
 void dircache_update_filesize(int fd, long newsize, long startcluster)
 {
+    struct dircache_fileinfo *info;
+
     if (!dircache_initialized || fd < 0)
         return ;
 
-    if (fd_bindings[fd] == NULL)
+    if (fd_bindings[fd] == 0)
     {
         logf("dircache fd access error");
         dircache_initialized = false;
         return ;
     }
-    
-    fd_bindings[fd]->size = newsize;
-    fd_bindings[fd]->startcluster = startcluster;
+
+    info = get_info(fd_bindings[fd]);
+    info->size = newsize;
+    info->startcluster = startcluster;
 }
 void dircache_update_filetime(int fd)
 {
 #if CONFIG_RTC == 0
     (void)fd;
 #else
+    struct dircache_fileinfo *info;
     short year;
     struct tm *now = get_time();
     if (!dircache_initialized || fd < 0)
         return ;
 
-    if (fd_bindings[fd] == NULL)
+    if (fd_bindings[fd] == 0)
     {
         logf("dircache fd access error");
         dircache_initialized = false;
         return ;
     }
+    info = get_info(fd_bindings[fd]);
     year = now->tm_year+1900-1980;
-    fd_bindings[fd]->wrtdate = (((year)&0x7f)<<9)           |
-                               (((now->tm_mon+1)&0xf)<<5)   |
-                               (((now->tm_mday)&0x1f));
-    fd_bindings[fd]->wrttime = (((now->tm_hour)&0x1f)<<11)  |
-                               (((now->tm_min)&0x3f)<<5)    |
-                               (((now->tm_sec/2)&0x1f));
+    info->wrtdate = (((year)&0x7f)<<9)           |
+                    (((now->tm_mon+1)&0xf)<<5)   |
+                    (((now->tm_mday)&0x1f));
+    info->wrttime = (((now->tm_hour)&0x1f)<<11)  |
+                    (((now->tm_min)&0x3f)<<5)    |
+                    (((now->tm_sec/2)&0x1f));
 #endif
 }
 
@@ -1067,67 +1779,67 @@ void dircache_mkdir(const char *path)
 { /* Test ok. */
     if (block_until_ready())
         return ;
-        
+
     logf("mkdir: %s", path);
     dircache_new_entry(path, ATTR_DIRECTORY);
 }
 
 void dircache_rmdir(const char *path)
 { /* Test ok. */
-    struct dircache_entry *entry;
-    
+    uint32_t entry;
+
     if (block_until_ready())
         return ;
-        
+
     logf("rmdir: %s", path);
-    entry = dircache_get_entry(path, true, true);
-    if (entry == NULL)
+    entry = dircache_get_entry(path);
+    if (entry == 0)
     {
         logf("not found!");
         dircache_initialized = false;
         return ;
     }
 
-    entry->down = NULL;
-    entry->name_len = 0;
+    get_node(entry)->down = 0;
+    get_node(entry)->name |= DIRCACHE_NODE_REMOVED;
 }
 
 /* Remove a file from cache */
 void dircache_remove(const char *name)
 { /* Test ok. */
-    struct dircache_entry *entry;
-    
+    uint32_t entry;
+
     if (block_until_ready())
         return ;
-        
+
     logf("remove: %s", name);
-    
-    entry = dircache_get_entry(name, false, false);
 
-    if (entry == NULL)
+    entry = dircache_get_entry(name);
+
+    if (entry == 0)
     {
         logf("not found!");
         dircache_initialized = false;
         return ;
     }
-    
-    entry->name_len = 0;
+
+    get_node(entry)->name |= DIRCACHE_NODE_REMOVED;
 }
 
 void dircache_rename(const char *oldpath, const char *newpath)
 { /* Test ok. */
-    struct dircache_entry *entry, *newentry;
-    struct dircache_entry oldentry;
+    uint32_t entry, newentry, down, idx;
+    struct dircache_fileinfo oldinfo;
     char absolute_path[MAX_PATH*2];
     char *p;
-    
+
     if (block_until_ready())
         return ;
-        
+
     logf("rename: %s->%s", oldpath, newpath);
-    
-    entry = dircache_get_entry(oldpath, true, false);
-    if (entry == NULL)
+
+    entry = dircache_get_entry(oldpath);
+    if (entry == 0)
     {
         logf("not found!");
         dircache_initialized = false;
@@ -1135,11 +1847,12 @@ void dircache_rename(const char *oldpath, const char *newpath)
     }
 
     /* Delete the old entry. */
-    entry->name_len = 0;
+    get_node(entry)->name |= DIRCACHE_NODE_REMOVED;
 
     /** If we rename the same filename twice in a row, we need to
      * save the data, because the entry will be re-used. */
-    oldentry = *entry;
+    oldinfo = *get_info(entry);
+    down = get_node(entry)->down;
 
     /* Generate the absolute path for destination if necessary. */
     if (newpath[0] != '/')
@@ -1152,44 +1865,45 @@ void dircache_rename(const char *oldpath, const char *newpath)
             dircache_initialized = false;
             return ;
         }
-        
+
         *p = '\0';
         strlcpy(p, absolute_path, sizeof(absolute_path)-strlen(p));
         newpath = absolute_path;
     }
-    
-    newentry = dircache_new_entry(newpath, entry->attribute);
-    if (newentry == NULL)
+
+    newentry = dircache_new_entry(newpath, oldinfo.attribute);
+    if (newentry == 0)
     {
         dircache_initialized = false;
         return ;
     }
 
-    newentry->down = oldentry.down;
-    newentry->size = oldentry.size;
-    newentry->startcluster = oldentry.startcluster;
-    newentry->wrttime = oldentry.wrttime;
-    newentry->wrtdate = oldentry.wrtdate;
+    /* Move the children over so their paths follow the new name. */
+    get_node(newentry)->down = down;
+    for (idx = down; idx != 0; idx = get_node(idx)->next)
+        get_node(idx)->up = newentry;
+
+    *get_info(newentry) = oldinfo;
 }
 
 void dircache_add_file(const char *path, long startcluster)
 {
-    struct dircache_entry *entry;
-    
+    uint32_t entry;
+
     if (block_until_ready())
         return ;
-    
+
     logf("add file: %s", path);
     entry = dircache_new_entry(path, 0);
-    if (entry == NULL)
+    if (entry == 0)
         return ;
-    
-    entry->startcluster = startcluster;
+
+    get_info(entry)->startcluster = startcluster;
 }
 
 DIR_CACHED* opendir_cached(const char* name)
 {
-    struct dircache_entry *cache_entry;
+    uint32_t cache_entry;
     int dd;
     DIR_CACHED* pdir = opendirs;
 
@@ -1211,35 +1925,39 @@ DIR_CACHED* opendir_cached(const char* name)
         return NULL;
     }
 
+    pdir->internal_entry = -1;
     if (!dircache_initialized)
     {
         pdir->regulardir = opendir_uncached(name);
         if (!pdir->regulardir)
             return NULL;
-        
+
         pdir->busy = true;
         return pdir;
     }
-    
+
     pdir->busy = true;
     pdir->regulardir = NULL;
-    cache_entry = dircache_get_entry(name, false, true);
-    pdir->entry = cache_entry;
+    cache_entry = dircache_get_entry(name);
 
-    if (cache_entry == NULL)
+    if (cache_entry == 0
+        || !(get_info(cache_entry)->attribute & ATTR_DIRECTORY))
     {
         pdir->busy = false;
         return NULL;
     }
 
+    pdir->entry = get_node(cache_entry)->down;
     return pdir;
 }
 
 struct dircache_entry* readdir_cached(DIR_CACHED* dir)
 {
     struct dirent_uncached *regentry;
-    struct dircache_entry *ce;
-    
+    struct dircache_node *node;
+    struct dircache_fileinfo *info;
+    uint32_t idx;
+
     if (!dir->busy)
         return NULL;
 
@@ -1256,33 +1974,32 @@ struct dircache_entry* readdir_cached(DIR_CACHED* dir)
         dir->secondary_entry.wrttime = regentry->wrttime;
         dir->secondary_entry.wrtdate = regentry->wrtdate;
         dir->secondary_entry.next = NULL;
-        
+
         return &dir->secondary_entry;
     }
-        
+
     do {
-        if (dir->entry == NULL)
+        idx = dir->entry;
+        if (idx == 0)
             return NULL;
 
-        ce = dir->entry;
-        if (ce->name_len == 0)
-            dir->entry = ce->next;
-    } while (ce->name_len == 0) ;
-
-    dir->entry = ce->next;
-
-    strlcpy(dir->secondary_entry.d_name, ce->d_name, MAX_PATH);
-    /* Can't do `dir->secondary_entry = *ce`
-       because that modifies the d_name pointer. */
-    dir->secondary_entry.size = ce->size;
-    dir->secondary_entry.startcluster = ce->startcluster;
-    dir->secondary_entry.attribute = ce->attribute;
-    dir->secondary_entry.wrttime = ce->wrttime;
-    dir->secondary_entry.wrtdate = ce->wrtdate;
+        node = get_node(idx);
+        dir->entry = node->next;
+    } while (is_removed(node)) ;
+
+    info = get_info(idx);
+    strlcpy(dir->secondary_entry.d_name, get_name(node), MAX_PATH);
+    /* Directories keep the checksum of their listing in the size. */
+    dir->secondary_entry.size =
+        (info->attribute & ATTR_DIRECTORY) ? 0 : info->size;
+    dir->secondary_entry.startcluster = info->startcluster;
+    dir->secondary_entry.attribute = info->attribute;
+    dir->secondary_entry.wrttime = info->wrttime;
+    dir->secondary_entry.wrtdate = info->wrtdate;
     dir->secondary_entry.next = NULL;
-    dir->internal_entry = ce;
+    dir->internal_entry = idx;
 
-    //logf("-> %s", ce->name);
+    //logf("-> %s", get_name(node));
     return &dir->secondary_entry;
 }
 
@@ -1290,11 +2007,11 @@ int closedir_cached(DIR_CACHED* dir)
 {
     if (!dir->busy)
         return -1;
-        
+
     dir->busy=false;
     if (dir->regulardir != NULL)
         return closedir_uncached(dir->regulardir);
-    
+
     return 0;
 }
 
@@ -36,11 +36,24 @@
   cache for each open file. This way we can provide byte access without
   having to re-read the sector each time. 
   The penalty is the RAM used for the cache and slightly more complex code.
+
+  Files opened read-only use a bigger cache as a read-ahead window, filled
+  with one storage command. Whole sectors not in the window are read
+  straight into the caller's buffer.
 */
 
+#if MEM >= 8 && !defined(BOOTLOADER)
+#define READAHEAD_SECTORS 4
+#else
+#define READAHEAD_SECTORS 1
+#endif
+
 struct filedesc {
-    unsigned char cache[SECTOR_SIZE];
+    unsigned char cache[READAHEAD_SECTORS*SECTOR_SIZE];
     int cacheoffset; /* invariant: 0 <= cacheoffset <= SECTOR_SIZE */
+    long cachesector; /* read-only: first sector in the window */
+    int cachecount;   /* read-only: number of sectors in the window */
+    long fatsector;   /* read-only: sector the fat_file is positioned at */
     long fileoffset;
     long size;
     int attr;
@@ -53,6 +66,9 @@ struct filedesc {
 
 static struct filedesc openfiles[MAX_OPEN_FILES];
 
+/* for the debug screen */
+static unsigned long bytes_read;
+
 static int flush_cache(int fd);
 
 int creat(const char *pathname)
@@ -107,12 +123,12 @@ static int open_internal(const char* pathname, int flags, bool use_cache)
 #ifdef HAVE_DIRCACHE
     if (dircache_is_enabled() && !file->write && use_cache)
     {
-        const struct dircache_entry *ce;
+        const struct dircache_fileinfo *ce;
 # ifdef HAVE_MULTIVOLUME
         int volume = strip_volume(pathname, pathnamecopy);
 # endif
 
-        ce = dircache_get_entry_ptr(pathname);
+        ce = dircache_get_fileinfo(dircache_get_entry_id(pathname));
         if (!ce)
         {
             errno = ENOENT;
@@ -250,6 +266,10 @@ int close(int fd)
         return -2;
     }
     if (file->write) {
+        /* give back what fpreallocate() reserved but wasn't written */
+        rc = fat_release_unused(&(file->fatfile), file->size);
+        if (rc < 0)
+            DEBUGF("Failed releasing unused clusters: %d\n", rc);
         rc = fsync(fd);
         if (rc < 0)
             return rc * 10 - 3;
@@ -454,6 +474,35 @@ int ftruncate(int fd, off_t size)
     return 0;
 }
 
+/* Reserves disk space for the file to grow to size bytes, contiguous if
+   possible. The file size doesn't change and close() releases whatever
+   hasn't been written to by then. */
+int fpreallocate(int fd, off_t size)
+{
+    struct filedesc* file = &openfiles[fd];
+    int rc;
+
+    LDEBUGF("fpreallocate(%d, %ld)\n", fd, (long)size);
+
+    if (fd < 0 || fd > MAX_OPEN_FILES-1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!file->busy || !file->write) {
+        errno = EBADF;
+        return -2;
+    }
+
+    rc = fat_preallocate(&(file->fatfile),
+                         (size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    if (rc < 0) {
+        errno = ENOSPC;
+        return rc * 10 - 3;
+    }
+
+    return 0;
+}
+
 static int flush_cache(int fd)
 {
     int rc;
@@ -481,6 +530,66 @@ static int flush_cache(int fd)
     return 0;
 }
 
+/* Reads from a read-only file through the read-ahead window */
+static long read_window(struct filedesc* file, unsigned char* buf, long count)
+{
+    long nread = 0;
+    int rc;
+
+    while (count > 0) {
+        long sector = file->fileoffset / SECTOR_SIZE;
+        long n;
+
+        if (sector >= file->cachesector &&
+            sector < file->cachesector + file->cachecount) {
+            long offs = file->fileoffset - file->cachesector * SECTOR_SIZE;
+            n = MIN(count, file->cachecount * SECTOR_SIZE - offs);
+            memcpy(buf + nread, file->cache + offs, n);
+        }
+        else {
+            if (sector != file->fatsector) {
+                rc = fat_seek(&(file->fatfile), sector);
+                if (rc < 0) {
+                    file->fatsector = -1;
+                    errno = EIO;
+                    return nread ? nread : rc * 10 - 1;
+                }
+                file->fatsector = sector;
+            }
+
+            if (file->fileoffset % SECTOR_SIZE == 0 && count >= SECTOR_SIZE) {
+                /* whole sectors, no need for the window */
+                rc = fat_readwrite(&(file->fatfile), count / SECTOR_SIZE,
+                                   buf + nread, false);
+                n = rc * SECTOR_SIZE;
+            }
+            else {
+                rc = fat_readwrite(&(file->fatfile), READAHEAD_SECTORS,
+                                   file->cache, false);
+                file->cachesector = sector;
+                file->cachecount = MAX(rc, 0);
+                n = 0;
+            }
+
+            if (rc <= 0) {
+                DEBUGF("Failed reading sector %ld\n", sector);
+                file->fatsector = -1;
+                file->cachecount = 0;
+                errno = EIO;
+                return nread ? nread : rc * 10 - 2;
+            }
+            file->fatsector += rc;
+        }
+
+        nread += n;
+        count -= n;
+        file->fileoffset += n;
+    }
+
+    bytes_read += nread;
+    return nread;
+}
+
 static int readwrite(int fd, void* buf, long count, bool write)
 {
     long sectors;
@@ -504,6 +613,9 @@ static int readwrite(int fd, void* buf, long count, bool write)
     if (!write && count > file->size - file->fileoffset)
         count = file->size - file->fileoffset;
 
+    if (!file->write)
+        return read_window(file, buf, count);
+
     /* any head bytes? */
     if ( file->cacheoffset != -1 ) {
         int offs = file->cacheoffset;
@@ -715,6 +827,12 @@ off_t lseek(int fd, off_t offset, int whence)
         return -3;
     }
 
+    if (!file->write) {
+        /* reads find their way from the new position */
+        file->fileoffset = pos;
+        return pos;
+    }
+
     /* new sector? */
     newsector = pos / SECTOR_SIZE;
     oldsector = file->fileoffset / SECTOR_SIZE;
@@ -757,6 +875,14 @@ off_t lseek(int fd, off_t offset, int whence)
     return pos;
 }
 
+/* Bytes read from files and storage commands it took, for the debug
+   screen */
+void file_get_read_stats(unsigned long *bytes, unsigned long *commands)
+{
+    *bytes = bytes_read;
+    *commands = fat_get_read_commands();
+}
+
 off_t filesize(int fd)
 {
     struct filedesc* file = &openfiles[fd];
@@ -0,0 +1,217 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include "config.h"
+#include "system.h"
+#include "buffer.h"
+#include "buflib.h"
+#include "core_alloc.h"
+#include "logf.h"
+#ifndef BOOTLOADER
+#include "audio.h"
+#endif
+
+struct buflib_context core_ctx;
+
+/* End of the allocator's buffer. This is where the audio buffer starts,
+   unless someone is still moving audiobuf around by hand. */
+static unsigned char *core_end;
+/* Set while buflib is allocating. Shrink callbacks may free memory then, but
+   the handle table must stay where it is until the allocation is done, so
+   that memory is only given back on the next free or shrink. */
+static bool allocating;
+/* Block that permanent allocations are carved from, and how much of it is
+   handed out */
+static int permanent_handle;
+static size_t permanent_used;
+
+void core_allocator_init(void)
+{
+    buflib_init(&core_ctx, audiobuf, 0);
+    core_end = audiobuf = (unsigned char *)core_ctx.buf_start;
+}
+
+/* Whether audiobuf may be moved up right now */
+static bool core_can_move(void)
+{
+    if (audiobuf != core_end)
+    {
+        logf("core_alloc: audiobuf is borrowed");
+        return false;
+    }
+#ifndef BOOTLOADER
+    /* Playback and recording use the audio buffer until they're stopped */
+    if (audio_status())
+    {
+        logf("core_alloc: audio is busy");
+        return false;
+    }
+#endif
+    return true;
+}
+
+/* Takes size more bytes off the start of the audio buffer */
+static bool core_grow(size_t size)
+{
+    unsigned char *new_end;
+
+    if (!core_can_move())
+        return false;
+
+    new_end = core_end + ALIGN_UP(size, sizeof(union buflib_data));
+    if (new_end > audiobufend)
+        return false;
+
+    buflib_resize(&core_ctx, new_end - (unsigned char *)core_ctx.buf_start);
+    core_end = audiobuf = new_end;
+    return true;
+}
+
+/* Gives whatever isn't used any more back to the audio buffer */
+static void core_trim(void)
+{
+    size_t size;
+
+    if (allocating || audiobuf != core_end)
+        return;
+
+    size = buflib_resize(&core_ctx, 0);
+    core_end = audiobuf = (unsigned char *)core_ctx.buf_start + size;
+}
+
+int core_alloc_ex(const char *name, size_t size, struct buflib_callbacks *ops)
+{
+    int handle;
+
+    allocating = true;
+    handle = buflib_alloc_ex(&core_ctx, size, name, ops);
+    if (handle <= 0 && core_grow(size + BUFLIB_ALLOC_OVERHEAD))
+        handle = buflib_alloc_ex(&core_ctx, size, name, ops);
+    allocating = false;
+
+    if (handle <= 0)
+    {
+        logf("core_alloc: no room for %s (%lu)", name, (unsigned long)size);
+    }
+
+    return handle;
+}
+
+/* Memory that is never given back is taken off the start of the buffer as
+ * long as the allocator is empty, which costs no header and moves nothing.
+ * Later on it is carved from a pinned block that is extended in place while
+ * it's the last one, so that only a new block pays for a header and handle.
+ */
+void *core_alloc_permanent(size_t size)
+{
+    unsigned char *ret;
+    int handle;
+
+    size = ALIGN_UP(size, sizeof(union buflib_data));
+
+    if (core_ctx.handle_table == core_ctx.buf_start)
+    {
+        if (!core_can_move() || size > (size_t)(audiobufend - core_end))
+            return NULL;
+
+        ret = core_end;
+        buflib_init(&core_ctx, ret + size, 0);
+        core_end = audiobuf = (unsigned char *)core_ctx.buf_start;
+        return ret;
+    }
+
+    if (permanent_handle > 0 &&
+        (buflib_extend(&core_ctx, permanent_handle, permanent_used + size) ||
+         (core_grow(size) &&
+          buflib_extend(&core_ctx, permanent_handle, permanent_used + size))))
+    {
+        ret = (unsigned char *)core_get_data(permanent_handle) + permanent_used;
+        permanent_used += size;
+        return ret;
+    }
+
+    handle = core_alloc_ex("buffer_alloc", size, &buflib_pinned_ops);
+    if (handle <= 0)
+        return NULL;
+
+    permanent_handle = handle;
+    permanent_used = size;
+    return core_get_data(handle);
+}
+
+int core_alloc(const char *name, size_t size)
+{
+    return core_alloc_ex(name, size, NULL);
+}
+
+int core_alloc_maximum(const char *name, size_t *size,
+                       struct buflib_callbacks *ops)
+{
+    int handle;
+
+    core_grow(audiobufend - core_end);
+    allocating = true;
+    handle = buflib_alloc_maximum(&core_ctx, name, size, ops);
+    allocating = false;
+    core_trim();
+
+    return handle;
+}
+
+void core_free(int handle)
+{
+    buflib_free(&core_ctx, handle);
+    core_trim();
+}
+
+bool core_shrink(int handle, size_t new_size)
+{
+    if (!buflib_shrink(&core_ctx, handle, new_size))
+        return false;
+
+    core_trim();
+    return true;
+}
+
+size_t core_allocated(void)
+{
+    return core_end - (unsigned char *)core_ctx.buf_start;
+}
+
+size_t core_available(void)
+{
+    return buflib_available(&core_ctx);
+}
+
+int core_get_next_handle(int handle)
+{
+    return buflib_get_next_handle(&core_ctx, handle);
+}
+
+const char *core_get_name(int handle)
+{
+    return buflib_get_name(&core_ctx, handle);
+}
+
+size_t core_get_size(int handle)
+{
+    return buflib_get_size(&core_ctx, handle);
+}
@@ -52,6 +52,8 @@
 #endif
 
 struct event_queue button_queue;
+/* Events posted from interrupt handlers */
+static struct spsc_queue button_irq_queue;
 
 static long lastbtn;   /* Last valid button status */
 static long last_read; /* Last button status, for debouncing/filtering */
@@ -102,6 +104,16 @@ static int btn_detect_callback(struct timeout *tmo)
 }
 #endif
 
+/* Posts from interrupt context without masking interrupts. The handlers
+   using this must all run on the same core and must not interrupt each
+   other. */
+void button_queue_post_irq(long id, intptr_t data)
+{
+    /* Dropping a release would leave a button stuck, rather wait for the
+       lock when the queue is full */
+    spsc_queue_post_or_queue(&button_irq_queue, id, data);
+}
+
 static void button_tick(void)
 {
     static int count = 0;
@@ -128,7 +140,7 @@ static void button_tick(void)
     btn = remote_control_rx();
     if(btn)
     {
-        queue_post(&button_queue, btn, 0);
+        button_queue_post_irq(btn, 0);
     }
 #endif
 
@@ -156,17 +168,17 @@ static void button_tick(void)
 #ifdef HAVE_REMOTE_LCD
         if(diff & BUTTON_REMOTE)
             if(!skip_remote_release)
-                queue_post(&button_queue, BUTTON_REL | diff, data);
+                button_queue_post_irq(BUTTON_REL | diff, data);
             else
                 skip_remote_release = false;
         else
 #endif
             if(!skip_release)
-                queue_post(&button_queue, BUTTON_REL | diff, data);
+                button_queue_post_irq(BUTTON_REL | diff, data);
             else
                 skip_release = false;
 #else
-        queue_post(&button_queue, BUTTON_REL | diff, data);
+        button_queue_post_irq(BUTTON_REL | diff, data);
 #endif
     }
     else
@@ -243,7 +255,7 @@ static void button_tick(void)
                      * to avoid afterscroll effects. */
                     if (queue_empty(&button_queue))
                     {
-                        queue_post(&button_queue, BUTTON_REPEAT | btn, data);
+                        button_queue_post_irq(BUTTON_REPEAT | btn, data);
 #ifdef HAVE_BACKLIGHT
 #ifdef HAVE_REMOTE_LCD
                         skip_remote_release = false;
@@ -264,7 +276,7 @@ static void button_tick(void)
                             || (remote_type()==REMOTETYPE_H300_NONLCD)
 #endif
                             )
-                            queue_post(&button_queue, btn, data);
+                            button_queue_post_irq(btn, data);
                         else
                             skip_remote_release = true;
                     }
@@ -275,11 +287,11 @@ static void button_tick(void)
                                 || (btn & BUTTON_REMOTE)
 #endif
                            )
-                            queue_post(&button_queue, btn, data);
+                            button_queue_post_irq(btn, data);
                         else
                             skip_release = true;
 #else /* no backlight, nothing to skip */
-                    queue_post(&button_queue, btn, data);
+                    button_queue_post_irq(btn, data);
 #endif
                     post = false;
                 }
@@ -304,6 +316,12 @@ static void button_tick(void)
             count = 0;
         }
     }
+#ifdef HAVE_TICKLESS_IDLE
+    /* Repeats are counted in ticks, so the tick may only stop while no
+       button is held. Presses wake the core through the button interrupt. */
+    if ((btn == BUTTON_NONE) != (lastbtn == BUTTON_NONE))
+        tick_set_deferrable(button_tick, btn == BUTTON_NONE);
+#endif
     lastbtn = btn & ~(BUTTON_REL | BUTTON_REPEAT);
 #ifdef HAVE_BUTTON_DATA
     lastdata = data;
@@ -392,6 +410,7 @@ void button_init(void)
 {
     /* Init used objects first */
     queue_init(&button_queue, true);
+    queue_attach_spsc(&button_queue, &button_irq_queue);
 
 #ifdef HAVE_BUTTON_DATA
     int temp;
@@ -423,6 +442,7 @@ void button_init(void)
 #endif    
     /* Start polling last */
     tick_add_task(button_tick);
+    tick_set_deferrable(button_tick, true);
 }
 
 #ifndef SIMULATOR
@@ -130,6 +130,10 @@ struct fsinfo {
 #define FSINFO_FREECOUNT 488
 #define FSINFO_NEXTFREE  492
 
+/* Size of the per-volume summary of which parts of the FAT have free
+   clusters left */
+#define FAT_FREEMAP_BYTES 512
+
 /* Note: This struct doesn't hold the raw values after mounting if
  * bpb_bytspersec isn't 512. All sector counts are normalized to 512 byte
  * physical sectors. */
@@ -159,6 +163,10 @@ struct bpb
     unsigned long startsector;
     unsigned long dataclusters;
     struct fsinfo fsinfo;
+    /* One bit per group of 1 << freemap_shift FAT sectors. A cleared bit
+       means the group is known to have no free clusters. */
+    unsigned char freemap[FAT_FREEMAP_BYTES];
+    int freemap_shift;
 #ifdef HAVE_FAT16SUPPORT
     int bpb_rootentcnt;  /* Number of dir entries in the root */
     /* internals for FAT16 support */
@@ -184,11 +192,22 @@ static void *cache_fat_sector(IF_MV2(struct bpb* fat_bpb,)
                               long secnum, bool dirty);
 static void create_dos_name(const unsigned char *name, unsigned char *newname);
 static void randomize_dos_name(unsigned char *name);
-static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
-                                       unsigned long start);
+static unsigned long find_free_run(IF_MV2(struct bpb* fat_bpb,)
+                                   unsigned long startcluster,
+                                   unsigned long count,
+                                   unsigned long maxsectors);
 static int transfer(IF_MV2(struct bpb* fat_bpb,) unsigned long start,
                     long count, char* buf, bool write );
 
+/* When a file being written can't continue with the next cluster, this
+   many free clusters in a row are looked for within FAT_RUN_SEARCH
+   sectors of the FAT, to keep the file from fragmenting further */
+#define FAT_WRITE_RUN  16
+#define FAT_RUN_SEARCH 8
+/* fat_preallocate() looks this far for a run that holds everything at
+   once, after that only FAT_RUN_SEARCH sectors for each further piece */
+#define FAT_PREALLOC_SEARCH 128
+
 #define FAT_CACHE_SIZE 0x20
 #define FAT_CACHE_MASK (FAT_CACHE_SIZE-1)
 
@@ -206,6 +225,8 @@ static char fat_cache_sectors[FAT_CACHE_SIZE][SECTOR_SIZE];
 static struct fat_cache_entry fat_cache[FAT_CACHE_SIZE];
 static struct mutex cache_mutex SHAREDBSS_ATTR;
 
+static unsigned long read_commands; /* issued by transfer(), for debug */
+
 #if defined(HAVE_HOTSWAP) && !(CONFIG_STORAGE & STORAGE_MMC) /* A better condition ?? */
 void fat_lock(void)
 {
@@ -414,6 +435,12 @@ int fat_mount(IF_MV2(int volume,) IF_MD2(int drive,) long startsector)
         return rc * 10 - 3;
     }
 
+    /* nothing is known about the free space yet */
+    while ((fat_bpb->fatsize >> fat_bpb->freemap_shift)
+           >= FAT_FREEMAP_BYTES * 8)
+        fat_bpb->freemap_shift++;
+    memset(fat_bpb->freemap, 0xff, FAT_FREEMAP_BYTES);
+
 #ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
     {
@@ -495,6 +522,34 @@ int fat_unmount(int volume, bool flush)
 }
 #endif /* #ifdef HAVE_HOTSWAP */
 
+/* fat_recalc_free() builds the new freemap of a volume aside, so that the
+   old one stays usable meanwhile. Groups that get a free cluster while it
+   runs are noted as well, since it may have scanned them already. */
+static unsigned char recalc_freemap[FAT_FREEMAP_BYTES];
+static unsigned char recalc_freed[FAT_FREEMAP_BYTES];
+static struct bpb* recalc_bpb = NULL;
+
+static inline bool freemap_test(const struct bpb* fat_bpb,
+                                unsigned long fatsector)
+{
+    unsigned long bit = fatsector >> fat_bpb->freemap_shift;
+    return fat_bpb->freemap[bit >> 3] & (1 << (bit & 7));
+}
+
+static inline void freemap_update(struct bpb* fat_bpb,
+                                  unsigned long fatsector, bool hasfree)
+{
+    unsigned long bit = fatsector >> fat_bpb->freemap_shift;
+    if (hasfree)
+    {
+        fat_bpb->freemap[bit >> 3] |= 1 << (bit & 7);
+        if (fat_bpb == recalc_bpb)
+            recalc_freed[bit >> 3] |= 1 << (bit & 7);
+    }
+    else
+        fat_bpb->freemap[bit >> 3] &= ~(1 << (bit & 7));
+}
+
 void fat_recalc_free(IF_MV_NONVOID(int volume))
 {
 #ifndef HAVE_MULTIVOLUME
@@ -503,6 +558,10 @@ void fat_recalc_free(IF_MV_NONVOID(int volume))
     struct bpb* fat_bpb = &fat_bpbs[volume];
     long free = 0;
     unsigned long i;
+
+    memset(recalc_freemap, 0, FAT_FREEMAP_BYTES);
+    memset(recalc_freed, 0, FAT_FREEMAP_BYTES);
+    recalc_bpb = fat_bpb;
 #ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
     {
@@ -516,6 +575,8 @@ void fat_recalc_free(IF_MV_NONVOID(int volume))
 
                 if (letoh16(fat[j]) == 0x0000) {
                     free++;
+                    recalc_freemap[(i >> fat_bpb->freemap_shift) >> 3] |=
+                        1 << ((i >> fat_bpb->freemap_shift) & 7);
                     if ( fat_bpb->fsinfo.nextfree == 0xffffffff )
                         fat_bpb->fsinfo.nextfree = c;
                 }
@@ -535,12 +596,19 @@ void fat_recalc_free(IF_MV_NONVOID(int volume))
 
                 if (!(letoh32(fat[j]) & 0x0fffffff)) {
                     free++;
+                    recalc_freemap[(i >> fat_bpb->freemap_shift) >> 3] |=
+                        1 << ((i >> fat_bpb->freemap_shift) & 7);
                     if ( fat_bpb->fsinfo.nextfree == 0xffffffff )
                         fat_bpb->fsinfo.nextfree = c;
                 }
             }
         }
     }
+
+    for (i = 0; i < FAT_FREEMAP_BYTES; i++)
+        fat_bpb->freemap[i] = recalc_freemap[i] | recalc_freed[i];
+    recalc_bpb = NULL;
+
     fat_bpb->fsinfo.freecount = free;
     update_fsinfo(IF_MV(fat_bpb));
 }
@@ -698,75 +766,120 @@ static void *cache_fat_sector(IF_MV2(struct bpb* fat_bpb,)
     return sectorbuf;
 }
 
-static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
-                                       unsigned long startcluster)
+/* Looks for count free clusters in a row, starting at startcluster and
+   wrapping around at the end of the FAT. Groups of FAT sectors that are
+   known to be full are skipped. If no such run is found within maxsectors
+   FAT sectors, the start of the longest shorter run seen is returned.
+   Returns 0 if no free cluster was found at all. */
+static unsigned long find_free_run(IF_MV2(struct bpb* fat_bpb,)
+                                   unsigned long startcluster,
+                                   unsigned long count,
+                                   unsigned long maxsectors)
 {
 #ifndef HAVE_MULTIVOLUME
     struct bpb* fat_bpb = &fat_bpbs[0];
 #endif
-    unsigned long sector;
-    unsigned long offset;
-    unsigned long i;
+    unsigned long perfatsector = CLUSTERS_PER_FAT_SECTOR;
+    unsigned long groupmask = (1 << fat_bpb->freemap_shift) - 1;
+    unsigned long sector, offset, i;
+    unsigned long runstart = 0, runlen = 0;
+    unsigned long beststart = 0, bestlen = 0;
+    bool groupfull = false;
 
 #ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
-    {
-        sector = startcluster / CLUSTERS_PER_FAT16_SECTOR;
-        offset = startcluster % CLUSTERS_PER_FAT16_SECTOR;
+        perfatsector = CLUSTERS_PER_FAT16_SECTOR;
+#endif
 
-        for (i = 0; i<fat_bpb->fatsize; i++) {
-            unsigned int j;
-            unsigned int nr = (i + sector) % fat_bpb->fatsize;
-            unsigned short* fat = cache_fat_sector(IF_MV2(fat_bpb,) nr, false);
-            if ( !fat )
-                break;
-            for (j = 0; j < CLUSTERS_PER_FAT16_SECTOR; j++) {
-                int k = (j + offset) % CLUSTERS_PER_FAT16_SECTOR;
-                if (letoh16(fat[k]) == 0x0000) {
-                    unsigned int c = nr * CLUSTERS_PER_FAT16_SECTOR + k;
-                     /* Ignore the reserved clusters 0 & 1, and also
-                        cluster numbers out of bounds */
-                    if ( c < 2 || c > fat_bpb->dataclusters+1 )
-                        continue;
-                    LDEBUGF("find_free_cluster(%x) == %x\n",startcluster,c);
-                    fat_bpb->fsinfo.nextfree = c;
-                    return c;
-                }
-            }
-            offset = 0;
+    sector = startcluster / perfatsector;
+    offset = startcluster % perfatsector;
+    if (sector >= fat_bpb->fatsize)
+        sector = offset = 0;
+
+    /* The first sector is visited twice: from offset on at the start and
+       up to offset at the very end. */
+    for (i = 0; i <= fat_bpb->fatsize && i < maxsectors; i++) {
+        unsigned long nr = (i + sector) % fat_bpb->fatsize;
+        unsigned long first = (i == 0) ? offset : 0;
+        unsigned long last = (i == fat_bpb->fatsize) ? offset : perfatsector;
+        unsigned long j;
+        void* fat;
+
+        if (first >= last)
+            continue;
+
+        /* runs don't wrap around the end of the FAT */
+        if (nr == 0)
+            runlen = 0;
+
+        if (!freemap_test(fat_bpb, nr)) {
+            runlen = 0;
+            continue;
         }
-    }
-    else
-#endif /* #ifdef HAVE_FAT16SUPPORT */
-    {
-        sector = startcluster / CLUSTERS_PER_FAT_SECTOR;
-        offset = startcluster % CLUSTERS_PER_FAT_SECTOR;
 
-        for (i = 0; i<fat_bpb->fatsize; i++) {
-            unsigned int j;
-            unsigned long nr = (i + sector) % fat_bpb->fatsize;
-            unsigned long* fat = cache_fat_sector(IF_MV2(fat_bpb,) nr, false);
-            if ( !fat )
-                break;
-            for (j = 0; j < CLUSTERS_PER_FAT_SECTOR; j++) {
-                int k = (j + offset) % CLUSTERS_PER_FAT_SECTOR;
-                if (!(letoh32(fat[k]) & 0x0fffffff)) {
-                    unsigned long c = nr * CLUSTERS_PER_FAT_SECTOR + k;
-                     /* Ignore the reserved clusters 0 & 1, and also
-                        cluster numbers out of bounds */
-                    if ( c < 2 || c > fat_bpb->dataclusters+1 )
-                        continue;
-                    LDEBUGF("find_free_cluster(%lx) == %lx\n",startcluster,c);
-                    fat_bpb->fsinfo.nextfree = c;
-                    return c;
-                }
+        /* only a group whose sectors are all scanned whole can be found to
+           be full, which the partly scanned start sector never is, even if
+           it is the only one */
+        if ((nr & groupmask) == 0)
+            groupfull = true;
+        if (first != 0 || last != perfatsector)
+            groupfull = false;
+
+        fat = cache_fat_sector(IF_MV2(fat_bpb,) nr, false);
+        if ( !fat )
+            break;
+
+        for (j = first; j < last; j++) {
+            unsigned long c = nr * perfatsector + j;
+            bool isfree;
+
+#ifdef HAVE_FAT16SUPPORT
+            if (fat_bpb->is_fat16)
+                isfree = letoh16(((unsigned short*)fat)[j]) == 0x0000;
+            else
+#endif
+                isfree = !(letoh32(((unsigned long*)fat)[j]) & 0x0fffffff);
+
+            /* Ignore the reserved clusters 0 & 1, and also
+               cluster numbers out of bounds */
+            if (!isfree || c < 2 || c > fat_bpb->dataclusters+1) {
+                runlen = 0;
+                continue;
+            }
+
+            groupfull = false;
+            if (runlen++ == 0)
+                runstart = c;
+
+            if (runlen > bestlen) {
+                beststart = runstart;
+                bestlen = runlen;
+                if (bestlen >= count)
+                    goto found;
             }
-            offset = 0;
         }
+
+        if (groupfull && (((nr + 1) & groupmask) == 0 ||
+                          nr + 1 == fat_bpb->fatsize))
+            freemap_update(fat_bpb, nr, false);
+    }
+
+    if (!bestlen) {
+        LDEBUGF("find_free_run(%lx, %ld) == 0\n", startcluster, count);
+        return 0; /* 0 is an illegal cluster number */
     }
 
-    LDEBUGF("find_free_cluster(%lx) == 0\n",startcluster);
-    return 0; /* 0 is an illegal cluster number */
+found:
+    LDEBUGF("find_free_run(%lx, %ld) == %lx\n", startcluster, count,
+            beststart);
+    fat_bpb->fsinfo.nextfree = beststart;
+    return beststart;
+}
+
+static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
+                                       unsigned long startcluster)
+{
+    return find_free_run(IF_MV2(fat_bpb,) startcluster, 1, ~0UL);
 }
 
 static int update_fat_entry(IF_MV2(struct bpb* fat_bpb,) unsigned long entry,
@@ -806,6 +919,7 @@ static int update_fat_entry(IF_MV2(struct bpb* fat_bpb,) unsigned long entry,
         else {
             if (letoh16(sec[offset]))
                 fat_bpb->fsinfo.freecount++;
+            freemap_update(fat_bpb, sector, true);
         }
 
         LDEBUGF("update_fat_entry: %d free clusters\n",
@@ -843,6 +957,7 @@ static int update_fat_entry(IF_MV2(struct bpb* fat_bpb,) unsigned long entry,
         else {
             if (letoh32(sec[offset]) & 0x0fffffff)
                 fat_bpb->fsinfo.freecount++;
+            freemap_update(fat_bpb, sector, true);
         }
 
         LDEBUGF("update_fat_entry: %ld free clusters\n",
@@ -920,6 +1035,105 @@ static long get_next_cluster(IF_MV2(struct bpb* fat_bpb,) long cluster)
         return next_cluster;
 }
 
+/* The extent cache of a file describes its cluster chain from the start
+   as runs of consecutive clusters. It is filled as the chain is followed
+   and only ever grows at the end, so it is always a prefix of the chain. */
+
+/* Returns the cluster with the given clusternum if the extent cache
+   knows it, 0 otherwise */
+static long extent_lookup(const struct fat_file *file, long clusternum)
+{
+    int i;
+
+    for (i = 0; i < file->extentcount; i++) {
+        const struct fat_extent *ext = &file->extents[i];
+        if (clusternum < ext->clusternum + ext->count)
+            return ext->firstcluster + (clusternum - ext->clusternum);
+    }
+
+    return 0;
+}
+
+/* Records that cluster, following prevcluster in the chain, has the
+   given clusternum. Ignored unless it directly continues the cache. */
+static void extent_add(struct fat_file *file, long clusternum,
+                       long prevcluster, long cluster)
+{
+    struct fat_extent *ext;
+
+    /* nothing to do at the end of the chain or in the FAT16 root dir */
+    if (cluster <= 0 || file->firstcluster <= 0)
+        return;
+
+    if (file->extentcount == 0) {
+        file->extents[0].firstcluster = file->firstcluster;
+        file->extents[0].clusternum = 0;
+        file->extents[0].count = 1;
+        file->extentcount = 1;
+        if (clusternum == 0)
+            return;
+    }
+
+    ext = &file->extents[file->extentcount - 1];
+    if (clusternum != ext->clusternum + ext->count ||
+        prevcluster != ext->firstcluster + ext->count - 1)
+        return;
+
+    if (cluster == prevcluster + 1) {
+        ext->count++;
+        return;
+    }
+
+    if (file->extentcount == FAT_MAX_EXTENTS)
+        return;
+
+    ext++;
+    ext->firstcluster = cluster;
+    ext->clusternum = clusternum;
+    ext->count = 1;
+    file->extentcount++;
+}
+
+/* Forgets all clusters after the given clusternum */
+static void extent_trim(struct fat_file *file, long clusternum)
+{
+    while (file->extentcount > 0) {
+        struct fat_extent *ext = &file->extents[file->extentcount - 1];
+        if (clusternum >= ext->clusternum) {
+            ext->count = MIN(ext->count, clusternum - ext->clusternum + 1);
+            break;
+        }
+        file->extentcount--;
+    }
+}
+
+/* Returns the cluster with the given clusternum, prevcluster being the
+   one before it. The FAT is only read if the extent cache can't tell. */
+static long get_file_cluster(IF_MV2(struct bpb* fat_bpb,)
+                             struct fat_file *file, long clusternum,
+                             long prevcluster)
+{
+    long cluster = extent_lookup(file, clusternum);
+
+    if (!cluster) {
+        cluster = get_next_cluster(IF_MV2(fat_bpb,) prevcluster);
+        extent_add(file, clusternum, prevcluster, cluster);
+    }
+
+    return cluster;
+}
+
+/* Returns the chain starting at cluster to the free pool */
+static void free_chain(IF_MV2(struct bpb* fat_bpb,) long cluster)
+{
+    long next;
+
+    for ( ; cluster; cluster = next) {
+        next = get_next_cluster(IF_MV2(fat_bpb,) cluster);
+        update_fat_entry(IF_MV2(fat_bpb,) cluster, 0);
+    }
+}
+
 static int update_fsinfo(IF_MV_NONVOID(struct bpb* fat_bpb))
 {
 #ifndef HAVE_MULTIVOLUME
@@ -1638,6 +1852,8 @@ int fat_open(IF_MV2(int volume,)
     file->clusternum = 0;
     file->sectornum = 0;
     file->eof = false;
+    file->preallocated = false;
+    file->extentcount = 0;
 #ifdef HAVE_MULTIVOLUME
     file->volume = volume;
     /* fixme: remove error check when done */
@@ -1673,6 +1889,8 @@ int fat_create_file(const char* name,
         file->clusternum = 0;
         file->sectornum = 0;
         file->eof = false;
+        file->preallocated = false;
+        file->extentcount = 0;
     }
 
     return rc;
@@ -1749,10 +1967,9 @@ int fat_create_dir(const char* name,
     return rc;
 }
 
-int fat_truncate(const struct fat_file *file)
+int fat_truncate(struct fat_file *file)
 {
     /* truncate trailing clusters */
-    long next;
     long last = file->lastcluster;
 #ifdef HAVE_MULTIVOLUME
     struct bpb* fat_bpb = &fat_bpbs[file->volume];
@@ -1760,16 +1977,162 @@ int fat_truncate(const struct fat_file *file)
 
     LDEBUGF("fat_truncate(%lx, %lx)\n", file->firstcluster, last);
 
-    for ( last = get_next_cluster(IF_MV2(fat_bpb,) last); last; last = next ) {
-        next = get_next_cluster(IF_MV2(fat_bpb,) last);
-        update_fat_entry(IF_MV2(fat_bpb,) last,0);
-    }
+    free_chain(IF_MV2(fat_bpb,) get_next_cluster(IF_MV2(fat_bpb,) last));
     if (file->lastcluster)
         update_fat_entry(IF_MV2(fat_bpb,) file->lastcluster,FAT_EOF_MARK);
 
+    extent_trim(file, file->clusternum);
+    file->preallocated = false;
+
+    return 0;
+}
+
+/* Extends the cluster chain of a file opened for writing so that it holds
+   at least sectorcount sectors, without changing the file size. The new
+   clusters are taken from a single run of free clusters if there is one
+   long enough nearby, otherwise from the longest runs found close to each
+   other. Whatever isn't written to is given back by fat_release_unused(). */
+int fat_preallocate(struct fat_file *file, long sectorcount)
+{
+#ifdef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[file->volume];
+#else
+    struct bpb* fat_bpb = &fat_bpbs[0];
+#endif
+    long count = (sectorcount + fat_bpb->bpb_secperclus - 1) /
+                 fat_bpb->bpb_secperclus;
+    long cluster = file->firstcluster;
+    long clusternum = 0;
+    long next;
+    unsigned long start;
+    unsigned long maxsectors = FAT_PREALLOC_SEARCH;
+
+    LDEBUGF("fat_preallocate(%lx, %ld)\n", file->firstcluster, sectorcount);
+
+#ifdef HAVE_FAT16SUPPORT
+    if (cluster < 0)
+        return -1; /* the root dir can't grow */
+#endif
+
+    /* find the end of the chain, clusternum ends up as its length */
+    if (cluster) {
+        while ((next = get_file_cluster(IF_MV2(fat_bpb,) file,
+                                        clusternum + 1, cluster))) {
+            cluster = next;
+            clusternum++;
+        }
+        clusternum++;
+    }
+
+    while (clusternum < count) {
+        start = cluster ? (unsigned long)cluster + 1
+                        : fat_bpb->fsinfo.nextfree;
+        /* the longest run in the window is taken even if it is too short,
+           so that a fragmented FAT isn't searched again for every hole */
+        next = find_free_run(IF_MV2(fat_bpb,) start, count - clusternum,
+                             maxsectors);
+        maxsectors = FAT_RUN_SEARCH;
+        if (!next)
+            next = find_free_cluster(IF_MV2(fat_bpb,) start);
+        if (!next) {
+            DEBUGF("fat_preallocate(): Disk full!\n");
+            flush_fat(IF_MV(fat_bpb));
+            return -2;
+        }
+
+        /* take as much of the run as is needed */
+        do {
+            if (cluster)
+                update_fat_entry(IF_MV2(fat_bpb,) cluster, next);
+            else
+                file->firstcluster = next;
+            update_fat_entry(IF_MV2(fat_bpb,) next, FAT_EOF_MARK);
+            extent_add(file, clusternum, cluster, next);
+            file->preallocated = true;
+            cluster = next++;
+            clusternum++;
+        } while (clusternum < count &&
+                 (unsigned long)next <= fat_bpb->dataclusters + 1 &&
+                 read_fat_entry(IF_MV2(fat_bpb,) next) == 0);
+    }
+
+    return flush_fat(IF_MV(fat_bpb));
+}
+
+/* Frees the clusters fat_preallocate() reserved beyond size bytes. Must
+   only be called when the file is finished with, the position of the
+   file is not kept valid. */
+int fat_release_unused(struct fat_file *file, long size)
+{
+#ifdef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[file->volume];
+#else
+    struct bpb* fat_bpb = &fat_bpbs[0];
+#endif
+    long clustersize = fat_bpb->bpb_secperclus * SECTOR_SIZE;
+    long count = (size + clustersize - 1) / clustersize;
+    long cluster = file->firstcluster;
+    long clusternum;
+    long next;
+
+    if (!file->preallocated)
+        return 0;
+
+    LDEBUGF("fat_release_unused(%lx, %ld)\n", file->firstcluster, size);
+
+    file->preallocated = false;
+
+    if (!count) {
+        free_chain(IF_MV2(fat_bpb,) cluster);
+        file->firstcluster = 0;
+        file->extentcount = 0;
+        return 0;
+    }
+
+    for (clusternum = 1; clusternum < count && cluster; clusternum++)
+        cluster = get_file_cluster(IF_MV2(fat_bpb,) file, clusternum, cluster);
+
+    if (!cluster)
+        return -1; /* chain shorter than the file */
+
+    next = get_next_cluster(IF_MV2(fat_bpb,) cluster);
+    if (next) {
+        update_fat_entry(IF_MV2(fat_bpb,) cluster, FAT_EOF_MARK);
+        free_chain(IF_MV2(fat_bpb,) next);
+        extent_trim(file, count - 1);
+    }
+
     return 0;
 }
 
+unsigned long fat_get_read_commands(void)
+{
+    return read_commands;
+}
+
+/* Counts the runs of consecutive clusters the chain starting at
+   startcluster is made of (for the debug screen) */
+long fat_fragments(IF_MV2(int volume,) long startcluster)
+{
+#ifdef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[volume];
+#endif
+    long cluster, next;
+    long count = 1;
+
+    if (startcluster <= 0)
+        return 0;
+
+    for (cluster = startcluster;
+         (next = get_next_cluster(IF_MV2(fat_bpb,) cluster));
+         cluster = next) {
+        if (next != cluster + 1)
+            count++;
+    }
+
+    return count;
+}
+
 int fat_closewrite(struct fat_file *file, long size, int attr)
 {
     int rc;
@@ -1781,8 +2144,10 @@ int fat_closewrite(struct fat_file *file, long size, int attr)
     if (!size) {
         /* empty file */
         if ( file->firstcluster ) {
-            update_fat_entry(IF_MV2(fat_bpb,) file->firstcluster, 0);
+            free_chain(IF_MV2(fat_bpb,) file->firstcluster);
             file->firstcluster = 0;
+            file->extentcount = 0;
+            file->preallocated = false;
         }
     }
 
@@ -1813,7 +2178,8 @@ int fat_closewrite(struct fat_file *file, long size, int attr)
         len = count * fat_bpb->bpb_secperclus * SECTOR_SIZE;
         LDEBUGF("File is %ld clusters (chainlen=%ld, size=%ld)\n",
                 count, len, size );
-        if ( len > size + fat_bpb->bpb_secperclus * SECTOR_SIZE)
+        if ( len > size + fat_bpb->bpb_secperclus * SECTOR_SIZE &&
+             !file->preallocated )
             panicf("Cluster chain is too long\n");
         if ( len < size )
             panicf("Cluster chain is too short\n");
@@ -1888,7 +2254,7 @@ static int free_direntries(struct fat_file* file)
 
 int fat_remove(struct fat_file* file)
 {
-    long next, last = file->firstcluster;
+    long last = file->firstcluster;
     int rc;
 #ifdef HAVE_MULTIVOLUME
     struct bpb* fat_bpb = &fat_bpbs[file->volume];
@@ -1896,11 +2262,7 @@ int fat_remove(struct fat_file* file)
 
     LDEBUGF("fat_remove(%lx)\n",last);
 
-    while ( last ) {
-        next = get_next_cluster(IF_MV2(fat_bpb,) last);
-        update_fat_entry(IF_MV2(fat_bpb,) last,0);
-        last = next;
-    }
+    free_chain(IF_MV2(fat_bpb,) last);
 
     if ( file->dircluster ) {
         rc = free_direntries(file);
@@ -2023,6 +2385,7 @@ int fat_rename(struct fat_file* file,
 
 static long next_write_cluster(struct fat_file* file,
                               long oldcluster,
+                              long clusternum,
                               long* newsector)
 {
 #ifdef HAVE_MULTIVOLUME
@@ -2036,14 +2399,32 @@ static long next_write_cluster(struct fat_file* file,
     LDEBUGF("next_write_cluster(%lx,%lx)\n",file->firstcluster, oldcluster);
 
     if (oldcluster)
-        cluster = get_next_cluster(IF_MV2(fat_bpb,) oldcluster);
+        cluster = get_file_cluster(IF_MV2(fat_bpb,) file, clusternum,
+                                   oldcluster);
+    else if (clusternum == 0)
+        cluster = file->firstcluster; /* may have been preallocated */
 
     if (!cluster) {
-        if (oldcluster > 0)
-            cluster = find_free_cluster(IF_MV2(fat_bpb,) oldcluster+1);
-        else if (oldcluster == 0)
-            cluster = find_free_cluster(IF_MV2(fat_bpb,)
-                                        fat_bpb->fsinfo.nextfree);
+        if (oldcluster > 0) {
+            /* continue right behind the file if possible, otherwise look
+               for a run that gives the file room to grow */
+            if ((unsigned long)oldcluster + 1 <= fat_bpb->dataclusters + 1 &&
+                read_fat_entry(IF_MV2(fat_bpb,) oldcluster + 1) == 0)
+                cluster = oldcluster + 1;
+            else
+                cluster = find_free_run(IF_MV2(fat_bpb,) oldcluster + 1,
+                                        FAT_WRITE_RUN, FAT_RUN_SEARCH);
+            if (!cluster)
+                cluster = find_free_cluster(IF_MV2(fat_bpb,) oldcluster+1);
+        }
+        else if (oldcluster == 0) {
+            cluster = find_free_run(IF_MV2(fat_bpb,)
+                                    fat_bpb->fsinfo.nextfree,
+                                    FAT_WRITE_RUN, FAT_RUN_SEARCH);
+            if (!cluster)
+                cluster = find_free_cluster(IF_MV2(fat_bpb,)
+                                            fat_bpb->fsinfo.nextfree);
+        }
 #ifdef HAVE_FAT16SUPPORT
         else /* negative, pseudo-cluster of the root dir */
             return 0; /* impossible to append something to the root */
@@ -2055,6 +2436,7 @@ static long next_write_cluster(struct fat_file* file,
             else
                 file->firstcluster = cluster;
             update_fat_entry(IF_MV2(fat_bpb,) cluster, FAT_EOF_MARK);
+            extent_add(file, clusternum, oldcluster, cluster);
         }
         else {
 #ifdef TEST_FAT
@@ -2101,9 +2483,11 @@ static int transfer(IF_MV2(struct bpb* fat_bpb,)
         rc = storage_write_sectors(fat_bpb->drive,
                                start + fat_bpb->startsector, count, buf);
     }
-    else
+    else {
+        read_commands++;
         rc = storage_read_sectors(fat_bpb->drive,
                               start + fat_bpb->startsector, count, buf);
+    }
     if (rc < 0) {
         DEBUGF( "transfer() - Couldn't %s sector %lx"
                 " (error code %d)\n", 
@@ -2146,14 +2530,21 @@ long fat_readwrite( struct fat_file *file, long sectorcount,
             long oldcluster = cluster;
             long oldsector = sector;
             long oldnumsec = numsec;
+            long oldclusternum = clusternum;
+
+            /* the first cluster of a file is clusternum 0 */
+            if (cluster)
+                clusternum++;
+
             if (write)
-                cluster = next_write_cluster(file, cluster, &sector);
+                cluster = next_write_cluster(file, cluster, clusternum,
+                                             &sector);
             else {
-                cluster = get_next_cluster(IF_MV2(fat_bpb,) cluster);
+                cluster = get_file_cluster(IF_MV2(fat_bpb,) file,
+                                           clusternum, cluster);
                 sector = cluster2sec(IF_MV2(fat_bpb,) cluster);
             }
 
-            clusternum++;
             numsec=1;
 
             if (!cluster) {
@@ -2164,7 +2555,7 @@ long fat_readwrite( struct fat_file *file, long sectorcount,
                     sector = oldsector;
                     cluster = oldcluster;
                     numsec = oldnumsec;
-                    clusternum--;
+                    clusternum = oldclusternum;
                     i = -1; /* Error code */
                     break;
                 }
@@ -2236,9 +2627,9 @@ int fat_seek(struct fat_file *file, unsigned long seeksector )
 #else
     struct bpb* fat_bpb = &fat_bpbs[0];
 #endif
-    long clusternum=0, numclusters=0, sectornum=0, sector=0;
+    long clusternum=0, sectornum=0, sector=0;
     long cluster = file->firstcluster;
-    long i;
+    long i = 0;
 
 #ifdef HAVE_FAT16SUPPORT
     if (cluster < 0) /* FAT16 root dir */
@@ -2250,17 +2641,27 @@ int fat_seek(struct fat_file *file, unsigned long seeksector )
         /* we need to find the sector BEFORE the requested, since
            the file struct stores the last accessed sector */
         seeksector--;
-        numclusters = clusternum = seeksector / fat_bpb->bpb_secperclus;
+        clusternum = seeksector / fat_bpb->bpb_secperclus;
         sectornum = seeksector % fat_bpb->bpb_secperclus;
 
-        if (file->clusternum && clusternum >= file->clusternum)
+        /* start from the closest known cluster before the target, i being
+           its clusternum */
+        if (file->extentcount)
+        {
+            struct fat_extent *ext = &file->extents[file->extentcount - 1];
+            i = MIN(clusternum, ext->clusternum + ext->count - 1);
+            cluster = extent_lookup(file, i);
+        }
+
+        if (file->lastcluster && file->clusternum > i &&
+            clusternum >= file->clusternum)
         {
             cluster = file->lastcluster;
-            numclusters -= file->clusternum;
+            i = file->clusternum;
         }
 
-        for (i=0; i<numclusters; i++) {
-            cluster = get_next_cluster(IF_MV2(fat_bpb,) cluster);
+        for (; i<clusternum; i++) {
+            cluster = get_file_cluster(IF_MV2(fat_bpb,) file, i + 1, cluster);
             if (!cluster) {
                 DEBUGF("Seeking beyond the end of the file! "
                        "(sector %ld, cluster %ld)\n", seeksector, i);
@@ -33,6 +33,7 @@ extern struct event_queue button_queue;
 void button_init (void);
 void button_close(void);
 int button_queue_count(void);
+void button_queue_post_irq(long id, intptr_t data);
 long button_get (bool block);
 long button_get_w_tmo(int ticks);
 intptr_t button_get_data(void);
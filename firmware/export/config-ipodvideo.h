@@ -204,6 +204,12 @@
 /* Define this if you have adjustable CPU frequency */
 #define HAVE_ADJUSTABLE_CPU_FREQ
 
+/* Define this to stop the tick while all cores sleep. Needs buttons that
+   raise an interrupt when pressed. */
+#ifndef BOOTLOADER
+#define HAVE_TICKLESS_IDLE
+#endif
+
 /* Define this if you can read an absolute wheel position */
 #define HAVE_WHEEL_POSITION
 
@@ -69,6 +69,8 @@
 
 #undef INCLUDE_TIMEOUT_API
 
+#undef HAVE_TICKLESS_IDLE
+
 #undef HAVE_FLASHED_ROCKBOX
 
 #undef IPOD_ACCESSORY_PROTOCOL
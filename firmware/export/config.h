@@ -657,6 +657,21 @@ Lyre prototype 1 */
 
 #define HAVE_SEMAPHORE_OBJECTS
 
+#ifndef SIMULATOR
+/* storage requests of all threads are queued, merged and ordered */
+#define HAVE_IO_SCHEDULER
+#endif
+
+#if CONFIG_CODEC == SWCODEC && !defined(SIMULATOR)
+/* per-thread run time, which the CPU governor measures the codec by */
+#define HAVE_THREAD_STATS
+#ifdef DEBUG
+/* wakeup latency and boost accounting, and a trace of scheduling events,
+   for the debug menu */
+#define HAVE_THREAD_TRACE
+#endif
+#endif
+
 #if defined(HAVE_USBSTACK) && CONFIG_USBOTG == USBOTG_ARC
 #define USB_STATUS_BY_EVENT
 #define USB_DETECT_BY_DRV
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#ifndef CORE_ALLOC_H
+#define CORE_ALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "buflib.h"
+
+/* The core allocator sits at the start of the audio buffer and only takes
+ * as much of it as its allocations need: audiobuf always points right after
+ * it. It doesn't grow while audio is playing or recording, and whoever lays
+ * out the audio buffer checks that audiobuf is still where it was. Freeing and shrinking compact the
+ * allocations and give the space back, playback picks it up the next time
+ * it sets up its buffers.
+ *
+ * Allocations are referred to by handle, 0 means the allocation failed.
+ * Like buffer_alloc(), this is meant for the cooperatively scheduled
+ * threads of the main core and isn't locked.
+ */
+
+void core_allocator_init(void);
+
+/* Block that is moved freely, use core_get_data() after anything that may
+ * compact */
+int core_alloc(const char *name, size_t size);
+/* Block with callbacks, &buflib_pinned_ops for one that never moves */
+int core_alloc_ex(const char *name, size_t size,
+                  struct buflib_callbacks *ops);
+/* Memory for buffer_alloc(), never freed or moved. NULL if there's no room */
+void *core_alloc_permanent(size_t size);
+/* Takes all the memory that's left, setting size to the amount */
+int core_alloc_maximum(const char *name, size_t *size,
+                       struct buflib_callbacks *ops);
+void core_free(int handle);
+/* Gives back the end of an allocation */
+bool core_shrink(int handle, size_t new_size);
+
+static inline void *core_get_data(int handle)
+{
+    extern struct buflib_context core_ctx;
+    return buflib_get_data(&core_ctx, handle);
+}
+
+/* Debugging info */
+size_t core_allocated(void);
+size_t core_available(void);
+int core_get_next_handle(int handle);
+const char *core_get_name(int handle);
+size_t core_get_size(int handle);
+
+#endif /* CORE_ALLOC_H */
@@ -63,6 +63,17 @@ struct fat_direntry
 #define FAT_ATTR_ARCHIVE     0x20
 #define FAT_ATTR_VOLUME      0x40 /* this is a volume, not a real directory */
 
+/* Number of cluster runs remembered per open file. Seeking within the
+   part of the chain they cover needs no FAT access. */
+#define FAT_MAX_EXTENTS 8
+
+struct fat_extent
+{
+    long firstcluster;    /* first cluster of the run */
+    long clusternum;      /* clusternum of firstcluster within the file */
+    long count;           /* number of consecutive clusters */
+};
+
 struct fat_file
 {
     long firstcluster;    /* first cluster in file */
@@ -74,9 +85,12 @@ struct fat_file
     unsigned int direntries; /* number of dir entries used by this file */
     long dircluster;      /* first cluster of dir */
     bool eof;
+    bool preallocated;   /* chain may reach beyond the end of the file */
 #ifdef HAVE_MULTIVOLUME
     int volume;          /* file resides on which volume */
 #endif
+    int extentcount;     /* number of valid entries in extents */
+    struct fat_extent extents[FAT_MAX_EXTENTS]; /* known start of the chain */
 };
 
 struct fat_dir
@@ -115,7 +129,11 @@ extern long fat_readwrite(struct fat_file *ent, long sectorcount,
 extern int fat_closewrite(struct fat_file *ent, long size, int attr);
 extern int fat_seek(struct fat_file *ent, unsigned long sector );
 extern int fat_remove(struct fat_file *ent);
-extern int fat_truncate(const struct fat_file *ent);
+extern int fat_truncate(struct fat_file *ent);
+extern int fat_preallocate(struct fat_file *ent, long sectorcount);
+extern int fat_release_unused(struct fat_file *ent, long size);
+extern long fat_fragments(IF_MV2(int volume,) long startcluster); /* debug */
+extern unsigned long fat_get_read_commands(void); /* debug */
 extern int fat_rename(struct fat_file* file, 
                       struct fat_dir* dir,
                       const unsigned char* newname,
@@ -120,12 +120,28 @@ struct queue_sender_list
     (NULL)
 #endif
 
+/* Queue for a single producer that mustn't wait for anything, usually an
+ * interrupt handler, and a single consumer. Posting only publishes the write
+ * index, the events are read by waiting on the event_queue it is attached
+ * to. */
+struct spsc_queue
+{
+    struct queue_event events[QUEUE_LENGTH]; /* list of events */
+    volatile unsigned int read;         /* head, moved by the consumer */
+    volatile unsigned int write;        /* tail, moved by the producer */
+    volatile unsigned char waiting;     /* consumer is blocked or blocking */
+    unsigned char overflow;             /* posting to q until it is read */
+    unsigned int dropped;               /* events lost because it was full */
+    struct event_queue *q;              /* queue waited on for the events */
+};
+
 struct event_queue
 {
     struct thread_entry *queue;         /* waiter list */
     struct queue_event events[QUEUE_LENGTH]; /* list of events */
     unsigned int read;                  /* head of queue */
     unsigned int write;                 /* tail of queue */
+    struct spsc_queue *spsc;            /* attached lock-free queue */
 #ifdef HAVE_EXTENDED_MESSAGING_AND_NAME
     struct queue_sender_list *send;     /* list of threads waiting for
                                            reply to an event */
@@ -221,6 +237,37 @@ int tick_add_task(void (*f)(void));
 int tick_remove_task(void (*f)(void));
 extern void tick_start(unsigned int interval_in_ms);
 
+#ifdef HAVE_TICKLESS_IDLE
+/* Longest stretch the tick is stopped for while idle, deferrable tasks run
+   at least this often */
+#define TICK_IDLE_MAX (HZ/2)
+/* A deferrable task copes with current_tick advancing by more than one
+ * between calls. The tick is only stopped while every task is deferrable. */
+int tick_set_deferrable(void (*f)(void), bool deferrable);
+/* Called by the scheduler with interrupts disabled when all cores are about
+   to sleep, deadline being the tick the next thread timeout is due */
+void tick_idle_enter(long deadline);
+/* Implemented by the target */
+void tick_idle_stop(long ticks);
+void tick_idle_restart(void);
+
+/* Counted since boot, for the debug menu */
+struct tick_idle_stats
+{
+    unsigned long entries;  /* Times all cores were about to sleep */
+    unsigned long kept;     /* Times a tick task needed every tick then */
+    unsigned long stops;    /* Times the tick was stopped */
+    unsigned long skipped;  /* Ticks that went by while it was */
+};
+extern struct tick_idle_stats tick_idle_stats;
+#else
+static inline int tick_set_deferrable(void (*f)(void), bool deferrable)
+{
+    (void)f; (void)deferrable;
+    return 0;
+}
+#endif /* HAVE_TICKLESS_IDLE */
+
 #ifdef INCLUDE_TIMEOUT_API
 struct timeout;
 
@@ -228,14 +275,16 @@ struct timeout;
  * tmo - pointer to struct timeout associated with event
  * return next interval or <= 0 to stop event
  */
-#define MAX_NUM_TIMEOUTS 8
 typedef int (* timeout_cb_type)(struct timeout *tmo);
 
+/* Must start out zeroed - declare it static */
 struct timeout
 {
     timeout_cb_type callback;/* callback - returning false cancels */
     intptr_t        data;    /* data passed to callback */
     long            expires; /* expiration tick */
+    struct timeout  *next;   /* next in its timer wheel slot */
+    struct timeout  **pprev; /* link pointing at it, NULL if not pending */
 };
 
 void timeout_register(struct timeout *tmo, timeout_cb_type callback,
@@ -264,6 +313,10 @@ extern intptr_t queue_send(struct event_queue *q, long id, intptr_t data);
 extern void queue_reply(struct event_queue *q, intptr_t retval);
 extern bool queue_in_queue_send(struct event_queue *q);
 #endif /* HAVE_EXTENDED_MESSAGING_AND_NAME */
+extern void queue_attach_spsc(struct event_queue *q, struct spsc_queue *sq);
+extern bool spsc_queue_post(struct spsc_queue *sq, long id, intptr_t data);
+extern void spsc_queue_post_or_queue(struct spsc_queue *sq, long id,
+                                     intptr_t data);
 extern bool queue_empty(const struct event_queue* q);
 extern bool queue_peek(struct event_queue *q, struct queue_event *ev);
 extern void queue_clear(struct event_queue* q);
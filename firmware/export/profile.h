@@ -44,4 +44,21 @@ void __cyg_profile_func_exit(void *this_fn, void *call_site)
 void __cyg_profile_func_enter(void *this_fn, void *call_site)
   NO_PROF_ATTR ICODE_ATTR;
 
+/* Sampling profiler - needs no instrumented code. A timer interrupt on the
+ * calling core records where it interrupted the code (PC, and LR as the
+ * likely caller) into a ring buffer holding the most recent samples. */
+#define PROFILE_SAMPLE_HZ 1000
+#define PROFILE_SAMPLES   8192 /* must be a power of 2 */
+
+/* Start sampling on the current core */
+void profsample_start(void)
+  NO_PROF_ATTR;
+/* Stop and write the samples to /profile_samples.out */
+void profsample_stop(void)
+  NO_PROF_ATTR;
+
+/* Set by the target interrupt handler to where it interrupted the code,
+   before calling the timer handler */
+extern void *profile_irq_pc;
+
 #endif /*_SYS_PROFILE_H*/
@@ -65,10 +65,10 @@ struct storage_info
 		#define storage_sleepnow() ata_sleepnow()
 		#define storage_disk_is_active() ata_disk_is_active()
 		#define storage_soft_reset() ata_soft_reset()
-		#define storage_init() ata_init()
+		#define storage_driver_init() ata_init()
 		#define storage_close() ata_close()
-		#define storage_read_sectors(drive, start, count, buf) ata_read_sectors(IF_MD2(drive,) start, count, buf)
-		#define storage_write_sectors(drive, start, count, buf) ata_write_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_read_sectors(drive, start, count, buf) ata_read_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_write_sectors(drive, start, count, buf) ata_write_sectors(IF_MD2(drive,) start, count, buf)
         #ifdef HAVE_STORAGE_FLUSH
             #define storage_flush() (void)0
         #endif
@@ -92,9 +92,9 @@ struct storage_info
 		#define storage_sleepnow() sd_sleepnow()
 		#define storage_disk_is_active() 0
 		#define storage_soft_reset() (void)0
-		#define storage_init() sd_init()
-		#define storage_read_sectors(drive, start, count, buf) sd_read_sectors(IF_MD2(drive,) start, count, buf)
-		#define storage_write_sectors(drive, start, count, buf) sd_write_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_init() sd_init()
+		#define storage_driver_read_sectors(drive, start, count, buf) sd_read_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_write_sectors(drive, start, count, buf) sd_write_sectors(IF_MD2(drive,) start, count, buf)
         #ifdef HAVE_STORAGE_FLUSH
             #define storage_flush() (void)0
         #endif
@@ -118,9 +118,9 @@ struct storage_info
 		#define storage_sleepnow() mmc_sleepnow()
 		#define storage_disk_is_active() mmc_disk_is_active()
 		#define storage_soft_reset() (void)0
-		#define storage_init() mmc_init()
-		#define storage_read_sectors(drive, start, count, buf) mmc_read_sectors(IF_MD2(drive,) start, count, buf)
-		#define storage_write_sectors(drive, start, count, buf) mmc_write_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_init() mmc_init()
+		#define storage_driver_read_sectors(drive, start, count, buf) mmc_read_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_write_sectors(drive, start, count, buf) mmc_write_sectors(IF_MD2(drive,) start, count, buf)
         #ifdef HAVE_STORAGE_FLUSH
             #define storage_flush() (void)0
         #endif
@@ -144,9 +144,9 @@ struct storage_info
 		#define storage_sleepnow() nand_sleepnow()
 		#define storage_disk_is_active() 0
 		#define storage_soft_reset() (void)0
-		#define storage_init() nand_init()
-		#define storage_read_sectors(drive, start, count, buf) nand_read_sectors(IF_MD2(drive,) start, count, buf)
-		#define storage_write_sectors(drive, start, count, buf) nand_write_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_init() nand_init()
+		#define storage_driver_read_sectors(drive, start, count, buf) nand_read_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_write_sectors(drive, start, count, buf) nand_write_sectors(IF_MD2(drive,) start, count, buf)
         #ifdef HAVE_STORAGE_FLUSH
 		    #define storage_flush() nand_flush()
         #endif
@@ -170,9 +170,9 @@ struct storage_info
 		#define storage_sleepnow() ramdisk_sleepnow()
 		#define storage_disk_is_active() 0
 		#define storage_soft_reset() (void)0
-		#define storage_init() ramdisk_init()
-		#define storage_read_sectors(drive, start, count, buf) ramdisk_read_sectors(IF_MD2(drive,) start, count, buf)
-		#define storage_write_sectors(drive, start, count, buf) ramdisk_write_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_init() ramdisk_init()
+		#define storage_driver_read_sectors(drive, start, count, buf) ramdisk_read_sectors(IF_MD2(drive,) start, count, buf)
+		#define storage_driver_write_sectors(drive, start, count, buf) ramdisk_write_sectors(IF_MD2(drive,) start, count, buf)
         #ifdef HAVE_STORAGE_FLUSH
             #define storage_flush() (void)0
         #endif
@@ -217,4 +217,45 @@ bool storage_present(int drive);
 #endif
 
 #endif /* NOT CONFIG_STORAGE_MULTI and NOT SIMULATOR*/
+
+#ifndef SIMULATOR
+#ifdef CONFIG_STORAGE_MULTI
+int storage_driver_read_sectors(int drive, unsigned long start, int count, void* buf);
+int storage_driver_write_sectors(int drive, unsigned long start, int count, const void* buf);
+#endif
+
+#ifdef HAVE_IO_SCHEDULER
+#ifndef CONFIG_STORAGE_MULTI
+int storage_init(void);
+#endif
+int storage_sched_read_sectors(IF_MD2(int drive,) unsigned long start,
+                               int count, void* buf);
+int storage_sched_write_sectors(IF_MD2(int drive,) unsigned long start,
+                                int count, const void* buf);
+#define storage_read_sectors(drive, start, count, buf) \
+    storage_sched_read_sectors(IF_MD2(drive,) start, count, buf)
+#define storage_write_sectors(drive, start, count, buf) \
+    storage_sched_write_sectors(IF_MD2(drive,) start, count, buf)
+
+struct storage_sched_stats
+{
+    int depth;                   /* requests queued right now */
+    int max_depth;               /* most requests queued at once */
+    unsigned long requests;      /* requests made */
+    unsigned long prio_requests; /* requests from playback critical threads */
+    unsigned long commands;      /* commands given to the driver */
+    unsigned long merged;        /* requests done by another's command */
+};
+
+void storage_get_sched_stats(struct storage_sched_stats *stats);
+#else /* !HAVE_IO_SCHEDULER */
+#ifndef CONFIG_STORAGE_MULTI
+#define storage_init() storage_driver_init()
+#endif
+#define storage_read_sectors(drive, start, count, buf) \
+    storage_driver_read_sectors(drive, start, count, buf)
+#define storage_write_sectors(drive, start, count, buf) \
+    storage_driver_write_sectors(drive, start, count, buf)
+#endif /* HAVE_IO_SCHEDULER */
+#endif /* !SIMULATOR */
 #endif
@@ -205,6 +205,14 @@ int get_cpu_boost_counter(void);
 #define UNLIKELY(x) (x)
 #endif
 
+/* Keeps memory accesses from being moved across it. The targets don't
+ * reorder them by themselves, the hosts the simulator runs on do. */
+#if defined(SIMULATOR) || defined(__PCTOOL__)
+#define memory_barrier() __sync_synchronize()
+#else
+#define memory_barrier() asm volatile ("" : : : "memory")
+#endif
+
 /* returns index of first set bit + 1 or 0 if no bits are set */
 int find_first_set_bit(uint32_t val);
 
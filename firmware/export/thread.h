@@ -186,6 +186,18 @@ struct corelock
     ({ test_and_set(&(cl)->locked, 1) ? 0 : 1; })
 #define corelock_unlock(cl) \
     ({ (cl)->locked = 0; })
+#elif defined(SIMULATOR)
+/* Kernel objects take the host kernel lock instead when the simulator
+   runs its threads concurrently */
+void sim_kernel_lock(void);
+void sim_kernel_unlock(void);
+#define corelock_init(cl)
+#define corelock_lock(cl) \
+    sim_kernel_lock()
+#define corelock_try_lock(cl) \
+    ({ sim_kernel_lock(); 1; })
+#define corelock_unlock(cl) \
+    sim_kernel_unlock()
 #else
 /* No atomic corelock op needed or just none defined */
 #define corelock_init(cl)
@@ -330,13 +342,18 @@ struct core_entry
 {
     /* "Active" lists - core is constantly active on these and are never
        locked and interrupts do not access them */
-    struct thread_entry *running;  /* threads that are running (RTR) */
+    struct thread_entry *running;  /* thread that is running, NULL if none
+                                      is ready to run. Without priority
+                                      scheduling also the head of the RTR
+                                      list */
     struct thread_entry *timeout;  /* threads that are on a timeout before
                                       running again */
     struct thread_entry *block_task; /* Task going off running list */
 #ifdef HAVE_PRIORITY_SCHEDULING
     struct priority_distribution rtr; /* Summary of running and ready-to-run
                                          threads */
+    struct thread_entry *rtr_threads[NUM_PRIORITIES]; /* RTR threads of each
+                                         priority, head runs next */
 #endif
     long next_tmo_check;           /* soonest time to check tmo threads */
 #if NUM_CORES > 1
@@ -546,8 +563,10 @@ unsigned int thread_get_current(void);
 
 /* Debugging info - only! */
 int thread_stack_usage(const struct thread_entry *thread);
+size_t thread_stack_peak(const struct thread_entry *thread);
 #if NUM_CORES > 1
 int idle_stack_usage(unsigned int core);
+size_t idle_stack_peak(unsigned int core);
 #endif
 void thread_get_name(char *buffer, int size,
                      struct thread_entry *thread);
@@ -555,4 +574,56 @@ void thread_get_name(char *buffer, int size,
 void profile_thread(void);
 #endif
 
+#ifdef HAVE_THREAD_STATS
+/* Scheduler accounting for one thread. Times are in microseconds. */
+struct thread_stats
+{
+    uint64_t run_time;          /* Time spent running */
+    unsigned long switches;     /* Number of times switched in */
+#ifdef HAVE_THREAD_TRACE
+    uint64_t boost_time;        /* Time spent holding a CPU boost */
+    uint64_t wakeup_latency;    /* Sum of the delays from wakeup to running */
+    unsigned long max_wakeup_latency; /* Longest of those */
+    unsigned long wakeups;      /* Number of wakeups */
+#endif
+};
+
+void thread_get_stats(struct thread_entry *thread,
+                      struct thread_stats *stats);
+/* Time covered by the statistics since the last reset */
+uint64_t thread_stats_time(void);
+void thread_reset_stats(void);
+#endif /* HAVE_THREAD_STATS */
+
+#ifdef HAVE_THREAD_TRACE
+/* Ring buffer of scheduling events, dumped by the debug menu */
+#define THREAD_TRACE_SIZE 1024
+
+enum
+{
+    THREAD_TRACE_SWITCH = 0,    /* thread switched in, arg = previous thread */
+    THREAD_TRACE_WAKEUP,        /* thread woken, arg = running thread */
+    THREAD_TRACE_BOOST,         /* thread boosted the CPU */
+    THREAD_TRACE_UNBOOST,       /* thread released its boost */
+};
+
+#define THREAD_TRACE_NONE 0xff  /* arg when there was no thread */
+
+struct thread_trace_event
+{
+    uint32_t time;              /* Microseconds, wraps */
+    uint8_t  type;              /* THREAD_TRACE_* */
+    uint8_t  core;
+    uint8_t  thread;            /* Thread slot */
+    uint8_t  arg;               /* Thread slot or THREAD_TRACE_NONE */
+};
+
+/* Starting clears the buffer, the last THREAD_TRACE_SIZE events are kept */
+void thread_trace_start(void);
+void thread_trace_stop(void);
+bool thread_trace_running(void);
+/* Copies out events, oldest first, and returns how many were copied */
+int thread_trace_read(int pos, struct thread_trace_event *buf, int count);
+#endif /* HAVE_THREAD_TRACE */
+
 #endif /* THREAD_H */
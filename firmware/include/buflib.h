@@ -0,0 +1,122 @@
+/***************************************************************************
+*             __________               __   ___.
+*   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+*   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+*   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+*   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+*                     \/            \/     \/    \/            \/
+* $Id$
+*
+* This is a memory allocator designed to provide reasonable management of free
+* space and fast access to allocated data. More than one allocator can be used
+* at a time by initializing multiple contexts.
+*
+* Copyright (C) 2009 Andrew Mahone
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+*
+****************************************************************************/
+
+#ifndef _BUFLIB_H_
+#define _BUFLIB_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+union buflib_data
+{
+    intptr_t val;
+    union buflib_data *ptr;
+    struct buflib_callbacks *ops;
+    const char *name;
+};
+
+struct buflib_context
+{
+    union buflib_data *handle_table;
+    union buflib_data *first_free_handle;
+    union buflib_data *last_handle;
+    union buflib_data *first_free_block;
+    union buflib_data *buf_start;
+    union buflib_data *alloc_end;
+    bool compact;
+};
+
+/* Return values of the callbacks */
+#define BUFLIB_CB_OK             0
+#define BUFLIB_CB_CANNOT_MOVE    1
+#define BUFLIB_CB_CANNOT_SHRINK  1
+
+/* Lets the owner of an allocation take part in compaction. An allocation
+ * made without callbacks is moved freely, so its owner must only ever get
+ * at it through buflib_get_data().
+ */
+struct buflib_callbacks
+{
+    /* Called before the data is moved from current to new. The owner fixes
+     * up the pointers it keeps into the block and returns BUFLIB_CB_OK, or
+     * returns BUFLIB_CB_CANNOT_MOVE to keep it in place this time. NULL
+     * pins the block for good. */
+    int (*move_callback)(int handle, void *current, void *new);
+    /* Called when an allocation failed, wanted is the number of bytes that
+     * are missing. The owner may give memory back with buflib_shrink()
+     * before returning BUFLIB_CB_OK, or return BUFLIB_CB_CANNOT_SHRINK. */
+    int (*shrink_callback)(int handle, size_t wanted, void *start,
+                           size_t old_size);
+};
+
+/* Callbacks of blocks that never move */
+extern struct buflib_callbacks buflib_pinned_ops;
+
+/* Bytes taken by the header of each allocation and its handle */
+#define BUFLIB_ALLOC_OVERHEAD (5*sizeof(union buflib_data))
+
+void buflib_init(struct buflib_context *context, void *buf, size_t size);
+int buflib_alloc(struct buflib_context *context, size_t size);
+int buflib_alloc_ex(struct buflib_context *context, size_t size,
+                    const char *name, struct buflib_callbacks *ops);
+int buflib_alloc_maximum(struct buflib_context *context, const char *name,
+                         size_t *size, struct buflib_callbacks *ops);
+void buflib_free(struct buflib_context *context, int handle);
+bool buflib_shrink(struct buflib_context *context, int handle,
+                   size_t new_size);
+bool buflib_extend(struct buflib_context *context, int handle,
+                   size_t new_size);
+size_t buflib_available(struct buflib_context *context);
+bool buflib_compact(struct buflib_context *context);
+
+/* Moves the end of the buffer, along with the handle table. Growing needs
+ * the memory after the buffer to be free, shrinking compacts first and
+ * stops at what is in use. Returns the resulting size. */
+size_t buflib_resize(struct buflib_context *context, size_t size);
+/* Smallest size buflib_resize() could shrink to right now */
+size_t buflib_used(struct buflib_context *context);
+
+/* Lend the start of the buffer out and take it back, moving all the blocks.
+ * Only for contexts whose allocations have no callbacks. */
+void* buflib_buffer_out(struct buflib_context *context, size_t *size);
+void buflib_buffer_in(struct buflib_context *context, int size);
+
+const char *buflib_get_name(struct buflib_context *context, int handle);
+size_t buflib_get_size(struct buflib_context *context, int handle);
+/* Walks the allocations for debugging, returns a handle or 0 at the end */
+int buflib_get_next_handle(struct buflib_context *context, int handle);
+
+/* always_inline is due to this not getting inlined when not optimizing, which
+ * leads to an unresolved reference since it doesn't exist as a non-inline
+ * function
+ */
+static inline __attribute__((always_inline))
+void* buflib_get_data(struct buflib_context *context, int handle)
+{
+    return (void*)(context->handle_table[-handle].ptr);
+}
+
+#endif /* _BUFLIB_H_ */
@@ -21,6 +21,7 @@
 #ifndef _DIRCACHE_H
 #define _DIRCACHE_H
 
+#include <inttypes.h>
 #include "dir_uncached.h"
 
 #ifdef HAVE_DIRCACHE
@@ -33,9 +34,8 @@
 
 /* Internal structures. */
 struct travel_data {
-    struct dircache_entry *first;
-    struct dircache_entry *ce;
-    struct dircache_entry *down_entry;
+    uint32_t parent; /* directory being scanned */
+    uint32_t ce;     /* last entry added to it */
 #ifdef SIMULATOR
     DIR_UNCACHED *dir, *newdir;
     struct dirent_uncached *entry;
@@ -45,15 +45,47 @@ struct travel_data {
     struct fat_direntry entry;
 #endif
     int pathpos;
+    unsigned crc; /* checksum of the directory listing */
 };
 
-#define DIRCACHE_MAGIC  0x00d0c0a0
+#define DIRCACHE_MAGIC  0x00d0c0a3
 struct dircache_maindata {
     long magic;
     long size;
     long entry_count;
     long appflags;
-    struct dircache_entry *root_entry;
+    unsigned long node_count;
+    unsigned long names_size;
+    unsigned long hash_size;
+    unsigned long hash_mask;
+    unsigned long hash_used;
+};
+
+/* Tree links of a cached entry, kept apart from the file information so
+ * that lookups and directory walks touch as little memory as possible.
+ * Links are entry indices, 0 meaning none. */
+struct dircache_node {
+    uint32_t next;
+    uint32_t up;
+    uint32_t down;
+    uint32_t name; /* offset of the name below the top of the name pool */
+};
+
+/* File information of a cached entry. For directories, size holds the
+ * checksum of their listing. */
+struct dircache_fileinfo {
+    long size;
+    long startcluster;
+    unsigned short wrtdate;
+    unsigned short wrttime;
+    unsigned char attribute;
+    unsigned char flags;
+};
+
+#define DIRCACHE_BLOCK_ENTRIES 64
+struct dircache_block {
+    struct dircache_node node[DIRCACHE_BLOCK_ENTRIES];
+    struct dircache_fileinfo info[DIRCACHE_BLOCK_ENTRIES];
 };
 
 #define MAX_PENDING_BINDINGS 2
@@ -62,7 +94,8 @@ struct fdbind_queue {
     int fd;
 };
 
-/* Exported structures. */
+/* Exported structures. Entries are returned in this form by readdir_cached,
+ * the cache itself is stored more compactly. */
 struct dircache_entry {
     struct dircache_entry *next;
     struct dircache_entry *up;
@@ -78,28 +111,33 @@ struct dircache_entry {
 
 typedef struct {
     bool busy;
-    struct dircache_entry *entry;
-    struct dircache_entry *internal_entry;
+    uint32_t entry;     /* next entry to return */
+    int internal_entry; /* ID of the last returned entry, -1 if none */
     struct dircache_entry secondary_entry;
     DIR_UNCACHED *regulardir;
 } DIR_CACHED;
 
 void dircache_init(void);
-int dircache_load(void);
+int dircache_load(bool validate);
 int dircache_save(void);
 int dircache_build(int last_size);
+int dircache_resume(void);
 void* dircache_steal_buffer(long *size);
 bool dircache_is_enabled(void);
 bool dircache_is_initializing(void);
+bool dircache_is_validating(void);
 void dircache_set_appflag(long mask);
 bool dircache_get_appflag(long mask);
 int dircache_get_entry_count(void);
 int dircache_get_cache_size(void);
+int dircache_get_names_size(void);
 int dircache_get_reserve_used(void);
 int dircache_get_build_ticks(void);
+int dircache_get_changed_dirs(void);
 void dircache_disable(void);
-const struct dircache_entry *dircache_get_entry_ptr(const char *filename);
-void dircache_copy_path(const struct dircache_entry *entry, char *buf, int size);
+int dircache_get_entry_id(const char *filename);
+const struct dircache_fileinfo *dircache_get_fileinfo(int id);
+void dircache_copy_path(int entry, char *buf, int size);
 
 void dircache_bind(int fd, const char *path);
 void dircache_update_filesize(int fd, long newsize, long startcluster);
@@ -56,6 +56,7 @@
 #define filesize(x) sim_filesize(x)
 #define fsync(x) sim_fsync(x)
 #define ftruncate(x,y) sim_ftruncate(x,y)
+#define fpreallocate(x,y) sim_fpreallocate(x,y)
 #define lseek(x,y,z) sim_lseek(x,y,z)
 #define read(x,y,z) sim_read(x,y,z)
 #define write(x,y,z) sim_write(x,y,z)
@@ -79,7 +80,16 @@ extern ssize_t write(int fd, const void *buf, size_t count);
 extern int remove(const char* pathname);
 extern int rename(const char* path, const char* newname);
 extern int ftruncate(int fd, off_t length);
+extern int fpreallocate(int fd, off_t size);
 extern off_t filesize(int fd);
 extern int release_files(int volume);
+extern void file_get_read_stats(unsigned long *bytes,
+                                unsigned long *commands); /* debug */
+
+#if defined(SIMULATOR) && !defined(PLUGIN) && !defined(CODEC)
+/* Read-only mapping of a whole file, NULL if the host can't do it. */
+extern void *sim_mmap(int fd, long size);
+extern void sim_munmap(void *addr, long size);
+#endif
 
 #endif
@@ -57,7 +57,12 @@ volatile long current_tick SHAREDDATA_ATTR = 0;
 /* List of tick tasks - final element always NULL for termination */
 void (*tick_funcs[MAX_NUM_TICK_TASKS+1])(void);
 
+#ifdef SIMULATOR
+/* Every host thread has its own, see thread-sdl.c */
+extern __thread struct core_entry cores[NUM_CORES];
+#else
 extern struct core_entry cores[NUM_CORES];
+#endif
 
 /* This array holds all queues that are initiated. It is used for broadcast. */
 static struct
@@ -159,10 +164,86 @@ int tick_remove_task(void (*f)(void))
  * Tick-based interval timers/one-shots - be mindful this is not really
  * intended for continuous timers but for events that need to run for a short
  * time and be cancelled without further software intervention.
+ *
+ * Pending timeouts are kept in a hierarchical timer wheel. The first level
+ * has a slot for each of the next TMO_WHEEL_SIZE ticks, each further level
+ * covers TMO_WHEEL_SIZE times the span of the one below it. A tick only looks
+ * at one slot of the first level, and each time that level wraps around the
+ * next slot of the level above is cascaded down, so registering, cancelling
+ * and expiring are all O(1) no matter how many timeouts are pending.
  ****************************************************************************/
 #ifdef INCLUDE_TIMEOUT_API
-/* list of active timeout events */
-static struct timeout *tmo_list[MAX_NUM_TIMEOUTS+1];
+#define TMO_WHEEL_BITS   6
+#define TMO_WHEEL_SIZE   (1 << TMO_WHEEL_BITS)
+#define TMO_WHEEL_MASK   (TMO_WHEEL_SIZE - 1)
+#define TMO_WHEEL_LEVELS 3
+/* Timeouts further away than this are parked in the last level and cascaded
+   again when they come around */
+#define TMO_WHEEL_SPAN   (1L << (TMO_WHEEL_BITS*TMO_WHEEL_LEVELS))
+
+#define TMO_WHEEL_INDEX(tick, level) \
+    (((unsigned long)(tick) >> ((level)*TMO_WHEEL_BITS)) & TMO_WHEEL_MASK)
+
+static struct timeout *tmo_wheel[TMO_WHEEL_LEVELS][TMO_WHEEL_SIZE];
+static unsigned long tmo_wheel_next; /* next tick the wheel will process */
+static int tmo_count;                /* number of pending timeouts */
+
+static void timeout_link(struct timeout *tmo)
+{
+    long delta = tmo->expires - (long)tmo_wheel_next;
+    long expires = tmo->expires;
+    struct timeout **slot;
+    int level;
+
+    if(delta < 0)
+    {
+        /* Overdue - fire on the next tick processed */
+        expires = tmo_wheel_next;
+        delta = 0;
+    }
+    else if(delta >= TMO_WHEEL_SPAN)
+    {
+        expires = tmo_wheel_next + TMO_WHEEL_SPAN - 1;
+        delta = TMO_WHEEL_SPAN - 1;
+    }
+
+    for(level = 0; delta >= TMO_WHEEL_SIZE; level++)
+        delta >>= TMO_WHEEL_BITS;
+
+    slot = &tmo_wheel[level][TMO_WHEEL_INDEX(expires, level)];
+    tmo->next = *slot;
+    if(tmo->next != NULL)
+        tmo->next->pprev = &tmo->next;
+    tmo->pprev = slot;
+    *slot = tmo;
+}
+
+static void timeout_unlink(struct timeout *tmo)
+{
+    *tmo->pprev = tmo->next;
+    if(tmo->next != NULL)
+        tmo->next->pprev = tmo->pprev;
+    tmo->pprev = NULL;
+}
+
+/* Moves the timeouts of a slot of an upper level down to where they belong
+ * now. Returns the index of the slot. */
+static int timeout_cascade(int level)
+{
+    int index = TMO_WHEEL_INDEX(tmo_wheel_next, level);
+    struct timeout *tmo = tmo_wheel[level][index];
+
+    tmo_wheel[level][index] = NULL;
+
+    while(tmo != NULL)
+    {
+        struct timeout *next = tmo->next;
+        timeout_link(tmo);
+        tmo = next;
+    }
+
+    return index;
+}
 
 /* timeout tick task - calls event handlers when they expire
  * Event handlers may alter expiration, callback and data during operation.
@@ -170,39 +251,121 @@ static struct timeout *tmo_list[MAX_NUM_TIMEOUTS+1];
 static void timeout_tick(void)
 {
     unsigned long tick = current_tick;
-    struct timeout **p = tmo_list;
-    struct timeout *curr;
 
-    for(curr = *p; curr != NULL; curr = *(++p))
+    /* Normally a single pass, more when ticks were skipped while idle */
+    while(!TIME_AFTER(tmo_wheel_next, tick) && tmo_count > 0)
     {
-        int ticks;
+        int index = TMO_WHEEL_INDEX(tmo_wheel_next, 0);
+        struct timeout *work;
 
-        if(TIME_BEFORE(tick, curr->expires))
-            continue;
+        if(index == 0)
+        {
+            int level;
+
+            for(level = 1; level < TMO_WHEEL_LEVELS; level++)
+            {
+                if(timeout_cascade(level) != 0)
+                    break;
+            }
+        }
+
+        /* Take the whole slot, so that callbacks registering again can't
+           land in it. Cancelling others in it still works through pprev. */
+        work = tmo_wheel[0][index];
+        tmo_wheel[0][index] = NULL;
+        if(work != NULL)
+            work->pprev = &work;
 
-        /* this event has expired - call callback */
-        ticks = curr->callback(curr);
-        if(ticks > 0)
+        tmo_wheel_next++;
+
+        while(work != NULL)
         {
-            curr->expires = tick + ticks; /* reload */
+            struct timeout *curr = work;
+            int ticks;
+
+            timeout_unlink(curr);
+
+            if(TIME_AFTER(curr->expires, (long)tick))
+            {
+                /* Parked in the last level for longer than the wheel
+                   spans - not due yet */
+                timeout_link(curr);
+                continue;
+            }
+
+            /* this event has expired - call callback, which may register
+               it again but its return value decides */
+            tmo_count--;
+            ticks = curr->callback(curr);
+
+            if(curr->pprev != NULL)
+            {
+                timeout_unlink(curr);
+                tmo_count--;
+            }
+
+            if(ticks > 0)
+            {
+                curr->expires = tick + ticks; /* reload */
+                timeout_link(curr);
+                tmo_count++;
+            }
         }
-        else
+    }
+
+    if(tmo_count == 0)
+        tick_remove_task(timeout_tick); /* Last one - remove task */
+}
+
+#ifdef HAVE_TICKLESS_IDLE
+/* Returns the first tick before limit at which the wheel has anything to do,
+ * or limit if there is nothing. Looks at no more than one slot per tick. */
+static long timeout_next_expiry(long limit)
+{
+    unsigned long t;
+
+    if(tmo_count == 0)
+        return limit;
+
+    for(t = tmo_wheel_next; TIME_BEFORE((long)t, limit); t++)
+    {
+        int index = TMO_WHEEL_INDEX(t, 0);
+
+        if(tmo_wheel[0][index] != NULL)
+            return t;
+
+        if(index == 0)
         {
-            timeout_cancel(curr); /* cancel */
+            int level;
+
+            for(level = 1; level < TMO_WHEEL_LEVELS; level++)
+            {
+                int upper = TMO_WHEEL_INDEX(t, level);
+
+                if(tmo_wheel[level][upper] != NULL)
+                    return t; /* wake up to cascade */
+
+                if(upper != 0)
+                    break;
+            }
         }
     }
+
+    return limit;
 }
+#endif /* HAVE_TICKLESS_IDLE */
 
 /* Cancels a timeout callback - can be called from the ISR */
 void timeout_cancel(struct timeout *tmo)
 {
     int oldlevel = disable_irq_save();
-    void **arr = (void **)tmo_list;
-    int rc = remove_array_ptr(arr, tmo);
 
-    if(rc >= 0 && *arr == NULL)
+    if(tmo->pprev != NULL)
     {
-        tick_remove_task(timeout_tick); /* Last one - remove task */
+        timeout_unlink(tmo);
+
+        if(--tmo_count == 0)
+            tick_remove_task(timeout_tick); /* Last one - remove task */
     }
 
     restore_irq(oldlevel);
@@ -214,40 +377,93 @@ void timeout_register(struct timeout *tmo, timeout_cb_type callback,
                       int ticks, intptr_t data)
 {
     int oldlevel;
-    void **arr, **p;
 
     if(tmo == NULL)
         return;
 
     oldlevel = disable_irq_save();
 
-    /* See if this one is already registered */
-    arr = (void **)tmo_list;
-    p = find_array_ptr(arr, tmo);
-
-    if(p - arr < MAX_NUM_TIMEOUTS)
+    if(tmo->pprev != NULL)
     {
-        /* Vacancy */
-        if(*p == NULL)
-        {
-            /* Not present */
-            if(*arr == NULL)
-            {
-                tick_add_task(timeout_tick); /* First one - add task */
-            }
+        /* Already registered - take it out of its old slot */
+        timeout_unlink(tmo);
+    }
+    else if(tmo_count++ == 0)
+    {
+        /* First one - the wheel was idle, start it at the next tick */
+        tmo_wheel_next = current_tick + 1;
+        tick_add_task(timeout_tick);
+        tick_set_deferrable(timeout_tick, true);
+    }
 
-            *p = tmo;
-        }
+    tmo->callback = callback;
+    tmo->data = data;
+    tmo->expires = current_tick + ticks;
+    timeout_link(tmo);
+
+    restore_irq(oldlevel);
+}
+
+#endif /* INCLUDE_TIMEOUT_API */
+
+/****************************************************************************
+ * Tickless idle - when all cores sleep and every tick task can wait, the
+ * target stops the tick until the next thread or timeout is due.
+ ****************************************************************************/
+#ifdef HAVE_TICKLESS_IDLE
+/* tick tasks that don't need to run every tick */
+static void (*tick_deferrable[MAX_NUM_TICK_TASKS+1])(void);
+struct tick_idle_stats tick_idle_stats;
+
+int tick_set_deferrable(void (*f)(void), bool deferrable)
+{
+    int oldlevel = disable_irq_save();
+    void **arr = (void **)tick_deferrable;
+
+    if(deferrable)
+    {
+        void **p = find_array_ptr(arr, f);
 
-        tmo->callback = callback;
-        tmo->data = data;
-        tmo->expires = current_tick + ticks;
+        if(p - arr < MAX_NUM_TICK_TASKS)
+            *p = f;
+    }
+    else
+    {
+        remove_array_ptr(arr, f);
     }
 
     restore_irq(oldlevel);
+    return 0;
 }
 
-#endif /* INCLUDE_TIMEOUT_API */
+void tick_idle_enter(long deadline)
+{
+    void (**p)(void);
+    long limit = current_tick + TICK_IDLE_MAX;
+
+    tick_idle_stats.entries++;
+
+    for(p = tick_funcs; *p != NULL; p++)
+    {
+        if(*find_array_ptr((void **)tick_deferrable, *p) == NULL)
+        {
+            /* this one wants every tick */
+            tick_idle_stats.kept++;
+            return;
+        }
+    }
+
+    if(TIME_BEFORE(deadline, limit))
+        limit = deadline;
+
+#ifdef INCLUDE_TIMEOUT_API
+    limit = timeout_next_expiry(limit);
+#endif
+
+    if(limit - current_tick > 1)
+        tick_idle_stop(limit - current_tick);
+}
+#endif /* HAVE_TICKLESS_IDLE */
 
 /****************************************************************************
  * Thread stuff
@@ -449,6 +665,142 @@ static inline void queue_do_fetch_sender(struct queue_sender_list *send,
 #define queue_do_fetch_sender(send, rd)
 #endif /* HAVE_EXTENDED_MESSAGING_AND_NAME */
 
+/****************************************************************************
+ * Lock-free single producer queues attached to event queues. The producer
+ * only ever writes the events and the write index, the consumer only the
+ * read index, so posting doesn't need to mask interrupts or take the
+ * corelock. Only a producer that finds the consumer blocked takes them to
+ * wake it up. The consumer side runs with the event queue locked like the
+ * rest of the queue functions.
+ ****************************************************************************/
+
+/* Hands out the oldest event of the attached queue, if any */
+static bool queue_fetch_spsc(struct event_queue *q, struct queue_event *ev)
+{
+    struct spsc_queue *sq = q->spsc;
+    unsigned int rd;
+
+    if(sq == NULL)
+        return false;
+
+    rd = sq->read;
+    if(rd == sq->write)
+        return false;
+
+    /* The event is read after its index was seen, and before the slot is
+       handed back to the producer */
+    memory_barrier();
+    *ev = sq->events[rd & QUEUE_LENGTH_MASK];
+    memory_barrier();
+    sq->read = rd + 1;
+
+    return true;
+}
+
+/* Tells the producer of the attached queue that the consumer is about to
+   block. Returns false if something was posted in the meantime. */
+static inline bool queue_spsc_block(struct event_queue *q)
+{
+    struct spsc_queue *sq = q->spsc;
+
+    if(sq == NULL)
+        return true;
+
+    sq->waiting = 1;
+    memory_barrier();
+    return sq->read == sq->write;
+}
+
+static inline void queue_spsc_unblock(struct event_queue *q)
+{
+    if(q->spsc != NULL)
+        q->spsc->waiting = 0;
+}
+
+/* Attaches sq to q. Its events are returned by queue_wait and
+   queue_wait_w_tmo on q ahead of those posted to q itself, so there is no
+   order between the two. Must be done before the producer starts posting. */
+void queue_attach_spsc(struct event_queue *q, struct spsc_queue *sq)
+{
+    int oldlevel = disable_irq_save();
+    corelock_lock(&q->cl);
+
+    sq->read = 0;
+    sq->write = 0;
+    sq->waiting = 0;
+    sq->overflow = 0;
+    sq->dropped = 0;
+    sq->q = q;
+    q->spsc = sq;
+
+    corelock_unlock(&q->cl);
+    restore_irq(oldlevel);
+}
+
+/* Posts an event from the producer of sq. Unlike queue_post, nothing is
+   overwritten when the queue is full, the event is dropped and false is
+   returned. */
+bool spsc_queue_post(struct spsc_queue *sq, long id, intptr_t data)
+{
+    unsigned int wr = sq->write;
+
+    if(wr - sq->read >= QUEUE_LENGTH)
+    {
+        sq->dropped++;
+        return false;
+    }
+
+    sq->events[wr & QUEUE_LENGTH_MASK].id   = id;
+    sq->events[wr & QUEUE_LENGTH_MASK].data = data;
+
+    /* Publish the event, then look for a waiting consumer */
+    memory_barrier();
+    sq->write = wr + 1;
+    memory_barrier();
+
+    if(sq->waiting)
+    {
+        struct event_queue *q = sq->q;
+        int oldlevel = disable_irq_save();
+        corelock_lock(&q->cl);
+
+        wakeup_thread(&q->queue);
+
+        corelock_unlock(&q->cl);
+        restore_irq(oldlevel);
+    }
+
+    return true;
+}
+
+/* Posts an event from the producer of sq that must not get lost. When sq is
+   full it goes to the attached queue with queue_post instead, and so do the
+   following ones until the consumer has read them all, as it would otherwise
+   get the newer events from sq first. */
+void spsc_queue_post_or_queue(struct spsc_queue *sq, long id, intptr_t data)
+{
+    struct event_queue *q = sq->q;
+
+    if(sq->overflow)
+    {
+        int oldlevel = disable_irq_save();
+        corelock_lock(&q->cl);
+
+        /* sq is read first, so it is empty as well by then */
+        if(q->read == q->write)
+            sq->overflow = 0;
+
+        corelock_unlock(&q->cl);
+        restore_irq(oldlevel);
+    }
+
+    if(!sq->overflow && spsc_queue_post(sq, id, data))
+        return;
+
+    sq->overflow = 1;
+    queue_post(q, id, data);
+}
+
 /* Queue must not be available for use during this call */
 void queue_init(struct event_queue *q, bool register_queue)
 {
@@ -463,6 +815,7 @@ void queue_init(struct event_queue *q, bool register_queue)
     q->queue = NULL;
     q->read = 0;
     q->write = 0;
+    q->spsc = NULL;
 #ifdef HAVE_EXTENDED_MESSAGING_AND_NAME
     q->send = NULL; /* No message sending by default */
     IF_PRIO( q->blocker_p = NULL; )
@@ -520,6 +873,7 @@ void queue_delete(struct event_queue *q)
 
     q->read = 0;
     q->write = 0;
+    q->spsc = NULL;
 
     corelock_unlock(&q->cl);
     restore_irq(oldlevel);
@@ -545,32 +899,38 @@ void queue_wait(struct event_queue *q, struct queue_event *ev)
     /* auto-reply */
     queue_do_auto_reply(q->send);
     
-    if (q->read == q->write)
+    while (!queue_fetch_spsc(q, ev))
     {
-        struct thread_entry *current = cores[CURRENT_CORE].running;
+        struct thread_entry *current;
 
-        do
+        if (q->read != q->write)
         {
-            IF_COP( current->obj_cl = &q->cl; )
-            current->bqp = &q->queue;
+            rd = q->read++ & QUEUE_LENGTH_MASK;
+            *ev = q->events[rd];
 
-            block_thread(current);
+            /* Get data for a waiting thread if one */
+            queue_do_fetch_sender(q->send, rd);
+            break;
+        }
 
-            corelock_unlock(&q->cl);
-            switch_thread();
+        if (!queue_spsc_block(q))
+            continue;
 
-            oldlevel = disable_irq_save();
-            corelock_lock(&q->cl);
-        }
-        /* A message that woke us could now be gone */
-        while (q->read == q->write);
-    } 
+        current = cores[CURRENT_CORE].running;
+        IF_COP( current->obj_cl = &q->cl; )
+        current->bqp = &q->queue;
 
-    rd = q->read++ & QUEUE_LENGTH_MASK;
-    *ev = q->events[rd];
+        block_thread(current);
+
+        corelock_unlock(&q->cl);
+        switch_thread();
+
+        oldlevel = disable_irq_save();
+        corelock_lock(&q->cl);
+        /* A message that woke us could now be gone */
+    }
 
-    /* Get data for a waiting thread if one */
-    queue_do_fetch_sender(q->send, rd);
+    queue_spsc_unblock(q);
 
     corelock_unlock(&q->cl);
     restore_irq(oldlevel);
@@ -592,7 +952,7 @@ void queue_wait_w_tmo(struct event_queue *q, struct queue_event *ev, int ticks)
     /* Auto-reply */
     queue_do_auto_reply(q->send);
 
-    if (q->read == q->write && ticks > 0)
+    if (q->read == q->write && ticks > 0 && queue_spsc_block(q))
     {
         struct thread_entry *current = cores[CURRENT_CORE].running;
 
@@ -608,9 +968,15 @@ void queue_wait_w_tmo(struct event_queue *q, struct queue_event *ev, int ticks)
         corelock_lock(&q->cl);
     }
 
+    queue_spsc_unblock(q);
+
     /* no worry about a removed message here - status is checked inside
        locks - perhaps verify if timeout or false alarm */
-    if (q->read != q->write)
+    if (queue_fetch_spsc(q, ev))
+    {
+        /* Posted from the attached queue */
+    }
+    else if (q->read != q->write)
     {
         unsigned int rd = q->read++ & QUEUE_LENGTH_MASK;
         *ev = q->events[rd];
@@ -747,7 +1113,7 @@ void queue_reply(struct event_queue *q, intptr_t retval)
 
 bool queue_peek(struct event_queue *q, struct queue_event *ev)
 {
-    if(q->read == q->write)
+    if(queue_empty(q))
          return false;
 
     bool have_msg = false;
@@ -755,7 +1121,13 @@ bool queue_peek(struct event_queue *q, struct queue_event *ev)
     int oldlevel = disable_irq_save();
     corelock_lock(&q->cl);
 
-    if(q->read != q->write)
+    if(q->spsc != NULL && q->spsc->read != q->spsc->write)
+    {
+        memory_barrier();
+        *ev = q->spsc->events[q->spsc->read & QUEUE_LENGTH_MASK];
+        have_msg = true;
+    }
+    else if(q->read != q->write)
     {
         *ev = q->events[q->read & QUEUE_LENGTH_MASK];
         have_msg = true;
@@ -774,7 +1146,8 @@ bool queue_peek(struct event_queue *q, struct queue_event *ev)
  * unsignals the queue may cause an unwanted block */
 bool queue_empty(const struct event_queue* q)
 {
-    return ( q->read == q->write );
+    return ( q->read == q->write &&
+             (q->spsc == NULL || q->spsc->read == q->spsc->write) );
 }
 
 void queue_clear(struct event_queue* q)
@@ -791,6 +1164,10 @@ void queue_clear(struct event_queue* q)
     q->read = 0;
     q->write = 0;
 
+    /* Only the consumer may clear the attached queue */
+    if(q->spsc != NULL)
+        q->spsc->read = q->spsc->write;
+
     corelock_unlock(&q->cl);
     restore_irq(oldlevel);
 }
@@ -829,7 +1206,12 @@ void queue_remove_from_head(struct event_queue *q, long id)
  */
 int queue_count(const struct event_queue *q)
 {
-    return q->write - q->read;
+    int count = q->write - q->read;
+
+    if(q->spsc != NULL)
+        count += q->spsc->write - q->spsc->read;
+
+    return count;
 }
 
 int queue_broadcast(long id, intptr_t data)
@@ -59,6 +59,7 @@
 #include <system.h>
 #include <string.h>
 #include <timer.h>
+#include <thread.h>
 #include <sys/types.h>
 #include "profile.h"
 
@@ -339,6 +340,93 @@ overflow:
     return;
 }
 
+/* Sampling profiler. The timer tick records the PC that was interrupted and
+ * the LR of the interrupted mode. In a leaf function or before it made any
+ * call LR is the return address into its caller, later it mostly points back
+ * into the function itself, which profile_reader.pl leaves out of the call
+ * graph. Threads run in supervisor mode, so that is where LR is taken from. */
+struct profile_sample {
+    void *pc;
+    void *lr;
+};
+
+extern struct core_entry cores[NUM_CORES];
+
+void *profile_irq_pc;
+static struct profile_sample samples[PROFILE_SAMPLES];
+static unsigned char sample_threads[PROFILE_SAMPLES];
+static unsigned long samples_taken;
+static bool sample_timer_lost;
+
+#ifdef CPU_ARM
+static inline void *interrupted_lr(void) {
+    unsigned long lr, cpsr;
+    asm volatile (
+        "mrs    %1, cpsr        \n"
+        "bic    %0, %1, #0x1f   \n" /* switch to supervisor mode */
+        "orr    %0, %0, #0x13   \n"
+        "msr    cpsr_c, %0      \n"
+        "mov    %0, lr          \n"
+        "msr    cpsr_c, %1      \n" /* and back */
+        : "=&r"(lr), "=&r"(cpsr));
+    return (void *)lr;
+}
+#else
+/* Not implemented, only the PC is recorded */
+#define interrupted_lr() NULL
+#endif
+
+static void profile_sample_tick(void) NO_PROF_ATTR;
+static void profile_sample_tick(void) {
+    struct thread_entry *thread = cores[CURRENT_CORE].running;
+    unsigned int index = samples_taken++ & (PROFILE_SAMPLES - 1);
+
+    samples[index].pc = profile_irq_pc;
+    samples[index].lr = interrupted_lr();
+    /* No thread is running while the core sleeps */
+    sample_threads[index] = thread ? thread->id & THREAD_ID_SLOT_MASK : 0xff;
+}
+
+static void profile_sample_unregister(void) {
+    sample_timer_lost = true;
+}
+
+void profsample_start(void) {
+    samples_taken = 0;
+    sample_timer_lost = false;
+    if (!timer_register(0, profile_sample_unregister,
+                        TIMER_FREQ/PROFILE_SAMPLE_HZ, profile_sample_tick
+                        IF_COP(, CURRENT_CORE))) {
+        sample_timer_lost = true;
+    }
+}
 
+void profsample_stop(void) {
+    unsigned long taken, i, first;
+    bool lost = sample_timer_lost;
+    int fd;
 
+    if (!lost) {
+        timer_unregister();
+    }
+    taken = samples_taken;
+    first = taken > PROFILE_SAMPLES ? taken - PROFILE_SAMPLES : 0;
 
+    fd = open("/profile_samples.out", O_WRONLY|O_CREAT|O_TRUNC);
+    if (fd < 0) {
+        return;
+    }
+    if (lost) {
+        fdprintf(fd,"Sampling stopped early, the timer was taken over.\n");
+    }
+    fdprintf(fd,"PROFILE_SAMPLES\tSAMPLE_HZ\tOVERWRITTEN\n");
+    fdprintf(fd,"%08ld\t%08d\t%08ld\n", taken - first, PROFILE_SAMPLE_HZ, first);
+    fdprintf(fd,"SAMPLE_PC\tCALLER_PC\tTHREAD\n");
+    for (i = first; i != taken; i++) {
+        unsigned int index = i & (PROFILE_SAMPLES - 1);
+        fdprintf(fd,"0x%08lX\t0x%08lX\t%04d\n",
+                (size_t)samples[index].pc, (size_t)samples[index].lr,
+                sample_threads[index] == 0xff ? -1 : sample_threads[index]);
+    }
+    close(fd);
+}
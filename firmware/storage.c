@@ -18,8 +18,18 @@
  * KIND, either express or implied.
  *
  ****************************************************************************/
+#include <string.h>
 #include "storage.h"
+#include "kernel.h"
+#include "thread.h"
+#include "system.h"
+#include "fat.h"
 
+#ifdef HAVE_IO_SCHEDULER
+static void iosched_init(void);
+#endif
+
+#ifdef CONFIG_STORAGE_MULTI
 #define DRIVER_MASK     0xff000000
 #define DRIVER_OFFSET   24
 #define DRIVE_MASK      0x00ff0000
@@ -39,6 +49,10 @@ int storage_init(void)
     int rc=0;
     int i;
     num_drives=0;
+
+#ifdef HAVE_IO_SCHEDULER
+    iosched_init();
+#endif
     
 #if (CONFIG_STORAGE & STORAGE_ATA)
     if ((rc=ata_init())) return rc;
@@ -98,8 +112,8 @@ int storage_init(void)
     return 0;
 }
 
-int storage_read_sectors(int drive, unsigned long start, int count,
-                         void* buf)
+int storage_driver_read_sectors(int drive, unsigned long start, int count,
+                                void* buf)
 {
     int driver=(storage_drivers[drive] & DRIVER_MASK)>>DRIVER_OFFSET;
     int ldrive=(storage_drivers[drive] & DRIVE_MASK)>>DRIVE_OFFSET;
@@ -135,8 +149,8 @@ int storage_read_sectors(int drive, unsigned long start, int count,
     return -1;
 }
 
-int storage_write_sectors(int drive, unsigned long start, int count,
-                          const void* buf)
+int storage_driver_write_sectors(int drive, unsigned long start, int count,
+                                 const void* buf)
 {
     int driver=(storage_drivers[drive] & DRIVER_MASK)>>DRIVER_OFFSET;
     int ldrive=(storage_drivers[drive] & DRIVE_MASK)>>DRIVE_OFFSET;
@@ -572,3 +586,355 @@ bool storage_present(int drive)
     return ret;
 }
 #endif
+#endif /* CONFIG_STORAGE_MULTI */
+
+#ifdef HAVE_IO_SCHEDULER
+/* I/O scheduler
+
+   The requests of all threads go into a small queue. The thread finding
+   the storage idle serves the queue until its own request is done and
+   then hands the job over to the owner of a request still waiting.
+   Requests are served in one sweep across the disk (elevator order),
+   those of threads running at buffering priority or above before all
+   others. Queued requests continuing the one being served are merged into
+   a single command through a bounce buffer.
+
+   Serving is handed over to the most important waiting thread, and the
+   thread serving the queue runs at the priority of the most important one
+   waiting for it, so that playback isn't held up by a background thread
+   that has been preempted while it does playback's transfer. */
+
+#define IOSCHED_QUEUE_DEPTH   8
+#define IOSCHED_MERGE_SECTORS 16 /* size of the bounce buffer */
+
+struct io_request
+{
+    int drive;
+    unsigned long start;
+    int count;
+    void *buf;
+    bool write;
+    bool prio;                   /* playback critical */
+#ifdef HAVE_PRIORITY_SCHEDULING
+    unsigned int thread;         /* owner */
+    int priority;                /* owner's own priority */
+#endif
+    bool serve;                  /* owner takes over serving the queue */
+    int rc;
+    struct semaphore done;
+};
+
+static struct io_request *ioq[IOSCHED_QUEUE_DEPTH];
+static int ioq_count;
+static bool ioq_busy;            /* some thread is serving the queue */
+static unsigned long ioq_head;   /* sector following the last transfer */
+#ifdef HAVE_PRIORITY_SCHEDULING
+static unsigned int ioq_server;  /* thread serving the queue */
+static int ioq_server_priority;  /* and the priority it runs at */
+#endif
+static struct mutex ioq_mutex;
+static struct semaphore ioq_slots;
+static struct storage_sched_stats ioq_stats;
+static bool ioq_initialized = false;
+
+static unsigned char ioq_bounce[IOSCHED_MERGE_SECTORS*SECTOR_SIZE]
+    CACHEALIGN_ATTR;
+
+static void iosched_init(void)
+{
+    /* storage_init() is called again after USB */
+    if (ioq_initialized)
+        return;
+
+    mutex_init(&ioq_mutex);
+    semaphore_init(&ioq_slots, IOSCHED_QUEUE_DEPTH, IOSCHED_QUEUE_DEPTH);
+    ioq_initialized = true;
+}
+
+/* Takes the request to serve next out of the queue */
+static struct io_request *iosched_take(void)
+{
+    struct io_request *r;
+    bool ahead = false;
+    int best = 0;
+    int i;
+
+    for (i = 0; i < ioq_count; i++)
+    {
+        bool r_ahead;
+
+        r = ioq[i];
+        r_ahead = r->start >= ioq_head;
+
+        if (i > 0)
+        {
+            struct io_request *b = ioq[best];
+
+            if (r->prio != b->prio)
+            {
+                if (!r->prio)
+                    continue;
+            }
+            else if (r_ahead != ahead)
+            {
+                if (!r_ahead)
+                    continue; /* wait for the next sweep */
+            }
+            else if (r->start >= b->start)
+                continue;
+        }
+
+        best = i;
+        ahead = r_ahead;
+    }
+
+    r = ioq[best];
+    ioq[best] = ioq[--ioq_count];
+    semaphore_release(&ioq_slots);
+    return r;
+}
+
+/* Takes a queued request continuing the given range out of the queue */
+static struct io_request *iosched_take_next(const struct io_request *first,
+                                            unsigned long end, int count)
+{
+    int i;
+
+    for (i = 0; i < ioq_count; i++)
+    {
+        struct io_request *r = ioq[i];
+
+        if (r->start == end && r->drive == first->drive &&
+            r->write == first->write &&
+            count + r->count <= IOSCHED_MERGE_SECTORS)
+        {
+            ioq[i] = ioq[--ioq_count];
+            semaphore_release(&ioq_slots);
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+/* Does the requests in batch, which continue one another, with one
+   command */
+static int iosched_transfer(struct io_request **batch, int n, int count)
+{
+    unsigned char *p = ioq_bounce;
+    int rc, i;
+
+    if (n == 1)
+    {
+        struct io_request *r = batch[0];
+
+        if (r->write)
+            return storage_driver_write_sectors(r->drive, r->start,
+                                                r->count, r->buf);
+        return storage_driver_read_sectors(r->drive, r->start, r->count,
+                                           r->buf);
+    }
+
+    if (batch[0]->write)
+    {
+        for (i = 0; i < n; p += batch[i]->count * SECTOR_SIZE, i++)
+            memcpy(p, batch[i]->buf, batch[i]->count * SECTOR_SIZE);
+
+        return storage_driver_write_sectors(batch[0]->drive, batch[0]->start,
+                                            count, ioq_bounce);
+    }
+
+    rc = storage_driver_read_sectors(batch[0]->drive, batch[0]->start,
+                                     count, ioq_bounce);
+    if (rc == 0)
+    {
+        for (i = 0; i < n; p += batch[i]->count * SECTOR_SIZE, i++)
+            memcpy(batch[i]->buf, p, batch[i]->count * SECTOR_SIZE);
+    }
+
+    return rc;
+}
+
+/* Picks the waiting request whose owner serves the queue next */
+static struct io_request *iosched_next_server(void)
+{
+    int best = 0;
+#ifdef HAVE_PRIORITY_SCHEDULING
+    int i;
+
+    for (i = 1; i < ioq_count; i++)
+    {
+        if (ioq[i]->priority < ioq[best]->priority)
+            best = i;
+    }
+
+    ioq_server = ioq[best]->thread;
+    ioq_server_priority = ioq[best]->priority;
+#endif
+    return ioq[best];
+}
+
+static int iosched_submit(struct io_request *req)
+{
+    struct io_request *batch[IOSCHED_QUEUE_DEPTH];
+    bool own_done = false;
+
+    req->serve = false;
+    req->rc = 0;
+    semaphore_init(&req->done, 1, 0);
+#ifdef HAVE_PRIORITY_SCHEDULING
+    req->thread = thread_get_current();
+    req->priority = thread_get_priority(THREAD_ID_CURRENT);
+    req->prio = req->priority <= PRIORITY_BUFFERING;
+#else
+    req->prio = false;
+#endif
+
+    semaphore_wait(&ioq_slots);
+    mutex_lock(&ioq_mutex);
+
+    ioq[ioq_count++] = req;
+    ioq_stats.requests++;
+    if (req->prio)
+        ioq_stats.prio_requests++;
+    if (ioq_count > ioq_stats.max_depth)
+        ioq_stats.max_depth = ioq_count;
+
+    if (ioq_busy)
+    {
+        /* whoever serves the queue will do it */
+#ifdef HAVE_PRIORITY_SCHEDULING
+        if (req->priority < ioq_server_priority)
+        {
+            ioq_server_priority = req->priority;
+            thread_set_priority(ioq_server, req->priority);
+        }
+#endif
+        mutex_unlock(&ioq_mutex);
+        semaphore_wait(&req->done);
+
+        if (!req->serve)
+            return req->rc;
+
+        mutex_lock(&ioq_mutex);
+    }
+
+    else
+    {
+        ioq_busy = true;
+#ifdef HAVE_PRIORITY_SCHEDULING
+        ioq_server = req->thread;
+        ioq_server_priority = req->priority;
+#endif
+    }
+
+    while (!own_done)
+    {
+        struct io_request *r;
+        unsigned long end;
+        int count, n, i;
+
+        r = iosched_take();
+        batch[0] = r;
+        n = 1;
+        count = r->count;
+        end = r->start + r->count;
+
+        if (count <= IOSCHED_MERGE_SECTORS)
+        {
+            while ((r = iosched_take_next(batch[0], end, count)) != NULL)
+            {
+                batch[n++] = r;
+                count += r->count;
+                end += r->count;
+            }
+        }
+
+        mutex_unlock(&ioq_mutex);
+        i = iosched_transfer(batch, n, count);
+        mutex_lock(&ioq_mutex);
+
+        ioq_head = end;
+        ioq_stats.commands++;
+        ioq_stats.merged += n - 1;
+
+        while (n-- > 0)
+        {
+            batch[n]->rc = i;
+            if (batch[n] == req)
+                own_done = true;
+            else
+                semaphore_release(&batch[n]->done);
+        }
+    }
+
+#ifdef HAVE_PRIORITY_SCHEDULING
+    if (ioq_server_priority != req->priority)
+        thread_set_priority(THREAD_ID_CURRENT, req->priority);
+#endif
+
+    if (ioq_count > 0)
+    {
+        /* hand the queue over rather than serving others forever */
+        struct io_request *r = iosched_next_server();
+
+        r->serve = true;
+        semaphore_release(&r->done);
+    }
+    else
+        ioq_busy = false;
+
+    mutex_unlock(&ioq_mutex);
+    return req->rc;
+}
+
+int storage_sched_read_sectors(IF_MD2(int drive,) unsigned long start,
+                               int count, void* buf)
+{
+    struct io_request req;
+
+#ifdef HAVE_MULTIDRIVE
+    req.drive = drive;
+#else
+    req.drive = 0;
+#endif
+    req.start = start;
+    req.count = count;
+    req.buf = buf;
+    req.write = false;
+    return iosched_submit(&req);
+}
+
+int storage_sched_write_sectors(IF_MD2(int drive,) unsigned long start,
+                                int count, const void* buf)
+{
+    struct io_request req;
+
+#ifdef HAVE_MULTIDRIVE
+    req.drive = drive;
+#else
+    req.drive = 0;
+#endif
+    req.start = start;
+    req.count = count;
+    req.buf = (void *)buf;
+    req.write = true;
+    return iosched_submit(&req);
+}
+
+#ifndef CONFIG_STORAGE_MULTI
+int storage_init(void)
+{
+    iosched_init();
+    return storage_driver_init();
+}
+#endif
+
+void storage_get_sched_stats(struct storage_sched_stats *stats)
+{
+    mutex_lock(&ioq_mutex);
+    *stats = ioq_stats;
+    stats->depth = ioq_count;
+    mutex_unlock(&ioq_mutex);
+}
+#endif /* HAVE_IO_SCHEDULER */
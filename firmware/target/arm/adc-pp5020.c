@@ -77,13 +77,15 @@ unsigned short adc_read(int channel)
     return adcdata[channel];
 }
 
-static int adc_counter;
+static long adc_next_scan;
 
+/* Goes by current_tick rather than counting calls, so it doesn't mind the
+   tick stopping while idle */
 static void adc_tick(void)
 {
-    if(++adc_counter == HZ)
+    if(!TIME_BEFORE(current_tick, adc_next_scan))
     {
-        adc_counter = 0;
+        adc_next_scan = current_tick + HZ;
         adc_scan(0);
         adc_scan(1);
         adc_scan(2);
@@ -167,5 +169,7 @@ void adc_init(void)
     adc_scan(2);
     adc_scan(3);
 
+    adc_next_scan = current_tick + HZ;
     tick_add_task(adc_tick);
+    tick_set_deferrable(adc_tick, true);
 }
@@ -152,7 +152,7 @@ static void scrollwheel(unsigned short dbop_din)
         {
             buttonlight_on();
             backlight_on();
-            queue_post(&button_queue, btn, ((wheel_delta+1)<<24));
+            button_queue_post_irq(btn, ((wheel_delta+1)<<24));
             /* message posted - reset count and remember post */
             counter = 0;
             last_wheel_post = current_tick;
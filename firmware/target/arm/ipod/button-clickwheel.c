@@ -224,12 +224,12 @@ static inline int ipod_4g_button_read(void)
                             /* always use acceleration mode (1<<31) */
                             /* always set message post count to (1<<24) for iPod */
                             /* this way the scrolling is always calculated from wheel_velocity */
-                            queue_post(&button_queue, wheel_keycode | repeat, 
-                                       (1<<31) | (1 << 24) | wheel_velocity);
+                            button_queue_post_irq(wheel_keycode | repeat, 
+                                                  (1<<31) | (1 << 24) | wheel_velocity);
                                        
 #else
-                            queue_post(&button_queue, wheel_keycode | repeat, 
-                                       (accumulated_wheel_delta << 16) | new_wheel_value);
+                            button_queue_post_irq(wheel_keycode | repeat, 
+                                                  (accumulated_wheel_delta << 16) | new_wheel_value);
 #endif
                             accumulated_wheel_delta = 0;
                         }
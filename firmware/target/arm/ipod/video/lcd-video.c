@@ -223,6 +223,7 @@ static void lcd_tick(void)
         {
             /* Update finished properly and no new update pending. */
             lcd_state.state = LCD_IDLE;
+            tick_set_deferrable(&lcd_tick, true);
 #ifdef HAVE_LCD_SLEEP
             if (lcd_state.waking)
                 continue_lcd_awake();
@@ -277,6 +278,8 @@ static void lcd_unblock_and_update(void)
          lcd_state.state = LCD_NEED_UPDATE; /* Post update request */
     }
     lcd_state.blocked = false;
+    /* The tick has to keep polling the BCM until it is done */
+    tick_set_deferrable(&lcd_tick, false);
 
 #if NUM_CORES > 1
     corelock_unlock(&lcd_state.cl);
@@ -365,6 +368,7 @@ void lcd_init_device(void)
         /* BCM is powered.  Assume it is initialized. */
         lcd_state.display_on = true;
         tick_add_task(&lcd_tick);
+        tick_set_deferrable(&lcd_tick, true);
     }
     else
     {
@@ -377,6 +381,7 @@ void lcd_init_device(void)
     }
 #else /* !HAVE_LCD_SLEEP */
     tick_add_task(&lcd_tick);
+    tick_set_deferrable(&lcd_tick, true);
 #endif
 #endif /* !BOOTLOADER */
 }
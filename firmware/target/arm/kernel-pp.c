@@ -22,12 +22,94 @@
 #include "system.h"
 #include "kernel.h"
 
+#ifdef HAVE_TICKLESS_IDLE
+#define TICK_USEC (1000000/HZ)
+
+static unsigned long tick_usec; /* USEC_TIMER at the last tick counted */
+static bool tick_stopped;       /* timer set up to sleep through ticks */
+static bool tick_realign;       /* running a partial period after that */
+
+/* Counts the ticks that went by while the tick was stopped, except for keep
+ * of them which the caller counts, and sets the timer to fire again where
+ * the next tick would have been */
+static void tick_resume(long keep)
+{
+    unsigned long now = USEC_TIMER;
+    long ticks = (long)(now - tick_usec) / TICK_USEC;
+    long remaining;
+
+    if (ticks < keep)
+        ticks = keep;
+
+    tick_usec += ticks * TICK_USEC;
+    current_tick += ticks - keep;
+    tick_idle_stats.skipped += ticks - keep;
+
+    remaining = tick_usec + TICK_USEC - now;
+    if (remaining < 2)
+        remaining = 2;
+
+    TIMER1_CFG = 0x0;
+    TIMER1_VAL;
+    TIMER1_CFG = 0xc0000000 | (remaining - 1);
+    tick_stopped = false;
+    tick_realign = true;
+}
+
+/* Called with interrupts disabled when all cores are about to sleep: don't
+   interrupt them again until ticks from the last tick counted */
+void tick_idle_stop(long ticks)
+{
+    long remaining = tick_usec + ticks * TICK_USEC - USEC_TIMER;
+
+    if (tick_realign || remaining < 2*TICK_USEC)
+        return;
+
+    /* A tick that is pending gets dropped here, tick_resume counts it */
+    TIMER1_CFG = 0x0;
+    TIMER1_VAL;
+    TIMER1_CFG = 0xc0000000 | (remaining - 1);
+    tick_stopped = true;
+    tick_idle_stats.stops++;
+}
+
+/* Called after waking up, whatever woke the core */
+void tick_idle_restart(void)
+{
+    int oldlevel = disable_irq_save();
+
+    if (tick_stopped)
+        tick_resume(0);
+
+    restore_irq(oldlevel);
+}
+#endif /* HAVE_TICKLESS_IDLE */
+
 #ifndef BOOTLOADER
 void TIMER1(void)
 {
     /* Run through the list of tick tasks (using main core) */
     TIMER1_VAL; /* Read value to ack IRQ */
 
+#ifdef HAVE_TICKLESS_IDLE
+    if (tick_stopped)
+    {
+        /* Slept until here - call_tick_tasks counts this tick */
+        tick_resume(1);
+    }
+    else
+    {
+        if (tick_realign)
+        {
+            /* Back on the regular period */
+            TIMER1_CFG = 0xc0000000 | (TICK_USEC - 1);
+            tick_realign = false;
+        }
+
+        tick_usec += TICK_USEC;
+    }
+#endif
+
     /* Run through the list of tick tasks using main CPU core - 
        wake up the COP through its control interface to provide pulse */
     call_tick_tasks();
@@ -45,6 +127,9 @@ void tick_start(unsigned int interval_in_ms)
 #ifndef BOOTLOADER
     TIMER1_CFG = 0x0;
     TIMER1_VAL;
+#ifdef HAVE_TICKLESS_IDLE
+    tick_usec = USEC_TIMER;
+#endif
     /* enable timer */
     TIMER1_CFG = 0xc0000000 | (interval_in_ms*1000 - 1);
     /* unmask interrupt source */
@@ -212,8 +212,8 @@ void clickwheel_int(void)
 
                 if (queue_empty(&button_queue))
                 {
-                    queue_post(&button_queue, btn, wheel_fast_mode |
-                               (wheel_delta << 24) | wheel_velocity*360/WHEELCLICKS_PER_ROTATION);
+                    button_queue_post_irq(btn, wheel_fast_mode |
+                                          (wheel_delta << 24) | wheel_velocity*360/WHEELCLICKS_PER_ROTATION);
                     /* message posted - reset delta */
                     wheel_delta = 1;
                 }
@@ -28,6 +28,9 @@
 #endif
 #include "button-target.h"
 #include "usb-target.h"
+#ifdef RB_PROFILE
+#include "profile.h"
+#endif
 #include "usb_drv.h"
 #ifdef HAVE_REMOTE_LCD
 #include "lcd-remote-target.h"
@@ -50,6 +53,9 @@ void __attribute__((interrupt("IRQ"))) irq_handler(void)
             TIMER1();
         }
         else if (CPU_INT_STAT & TIMER2_MASK) {
+#ifdef RB_PROFILE
+            profile_irq_pc = __builtin_return_address(0);
+#endif
             TIMER2();
         }
 #ifdef HAVE_USBSTACK
@@ -166,8 +172,12 @@ void __attribute__((interrupt("IRQ"))) irq_handler(void)
         }
 #endif
     } else {
-        if (COP_INT_STAT & TIMER2_MASK)
+        if (COP_INT_STAT & TIMER2_MASK) {
+#ifdef RB_PROFILE
+            profile_irq_pc = __builtin_return_address(0);
+#endif
             TIMER2();
+        }
     }
 }
 #endif /* BOOTLOADER */
@@ -0,0 +1,2 @@
+#define ROCKBOX_LITTLE_ENDIAN 1
+#define ROCKBOX_DIR "/.rockbox"
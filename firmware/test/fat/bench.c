@@ -0,0 +1,438 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/* Runs the file system code on a simulated disk and reports how much the
+   disk had to do for a few typical workloads. Every scenario runs in its
+   own process on a freshly formatted disk (or a fresh copy of the image
+   given with -i), so the results don't depend on each other. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "storage.h"
+#include "fat.h"
+#include "file.h"
+#include "dir.h"
+#include "dircache.h"
+#include "buffer.h"
+#include "storage-sim.h"
+
+#define CHUNK_SIZE (32*1024)
+
+static unsigned char chunk[CHUNK_SIZE];
+static bool header_printed = false;
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "bench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+/* Starts measuring, after the scenario has set up the disk */
+static void bench_start(void)
+{
+    sim_reset_stats();
+}
+
+/* Prints what the disk did since bench_start() or the last report */
+static void bench_report(const char *name)
+{
+    struct sim_stats s;
+
+    sim_get_stats(&s);
+    if (!header_printed)
+    {
+        printf("%-14s %-5s %8s %8s %9s %9s %7s %11s\n", "scenario", "model",
+               "rd cmds", "wr cmds", "rd sect", "wr sect", "seeks",
+               "time (ms)");
+        header_printed = true;
+    }
+    printf("%-14s %-5s %8lu %8lu %9lu %9lu %7lu %11.1f\n", name,
+           sim_get_model(), s.read_commands, s.write_commands,
+           s.sectors_read, s.sectors_written, s.seeks, s.usec / 1000.0);
+    fflush(stdout);
+    sim_reset_stats();
+}
+
+static void write_file(const char *path, long size, long chunksize)
+{
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC);
+    long done, n;
+
+    if (fd < 0)
+        fail("can't create %s", path);
+
+    for (done = 0; done < size; done += n)
+    {
+        n = size - done < chunksize ? size - done : chunksize;
+        if (write(fd, chunk, n) != n)
+            fail("write to %s failed", path);
+    }
+
+    close(fd);
+}
+
+static long read_file(const char *path, long chunksize)
+{
+    int fd = open(path, O_RDONLY);
+    long total = 0, n;
+
+    if (fd < 0)
+        fail("can't open %s", path);
+
+    while ((n = read(fd, chunk, chunksize)) > 0)
+        total += n;
+
+    close(fd);
+    return total;
+}
+
+/* Playback buffering a long file */
+static void seqread(void)
+{
+    write_file("/seq.mp3", 8*1024*1024, CHUNK_SIZE);
+    bench_start();
+    if (read_file("/seq.mp3", CHUNK_SIZE) != 8*1024*1024)
+        fail("short read");
+    bench_report("seqread");
+}
+
+/* The same for a file written alongside another one, so its clusters
+   alternate with those of the other file */
+static void fragread(void)
+{
+    int fda = open("/frag_a.mp3", O_WRONLY|O_CREAT|O_TRUNC);
+    int fdb = open("/frag_b.mp3", O_WRONLY|O_CREAT|O_TRUNC);
+    long done;
+
+    if (fda < 0 || fdb < 0)
+        fail("can't create files");
+
+    for (done = 0; done < 4*1024*1024; done += 4096)
+    {
+        if (write(fda, chunk, 4096) != 4096 || write(fdb, chunk, 4096) != 4096)
+            fail("write failed");
+    }
+
+    close(fda);
+    close(fdb);
+
+    bench_start();
+    if (read_file("/frag_a.mp3", CHUNK_SIZE) != 4*1024*1024)
+        fail("short read");
+    bench_report("fragread");
+}
+
+/* Settings, playlists, bookmarks and the like */
+static void smallfiles(void)
+{
+    char path[MAX_PATH];
+    int i;
+
+    bench_start();
+    if (mkdir("/small") < 0)
+        fail("can't make /small");
+
+    for (i = 0; i < 500; i++)
+    {
+        snprintf(path, sizeof(path), "/small/file%03d.cfg", i);
+        write_file(path, 1500, 1500);
+    }
+    bench_report("smallcreate");
+
+    for (i = 0; i < 500; i++)
+    {
+        snprintf(path, sizeof(path), "/small/file%03d.cfg", i);
+        if (remove(path) < 0)
+            fail("can't remove %s", path);
+    }
+    if (rmdir("/small") < 0)
+        fail("can't remove /small");
+    bench_report("smalldelete");
+}
+
+#define TREE_DEPTH  5
+#define TREE_FANOUT 3
+#define TREE_FILES  4
+
+static void make_tree(char *path, int depth)
+{
+    int len = strlen(path);
+    int i;
+
+    for (i = 0; i < TREE_FILES; i++)
+    {
+        snprintf(path + len, MAX_PATH - len, "/%02d - Track number %d.mp3",
+                 i + 1, i + 1);
+        write_file(path, 4096, 4096);
+    }
+
+    for (i = 0; depth > 0 && i < TREE_FANOUT; i++)
+    {
+        snprintf(path + len, MAX_PATH - len, "/Directory number %d", i);
+        if (mkdir(path) < 0)
+            fail("can't make %s", path);
+        make_tree(path, depth - 1);
+    }
+
+    path[len] = '\0';
+}
+
+/* Walks the tree reading the start of every file, like the database scan
+   does to get the tags */
+static int scan_tree(char *path)
+{
+    int len = strlen(path);
+    int files = 0;
+    struct dirent *entry;
+    DIR *dir = opendir(len ? path : "/");
+
+    if (!dir)
+        fail("can't open %s", path);
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path + len, MAX_PATH - len, "/%s", entry->d_name);
+        if (entry->attribute & ATTR_DIRECTORY)
+            files += scan_tree(path);
+        else
+        {
+            int fd = open(path, O_RDONLY);
+
+            if (fd < 0 || read(fd, chunk, 512) != 512)
+                fail("can't read %s", path);
+            close(fd);
+            files++;
+        }
+    }
+
+    closedir(dir);
+    path[len] = '\0';
+    return files;
+}
+
+static void tree(void)
+{
+    char path[MAX_PATH] = "";
+    int expect = 0, level = 1, i;
+
+    for (i = 0; i <= TREE_DEPTH; i++, level *= TREE_FANOUT)
+        expect += level * TREE_FILES;
+
+    make_tree(path, TREE_DEPTH);
+
+    bench_start();
+    if (scan_tree(path) != expect)
+        fail("files missing in the tree");
+    bench_report("tree");
+
+    if (dircache_build(0) < 0)
+        fail("can't build the dircache");
+    bench_report("dircachebuild");
+
+    if (scan_tree(path) != expect)
+        fail("files missing in the cached tree");
+    bench_report("tree-cached");
+}
+
+/* Recording: the file is preallocated and flushed now and then, the way
+   pcm_record.c does */
+static void recording(void)
+{
+    int fd;
+    long done;
+
+    bench_start();
+    fd = open("/rec.wav", O_WRONLY|O_CREAT|O_TRUNC);
+    if (fd < 0)
+        fail("can't create /rec.wav");
+
+    fpreallocate(fd, 8*1024*1024);
+    for (done = 0; done < 16*1024*1024; done += CHUNK_SIZE)
+    {
+        if (write(fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+            fail("write failed");
+
+        if ((done + CHUNK_SIZE) % (1024*1024) == 0)
+            fsync(fd);
+
+        if ((done + CHUNK_SIZE) % (8*1024*1024) == 0)
+            fpreallocate(fd, done + CHUNK_SIZE + 8*1024*1024);
+    }
+
+    close(fd);
+    bench_report("recording");
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(void);
+} scenarios[] =
+{
+    { "seqread",    seqread    },
+    { "fragread",   fragread   },
+    { "smallfiles", smallfiles },
+    { "tree",       tree       },
+    { "recording",  recording  },
+};
+
+#define NUM_SCENARIOS (int)(sizeof(scenarios)/sizeof(scenarios[0]))
+
+static unsigned long disk_mb = 256;
+static const char *image = NULL;
+static const char *save_image = NULL;
+
+static void run(int scenario)
+{
+    int rc;
+
+    rc = image ? sim_disk_load(image) : sim_disk_create(disk_mb * 2048);
+    if (rc < 0)
+        fail("can't set up the disk (%d)", rc);
+
+    buffer_init();
+    storage_init();
+    fat_init();
+    rc = fat_mount(IF_MV2(0,) IF_MD2(0,) 0);
+    if (rc < 0)
+        fail("mount failed (%d)", rc);
+    dircache_init();
+
+    memset(chunk, 0x5a, sizeof(chunk));
+    scenarios[scenario].run();
+
+    if (save_image && sim_disk_save(save_image) < 0)
+        fail("can't save %s", save_image);
+}
+
+static void usage(void)
+{
+    int i;
+
+    printf("usage: bench [-m hdd|sd] [-s MB] [-i image] [-o image] "
+           "[scenario...]\n"
+           "  -m  latency model, both if not given\n"
+           "  -s  size of the formatted disk (default %lu)\n"
+           "  -i  run on copies of this image instead\n"
+           "  -o  save the disk to this image after each scenario\n"
+           "scenarios:", disk_mb);
+    for (i = 0; i < NUM_SCENARIOS; i++)
+        printf(" %s", scenarios[i].name);
+    printf("\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *all_models[] = { "hdd", "sd", NULL };
+    const char *one_model[] = { NULL, NULL };
+    const char **models = all_models;
+    bool selected[NUM_SCENARIOS];
+    bool any = false;
+    int opt, i, m;
+
+    while ((opt = getopt(argc, argv, "m:s:i:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                if (!sim_set_model(optarg))
+                    usage();
+                one_model[0] = optarg;
+                models = one_model;
+                break;
+            case 's':
+                disk_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                image = optarg;
+                break;
+            case 'o':
+                save_image = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    for (i = 0; i < NUM_SCENARIOS; i++)
+        selected[i] = optind >= argc;
+
+    for (; optind < argc; optind++)
+    {
+        for (i = 0; i < NUM_SCENARIOS; i++)
+        {
+            if (!strcmp(argv[optind], scenarios[i].name))
+                break;
+        }
+        if (i == NUM_SCENARIOS)
+            usage();
+        selected[i] = true;
+    }
+
+    for (m = 0; models[m]; m++)
+    {
+        sim_set_model(models[m]);
+        for (i = 0; i < NUM_SCENARIOS; i++)
+        {
+            pid_t pid;
+            int status;
+
+            if (!selected[i])
+                continue;
+
+            if (!any)
+                any = true;
+            else
+                header_printed = true; /* print it only once */
+
+            fflush(stdout);
+            pid = fork();
+            if (pid == 0)
+            {
+                run(i);
+                exit(0);
+            }
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "bench: %s on %s failed\n",
+                        scenarios[i].name, models[m]);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
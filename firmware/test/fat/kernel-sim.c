@@ -0,0 +1,196 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/* What the file system code needs from the kernel. Everything runs in one
+   thread, so nothing ever has to wait. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "config.h"
+#include "kernel.h"
+#include "thread.h"
+#include "usb.h"
+#include "timefuncs.h"
+#include "panic.h"
+#include "buffer.h"
+#include "core_alloc.h"
+
+/* The target linker scripts put audiobufend at the end of RAM, here it is
+   the end of a plain array */
+unsigned char bench_audiobuf[8*1024*1024];
+__asm__(".globl audiobufend\n"
+        ".set audiobufend, bench_audiobuf + 8*1024*1024");
+unsigned char *audiobuf;
+volatile long current_tick;
+
+void buffer_init(void)
+{
+    audiobuf = bench_audiobuf;
+    core_allocator_init();
+}
+
+void *buffer_alloc(size_t size)
+{
+    void *retval = core_alloc_permanent(size);
+
+    if (!retval)
+        panicf("buffer_alloc: out of memory");
+
+    return retval;
+}
+
+/* Nothing is ever playing here */
+int audio_status(void)
+{
+    return 0;
+}
+
+void mutex_init(struct mutex *m)
+{
+    (void)m;
+}
+
+void mutex_lock(struct mutex *m)
+{
+    (void)m;
+}
+
+void mutex_unlock(struct mutex *m)
+{
+    (void)m;
+}
+
+void semaphore_init(struct semaphore *s, int max, int start)
+{
+    s->max = max;
+    s->count = start;
+}
+
+void semaphore_wait(struct semaphore *s)
+{
+    if (--s->count < 0)
+        panicf("semaphore_wait() would block");
+}
+
+void semaphore_release(struct semaphore *s)
+{
+    if (s->count < s->max)
+        s->count++;
+}
+
+int thread_get_priority(unsigned int thread_id)
+{
+    (void)thread_id;
+    return PRIORITY_USER_INTERFACE;
+}
+
+unsigned int create_thread(void (*function)(void), void* stack,
+                           size_t stack_size, unsigned flags,
+                           const char *name IF_PRIO(, int priority)
+                           IF_COP(, unsigned int core))
+{
+    (void)function; (void)stack; (void)stack_size; (void)flags; (void)name;
+#ifdef HAVE_PRIORITY_SCHEDULING
+    (void)priority;
+#endif
+#if NUM_CORES > 1
+    (void)core;
+#endif
+    return 1;
+}
+
+void queue_init(struct event_queue *q, bool register_queue)
+{
+    (void)q; (void)register_queue;
+}
+
+void queue_post(struct event_queue *q, long id, intptr_t data)
+{
+    (void)q; (void)id; (void)data;
+}
+
+void queue_wait(struct event_queue *q, struct queue_event *ev)
+{
+    (void)q;
+    panicf("queue_wait() would block");
+    ev->id = 0;
+}
+
+void queue_wait_w_tmo(struct event_queue *q, struct queue_event *ev,
+                      int ticks)
+{
+    (void)q; (void)ticks;
+    ev->id = SYS_TIMEOUT;
+}
+
+void sleep(int ticks)
+{
+    current_tick += ticks;
+}
+
+void yield(void)
+{
+}
+
+#ifdef HAVE_ADJUSTABLE_CPU_FREQ
+void cpu_boost(bool on_off)
+{
+    (void)on_off;
+}
+#endif
+
+void usb_acknowledge(long id)
+{
+    (void)id;
+}
+
+void usb_wait_for_disconnect(struct event_queue *q)
+{
+    (void)q;
+}
+
+struct tm *get_time(void)
+{
+    static struct tm tm = { .tm_year = 126, .tm_mon = 0, .tm_mday = 1 };
+    return &tm;
+}
+
+void panicf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "***PANIC*** ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(2);
+}
+
+void debugf(const char *fmt, ...)
+{
+    (void)fmt;
+}
+
+void ldebugf(const char* file, int line, const char *fmt, ...)
+{
+    (void)file; (void)line; (void)fmt;
+}
@@ -0,0 +1,280 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "config.h"
+#include "ata.h"
+#include "storage-sim.h"
+
+#define SECTOR_SIZE 512
+
+/* Times in microseconds. The hdd numbers are those of the 1.8" 4200 rpm
+   drives found in iPods, the sd ones of a class 4 card. */
+struct sim_model
+{
+    const char *name;
+    long command;        /* overhead of every command */
+    long seek_min;       /* track to track seek */
+    long seek_max;       /* full stroke seek */
+    long rotation;       /* average rotational latency after a seek */
+    long track;          /* sectors per track, shorter skips ahead only
+                            wait for the platter */
+    long read_sector;
+    long write_sector;
+    long write_jump;     /* write not continuing the last write, the card
+                            has to start a new erase block */
+};
+
+static const struct sim_model models[] =
+{
+    { "hdd", 500, 1500, 18000, 7140, 800, 26, 26,    0 },
+    { "sd",  300,    0,     0,    0,   0, 51, 102, 3000 },
+};
+
+static const struct sim_model *model = &models[0];
+
+static unsigned char *disk;
+static unsigned long disk_sectors;
+static unsigned long head;       /* sector following the last transfer */
+static unsigned long write_head; /* sector following the last write */
+static struct sim_stats stats;
+
+static long long command_time(unsigned long start, int count, bool write)
+{
+    long long t = model->command;
+
+    if (start != head)
+    {
+        unsigned long distance = start > head ? start - head : head - start;
+
+        stats.seeks++;
+        if (start > head && distance < (unsigned long)model->track)
+            t += distance * model->read_sector;
+        else if (model->seek_max > 0)
+            t += model->seek_min + model->rotation +
+                 (long long)((model->seek_max - model->seek_min) *
+                             sqrt((double)distance / disk_sectors));
+    }
+
+    if (write)
+    {
+        if (start != write_head)
+            t += model->write_jump;
+        t += (long long)count * model->write_sector;
+    }
+    else
+        t += (long long)count * model->read_sector;
+
+    return t;
+}
+
+int ata_read_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                     void* buf)
+{
+#ifdef HAVE_MULTIDRIVE
+    (void)drive;
+#endif
+    if (start + count > disk_sectors)
+        return -1;
+
+    stats.usec += command_time(start, count, false);
+    stats.read_commands++;
+    stats.sectors_read += count;
+    head = start + count;
+
+    memcpy(buf, &disk[start*SECTOR_SIZE], count*SECTOR_SIZE);
+    return 0;
+}
+
+int ata_write_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                      const void* buf)
+{
+#ifdef HAVE_MULTIDRIVE
+    (void)drive;
+#endif
+    if (start == 0 || start + count > disk_sectors)
+        return -1;
+
+    stats.usec += command_time(start, count, true);
+    stats.write_commands++;
+    stats.sectors_written += count;
+    head = write_head = start + count;
+
+    memcpy(&disk[start*SECTOR_SIZE], buf, count*SECTOR_SIZE);
+    return 0;
+}
+
+int ata_init(void)
+{
+    return disk ? 0 : -1;
+}
+
+static void put16(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+int sim_disk_create(unsigned long sectors)
+{
+    unsigned char *bpb, *fsinfo, *fat;
+    unsigned long fatsize, clusters;
+    const int reserved = 32;
+    int secperclus;
+    int i;
+
+    /* 4k clusters unless that's too few for FAT32 */
+    for (secperclus = 8; secperclus > 0; secperclus /= 2)
+    {
+        fatsize = (sectors / secperclus * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE + 1;
+        clusters = (sectors - reserved - 2 * fatsize) / secperclus;
+        if (clusters >= 65525)
+            break;
+    }
+    if (secperclus == 0)
+        return -2;
+
+    free(disk);
+    disk = calloc(sectors, SECTOR_SIZE);
+    if (!disk)
+        return -1;
+    disk_sectors = sectors;
+
+    bpb = disk;
+    memcpy(bpb, "\xeb\x58\x90MSWIN4.1", 11);
+    put16(bpb + 11, SECTOR_SIZE);
+    bpb[13] = secperclus;
+    put16(bpb + 14, reserved);
+    bpb[16] = 2;                 /* number of FATs */
+    bpb[21] = 0xf8;              /* media */
+    put16(bpb + 24, 32);         /* sectors per track */
+    put16(bpb + 26, 64);         /* heads */
+    put32(bpb + 32, sectors);
+    put32(bpb + 36, fatsize);
+    put32(bpb + 44, 2);          /* root directory cluster */
+    put16(bpb + 48, 1);          /* fsinfo sector */
+    put16(bpb + 50, 6);          /* backup boot sector */
+    bpb[64] = 0x80;
+    bpb[66] = 0x29;
+    put32(bpb + 67, 0x12345678);
+    memcpy(bpb + 71, "NO NAME    FAT32   ", 19);
+    bpb[510] = 0x55;
+    bpb[511] = 0xaa;
+
+    fsinfo = disk + SECTOR_SIZE;
+    put32(fsinfo, 0x41615252);
+    put32(fsinfo + 484, 0x61417272);
+    put32(fsinfo + 488, clusters - 1);
+    put32(fsinfo + 492, 3);
+    fsinfo[510] = 0x55;
+    fsinfo[511] = 0xaa;
+
+    for (i = 0; i < 2; i++)
+    {
+        fat = disk + (reserved + i * fatsize) * SECTOR_SIZE;
+        put32(fat, 0x0ffffff8);
+        put32(fat + 4, 0x0fffffff);
+        put32(fat + 8, 0x0fffffff); /* root directory */
+    }
+
+    sim_reset_stats();
+    return 0;
+}
+
+int sim_disk_load(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    long size;
+
+    if (!f)
+        return -1;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    free(disk);
+    disk_sectors = size / SECTOR_SIZE;
+    disk = malloc(disk_sectors * SECTOR_SIZE);
+    if (!disk || fread(disk, SECTOR_SIZE, disk_sectors, f) != disk_sectors)
+    {
+        fclose(f);
+        return -2;
+    }
+
+    fclose(f);
+    sim_reset_stats();
+    return 0;
+}
+
+int sim_disk_save(const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    int rc = 0;
+
+    if (!f)
+        return -1;
+
+    if (fwrite(disk, SECTOR_SIZE, disk_sectors, f) != disk_sectors)
+        rc = -2;
+
+    fclose(f);
+    return rc;
+}
+
+bool sim_set_model(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(models)/sizeof(models[0]); i++)
+    {
+        if (!strcmp(name, models[i].name))
+        {
+            model = &models[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *sim_get_model(void)
+{
+    return model->name;
+}
+
+void sim_get_stats(struct sim_stats *s)
+{
+    *s = stats;
+}
+
+void sim_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,52 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#ifndef _STORAGE_SIM_H_
+#define _STORAGE_SIM_H_
+
+#include <stdbool.h>
+
+/* Disk image kept in RAM, with the time each command would take on real
+   hardware added up instead of waited for */
+
+struct sim_stats
+{
+    unsigned long read_commands;
+    unsigned long write_commands;
+    unsigned long sectors_read;
+    unsigned long sectors_written;
+    unsigned long seeks;         /* commands not continuing the last one */
+    long long usec;              /* simulated time */
+};
+
+/* Makes an empty FAT32 disk of the given size */
+int sim_disk_create(unsigned long sectors);
+/* Loads the disk from an image file */
+int sim_disk_load(const char *filename);
+int sim_disk_save(const char *filename);
+
+/* Selects the latency model, "hdd" or "sd" */
+bool sim_set_model(const char *name);
+const char *sim_get_model(void);
+
+void sim_get_stats(struct sim_stats *stats);
+void sim_reset_stats(void);
+
+#endif
@@ -0,0 +1,207 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/* Measures what a context switch costs in the scheduler with 1, 8 and 20
+   threads yielding to each other, either all at the same priority or with
+   one above the others so that those have to age. The host's
+   own cost of switching stacks is measured separately, so the scheduler's
+   share can be told apart. Every run is done in its own process since the
+   threads can only be initialized once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "thread.h"
+#include "kernel.h"
+#include "thread-host.h"
+
+#define MAX_WORKERS 20
+#define STACK_WORDS 4096
+
+static uintptr_t stacks[MAX_WORKERS][STACK_WORDS];
+static unsigned int ids[MAX_WORKERS];
+static unsigned long yields_per_thread = 200000;
+static unsigned long yields;
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "bench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void worker(void)
+{
+    unsigned long i;
+
+    for (i = 0; i < yields_per_thread; i++)
+    {
+        yields++;
+        yield();
+    }
+}
+
+/* Runs the workers until all have exited, main waits for them */
+static void run(int threads, bool mixed)
+{
+    double start, ns;
+    int i;
+
+    host_init_threads();
+
+    for (i = 0; i < threads; i++)
+    {
+        /* Mixed has one thread above the others, which run when they have
+           aged enough, like the codec thread does to the rest */
+        int priority = mixed && i > 0 ? PRIORITY_BACKGROUND : PRIORITY_SYSTEM;
+
+        ids[i] = create_thread(worker, stacks[i], sizeof(stacks[i]), 0,
+                               "worker" IF_PRIO(, priority) IF_COP(, CPU));
+        if (ids[i] == 0)
+            fail("can't create thread %d", i);
+        (void)priority;
+    }
+
+    start = now();
+    for (i = 0; i < threads; i++)
+        thread_wait(ids[i]);
+    ns = now() - start;
+
+    printf("%7d %-6s %10lu %10lu %12.1f\n", threads, mixed ? "mixed" : "equal",
+           yields, host_context_switches, ns / yields);
+}
+
+/* What switching stacks costs the host, without any scheduler. This is
+   done the same way as in thread-host.c. */
+static ucontext_t pong_uc;
+static jmp_buf ping_jb, pong_jb;
+
+static void pong(void)
+{
+    for (;;)
+    {
+        if (_setjmp(pong_jb) == 0)
+            _longjmp(ping_jb, 1);
+    }
+}
+
+static double host_switch_ns(void)
+{
+    static uintptr_t stack[STACK_WORDS];
+    unsigned long i;
+    double start;
+
+    getcontext(&pong_uc);
+    pong_uc.uc_stack.ss_sp = stack;
+    pong_uc.uc_stack.ss_size = sizeof(stack);
+    pong_uc.uc_link = NULL;
+    makecontext(&pong_uc, pong, 0);
+
+    if (_setjmp(ping_jb) == 0)
+        setcontext(&pong_uc);
+
+    start = now();
+    for (i = 0; i < yields_per_thread; i++)
+    {
+        if (_setjmp(ping_jb) == 0)
+            _longjmp(pong_jb, 1);
+    }
+
+    return (now() - start) / (2*i);
+}
+
+static void usage(void)
+{
+    printf("usage: bench [-y yields]\n"
+           "  -y  yields done by every thread (default %lu)\n",
+           yields_per_thread);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = { 1, 8, 20 };
+    /* Equal priorities are all there is without priority scheduling */
+    const int modes = IF_PRIO(2) IFN_PRIO(1);
+    int opt, i, m;
+
+    while ((opt = getopt(argc, argv, "y:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'y':
+                yields_per_thread = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (yields_per_thread == 0)
+        usage();
+
+    printf("host stack switch: %.1f ns\n", host_switch_ns());
+    printf("%7s %-6s %10s %10s %12s\n", "threads", "prio", "yields",
+           "switches", "ns/yield");
+    fflush(stdout);
+
+    for (m = 0; m < modes; m++)
+    {
+        for (i = 0; i < (int)(sizeof(counts)/sizeof(counts[0])); i++)
+        {
+            pid_t pid;
+            int status;
+
+            pid = fork();
+            if (pid == 0)
+            {
+                run(counts[i], m);
+                exit(0);
+            }
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "bench: %d threads failed\n", counts[i]);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
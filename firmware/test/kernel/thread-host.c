@@ -0,0 +1,145 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 by agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/* Builds the firmware scheduler for the host. thread.c only lacks the CPU
+   specific part when no CPU is configured, which is supplied here. Threads
+   are started with ucontext and switched with _setjmp()/_longjmp(), which
+   unlike swapcontext() don't make a system call every time. It is built
+   with the simulator's configuration, which doesn't use priority
+   scheduling, so the Makefile turns that back on. */
+
+#include <setjmp.h>
+#include <ucontext.h>
+#include "config.h"
+#include "thread.h"
+#include "kernel.h"
+#include "thread-host.h"
+
+/* Interrupts never happen */
+#define disable_irq()
+#define enable_irq()
+#define disable_irq_save()  0
+#define restore_irq(level)  ((void)(level))
+
+static struct host_thread
+{
+    ucontext_t uc;  /* Where the thread starts */
+    jmp_buf jb;     /* Where it continues once started */
+} host_threads[MAXTHREADS];
+static struct regs *stored_context;
+unsigned long host_context_switches;
+
+static void host_startup_init(struct regs *context, uintptr_t *stack,
+                              size_t stack_size, void (*function)(void));
+
+#define THREAD_STARTUP_INIT(core, thread, function) \
+    host_startup_init(&(thread)->context, (thread)->stack, \
+                      (thread)->stack_size, (function))
+
+/* The simulator's struct regs has no stack pointer, create_thread() stores
+   it in the unused semaphore pointer instead */
+#define sp s
+
+#include "../../thread.c"
+
+#undef sp
+
+/* Main's stack, where the linker script would have put it */
+asm(".bss                   \n"
+    ".balign 16             \n"
+    ".globl  stackbegin     \n"
+    "stackbegin:            \n"
+    ".space  0x2000         \n"
+    ".globl  stackend       \n"
+    "stackend:              \n"
+    ".previous              \n");
+
+static struct host_thread *host_thread(struct regs *context)
+{
+    return &host_threads[(struct thread_entry *)
+        ((char *)context - offsetof(struct thread_entry, context)) - threads];
+}
+
+static void host_start_thread(void)
+{
+    struct regs *context = stored_context;
+    void (*function)(void) = context->start;
+
+    context->start = NULL;
+    function();
+    thread_exit();
+}
+
+static void host_startup_init(struct regs *context, uintptr_t *stack,
+                              size_t stack_size, void (*function)(void))
+{
+    ucontext_t *uc = &host_thread(context)->uc;
+
+    getcontext(uc);
+    uc->uc_stack.ss_sp = stack;
+    uc->uc_stack.ss_size = stack_size;
+    uc->uc_link = NULL;
+    makecontext(uc, host_start_thread, 0);
+    context->start = function;
+}
+
+static inline void store_context(void* addr)
+{
+    stored_context = addr;
+}
+
+/* Can't be inlined into switch_thread() since it uses setjmp */
+static void __attribute__((noinline)) host_switch(struct host_thread *old,
+                                                  struct regs *context)
+{
+    if (_setjmp(old->jb) == 0)
+    {
+        if (context->start != NULL)
+            setcontext(&host_thread(context)->uc);
+        else
+            _longjmp(host_thread(context)->jb, 1);
+    }
+}
+
+static inline void load_context(const void* addr)
+{
+    struct regs *context = (struct regs *)addr;
+    struct regs *old = stored_context;
+
+    if (context == old)
+        return;
+
+    /* A new thread finds its context here */
+    stored_context = context;
+    host_context_switches++;
+    host_switch(host_thread(old), context);
+}
+
+static inline void core_sleep(void)
+{
+    panicf("all threads are blocked");
+}
+
+void host_init_threads(void)
+{
+    stackbegin[0] = DEADBEEF;
+    init_threads();
+}
@@ -1398,6 +1398,8 @@ static inline void set_running_thread_priority(
 {
     const unsigned int core = IF_COP_CORE(thread->core);
     RTR_LOCK(core);
+    remove_from_list_l(&cores[core].rtr_threads[thread->priority], thread);
+    add_to_list_l(&cores[core].rtr_threads[priority], thread);
     rtr_move_entry(core, thread->priority, priority);
     thread->priority = priority;
     RTR_UNLOCK(core);
@@ -1730,6 +1732,201 @@ static void check_for_obj_waiters(const char *function, struct thread_entry *thr
 }
 #endif /* HAVE_PRIORITY_SCHEDULING */
 
+/*---------------------------------------------------------------------------
+ * Run queue - with priority scheduling every priority has its own list of
+ * ready-to-run threads and cores[core].rtr.mask has a bit set for each list
+ * that isn't empty, so the next thread is found without looking at any of
+ * the others. Without priority scheduling, a single list is used whose head
+ * is the running thread.
+ *
+ * These must be called with the RTR list locked.
+ *---------------------------------------------------------------------------
+ */
+static void rtr_add_thread(unsigned int core, struct thread_entry *thread)
+{
+#ifdef HAVE_PRIORITY_SCHEDULING
+    add_to_list_l(&cores[core].rtr_threads[thread->priority], thread);
+    rtr_add_entry(core, thread->priority);
+
+    if (cores[core].running == NULL)
+        cores[core].running = thread;
+#else
+    add_to_list_l(&cores[core].running, thread);
+#endif
+}
+
+static void rtr_remove_thread(unsigned int core, struct thread_entry *thread)
+{
+#ifdef HAVE_PRIORITY_SCHEDULING
+    remove_from_list_l(&cores[core].rtr_threads[thread->priority], thread);
+    rtr_subtract_entry(core, thread->priority);
+
+    if (cores[core].running == thread)
+    {
+        /* Until the next switch, let the running thread be the one most
+         * likely to run next or none at all */
+        uint32_t mask = cores[core].rtr.mask;
+        cores[core].running = mask == 0 ? NULL :
+            cores[core].rtr_threads[find_first_set_bit(mask)];
+    }
+#else
+    remove_from_list_l(&cores[core].running, thread);
+#endif
+}
+
+#ifdef HAVE_THREAD_STATS
+#ifdef USEC_TIMER
+#define STATS_TIME() ((unsigned long)USEC_TIMER)
+#else
+#define STATS_TIME() ((unsigned long)current_tick * (1000000/HZ))
+#endif
+
+#define THREAD_SLOT(thread) ((thread)->id & THREAD_ID_SLOT_MASK)
+
+/* Kept out of thread_entry so the accounting doesn't take up IRAM */
+static struct
+{
+    struct thread_stats s;
+#ifdef HAVE_THREAD_TRACE
+    unsigned long woken_at;     /* Time of a wakeup not followed by running */
+    unsigned long boosted_at;   /* Time the boost was taken */
+    bool woken;
+#endif
+} thread_stats[MAXTHREADS];
+
+static struct
+{
+    unsigned long started_at;   /* Time the running thread was switched in */
+#ifdef HAVE_THREAD_TRACE
+    unsigned char last;         /* Slot of the thread switched out */
+#endif
+} core_stats[NUM_CORES];
+
+static long stats_reset_tick;
+
+#ifdef HAVE_THREAD_TRACE
+static struct thread_trace_event trace_buf[THREAD_TRACE_SIZE];
+static unsigned int trace_pos;  /* Next event written */
+static unsigned int trace_count;
+static bool trace_on = false;
+
+/*---------------------------------------------------------------------------
+ * Adds an event to the trace if it's running. On dual core targets the
+ * cores may rarely overwrite each other's event, which is acceptable for
+ * a debugging aid.
+ *---------------------------------------------------------------------------
+ */
+static void thread_trace_add(unsigned int type, unsigned int core,
+                             unsigned int slot, unsigned int arg,
+                             unsigned long time)
+{
+    struct thread_trace_event *ev;
+    int oldlevel;
+
+    if (!trace_on)
+        return;
+
+    oldlevel = disable_irq_save();
+
+    ev = &trace_buf[trace_pos];
+    ev->time = time;
+    ev->type = type;
+    ev->core = core;
+    ev->thread = slot;
+    ev->arg = arg;
+
+    trace_pos = (trace_pos + 1) % THREAD_TRACE_SIZE;
+    if (trace_count < THREAD_TRACE_SIZE)
+        trace_count++;
+
+    restore_irq(oldlevel);
+}
+#endif /* HAVE_THREAD_TRACE */
+
+/*---------------------------------------------------------------------------
+ * Charges the run time to the thread being switched out.
+ *---------------------------------------------------------------------------
+ */
+static inline void thread_stats_stopped(unsigned int core,
+                                        struct thread_entry *thread)
+{
+    unsigned int slot = THREAD_SLOT(thread);
+
+    thread_stats[slot].s.run_time += STATS_TIME() - core_stats[core].started_at;
+#ifdef HAVE_THREAD_TRACE
+    core_stats[core].last = slot;
+#endif
+}
+
+/*---------------------------------------------------------------------------
+ * Counts the switch to the selected thread and the delay since its wakeup.
+ *---------------------------------------------------------------------------
+ */
+static inline void thread_stats_started(unsigned int core,
+                                        struct thread_entry *thread)
+{
+    unsigned int slot = THREAD_SLOT(thread);
+    unsigned long now = STATS_TIME();
+
+    core_stats[core].started_at = now;
+    thread_stats[slot].s.switches++;
+
+#ifdef HAVE_THREAD_TRACE
+    if (thread_stats[slot].woken)
+    {
+        unsigned long latency = now - thread_stats[slot].woken_at;
+
+        thread_stats[slot].woken = false;
+        thread_stats[slot].s.wakeups++;
+        thread_stats[slot].s.wakeup_latency += latency;
+        if (latency > thread_stats[slot].s.max_wakeup_latency)
+            thread_stats[slot].s.max_wakeup_latency = latency;
+    }
+
+    if (slot != core_stats[core].last)
+        thread_trace_add(THREAD_TRACE_SWITCH, core, slot,
+                         core_stats[core].last, now);
+#endif
+}
+
+#ifdef HAVE_THREAD_TRACE
+/*---------------------------------------------------------------------------
+ * Notes the time a thread became runnable. Called with the thread's slot
+ * locked.
+ *---------------------------------------------------------------------------
+ */
+static inline void thread_stats_woken(struct thread_entry *thread)
+{
+    const unsigned int core = CURRENT_CORE;
+    struct thread_entry *current = cores[core].running;
+    unsigned int slot = THREAD_SLOT(thread);
+    unsigned long now = STATS_TIME();
+
+    thread_stats[slot].woken_at = now;
+    thread_stats[slot].woken = true;
+
+    thread_trace_add(THREAD_TRACE_WAKEUP, core, slot,
+                     current ? THREAD_SLOT(current) : THREAD_TRACE_NONE, now);
+}
+
+#ifdef HAVE_SCHEDULER_BOOSTCTRL
+static inline void thread_stats_boost(struct thread_entry *thread, bool boost)
+{
+    unsigned int slot = THREAD_SLOT(thread);
+    unsigned long now = STATS_TIME();
+
+    if (boost)
+        thread_stats[slot].boosted_at = now;
+    else
+        thread_stats[slot].s.boost_time += now - thread_stats[slot].boosted_at;
+
+    thread_trace_add(boost ? THREAD_TRACE_BOOST : THREAD_TRACE_UNBOOST,
+                     CURRENT_CORE, slot, THREAD_TRACE_NONE, now);
+}
+#endif /* HAVE_SCHEDULER_BOOSTCTRL */
+#endif /* HAVE_THREAD_TRACE */
+#endif /* HAVE_THREAD_STATS */
+
 /*---------------------------------------------------------------------------
  * Move a thread back to a running state on its core.
  *---------------------------------------------------------------------------
@@ -1738,12 +1935,15 @@ static void core_schedule_wakeup(struct thread_entry *thread)
 {
     const unsigned int core = IF_COP_CORE(thread->core);
 
+#ifdef HAVE_THREAD_TRACE
+    thread_stats_woken(thread);
+#endif
+
     RTR_LOCK(core);
 
     thread->state = STATE_RUNNING;
 
-    add_to_list_l(&cores[core].running, thread);
-    rtr_add_entry(core, thread->priority);
+    rtr_add_thread(core, thread);
 
     RTR_UNLOCK(core);
 
@@ -1849,12 +2049,15 @@ void check_tmo_threads(void)
 
             remove_from_list_tmo(curr);
 
+#ifdef HAVE_THREAD_TRACE
+            thread_stats_woken(curr);
+#endif
+
             RTR_LOCK(core);
 
             curr->state = STATE_RUNNING;
 
-            add_to_list_l(&cores[core].running, curr);
-            rtr_add_entry(core, curr->priority);
+            rtr_add_thread(core, curr);
 
             RTR_UNLOCK(core);
         }
@@ -1865,6 +2068,28 @@ void check_tmo_threads(void)
     cores[core].next_tmo_check = next_tmo_check;
 }
 
+#ifdef HAVE_TICKLESS_IDLE
+/*---------------------------------------------------------------------------
+ * Called on the main core with interrupts disabled when it is about to
+ * sleep. If the other cores sleep too, nothing but an interrupt or a thread
+ * timeout can make any of them run again, so the tick may stop until then.
+ *---------------------------------------------------------------------------
+ */
+static inline void tick_idle_check(void)
+{
+    long deadline = cores[CPU].next_tmo_check;
+#if NUM_CORES > 1
+    if (cores[COP].running != NULL)
+        return;
+
+    if (TIME_BEFORE(cores[COP].next_tmo_check, deadline))
+        deadline = cores[COP].next_tmo_check;
+#endif
+
+    tick_idle_enter(deadline);
+}
+#endif /* HAVE_TICKLESS_IDLE */
+
 /*---------------------------------------------------------------------------
  * Performs operations that must be done before blocking a thread but after
  * the state is saved.
@@ -1916,8 +2141,7 @@ static inline void block_thread_on_l(struct thread_entry *thread,
 
     /* Remove the thread from the list of running threads. */
     RTR_LOCK(core);
-    remove_from_list_l(&cores[core].running, thread);
-    rtr_subtract_entry(core, thread->priority);
+    rtr_remove_thread(core, thread);
     RTR_UNLOCK(core);
 
     /* Add a timeout to the block if not infinite */
@@ -1996,6 +2220,10 @@ void switch_thread(void)
     profile_thread_stopped(thread->id & THREAD_ID_SLOT_MASK);
 #endif
 
+#ifdef HAVE_THREAD_STATS
+    thread_stats_stopped(core, thread);
+#endif
+
     /* Begin task switching by saving our current context so that we can
      * restore the state of the current thread later to the point prior
      * to this call. */
@@ -2037,6 +2265,15 @@ void switch_thread(void)
              * or wakeup request from another core - expected to enable
              * interrupts. */
             RTR_UNLOCK(core);
+#ifdef HAVE_TICKLESS_IDLE
+            if (core == CPU)
+            {
+                tick_idle_check();
+                core_sleep(IF_COP(core));
+                tick_idle_restart();
+            }
+            else
+#endif
             core_sleep(IF_COP(core));
         }
         else
@@ -2045,19 +2282,29 @@ void switch_thread(void)
             /* Select the new task based on priorities and the last time a
              * process got CPU time relative to the highest priority runnable
              * task. */
-            struct priority_distribution *pd = &cores[core].rtr;
-            int max = find_first_set_bit(pd->mask);
+            struct thread_entry **rtr_threads = cores[core].rtr_threads;
+            uint32_t mask = cores[core].rtr.mask;
+            int max;
 
-            if (block == NULL)
+            if (block == NULL && rtr_threads[thread->priority] == thread)
             {
-                /* Not switching on a block, tentatively select next thread */
-                thread = thread->l.next;
+                /* Not switching on a block, the current thread goes behind
+                 * the others of its priority */
+                rtr_threads[thread->priority] = thread->l.next;
             }
 
-            for (;;)
+            max = find_first_set_bit(mask);
+            thread = rtr_threads[max];
+            mask &= ~(1ul << max);
+
+            /* Lower priority threads are only considered when there are any.
+             * Only the first one of each priority ages at a time, the others
+             * get their turn when it has run. */
+            while (mask != 0)
             {
-                int priority = thread->priority;
-                int diff;
+                int priority = find_first_set_bit(mask);
+                struct thread_entry *t = rtr_threads[priority];
+                int diff = priority - max;
 
                 /* This ridiculously simple method of aging seems to work
                  * suspiciously well. It does tend to reward CPU hogs (under
@@ -2068,16 +2315,17 @@ void switch_thread(void)
                  * ready. Of course, aging is only employed when higher and lower
                  * priority threads are runnable. The highest priority runnable
                  * thread(s) are never skipped. */
-                if (LIKELY(priority <= max) ||
-                    IF_NO_SKIP_YIELD( thread->skip_count == -1 || )
-                    (diff = priority - max, ++thread->skip_count > diff*diff))
+                if (IF_NO_SKIP_YIELD( t->skip_count == -1 || )
+                    ++t->skip_count > diff*diff)
                 {
-                    cores[core].running = thread;
+                    thread = t;
                     break;
                 }
 
-                thread = thread->l.next;
+                mask &= ~(1ul << priority);
             }
+
+            cores[core].running = thread;
 #else
             /* Without priority use a simple FCFS algorithm */
             if (block == NULL)
@@ -2094,6 +2342,10 @@ void switch_thread(void)
         }
     }
 
+#ifdef HAVE_THREAD_STATS
+    thread_stats_started(core, thread);
+#endif
+
     /* And finally give control to the next thread. */
     load_context(&thread->context);
 
@@ -2403,6 +2655,10 @@ unsigned int create_thread(void (*function)(void),
 #ifdef HAVE_SCHEDULER_BOOSTCTRL
     thread->cpu_boost = 0;
 #endif
+#ifdef HAVE_THREAD_STATS
+    memset(&thread_stats[THREAD_SLOT(thread)], 0,
+           sizeof (thread_stats[0]));
+#endif
 #ifdef HAVE_PRIORITY_SCHEDULING
     memset(&thread->pdist, 0, sizeof(thread->pdist));
     thread->blocker = NULL;
@@ -2456,6 +2712,9 @@ static inline void boost_thread(struct thread_entry *thread, bool boost)
     if ((thread->cpu_boost != 0) != boost)
     {
         thread->cpu_boost = boost;
+#ifdef HAVE_THREAD_TRACE
+        thread_stats_boost(thread, boost);
+#endif
         cpu_boost(boost);
     }
 }
@@ -2682,8 +2941,7 @@ IF_COP( retry_state: )
     case STATE_RUNNING:
         RTR_LOCK(core);
         /* Remove thread from ready to run tasks */
-        remove_from_list_l(&cores[core].running, thread);
-        rtr_subtract_entry(core, thread->priority);
+        rtr_remove_thread(core, thread);
         RTR_UNLOCK(core);
         break;
     case STATE_BLOCKED:
@@ -2980,8 +3238,7 @@ unsigned int switch_core(unsigned int new_core)
 
     /* Get us off the running list for the current core */
     RTR_LOCK(core);
-    remove_from_list_l(&cores[core].running, current);
-    rtr_subtract_entry(core, current->priority);
+    rtr_remove_thread(core, current);
     RTR_UNLOCK(core);
 
     /* Stash return value (old core) in a safe place */
@@ -3003,8 +3260,7 @@ unsigned int switch_core(unsigned int new_core)
      * until this thread is ready. */
     RTR_LOCK(new_core);
 
-    rtr_add_entry(new_core, current->priority);
-    add_to_list_l(&cores[new_core].running, current);
+    rtr_add_thread(new_core, current);
 
     /* Make a callback into device-specific code, unlock the wakeup list so
      * that execution may resume on the new core, unlock our slot and finally
@@ -3064,6 +3320,13 @@ void init_threads(void)
 
     /* Initialize initially non-zero members of core */
     cores[core].next_tmo_check = current_tick; /* Something not in the past */
+#ifdef HAVE_THREAD_STATS
+    core_stats[core].started_at = STATS_TIME();
+#ifdef HAVE_THREAD_TRACE
+    core_stats[core].last = THREAD_SLOT(thread);
+#endif
+    stats_reset_tick = current_tick;
+#endif
 
     /* Initialize initially non-zero members of slot */
     UNLOCK_THREAD(thread); /* No sync worries yet */
@@ -3075,10 +3338,9 @@ void init_threads(void)
     thread->base_priority = PRIORITY_USER_INTERFACE;
     prio_add_entry(&thread->pdist, PRIORITY_USER_INTERFACE);
     thread->priority = PRIORITY_USER_INTERFACE;
-    rtr_add_entry(core, PRIORITY_USER_INTERFACE);
 #endif
 
-    add_to_list_l(&cores[core].running, thread);
+    rtr_add_thread(core, thread);
 
     if (core == CPU)
     {
@@ -3109,27 +3371,23 @@ void init_threads(void)
     }
 }
 
-/* Shared stack scan helper for thread_stack_usage and idle_stack_usage */
+/* Shared stack scan helper for the stack usage and peak functions */
 #if NUM_CORES == 1
-static inline int stack_usage(uintptr_t *stackptr, size_t stack_size)
+static inline size_t stack_peak(uintptr_t *stackptr, size_t stack_size)
 #else
-static int stack_usage(uintptr_t *stackptr, size_t stack_size)
+static size_t stack_peak(uintptr_t *stackptr, size_t stack_size)
 #endif
 {
     unsigned int stack_words = stack_size / sizeof (uintptr_t);
     unsigned int i;
-    int usage = 0;
 
     for (i = 0; i < stack_words; i++)
     {
         if (stackptr[i] != DEADBEEF)
-        {
-            usage = ((stack_words - i) * 100) / stack_words;
-            break;
-        }
+            return (stack_words - i) * sizeof (uintptr_t);
     }
 
-    return usage;
+    return 0;
 }
 
 /*---------------------------------------------------------------------------
@@ -3140,9 +3398,105 @@ static int stack_usage(uintptr_t *stackptr, size_t stack_size)
  */
 int thread_stack_usage(const struct thread_entry *thread)
 {
-    return stack_usage(thread->stack, thread->stack_size);
+    if (thread->stack_size == 0)
+        return 0;
+
+    return stack_peak(thread->stack, thread->stack_size) * 100 /
+           thread->stack_size;
+}
+
+/*---------------------------------------------------------------------------
+ * Returns the most bytes of stack a thread ever used while running, with
+ * the same caveat as thread_stack_usage.
+ *---------------------------------------------------------------------------
+ */
+size_t thread_stack_peak(const struct thread_entry *thread)
+{
+    return stack_peak(thread->stack, thread->stack_size);
+}
+
+#ifdef HAVE_THREAD_STATS
+/*---------------------------------------------------------------------------
+ * Copies the scheduler accounting of a thread, including the time of a
+ * boost it still holds when that is accounted.
+ *---------------------------------------------------------------------------
+ */
+void thread_get_stats(struct thread_entry *thread, struct thread_stats *stats)
+{
+    unsigned int slot = THREAD_SLOT(thread);
+    int oldlevel = disable_irq_save();
+
+    *stats = thread_stats[slot].s;
+#if defined(HAVE_THREAD_TRACE) && defined(HAVE_SCHEDULER_BOOSTCTRL)
+    if (thread->cpu_boost)
+        stats->boost_time += STATS_TIME() - thread_stats[slot].boosted_at;
+#endif
+
+    restore_irq(oldlevel);
+}
+
+uint64_t thread_stats_time(void)
+{
+    return (uint64_t)(current_tick - stats_reset_tick) * (1000000/HZ);
+}
+
+void thread_reset_stats(void)
+{
+#ifdef HAVE_THREAD_TRACE
+    unsigned long now = STATS_TIME();
+#endif
+    int oldlevel = disable_irq_save();
+    int i;
+
+    for (i = 0; i < MAXTHREADS; i++)
+    {
+        memset(&thread_stats[i].s, 0, sizeof (thread_stats[i].s));
+#ifdef HAVE_THREAD_TRACE
+        thread_stats[i].woken = false;
+        thread_stats[i].boosted_at = now;
+#endif
+    }
+
+    stats_reset_tick = current_tick;
+    restore_irq(oldlevel);
 }
 
+#ifdef HAVE_THREAD_TRACE
+void thread_trace_start(void)
+{
+    int oldlevel = disable_irq_save();
+    trace_pos = 0;
+    trace_count = 0;
+    trace_on = true;
+    restore_irq(oldlevel);
+}
+
+void thread_trace_stop(void)
+{
+    trace_on = false;
+}
+
+bool thread_trace_running(void)
+{
+    return trace_on;
+}
+
+int thread_trace_read(int pos, struct thread_trace_event *buf, int count)
+{
+    int oldlevel = disable_irq_save();
+    unsigned int first = (trace_pos + THREAD_TRACE_SIZE - trace_count)
+                            % THREAD_TRACE_SIZE;
+    int n;
+
+    for (n = 0; n < count && pos + n < (int)trace_count; n++)
+        buf[n] = trace_buf[(first + pos + n) % THREAD_TRACE_SIZE];
+
+    restore_irq(oldlevel);
+    return n;
+}
+#endif /* HAVE_THREAD_TRACE */
+#endif /* HAVE_THREAD_STATS */
+
 #if NUM_CORES > 1
 /*---------------------------------------------------------------------------
  * Returns the maximum percentage of the core's idle stack ever used during
@@ -3151,7 +3505,17 @@ int thread_stack_usage(const struct thread_entry *thread)
  */
 int idle_stack_usage(unsigned int core)
 {
-    return stack_usage(idle_stacks[core], IDLE_STACK_SIZE);
+    return stack_peak(idle_stacks[core], IDLE_STACK_SIZE) * 100 /
+           IDLE_STACK_SIZE;
+}
+
+/*---------------------------------------------------------------------------
+ * Returns the most bytes of the core's idle stack ever used.
+ *---------------------------------------------------------------------------
+ */
+size_t idle_stack_peak(unsigned int core)
+{
+    return stack_peak(idle_stacks[core], IDLE_STACK_SIZE);
 }
 #endif
 
@@ -84,6 +84,10 @@ static bool usb_monitor_enabled;
 static int last_usb_status;
 #ifdef HAVE_USBSTACK
 static bool exclusive_storage_access;
+#ifdef USB_FULL_INIT
+/* Transfer completions posted by the USB interrupt */
+static struct spsc_queue usb_irq_queue;
+#endif
 #endif
 
 #ifdef USB_FIREWIRE_HANDLING
@@ -158,10 +162,14 @@ static inline void usb_slave_mode(bool on)
 #endif /* USE_ROCKBOX_USB */
 }
 
+/* called from the USB interrupt */
 void usb_signal_transfer_completion(
     struct usb_transfer_completion_event_data* event_data)
 {
-    queue_post(&usb_queue, USB_TRANSFER_COMPLETION, (intptr_t)event_data);
+    /* A completion must not get lost, fall back to the locked queue if the
+       thread is that far behind */
+    spsc_queue_post_or_queue(&usb_irq_queue, USB_TRANSFER_COMPLETION,
+                             (intptr_t)event_data);
 }
 #else  /* !HAVE_USBSTACK */
 /* inline since branch is chosen at compile time */
@@ -583,6 +591,9 @@ void usb_init(void)
     usb_enable(false);
 
     queue_init(&usb_queue, true);
+#ifdef HAVE_USBSTACK
+    queue_attach_spsc(&usb_queue, &usb_irq_queue);
+#endif
 
     usb_thread_entry = create_thread(usb_thread, usb_stack,
                        sizeof(usb_stack), 0, usb_thread_name
@@ -591,6 +602,7 @@ void usb_init(void)
 #ifndef USB_STATUS_BY_EVENT
     countdown = -1;
     tick_add_task(usb_tick);
+    tick_set_deferrable(usb_tick, true);
 #endif
 #endif /* USB_FULL_INIT */
 }
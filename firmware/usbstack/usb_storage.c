@@ -67,6 +67,11 @@
 
 #define ALLOCATE_BUFFER_SIZE (2*MAX(READ_BUFFER_SIZE,WRITE_BUFFER_SIZE))
 
+/* Commands are received into the first half of the 1k in front of the
+ * transfer buffer and the status is sent from the second half, so the
+ * transfer buffer can hold data across commands */
+#define CBW_BUFFER_SIZE 512
+
 /* bulk-only class specific requests */
 #define USB_BULK_RESET_REQUEST   0xff
 #define USB_BULK_GET_MAX_LUN     0xfe
@@ -243,11 +248,11 @@ static union {
     struct mode_sense_data_6 *ms_data_6;
     struct mode_sense_data_10 *ms_data_10;
     struct report_lun_data *lun_data;
-    struct command_status_wrapper* csw;
     char *max_lun;
 } tb;
 
 static char *cbw_buffer;
+static struct command_status_wrapper* csw;
 
 static struct {
     unsigned int sector;
@@ -261,6 +266,20 @@ static struct {
     unsigned int last_result;
 } cur_cmd;
 
+/* Host OSes split long reads into many READ_10s. Once they come in
+ * sequentially, the chunk following a READ_10 is read from storage while
+ * its last chunk is sent, into the buffer the next READ_10 starts with. */
+static struct {
+    bool wanted;                 /* read it after the current READ_10 */
+    bool valid;
+    unsigned int lun;
+    unsigned int sector;
+    unsigned int count;
+    unsigned char data_select;
+    unsigned int last_lun;
+    unsigned int last_end;       /* sector after the last READ_10 */
+} read_ahead;
+
 static struct {
     unsigned char sense_key;
     unsigned char information;
@@ -467,7 +486,10 @@ void usb_storage_init_connection(void)
     ramdisk_buffer = tb.transfer_buffer + ALLOCATE_BUFFER_SIZE;
 #endif
 #endif
-    usb_drv_recv(ep_out, cbw_buffer, 1024);
+    csw = (void *)(cbw_buffer + CBW_BUFFER_SIZE);
+    read_ahead.wanted = false;
+    read_ahead.valid = false;
+    usb_drv_recv(ep_out, cbw_buffer, CBW_BUFFER_SIZE);
 
     int i;
     for(i=0;i<storage_num_drives();i++) {
@@ -660,6 +682,7 @@ bool usb_storage_control_request(struct usb_ctrlrequest* req, unsigned char* des
     (void)dest;
     switch (req->bRequest) {
         case USB_BULK_GET_MAX_LUN: {
+            read_ahead.valid = false;
             *tb.max_lun = storage_num_drives() - 1;
 #ifdef HIDE_FIRST_DRIVE
             *tb.max_lun --;
@@ -674,6 +697,7 @@ bool usb_storage_control_request(struct usb_ctrlrequest* req, unsigned char* des
         case USB_BULK_RESET_REQUEST:
             logf("ums: bulk reset");
             state = WAITING_FOR_COMMAND;
+            read_ahead.valid = false;
             /* UMS BOT 3.1 says The device shall preserve the value of its bulk
                data toggle bits and endpoint STALL conditions despite
                the Bulk-Only Mass Storage Reset. */
@@ -722,6 +746,16 @@ static void send_and_read_next(void)
                 cur_cmd.data[cur_cmd.data_select]);
 #endif
     }
+#ifndef USB_USE_RAMDISK
+    else if(read_ahead.wanted) {
+        /* and the start of the READ_10 likely to come next */
+        read_ahead.wanted = false;
+        read_ahead.data_select = cur_cmd.data_select;
+        read_ahead.valid = storage_read_sectors(read_ahead.lun,
+                read_ahead.sector, read_ahead.count,
+                cur_cmd.data[read_ahead.data_select]) == 0;
+    }
+#endif
 }
 /****************************************************************************/
 
@@ -767,6 +801,12 @@ static void handle_scsi(struct command_block_wrapper* cbw)
     cur_cmd.lun = lun;
     cur_cmd.cur_cmd = cbw->command_block[0];
 
+    /* everything else uses the transfer buffer or changes the disk */
+    if(cur_cmd.cur_cmd != SCSI_READ_10 &&
+       cur_cmd.cur_cmd != SCSI_TEST_UNIT_READY) {
+        read_ahead.valid = false;
+    }
+
     switch (cbw->command_block[0]) {
         case SCSI_TEST_UNIT_READY:
             logf("scsi test_unit_ready %d",lun);
@@ -1060,10 +1100,32 @@ static void handle_scsi(struct command_block_wrapper* cbw)
                         ramdisk_buffer + cur_cmd.sector*SECTOR_SIZE,
                         MIN(READ_BUFFER_SIZE/SECTOR_SIZE,cur_cmd.count)*SECTOR_SIZE);
 #else
-                cur_cmd.last_result = storage_read_sectors(cur_cmd.lun,
-                        cur_cmd.sector,
-                        MIN(READ_BUFFER_SIZE/SECTOR_SIZE, cur_cmd.count),
-                        cur_cmd.data[cur_cmd.data_select]);
+                if(read_ahead.valid && read_ahead.lun == lun &&
+                   read_ahead.sector == cur_cmd.sector &&
+                   read_ahead.count >= MIN(READ_BUFFER_SIZE/SECTOR_SIZE,
+                                           cur_cmd.count)) {
+                    /* already there */
+                    cur_cmd.data_select = read_ahead.data_select;
+                    cur_cmd.last_result = 0;
+                }
+                else {
+                    cur_cmd.last_result = storage_read_sectors(cur_cmd.lun,
+                            cur_cmd.sector,
+                            MIN(READ_BUFFER_SIZE/SECTOR_SIZE, cur_cmd.count),
+                            cur_cmd.data[cur_cmd.data_select]);
+                }
+                read_ahead.valid = false;
+
+                /* read ahead once the host reads sequentially */
+                read_ahead.wanted = lun == read_ahead.last_lun &&
+                    cur_cmd.sector == read_ahead.last_end &&
+                    cur_cmd.sector + cur_cmd.count < block_count;
+                read_ahead.lun = lun;
+                read_ahead.sector = cur_cmd.sector + cur_cmd.count;
+                read_ahead.count = MIN(READ_BUFFER_SIZE/SECTOR_SIZE,
+                                       block_count - read_ahead.sector);
+                read_ahead.last_lun = lun;
+                read_ahead.last_end = cur_cmd.sector + cur_cmd.count;
 
 #ifdef TOSHIBA_GIGABEAT_S
                 if(cur_cmd.sector == 0) {
@@ -1169,17 +1231,17 @@ static void receive_block_data(void *data,int size)
 
 static void send_csw(int status)
 {
-    tb.csw->signature = htole32(CSW_SIGNATURE);
-    tb.csw->tag = cur_cmd.tag;
-    tb.csw->data_residue = 0;
-    tb.csw->status = status;
+    csw->signature = htole32(CSW_SIGNATURE);
+    csw->tag = cur_cmd.tag;
+    csw->data_residue = 0;
+    csw->status = status;
 
-    usb_drv_send_nonblocking(ep_in, tb.csw,
+    usb_drv_send_nonblocking(ep_in, csw,
             sizeof(struct command_status_wrapper));
     state = SENDING_CSW;
     //logf("CSW: %X",status);
     /* Already start waiting for the next command */
-    usb_drv_recv(ep_out, cbw_buffer, 1024);
+    usb_drv_recv(ep_out, cbw_buffer, CBW_BUFFER_SIZE);
 
     if(status == UMS_STATUS_GOOD) {
         cur_sense_data.sense_key=0;
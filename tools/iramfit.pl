@@ -0,0 +1,255 @@
+#!/usr/bin/perl
+#             __________               __   ___.
+#   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+#   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+#   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+#   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+#                     \/            \/     \/    \/            \/
+# $Id$
+#
+# Copyright (C) 2026 by agent
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# Shows how the IRAM of rockbox.map and of codec or plugin .map files is
+# used, by output section and by object file, and how much is left. Given
+# a flat profile from profile_reader.pl it also suggests the hottest
+# functions that are not in IRAM yet and would fit into what is left, to be
+# marked with ICODE_ATTR.
+#
+# Function sizes are taken from the distance to the next symbol in the map,
+# so static functions are counted as part of the global one before them
+# unless the object was built with -ffunction-sections.
+
+use strict;
+use Getopt::Std;
+
+my %opts;
+getopts('p:n:h', \%opts);
+
+if ($opts{h} || !@ARGV) {
+    print STDERR <<EOF;
+usage: iramfit.pl [-p profile.txt] [-n count] file.map [file.map...]
+  -p  output of profile_reader.pl, sorted by samples or ticks
+  -n  hottest functions to consider per map (default 20)
+EOF
+    exit 1;
+}
+
+my $candidates = $opts{n} || 20;
+
+# function name => samples or ticks
+my %heat;
+my $heat_total = 0;
+
+if ($opts{p}) {
+    open(my $in, '<', $opts{p}) or die "can't open $opts{p}: $!\n";
+    while (<$in>) {
+        # "Samples: 00000123 Symbol: name(object.o)" from sampled profiles,
+        # "Calls: ... Ticks: 00000123 Symbol: ..." from instrumented ones
+        next unless /(?:Samples|Ticks):\s+([\d.]+)%?\s+Symbol:\s+(\S+)/;
+        my ($count, $name) = ($1, $2);
+        $name =~ s/\(.*\)$//;
+        next if $name =~ /^0x/ || $name eq '(unknown)';
+        $heat{$name} += $count;
+        $heat_total += $count;
+    }
+    close($in);
+    die "no functions in $opts{p}\n" unless %heat;
+}
+
+sub object_name {
+    my ($file) = @_;
+    # lib.a(file.o) stays that, without the path of the archive
+    $file =~ s/^.*\/// unless $file =~ s/^.*\/([^\/]*\()/$1/;
+    return $file;
+}
+
+sub read_map {
+    my ($file) = @_;
+    my %map = (regions => [], sections => [], inputs => [], symbols => []);
+    my ($in_memory, $in_script, $output, $pending, $input);
+
+    open(my $in, '<', $file) or die "can't open $file: $!\n";
+    while (<$in>) {
+        chomp;
+        if (/^Memory Configuration/) {
+            $in_memory = 1;
+            next;
+        }
+        if (/^Linker script and memory map/) {
+            $in_memory = 0;
+            $in_script = 1;
+            next;
+        }
+        if ($in_memory) {
+            if (/^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)/i) {
+                push @{$map{regions}},
+                    { name => $1, start => hex($2), size => hex($3) };
+            }
+            next;
+        }
+        next unless $in_script;
+
+        # ld puts long section names on a line of their own
+        if (defined $pending) {
+            $_ = $pending . $_;
+            undef $pending;
+        }
+        if (/^(\.\S+|COMMON)\s*$/ || /^ (\.\S+|COMMON)\s*$/) {
+            $pending = $_;
+            next;
+        }
+
+        if (/^(\.\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)/i) {
+            # output section
+            $output = { name => $1, start => hex($2), size => hex($3) };
+            push @{$map{sections}}, $output;
+            undef $input;
+        } elsif (/^ (\.\S+|COMMON)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$/i) {
+            # input section of an object file
+            next unless $output;
+            $input = { name => $1, start => hex($2), size => hex($3),
+                       object => object_name($4), output => $output };
+            push @{$map{inputs}}, $input;
+        } elsif (/^\s+0x([0-9a-f]+)\s+([A-Za-z_.\$][\w.\$]*)\s*$/i) {
+            # symbol defined in the last input section
+            next unless $input && hex($1) >= $input->{start} &&
+                hex($1) < $input->{start} + $input->{size};
+            push @{$map{symbols}},
+                { name => $2, start => hex($1), input => $input };
+        } elsif (/^\S/) {
+            undef $output;
+            undef $input;
+        }
+    }
+    close($in);
+
+    return \%map;
+}
+
+sub in_region {
+    my ($region, $address) = @_;
+    return $address >= $region->{start} &&
+           $address < $region->{start} + $region->{size};
+}
+
+# Sizes of the functions from the distance between their symbols
+sub functions {
+    my ($map) = @_;
+    my %functions;
+    my @symbols = sort { $a->{start} <=> $b->{start} } @{$map->{symbols}};
+
+    for (my $i = 0; $i < @symbols; $i++) {
+        my $symbol = $symbols[$i];
+        my $input = $symbol->{input};
+        next unless $input->{name} =~ /^\.(text|icode|init)/;
+        my $end = $input->{start} + $input->{size};
+        if ($i + 1 < @symbols && $symbols[$i + 1]{input} == $input &&
+            $symbols[$i + 1]{start} < $end) {
+            $end = $symbols[$i + 1]{start};
+        }
+        $functions{$symbol->{name}} = {
+            size => $end - $symbol->{start},
+            object => $input->{object},
+            start => $symbol->{start},
+        };
+    }
+
+    return \%functions;
+}
+
+foreach my $file (@ARGV) {
+    my $map = read_map($file);
+    my @iram = grep { $_->{name} =~ /IRAM/ && $_->{size} > 0 }
+                    @{$map->{regions}};
+
+    if (!@iram) {
+        print "$file: no IRAM\n\n";
+        next;
+    }
+
+    my $functions = functions($map);
+
+    foreach my $region (@iram) {
+        my $end = $region->{start};
+        my $used = 0;
+        my (%by_object, %section_names);
+
+        printf("%s: %s at 0x%08x, %d bytes\n", $file, $region->{name},
+               $region->{start}, $region->{size});
+
+        foreach my $section (@{$map->{sections}}) {
+            next unless $section->{size} > 0 &&
+                        in_region($region, $section->{start});
+            printf("  %-16s %8d\n", $section->{name}, $section->{size});
+            $used += $section->{size};
+            $end = $section->{start} + $section->{size}
+                if $section->{start} + $section->{size} > $end;
+        }
+
+        my $free = $region->{start} + $region->{size} - $end;
+        printf("  %-16s %8d\n  %-16s %8d\n", "used", $used, "free", $free);
+
+        foreach my $input (@{$map->{inputs}}) {
+            next unless $input->{size} > 0 &&
+                        in_region($region, $input->{start});
+            (my $name = $input->{name}) =~ s/^(\.[^.]+).*$/$1/;
+            $by_object{$input->{object}}{$name} += $input->{size};
+            $by_object{$input->{object}}{total} += $input->{size};
+            $section_names{$name} = 1;
+        }
+
+        if (%by_object) {
+            my @names = sort keys %section_names;
+            printf("\n  %-28s", "object");
+            printf(" %8s", $_) foreach (@names);
+            print "\n";
+            foreach my $object (sort { $by_object{$b}{total} <=>
+                                       $by_object{$a}{total} ||
+                                       $a cmp $b } keys %by_object) {
+                printf("  %-28s", $object);
+                printf(" %8d", $by_object{$object}{$_} || 0)
+                    foreach (@names);
+                print "\n";
+            }
+        }
+
+        if (%heat) {
+            my @hot = grep { exists $functions->{$_} &&
+                             !in_region($region, $functions->{$_}{start}) }
+                      sort { $heat{$b} <=> $heat{$a} || $a cmp $b }
+                      keys %heat;
+            my $left = $free;
+            my $moved = 0;
+
+            splice(@hot, $candidates) if @hot > $candidates;
+
+            print "\n  hot functions, * fits into what is left\n";
+            foreach my $name (@hot) {
+                my $f = $functions->{$name};
+                my $mark = ' ';
+                # keep word alignment
+                my $size = ($f->{size} + 3) & ~3;
+                if ($size <= $left) {
+                    $left -= $size;
+                    $moved += $heat{$name};
+                    $mark = '*';
+                }
+                printf("  %s %6.2f%% %6d %s (%s)\n", $mark,
+                       $heat{$name} / $heat_total * 100, $f->{size},
+                       $name, $f->{object});
+            }
+            printf("  moving the marked ones covers %.2f%% of the profile" .
+                   " and leaves %d bytes\n", $moved / $heat_total * 100,
+                   $left);
+        }
+        print "\n";
+    }
+}
@@ -9,6 +9,9 @@ sub warning {
     print STDERR ("Warning: @_\n");
 }
 
+# code symbols found by read_library, address:size
+my %code_sizes;
+
 # string (filename.map)
 # return hash(string:hash(string:number))
 sub read_map {
@@ -68,6 +71,9 @@ sub read_library {
             my $sectionOffset = hex($library{$object . $region});
             my $location = $symbolOffset + $sectionOffset;
             $retval{$location} = $parts[5] . "(" . $object . ")";
+            if ($region =~ m/\.(text|icode|init)/) {
+                $code_sizes{$location} = hex("0x" . $parts[4]);
+            }
         }
     }
     close(OBJECT_FILE);
@@ -90,6 +96,164 @@ sub get_name {
     }
 }
 
+# number, array(number), hash(number:string)
+# return string: the function containing the address
+sub get_function {
+    my $location = $_[0];
+    my $starts = $_[1];
+    my $offsets = $_[2];
+    my $low = 0;
+    my $high = @$starts - 1;
+    if ($location == 0) {
+        return "(unknown)";
+    }
+    if ($high < 0 || $location < @$starts[0]) {
+        return sprintf("0x%08x", $location);
+    }
+    while ($low < $high) {
+        my $middle = int(($low + $high + 1) / 2);
+        if (@$starts[$middle] <= $location) {
+            $low = $middle;
+        } else {
+            $high = $middle - 1;
+        }
+    }
+    my $start = @$starts[$low];
+    # assembler functions often have no size, give them the benefit
+    if ($code_sizes{$start} && $location >= $start + $code_sizes{$start}) {
+        return sprintf("0x%08x", $location);
+    }
+    return $$offsets{$start};
+}
+
+# string (filename)
+# return true if the file was written by the sampling profiler
+sub is_sampled {
+    open(PROFILE_FILE,$_[0]) || 
+        error("Could not open profile file: $_[0]");
+    my $retval = 0;
+    while (<PROFILE_FILE>) {
+        if (m/^PROFILE_SAMPLES/) {
+            $retval = 1;
+            last;
+        }
+    }
+    close(PROFILE_FILE);
+    return $retval;
+}
+
+# string (filename), hash(number:string)
+# return hash(string:number) self samples, hash(string:hash(string:number))
+# callers, hash(number:number) samples per thread, number total samples,
+# string summary
+sub create_sample_list {
+    open(PROFILE_FILE,$_[0]) || 
+        error("Could not open profile file: $_[0]");
+    my $offsets = $_[1];
+    my @starts = sort { $a <=> $b } keys(%code_sizes);
+    my %self;
+    my %callers;
+    my %threads;
+    my $total = 0;
+    my $summary = "";
+    my $started = 0;
+    while (<PROFILE_FILE>) {
+        chomp;
+        my @parts = split(/[[:space:]]+/);
+        if ($started == 0) {
+            if (m/^PROFILE_SAMPLES/) {
+                $_ = <PROFILE_FILE>;
+                my @header = split(/[[:space:]]+/);
+                $summary = sprintf("%d samples at %d Hz, %d older ones" .
+                        " overwritten", @header);
+            } elsif (m/^SAMPLE_PC/) {
+                $started = 1;
+            } elsif ($_ ne "") {
+                warning($_);
+            }
+            next;
+        }
+        if ($parts[0] !~ m/^0x/) {
+            last;
+        }
+        my $function = get_function(hex($parts[0]),\@starts,$offsets);
+        my $caller = get_function(hex($parts[1]),\@starts,$offsets);
+        # LR pointing back into the function itself is a return address
+        # left over from a call it made, not its caller
+        if ($caller eq $function || hex($parts[1]) == 0) {
+            $caller = "(unknown)";
+        }
+        $self{$function}++;
+        $callers{$function}{$caller}++;
+        $threads{$parts[2] + 0}++;
+        $total++;
+    }
+    close(PROFILE_FILE);
+    return (\%self,\%callers,\%threads,$total,$summary);
+}
+
+# hash(string:number), number, number (sort element), boolean
+sub print_sampled {
+    my $self = $_[0];
+    my $total = $_[1];
+    my $sort_index = $_[2];
+    my $percent = $_[3];
+    my @keys;
+    if ($sort_index == 2) {
+        @keys = sort(keys(%$self));
+    } else {
+        @keys = sort { $$self{$a} <=> $$self{$b} || $a cmp $b } keys(%$self);
+    }
+    print("FUNCTIONS\tTOTAL_SAMPLES\n");
+    printf("     %4d\t   %8d\n",scalar(@keys),$total);
+    foreach $key(@keys) {
+        if ($percent) {
+            printf("Samples: %7.2f%% Symbol: %s\n",
+                    $$self{$key}/$total*100, $key);
+        } else {
+            printf("Samples: %08d Symbol: %s\n", $$self{$key}, $key);
+        }
+    }
+}
+
+# hash(string:number), hash(string:hash(string:number)), number, boolean
+sub print_call_graph {
+    my $self = $_[0];
+    my $callers = $_[1];
+    my $total = $_[2];
+    my $percent = $_[3];
+    my %callees;
+    foreach $function(keys(%$callers)) {
+        my $from = $$callers{$function};
+        foreach $caller(keys(%$from)) {
+            if ($caller ne "(unknown)") {
+                $callees{$caller}{$function} += $$from{$caller};
+            }
+        }
+    }
+    my @keys = sort { $$self{$b} <=> $$self{$a} || $a cmp $b } keys(%$self);
+    print("CALL GRAPH (callers seen in LR, callees from their samples)\n");
+    foreach $key(@keys) {
+        my $count = $$self{$key};
+        print("\n");
+        if ($percent) {
+            printf("%7.2f%% %s\n", $count/$total*100, $key);
+        } else {
+            printf("%8d %s\n", $count, $key);
+        }
+        my $from = $$callers{$key};
+        foreach $caller(sort { $$from{$b} <=> $$from{$a} } keys(%$from)) {
+            printf("         called from %8d %s\n", $$from{$caller}, $caller);
+        }
+        if (exists $callees{$key}) {
+            my $to = $callees{$key};
+            foreach $callee(sort { $$to{$b} <=> $$to{$a} } keys(%$to)) {
+                printf("         calling     %8d %s\n", $$to{$callee}, $callee);
+            }
+        }
+    }
+}
+
 # string (filename), hash(number:string)
 # return array(array(number,number,string))
 sub create_list {
@@ -194,12 +358,20 @@ sub usage {
     print STDERR
         ("\tobj          library or object file, extension is .a or .o or .elf\n");
     print STDERR
-        ("\tformat       0-2[_p] 0: by calls, 1: by ticks, 2: by name\n");
+        ("\tformat       0-3[_p] 0: by calls, 1: by ticks, 2: by name\n");
+    print STDERR
+        ("\t             3: call graph (sampled profiles only)\n");
     print STDERR
         ("\t             _p shows percents instead of counts\n");
     print STDERR ("NOTES:\n");
     print STDERR
         ("\tmaps and objects come in sets, one map then many objects\n");
+    print STDERR
+        ("\tfor profile_samples.out from the sampling profiler, 0 and 1\n");
+    print STDERR
+        ("\tboth sort by samples, pass rockbox.elf and the codec or\n");
+    print STDERR
+        ("\tplugin .elf files so that all sampled code is known\n");
     exit(1);
 }
 
@@ -239,6 +411,28 @@ if (!%symbols) {
 if ($i >= @ARGV) {
     error("You forgot to specify any sort ordering on output (e.g. 0, 1_p, 2)");
 }    
+if (is_sampled($ARGV[0])) {
+    my ($self,$callers,$threads,$total,$summary) =
+        create_sample_list($ARGV[0],\%symbols);
+    if ($total == 0) {
+        error("No samples in $ARGV[0]");
+    }
+    print("$summary\n");
+    foreach $thread(sort { $a <=> $b } keys(%$threads)) {
+        printf("%-9s: %7.2f%%\n",
+                $thread < 0 ? "Idle" : sprintf("Thread %2d", $thread),
+                $$threads{$thread}/$total*100);
+    }
+    for (; $i < @ARGV; $i++) {
+        my ($sort_index,$percent) = split("_",$ARGV[$i]);
+        if ($sort_index == 3) {
+            print_call_graph($self,$callers,$total,$percent);
+        } else {
+            print_sampled($self,$total,$sort_index,$percent);
+        }
+    }
+    exit(0);
+}
 my @pfds = create_list($ARGV[0],\%symbols);
 for (; $i < @ARGV; $i++) {
     print_sorted(\@pfds,split("_",$ARGV[$i]));
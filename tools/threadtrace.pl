@@ -0,0 +1,139 @@
+#!/usr/bin/perl
+#             __________               __   ___.
+#   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+#   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+#   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+#   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+#                     \/            \/     \/    \/            \/
+# $Id$
+#
+# Copyright (C) 2026 by agent
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# Turns the thread_trace.txt saved by "Start/save thread trace" in the debug
+# menu into a timeline in the Chrome trace event format, which can be opened
+# with chrome://tracing or https://ui.perfetto.dev. A summary of run and
+# boost time per thread is printed to stderr.
+
+use strict;
+
+if (@ARGV != 1) {
+    print STDERR "usage: threadtrace.pl thread_trace.txt > trace.json\n";
+    exit 1;
+}
+
+open(my $in, '<', $ARGV[0]) or die "can't open $ARGV[0]: $!\n";
+
+my %names;
+my @events;
+my ($last, $offset);
+
+while (<$in>) {
+    chomp;
+    next if /^#/ || /^\s*$/;
+    if (/^thread (\d+) (.*)$/) {
+        $names{$1} = $2;
+        next;
+    }
+    my ($time, $core, $type, $thread, $arg) = split;
+    # the target clock is 32 bits wide and wraps after about 71 minutes
+    $offset = 0 unless defined $offset;
+    $offset += 2**32 if defined $last && $time < $last;
+    $last = $time;
+    push @events, [ $time + $offset, $core, $type, $thread, $arg ];
+}
+close($in);
+
+die "no events in $ARGV[0]\n" unless @events;
+
+my $start = $events[0][0];
+my (%running, %since, %boosted, %woken, %run, %boost, %latency);
+my @out;
+
+sub name {
+    my ($slot) = @_;
+    return defined $names{$slot} ? $names{$slot} : "thread $slot";
+}
+
+sub slice {
+    my ($name, $tid, $from, $to) = @_;
+    push @out, sprintf('{"name":"%s","ph":"X","pid":1,"tid":%d,'.
+                       '"ts":%d,"dur":%d}', $name, $tid, $from - $start,
+                       $to - $from);
+}
+
+for my $ev (@events) {
+    my ($time, $core, $type, $thread, $arg) = @$ev;
+
+    if ($type eq 'switch') {
+        if (defined $running{$core}) {
+            my $prev = $running{$core};
+            slice(name($prev), $prev, $since{$core}, $time);
+            $run{$prev} += $time - $since{$core};
+        }
+        $running{$core} = $thread;
+        $since{$core} = $time;
+        if (defined $woken{$thread}) {
+            my $l = $time - delete $woken{$thread};
+            $latency{$thread} = $l if $l > ($latency{$thread} || 0);
+        }
+    }
+    elsif ($type eq 'wakeup') {
+        $woken{$thread} = $time unless defined $woken{$thread};
+        push @out, sprintf('{"name":"wakeup","ph":"i","s":"t","pid":1,'.
+                           '"tid":%d,"ts":%d,"args":{"by":"%s"}}', $thread,
+                           $time - $start,
+                           $arg < 0 ? "interrupt/idle" : name($arg));
+    }
+    elsif ($type eq 'boost') {
+        $boosted{$thread} = $time;
+    }
+    elsif ($type eq 'unboost') {
+        # a boost taken before the trace started begins with the trace
+        my $from = defined $boosted{$thread} ? delete $boosted{$thread}
+                                             : $start;
+        push @out, sprintf('{"name":"boost %s","ph":"X","pid":2,"tid":%d,'.
+                           '"ts":%d,"dur":%d}', name($thread), $thread,
+                           $from - $start, $time - $from);
+        $boost{$thread} += $time - $from;
+    }
+}
+
+my $end = $events[-1][0];
+for my $core (keys %running) {
+    slice(name($running{$core}), $running{$core}, $since{$core}, $end);
+    $run{$running{$core}} += $end - $since{$core};
+}
+for my $thread (keys %boosted) {
+    $boost{$thread} += $end - $boosted{$thread};
+}
+
+push @out, '{"name":"process_name","ph":"M","pid":1,"args":{"name":"threads"}}';
+push @out, '{"name":"process_name","ph":"M","pid":2,"args":{"name":"cpu boost"}}';
+for my $slot (keys %names) {
+    for my $pid (1, 2) {
+        push @out, sprintf('{"name":"thread_name","ph":"M","pid":%d,'.
+                           '"tid":%d,"args":{"name":"%s"}}', $pid, $slot,
+                           $names{$slot});
+    }
+}
+
+print "[\n", join(",\n", @out), "\n]\n";
+
+my $total = $end - $start || 1;
+printf STDERR "%.3f s traced, %d events\n", $total / 1e6, scalar @events;
+printf STDERR "%-20s %7s %7s %12s\n", "thread", "run %", "boost %",
+              "max wake us";
+for my $slot (sort { ($boost{$b} || 0) <=> ($boost{$a} || 0) ||
+                     ($run{$b} || 0) <=> ($run{$a} || 0) } keys %names) {
+    printf STDERR "%-20s %7.1f %7.1f %12d\n", name($slot),
+                  100 * ($run{$slot} || 0) / $total,
+                  100 * ($boost{$slot} || 0) / $total, $latency{$slot} || 0;
+}
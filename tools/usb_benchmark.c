@@ -25,9 +25,20 @@
 
         2007-11-01: Some minor modifications by <bjorn@haxx.se>
 
+	With -d it measures the throughput of a block device instead: the
+	player in USB mass storage mode, or a loop device or a Linux
+	g_mass_storage gadget standing in for it. The device is read
+	directly (O_DIRECT), and the write test writes back what was read,
+	so the data on it stays the same.
+
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/timeb.h>
 
@@ -92,7 +103,151 @@ static int stoptimer(void)
 }
 
 
-int main(void)
+static void report(int iBlockSize, long long llBytes, int iTimer)
+{
+	if (iTimer)
+		fprintf(stderr, " %9lld bytes in %d ms = %lld kB/s\n",
+			llBytes, iTimer, llBytes / iTimer);
+	// stdout
+	printf("%d,%lld,%d\n", iBlockSize, llBytes, iTimer);
+}
+
+static int bench_device(const char *pszDevice, long long llOffset,
+			long lSize, int iBlockSize, int fWrite)
+{
+	const int blocksize[] = { 4096, 16384, 65536, 131072, 1048576 };
+	unsigned char *pbBuf;
+	long long llBytes;
+	long lDone;
+	int fd, i, j, n, iTimer;
+
+	fd = open(pszDevice, (fWrite ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0 && errno == EINVAL) {
+		// e.g. a plain file on tmpfs
+		fprintf(stderr, "O_DIRECT not supported, results include caching\n");
+		fd = open(pszDevice, fWrite ? O_RDWR : O_RDONLY);
+	}
+	if (fd < 0) {
+		perror(pszDevice);
+		return -1;
+	}
+
+	if (posix_memalign((void **)&pbBuf, 4096, lSize)) {
+		fprintf(stderr, "out of memory\n");
+		close(fd);
+		return -1;
+	}
+
+	for (j = 0; j < (int)(sizeof blocksize / sizeof blocksize[0]); j++) {
+		if (iBlockSize && blocksize[j] != iBlockSize)
+			continue;
+		fprintf(stderr, "Testing blocksize %7d\n", blocksize[j]);
+
+		fprintf(stderr, "* read :");
+		llBytes = 0;
+		starttimer();
+		for (lDone = 0; lDone < lSize; lDone += n) {
+			n = MIN(blocksize[j], lSize - lDone);
+			n = pread(fd, pbBuf + lDone, n, llOffset + lDone);
+			if (n <= 0) {
+				fprintf(stderr, " read failed: %s\n",
+					n ? strerror(errno) : "end of device");
+				break;
+			}
+			llBytes += n;
+		}
+		iTimer = stoptimer();
+		report(blocksize[j], llBytes, iTimer);
+		if (lDone < lSize)
+			break;
+
+		if (!fWrite)
+			continue;
+
+		fprintf(stderr, "* write:");
+		llBytes = 0;
+		starttimer();
+		for (lDone = 0; lDone < lSize; lDone += n) {
+			n = MIN(blocksize[j], lSize - lDone);
+			n = pwrite(fd, pbBuf + lDone, n, llOffset + lDone);
+			if (n <= 0) {
+				fprintf(stderr, " write failed: %s\n",
+					n ? strerror(errno) : "end of device");
+				break;
+			}
+			llBytes += n;
+		}
+		i = fsync(fd);
+		iTimer = stoptimer();
+		report(blocksize[j], llBytes, iTimer);
+		if (lDone < lSize || i < 0)
+			break;
+	}
+
+	free(pbBuf);
+	close(fd);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: usb_benchmark [-d device [-o offset] [-s size] [-b blocksize] [-w]]\n"
+		"  without -d, talks to the 'custom' LPC214x device through libusb\n"
+		"  -d  block device to measure, e.g. /dev/sdX or /dev/loop0\n"
+		"  -o  where to start, in MB (default 0)\n"
+		"  -s  how much to transfer, in MB (default 16)\n"
+		"  -b  only this block size (default 4k to 1M)\n"
+		"  -w  also measure writes, putting back the data read\n");
+}
+
+static int bench_custom_device(void);
+
+int main(int argc, char **argv)
+{
+	const char *pszDevice = NULL;
+	long long llOffset = 0;
+	long lSize = 16;
+	int iBlockSize = 0;
+	int fWrite = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:o:s:b:wh")) != -1) {
+		switch (c) {
+		case 'd':
+			pszDevice = optarg;
+			break;
+		case 'o':
+			llOffset = atoll(optarg);
+			break;
+		case 's':
+			lSize = atol(optarg);
+			break;
+		case 'b':
+			iBlockSize = atoi(optarg);
+			break;
+		case 'w':
+			fWrite = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (pszDevice == NULL)
+		return bench_custom_device();
+
+	if (lSize <= 0 || lSize > 1024) {
+		usage();
+		return -1;
+	}
+
+	return bench_device(pszDevice, llOffset << 20, lSize << 20,
+			    iBlockSize, fWrite);
+}
+
+static int bench_custom_device(void)
 {
     const int blocksize[] = { 128, 512 };
 	struct usb_device *dev;	
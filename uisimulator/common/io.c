@@ -35,6 +35,10 @@
 #include <sys/vfs.h>
 #endif
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
 #ifdef WIN32
 #include <windows.h>
 #endif
@@ -444,6 +448,30 @@ long sim_filesize(int fd)
 #endif
 }
 
+/* Map a file read-only into memory. Returns NULL if the host can't. */
+void *sim_mmap(int fd, long size)
+{
+#ifdef WIN32
+    (void)fd;
+    (void)size;
+    return NULL;
+#else
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    return addr == MAP_FAILED ? NULL : addr;
+#endif
+}
+
+void sim_munmap(void *addr, long size)
+{
+#ifdef WIN32
+    (void)addr;
+    (void)size;
+#else
+    munmap(addr, size);
+#endif
+}
+
 void fat_size(IF_MV2(int volume,) unsigned long* size, unsigned long* free)
 {
 #ifdef HAVE_MULTIVOLUME
@@ -657,3 +685,12 @@ int sim_ftruncate(int fd, long length)
     return ftruncate(fd, length);
 #endif
 }
+
+/* The host filesystem does its own allocation, there is nothing to
+   reserve in advance */
+int sim_fpreallocate(int fd, long size)
+{
+    (void)fd;
+    (void)size;
+    return 0;
+}
@@ -42,6 +42,37 @@ static int interrupt_level = HIGHEST_IRQ_LEVEL;
 static int handlers_pending = 0;
 static int status_reg = 0;
 
+/* When threads run concurrently, the "interrupt" level is per thread and
+ * raising it takes the kernel lock, which handlers hold while they run and
+ * kernel objects take in place of their corelock. The lock is recursive. */
+static SDL_mutex *sim_kernel_mtx;
+static __thread int thread_irq_level = 0;
+
+void sim_kernel_lock(void)
+{
+    if (thread_sdl_concurrent)
+        SDL_LockMutex(sim_kernel_mtx);
+}
+
+void sim_kernel_unlock(void)
+{
+    if (thread_sdl_concurrent)
+        SDL_UnlockMutex(sim_kernel_mtx);
+}
+
+static int set_thread_irq_level(int level)
+{
+    int oldlevel = thread_irq_level;
+
+    if (oldlevel == 0 && level != 0)
+        SDL_LockMutex(sim_kernel_mtx);
+    else if (oldlevel != 0 && level == 0)
+        SDL_UnlockMutex(sim_kernel_mtx);
+
+    thread_irq_level = level;
+    return oldlevel;
+}
+
 /* Nescessary logic:
  * 1) All threads must pass unblocked
  * 2) Current handler must always pass unblocked
@@ -50,6 +81,9 @@ static int status_reg = 0;
  */
 int set_irq_level(int level)
 {
+    if (thread_sdl_concurrent)
+        return set_thread_irq_level(level);
+
     SDL_LockMutex(sim_irq_mtx);
 
     int oldlevel = interrupt_level;
@@ -69,6 +103,12 @@ int set_irq_level(int level)
 
 void sim_enter_irq_handler(void)
 {
+    if (thread_sdl_concurrent)
+    {
+        set_thread_irq_level(HIGHEST_IRQ_LEVEL);
+        return;
+    }
+
     SDL_LockMutex(sim_irq_mtx);
     handlers_pending++;
 
@@ -83,6 +123,12 @@ void sim_enter_irq_handler(void)
 
 void sim_exit_irq_handler(void)
 {
+    if (thread_sdl_concurrent)
+    {
+        set_thread_irq_level(0);
+        return;
+    }
+
     if (--handlers_pending > 0)
         SDL_CondSignal(sim_thread_cond);
 
@@ -106,6 +152,13 @@ bool sim_kernel_init(void)
         return false;
     }
 
+    sim_kernel_mtx = SDL_CreateMutex();
+    if (sim_kernel_mtx == NULL)
+    {
+        fprintf(stderr, "Cannot create sim_kernel_mtx\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -114,6 +167,7 @@ void sim_kernel_shutdown(void)
     SDL_RemoveTimer(tick_timer_id);
     SDL_DestroyMutex(sim_irq_mtx);
     SDL_DestroyCond(sim_thread_cond);
+    SDL_DestroyMutex(sim_kernel_mtx);
 }
 
 Uint32 tick_timer(Uint32 interval, void *param)
@@ -49,15 +49,32 @@ static char __name[32];
 #define THREAD_PANICF(str...) \
     ({ fprintf(stderr, str); exit(-1); })
 
-/* Thread/core entries as in rockbox core */
-struct core_entry cores[NUM_CORES];
+/* Thread/core entries as in rockbox core - every host thread sees itself
+ * as the running one */
+__thread struct core_entry cores[NUM_CORES];
 struct thread_entry threads[MAXTHREADS];
 /* Jump buffers for graceful exit - kernel threads don't stay neatly
  * in their start routines responding to messages so this is the only
  * way to get them back in there so they may exit */
 static jmp_buf thread_jmpbufs[MAXTHREADS];
+/* Held by the running thread, unless threads run concurrently. Then the
+ * kernel lock (see kernel-sdl.c) guards the thread states and lists and
+ * blocking goes straight to the host semaphores. */
 static SDL_mutex *m;
 static volatile bool threads_exit = false;
+bool thread_sdl_concurrent = false;
+
+static inline void run_lock(void)
+{
+    if (!thread_sdl_concurrent)
+        SDL_LockMutex(m);
+}
+
+static inline void run_unlock(void)
+{
+    if (!thread_sdl_concurrent)
+        SDL_UnlockMutex(m);
+}
 
 extern long start_tick;
 
@@ -79,17 +96,24 @@ void thread_sdl_shutdown(void)
     for (i = 0; i < MAXTHREADS; i++)
     {
         struct thread_entry *thread = &threads[i];
-        if (thread->context.t != NULL)
+        int oldlevel = disable_irq_save();
+        SDL_Thread *t = thread->context.t;
+
+        if (t != NULL)
         {
             /* Signal thread on delay or block */
-            SDL_Thread *t = thread->context.t;
             SDL_SemPost(thread->context.s);
+            restore_irq(oldlevel);
             SDL_UnlockMutex(m);
             /* Wait for it to finish */
             SDL_WaitThread(t, NULL);
             /* Relock for next thread signal */
             SDL_LockMutex(m);
-        }        
+        }
+        else
+        {
+            restore_irq(oldlevel);
+        }
     }
 
     SDL_UnlockMutex(m);
@@ -134,7 +158,7 @@ static struct thread_entry * find_empty_thread_slot(void)
 extern void app_main(void *param);
 static int thread_sdl_app_main(void *param)
 {
-    SDL_LockMutex(m);
+    run_lock();
     cores[CURRENT_CORE].running = &threads[0];
 
     /* Set the jump address for return */
@@ -146,7 +170,7 @@ static int thread_sdl_app_main(void *param)
     }
 
     /* Unlock and exit */
-    SDL_UnlockMutex(m);
+    run_unlock();
     return 0;
 }
 
@@ -216,7 +240,7 @@ void thread_sdl_exception_wait(void)
 /* A way to yield and leave the threading system for extended periods */
 void thread_sdl_thread_lock(void *me)
 {
-    SDL_LockMutex(m);
+    run_lock();
     cores[CURRENT_CORE].running = (struct thread_entry *)me;
 
     if (threads_exit)
@@ -226,7 +250,7 @@ void thread_sdl_thread_lock(void *me)
 void * thread_sdl_thread_unlock(void)
 {
     struct thread_entry *current = cores[CURRENT_CORE].running;
-    SDL_UnlockMutex(m);
+    run_unlock();
     return current;
 }
 
@@ -293,6 +317,13 @@ void switch_thread(void)
     {
     case STATE_RUNNING:
     {
+        if (thread_sdl_concurrent)
+        {
+            /* Nothing to hand over - just give the host a chance */
+            SDL_Delay(0);
+            break;
+        }
+
         SDL_UnlockMutex(m);
         /* Any other thread waiting already will get it first */
         SDL_LockMutex(m);
@@ -303,9 +334,9 @@ void switch_thread(void)
     {
         int oldlevel;
 
-        SDL_UnlockMutex(m);
+        run_unlock();
         SDL_SemWait(current->context.s);
-        SDL_LockMutex(m);
+        run_lock();
 
         oldlevel = disable_irq_save();
         current->state = STATE_RUNNING;
@@ -317,9 +348,9 @@ void switch_thread(void)
     {
         int result, oldlevel;
 
-        SDL_UnlockMutex(m);
+        run_unlock();
         result = SDL_SemWaitTimeout(current->context.s, current->tmo_tick);
-        SDL_LockMutex(m);
+        run_lock();
 
         oldlevel = disable_irq_save();
 
@@ -350,9 +381,9 @@ void switch_thread(void)
 
     case STATE_SLEEPING:
     {
-        SDL_UnlockMutex(m);
+        run_unlock();
         SDL_SemWaitTimeout(current->context.s, current->tmo_tick);
-        SDL_LockMutex(m);
+        run_lock();
         current->state = STATE_RUNNING;
         break;
         } /* STATE_SLEEPING: */
@@ -431,12 +462,15 @@ unsigned int thread_queue_wake(struct thread_entry **list)
 void thread_thaw(unsigned int thread_id)
 {
     struct thread_entry *thread = thread_id_entry(thread_id);
+    int oldlevel = disable_irq_save();
 
     if (thread->id == thread_id && thread->state == STATE_FROZEN)
     {
         thread->state = STATE_RUNNING;
         SDL_SemPost(thread->context.s);
     }
+
+    restore_irq(oldlevel);
 }
 
 int runthread(void *data)
@@ -445,8 +479,9 @@ int runthread(void *data)
     jmp_buf *current_jmpbuf;
 
     /* Cannot access thread variables before locking the mutex as the
-       data structures may not be filled-in yet. */
-    SDL_LockMutex(m);
+       data structures may not be filled-in yet. Concurrent threads are
+       only started once they are. */
+    run_lock();
     cores[CURRENT_CORE].running = (struct thread_entry *)data;
     current = cores[CURRENT_CORE].running;
     current_jmpbuf = &thread_jmpbufs[current - threads];
@@ -457,9 +492,9 @@ int runthread(void *data)
         /* Run the thread routine */
         if (current->state == STATE_FROZEN)
         {
-            SDL_UnlockMutex(m);
+            run_unlock();
             SDL_SemWait(current->context.s);
-            SDL_LockMutex(m);
+            run_lock();
             cores[CURRENT_CORE].running = current;
         }
 
@@ -476,7 +511,7 @@ int runthread(void *data)
     else
     {
         /* Unlock and exit */
-        SDL_UnlockMutex(m);
+        run_unlock();
     }
 
     return 0;
@@ -489,16 +524,10 @@ unsigned int create_thread(void (*function)(void),
     struct thread_entry *thread;
     SDL_Thread* t;
     SDL_sem *s;
+    int oldlevel;
 
     THREAD_SDL_DEBUGF("Creating thread: (%s)\n", name ? name : "");
 
-    thread = find_empty_thread_slot();
-    if (thread == NULL)
-    {
-        DEBUGF("Failed to find thread slot\n");
-        return 0;
-    }
-
     s = SDL_CreateSemaphore(0);
     if (s == NULL)
     {
@@ -506,10 +535,14 @@ unsigned int create_thread(void (*function)(void),
         return 0;
     }
 
-    t = SDL_CreateThread(runthread, thread);
-    if (t == NULL)
+    /* Fill in the slot before the thread starts, it may not wait for us */
+    oldlevel = disable_irq_save();
+
+    thread = find_empty_thread_slot();
+    if (thread == NULL)
     {
-        DEBUGF("Failed to create SDL thread\n");
+        restore_irq(oldlevel);
+        DEBUGF("Failed to find thread slot\n");
         SDL_DestroySemaphore(s);
         return 0;
     }
@@ -520,9 +553,21 @@ unsigned int create_thread(void (*function)(void),
     thread->state = (flags & CREATE_THREAD_FROZEN) ?
         STATE_FROZEN : STATE_RUNNING;
     thread->context.start = function;
-    thread->context.t = t;
     thread->context.s = s;
 
+    t = SDL_CreateThread(runthread, thread);
+    if (t == NULL)
+    {
+        thread->state = STATE_KILLED;
+        restore_irq(oldlevel);
+        DEBUGF("Failed to create SDL thread\n");
+        SDL_DestroySemaphore(s);
+        return 0;
+    }
+
+    thread->context.t = t;
+    restore_irq(oldlevel);
+
     THREAD_SDL_DEBUGF("New Thread: %d (%s)\n",
                       thread - threads, THREAD_SDL_GET_NAME(thread));
 
@@ -612,6 +657,7 @@ void thread_wait(unsigned int thread_id)
 {
     struct thread_entry *current = cores[CURRENT_CORE].running;
     struct thread_entry *thread = thread_id_entry(thread_id);
+    int oldlevel = disable_irq_save();
 
     if (thread_id == THREAD_ID_CURRENT ||
         (thread->id == thread_id && thread->state != STATE_KILLED))
@@ -619,7 +665,10 @@ void thread_wait(unsigned int thread_id)
         current->bqp = &thread->queue;
         block_thread(current);
         switch_thread();
+        return;
     }
+
+    restore_irq(oldlevel);
 }
 
 int thread_stack_usage(const struct thread_entry *thread)
@@ -628,6 +677,11 @@ int thread_stack_usage(const struct thread_entry *thread)
     (void)thread;
 }
 
+size_t thread_stack_peak(const struct thread_entry *thread)
+{
+    return thread->stack_size / 2;
+}
+
 /* Return name if one or ID if none */
 void thread_get_name(char *buffer, int size,
                      struct thread_entry *thread)
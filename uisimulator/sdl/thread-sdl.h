@@ -25,6 +25,7 @@
 #include "SDL_thread.h"
 
 extern SDL_Thread *gui_thread;   /* The "main" thread */
+extern bool thread_sdl_concurrent; /* Threads run in parallel */
 void thread_sdl_thread_lock(void *me);
 void * thread_sdl_thread_unlock(void);
 void thread_sdl_exception_wait(void);
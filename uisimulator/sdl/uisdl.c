@@ -235,6 +235,11 @@ int main(int argc, char *argv[])
                 sim_alarm_wakeup = true;
                 printf("Simulating alarm wakeup.\n");
             }
+            else if (!strcmp("--concurrent", argv[x]))
+            {
+                thread_sdl_concurrent = true;
+                printf("Running threads concurrently.\n");
+            }
             else if (!strcmp("--root", argv[x]))
             {
                 x++;
@@ -257,6 +262,7 @@ int main(int argc, char *argv[])
                 printf("  --old_lcd \t [Player] simulate old playermodel (ROM version<4.51)\n");
                 printf("  --zoom [VAL]\t Window zoom (will disable backgrounds)\n");
                 printf("  --alarm \t Simulate a wake-up on alarm\n");
+                printf("  --concurrent \t Run threads in parallel instead of one at a time\n");
                 printf("  --root [DIR]\t Set root directory\n");
                 exit(0);
             }